@@ -0,0 +1,1303 @@
+/** \file aint_bench.c
+ *
+ * Microbenchmarks of the hot paths of the data structures
+ *
+ * Every benchmark runs the same number of operations on each of 1, 2, 4, ...
+ * up to the maximum number of threads. The #Membag, #ShardedMembag, #HashMap
+ * find and #WorkStealingScheduler benchmarks share one instance between all
+ * the threads. Most of the other structures are only safe against nesting
+ * (interrupts), not against parallel threads, so each thread uses its own
+ * instance, which measures how they scale when the cores don't share data.
+ * The \c mcas_contended benchmark adds contention by nesting the same
+ * operation from a timer signal in every thread. The results are written as
+ * CSV or JSON, one record per benchmark and thread count, with
+ *  - \c ns_per_op the mean latency of an operation in a thread,
+ *  - \c ops_per_sec the throughput of all the threads together,
+ *  - the hardware counters per operation, if perf_event_open(2) is
+ *    available, or empty (CSV) / \c null (JSON) otherwise.
+ *
+ * Build (Linux):
+ * \code{.sh}
+ * cc -std=gnu11 -O2 -pthread -Isrc -o aint_bench bench/aint_bench.c \
+ *         $(find src -name '*.c')
+ * ./aint_bench -t 8 -f json > results.json
+ * \endcode
+ *
+ * Every record also has \c orders, \c relaxed for a normal build and
+ * \c seq_cst for one with \c -DAINT_SAFE_SEQ_CST=1 (see memory_order.h),
+ * which makes every atomic operation seq_cst again. The cost of the weaker
+ * orders is measured by running both builds and comparing their records,
+ * eg. of the #Mcas and #DoubleBuffer benchmarks:
+ * \code{.sh}
+ * for orders in 0 1; do
+ *     cc -std=gnu11 -O2 -pthread -Isrc -DAINT_SAFE_SEQ_CST=$orders \
+ *             -o aint_bench_$orders bench/aint_bench.c $(find src -name '*.c')
+ * done
+ * ./aint_bench_0 -b mcas > orders.csv
+ * ./aint_bench_1 -b mcas | tail -n +2 >> orders.csv
+ * \endcode
+ * On x86-64 only the stores differ, as a seq_cst store is an \c xchg. On
+ * AArch64 the relaxed loads and stores are also plain ones instead of
+ * \c ldar and \c stlr. Without an AArch64 machine, build both with
+ * \c aarch64-linux-gnu-gcc \c -static and run them under \c qemu-aarch64,
+ * though the times under emulation are only indicative.
+ *
+ * Options:
+ *  - \c -t N maximum number of threads (default: number of online CPUs)
+ *  - \c -n N operations per thread (default: 1000000)
+ *  - \c -f csv|json output format (default: csv)
+ *  - \c -b NAME only run the benchmarks whose name contains NAME
+ *  - \c -r CONFIG also count the raw PMU event CONFIG (hex), eg. \c 0x21d0
+ *    (MEM_INST_RETIRED.LOCK_LOADS) to count atomic read-modify-writes on
+ *    recent Intel CPUs
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "broadcast_ring.h"
+#include "double_buffer.h"
+#include "hash_map.h"
+#include "mcas.h"
+#include "membag.h"
+#include "nested_queue.h"
+#include "nested_queue_group.h"
+#include "nested_queue_span.h"
+#include "sharded_membag.h"
+#include "slist.h"
+#include "timer_wheel.h"
+#include "work_stealing.h"
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_ELEM_SIZE 64
+#define BENCH_MCAS_MAX_ELEMS 16
+#define BENCH_QUEUE_LEN 64
+#define BENCH_SLIST_LEN 16
+#define BENCH_FANOUT_MAX 4
+#define BENCH_GROUP_LEN 64
+#define BENCH_SAMPLES (BENCH_ELEM_SIZE / sizeof(int16_t))
+
+/* The orders column, AINT_SAFE_SEQ_CST comes with any header */
+#if AINT_SAFE_SEQ_CST
+#define BENCH_ORDERS "seq_cst"
+#else
+#define BENCH_ORDERS "relaxed"
+#endif
+
+
+/* Hardware counters ******************************************************/
+
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_RAW,
+    NUMBER_OF_COUNTERS,
+} Counter;
+
+static const char *const counter_names[NUMBER_OF_COUNTERS] = {
+        [COUNTER_CYCLES]       = "cycles",
+        [COUNTER_INSTRUCTIONS] = "instructions",
+        [COUNTER_CACHE_MISSES] = "cache_misses",
+        [COUNTER_RAW]          = "raw",
+};
+
+static bool     raw_enabled = false;
+static uint64_t raw_config  = 0;
+
+
+/* Open a counter of the calling thread, or return -1 if it isn't available */
+static int counter_open(Counter counter) {
+    struct perf_event_attr attr = {
+            .type           = PERF_TYPE_HARDWARE,
+            .size           = sizeof(attr),
+            .disabled       = 1,
+            .exclude_kernel = 1,
+            .exclude_hv     = 1,
+    };
+    switch (counter) {
+    case COUNTER_CYCLES: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case COUNTER_INSTRUCTIONS: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case COUNTER_CACHE_MISSES: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+    case COUNTER_RAW:
+        if (!raw_enabled) { return -1; }
+        attr.type   = PERF_TYPE_RAW;
+        attr.config = raw_config;
+        break;
+    default: return -1;
+    }
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/* Benchmarks *************************************************************/
+
+typedef struct {
+    /** Name in the output */
+    const char *name;
+    /** Parameter passed to #setup, reported in the output */
+    size_t param;
+    /** Reset the data structure before a run with n_threads threads */
+    void (*setup)(size_t param, size_t n_threads);
+    /** Run n_ops operations in thread number thread */
+    void (*run)(size_t thread, size_t n_ops);
+} Benchmark;
+
+/** Operations per thread of the current run, for the setups that prepare an
+ * item per operation */
+static size_t bench_n_ops;
+
+
+static membag_alloc_status_t membag_status[BENCH_MAX_THREADS * 2];
+static char membag_data[BENCH_MAX_THREADS * 2][BENCH_ELEM_SIZE];
+static Membag membag = MEMBAG_STATIC_INIT(BENCH_ELEM_SIZE,
+                                          BENCH_MAX_THREADS * 2,
+                                          membag_status,
+                                          membag_data);
+
+static void membag_setup(size_t param, size_t n_threads) {
+    (void)param;
+    (void)n_threads;
+    Membag_init(&membag);
+}
+
+static void membag_run(size_t thread, size_t n_ops) {
+    (void)thread;
+    for (size_t i = 0; i < n_ops; i++) {
+        Membag_release(&membag, Membag_acquire(&membag));
+    }
+}
+
+
+/* A slot shared by two users */
+static membag_alloc_status_t rc_membag_status[BENCH_MAX_THREADS * 2];
+static membag_refcount_t     rc_membag_refcounts[BENCH_MAX_THREADS * 2];
+static char   rc_membag_data[BENCH_MAX_THREADS * 2][BENCH_ELEM_SIZE];
+static Membag rc_membag = MEMBAG_REFCOUNTED_STATIC_INIT(BENCH_ELEM_SIZE,
+                                                        BENCH_MAX_THREADS * 2,
+                                                        rc_membag_status,
+                                                        rc_membag_refcounts,
+                                                        rc_membag_data);
+
+static void rc_membag_setup(size_t param, size_t n_threads) {
+    (void)param;
+    (void)n_threads;
+    Membag_init(&rc_membag);
+}
+
+static void rc_membag_run(size_t thread, size_t n_ops) {
+    (void)thread;
+    for (size_t i = 0; i < n_ops; i++) {
+        void *slot = Membag_acquire(&rc_membag);
+        Membag_ref(&rc_membag, slot);
+        Membag_unref(&rc_membag, slot);
+        Membag_unref(&rc_membag, slot);
+    }
+}
+
+
+/* One instance over two nodes, with the threads as its CPUs alternating
+ * between them. The param is how many slots a thread acquires before it
+ * releases them all, and an operation is one acquire and one release. A
+ * burst of 1 stays in the magazine, one of twice the magazine size also
+ * refills it from the node and flushes it back every time. */
+#define BENCH_SHARDED_NODES 2
+#define BENCH_SHARDED_BURST_MAX (2 * SHARDED_MEMBAG_MAGAZINE_SIZE)
+/* Enough for the burst and the full magazine of every thread */
+#define BENCH_SHARDED_NODE_LEN                                      \
+    (BENCH_MAX_THREADS                                              \
+     * (BENCH_SHARDED_BURST_MAX + SHARDED_MEMBAG_MAGAZINE_SIZE)     \
+     / BENCH_SHARDED_NODES)
+
+static membag_alloc_status_t
+        sharded_status[BENCH_SHARDED_NODES][BENCH_SHARDED_NODE_LEN];
+static char sharded_data[BENCH_SHARDED_NODES][BENCH_SHARDED_NODE_LEN]
+                        [BENCH_ELEM_SIZE];
+static Membag sharded_node_membags[BENCH_SHARDED_NODES] = {
+        MEMBAG_STATIC_INIT(BENCH_ELEM_SIZE,
+                           BENCH_SHARDED_NODE_LEN,
+                           sharded_status[0],
+                           sharded_data[0]),
+        MEMBAG_STATIC_INIT(BENCH_ELEM_SIZE,
+                           BENCH_SHARDED_NODE_LEN,
+                           sharded_status[1],
+                           sharded_data[1]),
+};
+static Membag *const  sharded_nodes[BENCH_SHARDED_NODES] = {
+        &sharded_node_membags[0],
+        &sharded_node_membags[1],
+};
+static MembagMagazine sharded_magazines[BENCH_MAX_THREADS];
+static size_t         sharded_cpu_node[BENCH_MAX_THREADS];
+static ShardedMembag  sharded = SHARDED_MEMBAG_STATIC_INIT(BENCH_SHARDED_NODES,
+                                                          sharded_nodes,
+                                                          BENCH_MAX_THREADS,
+                                                          sharded_magazines,
+                                                          sharded_cpu_node);
+static size_t         sharded_burst;
+
+static void sharded_setup(size_t param, size_t n_threads) {
+    (void)n_threads;
+    for (size_t n = 0; n < BENCH_SHARDED_NODES; n++) {
+        Membag_init(&sharded_node_membags[n]);
+    }
+    for (size_t t = 0; t < BENCH_MAX_THREADS; t++) {
+        sharded_cpu_node[t] = t % BENCH_SHARDED_NODES;
+    }
+    ShardedMembag_init(&sharded);
+    sharded_burst = param;
+}
+
+static void sharded_run(size_t thread, size_t n_ops) {
+    void *slots[BENCH_SHARDED_BURST_MAX];
+    for (size_t i = 0; i < n_ops; i += sharded_burst) {
+        const size_t burst =
+                n_ops - i < sharded_burst ? n_ops - i : sharded_burst;
+        for (size_t j = 0; j < burst; j++) {
+            slots[j] = ShardedMembag_acquire(&sharded, thread);
+        }
+        for (size_t j = 0; j < burst; j++) {
+            ShardedMembag_release(&sharded, thread, slots[j]);
+        }
+    }
+}
+
+
+static _Atomic mcas_base_t mcas_data[BENCH_MAX_THREADS][BENCH_MCAS_MAX_ELEMS];
+static Mcas                mcas[BENCH_MAX_THREADS];
+
+static void mcas_setup(size_t param, size_t n_threads) {
+    for (size_t t = 0; t < n_threads; t++) {
+        const Mcas init = MCAS_STATIC_INIT(param, mcas_data[t]);
+        memcpy(&mcas[t], &init, sizeof(init));
+        for (size_t i = 0; i < param; i++) {
+            atomic_store(&mcas_data[t][i], 0);
+        }
+    }
+}
+
+static void mcas_read_run(size_t thread, size_t n_ops) {
+    mcas_base_t data[BENCH_MCAS_MAX_ELEMS];
+    for (size_t i = 0; i < n_ops; i++) { Mcas_read(&mcas[thread], data); }
+}
+
+static void mcas_compare_exchange_run(size_t thread, size_t n_ops) {
+    mcas_base_t expected[BENCH_MCAS_MAX_ELEMS];
+    mcas_base_t desired[BENCH_MCAS_MAX_ELEMS];
+    for (size_t i = 0; i < n_ops; i++) {
+        Mcas_read(&mcas[thread], expected);
+        for (size_t j = 0; j < mcas[thread].n_elems; j++) {
+            desired[j] = expected[j] + 1;
+        }
+        Mcas_compare_exchange(&mcas[thread], expected, desired);
+    }
+}
+
+
+/* A failed compare_exchange followed by getting the current values, as in
+ * the retry of a read-modify-CAS loop. The expected values never match. */
+static void mcas_retry_read_run(size_t thread, size_t n_ops) {
+    mcas_base_t expected[BENCH_MCAS_MAX_ELEMS];
+    for (size_t i = 0; i < n_ops; i++) {
+        for (size_t j = 0; j < mcas[thread].n_elems; j++) { expected[j] = -1; }
+        if (!Mcas_compare_exchange(&mcas[thread], expected, expected)) {
+            Mcas_read(&mcas[thread], expected);
+        }
+    }
+}
+
+static void mcas_retry_fetch_run(size_t thread, size_t n_ops) {
+    mcas_base_t expected[BENCH_MCAS_MAX_ELEMS];
+    for (size_t i = 0; i < n_ops; i++) {
+        for (size_t j = 0; j < mcas[thread].n_elems; j++) { expected[j] = -1; }
+        Mcas_compare_exchange_fetch(&mcas[thread], expected, expected);
+    }
+}
+
+
+/* Increments of all the words in a read-modify-CAS loop, interrupted by the
+ * same increments in a handler of a per-thread CPU time timer, so that the
+ * loop retries as it does under nesting. Each thread has its own Mcas, as
+ * an Mcas is only safe against nesting. Build with eg.
+ * -DAINT_SAFE_MCAS_BACKOFF=64 to compare with backing off. */
+#define BENCH_MCAS_CONTENDED_SIGNAL SIGURG
+#define BENCH_MCAS_CONTENDED_INTERVAL_NS 20000
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static _Thread_local Mcas *mcas_contended;
+
+static void mcas_increment(Mcas *m) {
+    mcas_base_t expected[BENCH_MCAS_MAX_ELEMS];
+    mcas_base_t desired[BENCH_MCAS_MAX_ELEMS];
+    Mcas_read(m, expected);
+    for (unsigned int attempt = 1;; attempt++) {
+        for (size_t j = 0; j < m->n_elems; j++) {
+            desired[j] = expected[j] + 1;
+        }
+        if (Mcas_compare_exchange_fetch(m, expected, desired)) { break; }
+        AINT_SAFE_MCAS_RETRY(attempt);
+    }
+}
+
+static void mcas_contended_handler(int signo) {
+    (void)signo;
+    if (mcas_contended != NULL) { mcas_increment(mcas_contended); }
+}
+
+static void mcas_contended_setup(size_t param, size_t n_threads) {
+    mcas_setup(param, n_threads);
+    struct sigaction sa = {.sa_handler = mcas_contended_handler};
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(BENCH_MCAS_CONTENDED_SIGNAL, &sa, NULL)) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void mcas_contended_run(size_t thread, size_t n_ops) {
+    struct sigevent sev = {
+            .sigev_notify = SIGEV_THREAD_ID,
+            .sigev_signo  = BENCH_MCAS_CONTENDED_SIGNAL,
+    };
+    sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+    const struct itimerspec interval = {
+            .it_interval = {.tv_nsec = BENCH_MCAS_CONTENDED_INTERVAL_NS},
+            .it_value    = {.tv_nsec = BENCH_MCAS_CONTENDED_INTERVAL_NS},
+    };
+    timer_t timer;
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer)
+        || timer_settime(timer, 0, &interval, NULL)) {
+        perror("timer_create");
+        exit(EXIT_FAILURE);
+    }
+    mcas_contended = &mcas[thread];
+    for (size_t i = 0; i < n_ops; i++) { mcas_increment(&mcas[thread]); }
+    mcas_contended = NULL;
+    timer_delete(timer);
+}
+
+
+static char queue_data[BENCH_MAX_THREADS][BENCH_QUEUE_LEN][BENCH_ELEM_SIZE];
+static NestedQueue queues[BENCH_MAX_THREADS];
+
+static void queue_setup(size_t param, size_t n_threads) {
+    (void)param;
+    for (size_t t = 0; t < n_threads; t++) {
+        const NestedQueue init =
+                NESTED_QUEUE_STATIC_INIT(queues[t],
+                                         BENCH_ELEM_SIZE,
+                                         BENCH_QUEUE_LEN,
+                                         queue_data[t],
+                                         NESTED_QUEUE_OPERATION_ORDER_NESTED,
+                                         NESTED_QUEUE_OPERATION_ORDER_NESTED);
+        memcpy(&queues[t], &init, sizeof(init));
+    }
+}
+
+static void queue_run(size_t thread, size_t n_ops) {
+    NestedQueue *q = &queues[thread];
+    for (size_t i = 0; i < n_ops; i++) {
+        void *slot = NestedQueue_write_acquire(q);
+        NestedQueue_write_commit(q, slot);
+        NestedQueue_read_release(q, NestedQueue_read_acquire(q));
+    }
+}
+
+
+/* One message to param consumers, with a queue and a copy per consumer */
+static char fanout_queue_data[BENCH_MAX_THREADS][BENCH_FANOUT_MAX]
+                             [BENCH_QUEUE_LEN][BENCH_ELEM_SIZE];
+static NestedQueue fanout_queues[BENCH_MAX_THREADS][BENCH_FANOUT_MAX];
+static size_t      fanout_consumers;
+
+static void queue_fanout_setup(size_t param, size_t n_threads) {
+    fanout_consumers = param;
+    for (size_t t = 0; t < n_threads; t++) {
+        for (size_t c = 0; c < BENCH_FANOUT_MAX; c++) {
+            const NestedQueue init = NESTED_QUEUE_STATIC_INIT(
+                    fanout_queues[t][c],
+                    BENCH_ELEM_SIZE,
+                    BENCH_QUEUE_LEN,
+                    fanout_queue_data[t][c],
+                    NESTED_QUEUE_OPERATION_ORDER_NESTED,
+                    NESTED_QUEUE_OPERATION_ORDER_NESTED);
+            memcpy(&fanout_queues[t][c], &init, sizeof(init));
+        }
+    }
+}
+
+static void queue_fanout_run(size_t thread, size_t n_ops) {
+    char copy[BENCH_ELEM_SIZE];
+    for (size_t i = 0; i < n_ops; i++) {
+        for (size_t c = 0; c < fanout_consumers; c++) {
+            NestedQueue *q    = &fanout_queues[thread][c];
+            void *       slot = NestedQueue_write_acquire(q);
+            memset(slot, (int)i, BENCH_ELEM_SIZE);
+            NestedQueue_write_commit(q, slot);
+        }
+        for (size_t c = 0; c < fanout_consumers; c++) {
+            NestedQueue *q    = &fanout_queues[thread][c];
+            const void * slot = NestedQueue_read_acquire(q);
+            memcpy(copy, slot, sizeof(copy));
+            NestedQueue_read_release(q, slot);
+        }
+    }
+    __asm__ volatile("" : : "r"(copy) : "memory");
+}
+
+
+/* The same with one broadcast ring read by all the consumers */
+static char ring_data[BENCH_MAX_THREADS][BENCH_QUEUE_LEN][BENCH_ELEM_SIZE];
+static BroadcastRingConsumer ring_consumers[BENCH_MAX_THREADS]
+                                           [BENCH_FANOUT_MAX];
+static BroadcastRing         rings[BENCH_MAX_THREADS];
+
+static void ring_setup(size_t param, size_t n_threads) {
+    fanout_consumers = param;
+    memset(ring_consumers, 0, sizeof(ring_consumers));
+    for (size_t t = 0; t < n_threads; t++) {
+        const BroadcastRing init =
+                BROADCAST_RING_STATIC_INIT(BENCH_ELEM_SIZE,
+                                           BENCH_QUEUE_LEN,
+                                           ring_data[t],
+                                           BENCH_FANOUT_MAX,
+                                           ring_consumers[t],
+                                           BROADCAST_RING_LAG_GATE);
+        memcpy(&rings[t], &init, sizeof(init));
+        for (size_t c = 0; c < param; c++) {
+            BroadcastRing_subscribe(&rings[t]);
+        }
+    }
+}
+
+static void ring_fanout_run(size_t thread, size_t n_ops) {
+    BroadcastRing *ring = &rings[thread];
+    char           copy[BENCH_ELEM_SIZE];
+    for (size_t i = 0; i < n_ops; i++) {
+        void *slot = BroadcastRing_write_acquire(ring);
+        memset(slot, (int)i, BENCH_ELEM_SIZE);
+        BroadcastRing_write_commit(ring, slot);
+        for (size_t c = 0; c < fanout_consumers; c++) {
+            BroadcastRingConsumer *consumer = &ring_consumers[thread][c];
+            const void *rd = BroadcastRing_read_acquire(ring, consumer);
+            memcpy(copy, rd, sizeof(copy));
+            BroadcastRing_read_release(ring, consumer, rd);
+        }
+    }
+    __asm__ volatile("" : : "r"(copy) : "memory");
+}
+
+
+/* One of param queues has data, found by polling all of them or through a
+ * group. Only the last queue gets data, which is the worst case for both. */
+static char group_queue_data[BENCH_MAX_THREADS][BENCH_GROUP_LEN][2]
+                            [BENCH_ELEM_SIZE];
+static NestedQueue  group_queues[BENCH_MAX_THREADS][BENCH_GROUP_LEN];
+static NestedQueue *group_queue_ptrs[BENCH_MAX_THREADS][BENCH_GROUP_LEN];
+static nested_queue_group_ready_t
+        group_ready[BENCH_MAX_THREADS]
+                   [NESTED_QUEUE_GROUP_READY_LEN(BENCH_GROUP_LEN)];
+static NestedQueueGroup groups[BENCH_MAX_THREADS];
+
+static void group_setup(size_t param, size_t n_threads) {
+    memset(group_ready, 0, sizeof(group_ready));
+    for (size_t t = 0; t < n_threads; t++) {
+        for (size_t q = 0; q < param; q++) {
+            const NestedQueue init = NESTED_QUEUE_STATIC_INIT(
+                    group_queues[t][q],
+                    BENCH_ELEM_SIZE,
+                    2,
+                    group_queue_data[t][q],
+                    NESTED_QUEUE_OPERATION_ORDER_NESTED,
+                    NESTED_QUEUE_OPERATION_ORDER_NESTED);
+            memcpy(&group_queues[t][q], &init, sizeof(init));
+            group_queue_ptrs[t][q] = &group_queues[t][q];
+        }
+        const NestedQueueGroup init =
+                NESTED_QUEUE_GROUP_STATIC_INIT(param,
+                                               group_queue_ptrs[t],
+                                               group_ready[t],
+                                               NESTED_QUEUE_GROUP_PRIORITY);
+        memcpy(&groups[t], &init, sizeof(init));
+    }
+}
+
+static void queue_poll_run(size_t thread, size_t n_ops) {
+    NestedQueueGroup *g    = &groups[thread];
+    NestedQueue *     last = g->queues[g->n_queues - 1];
+    for (size_t i = 0; i < n_ops; i++) {
+        NestedQueue_write_commit(last, NestedQueue_write_acquire(last));
+        for (size_t q = 0; q < g->n_queues; q++) {
+            const void *slot = NestedQueue_read_acquire(g->queues[q]);
+            if (slot != NULL) {
+                NestedQueue_read_release(g->queues[q], slot);
+                break;
+            }
+        }
+    }
+}
+
+static void group_select_run(size_t thread, size_t n_ops) {
+    NestedQueueGroup *g    = &groups[thread];
+    NestedQueue *     last = g->queues[g->n_queues - 1];
+    for (size_t i = 0; i < n_ops; i++) {
+        NestedQueueGroup_write_commit(
+                g, g->n_queues - 1, NestedQueue_write_acquire(last));
+        size_t      q;
+        const void *slot = NestedQueueGroup_read_acquire(g, &q);
+        NestedQueue_read_release(g->queues[q], slot);
+    }
+}
+
+
+
+/* A batch of param slots of int16_t samples converted to float, one slot at
+ * a time or as the spans of one bulk acquire */
+static int16_t convert_data[BENCH_MAX_THREADS][BENCH_QUEUE_LEN][BENCH_SAMPLES];
+static float   convert_out[BENCH_MAX_THREADS][BENCH_QUEUE_LEN * BENCH_SAMPLES];
+static NestedQueue convert_queues[BENCH_MAX_THREADS];
+static size_t      convert_batch;
+
+static void convert_setup(size_t param, size_t n_threads) {
+    convert_batch = param;
+    for (size_t t = 0; t < n_threads; t++) {
+        const NestedQueue init =
+                NESTED_QUEUE_STATIC_INIT(convert_queues[t],
+                                         BENCH_ELEM_SIZE,
+                                         BENCH_QUEUE_LEN,
+                                         convert_data[t],
+                                         NESTED_QUEUE_OPERATION_ORDER_NESTED,
+                                         NESTED_QUEUE_OPERATION_ORDER_NESTED);
+        memcpy(&convert_queues[t], &init, sizeof(init));
+    }
+}
+
+static void convert_fill(NestedQueue *q) {
+    for (size_t j = 0; j < convert_batch; j++) {
+        NestedQueue_write_commit(q, NestedQueue_write_acquire(q));
+    }
+}
+
+static void queue_convert_run(size_t thread, size_t n_ops) {
+    NestedQueue *q = &convert_queues[thread];
+    for (size_t i = 0; i < n_ops; i++) {
+        convert_fill(q);
+        float *        out = convert_out[thread];
+        const int16_t *slot;
+        while ((slot = NestedQueue_read_acquire(q)) != NULL) {
+            for (size_t k = 0; k < BENCH_SAMPLES; k++) {
+                *out++ = slot[k] * (1.0f / 32768);
+            }
+            NestedQueue_read_release(q, slot);
+        }
+    }
+    __asm__ volatile("" : : "r"(convert_out[thread]) : "memory");
+}
+
+static void queue_bulk_convert_run(size_t thread, size_t n_ops) {
+    NestedQueue *q = &convert_queues[thread];
+    for (size_t i = 0; i < n_ops; i++) {
+        convert_fill(q);
+        NestedQueueSpan spans[2];
+        NestedQueue_read_acquire_bulk(q, BENCH_QUEUE_LEN, spans);
+        NestedQueueSpan_int16_to_float(
+                spans, BENCH_ELEM_SIZE, 1.0f / 32768, convert_out[thread]);
+        NestedQueue_read_release_bulk(q, spans);
+    }
+    __asm__ volatile("" : : "r"(convert_out[thread]) : "memory");
+}
+
+static char         db_data[BENCH_MAX_THREADS][2][BENCH_ELEM_SIZE];
+static DoubleBuffer dbs[BENCH_MAX_THREADS];
+
+static void db_setup(size_t param, size_t n_threads) {
+    (void)param;
+    for (size_t t = 0; t < n_threads; t++) {
+        const DoubleBuffer init =
+                DOUBLE_BUFFER_STATIC_INIT(BENCH_ELEM_SIZE, db_data[t]);
+        memcpy(&dbs[t], &init, sizeof(init));
+    }
+}
+
+static void db_write_run(size_t thread, size_t n_ops) {
+    DoubleBuffer *db = &dbs[thread];
+    for (size_t i = 0; i < n_ops; i++) {
+        void *slot = DoubleBuffer_write_acquire(db);
+        memset(slot, (int)i, BENCH_ELEM_SIZE);
+        DoubleBuffer_write_commit(db, slot);
+    }
+}
+
+static void db_read_run(size_t thread, size_t n_ops) {
+    DoubleBuffer *db = &dbs[thread];
+    char          copy[BENCH_ELEM_SIZE];
+    for (size_t i = 0; i < n_ops; i++) {
+        const void *slot = DoubleBuffer_read_acquire(db);
+        memcpy(copy, slot, sizeof(copy));
+        DoubleBuffer_read_release(db, slot);
+    }
+    __asm__ volatile("" : : "r"(copy) : "memory");
+}
+
+
+static SlistNode slist_heads[BENCH_MAX_THREADS];
+static SlistNode slist_nodes[BENCH_MAX_THREADS][BENCH_SLIST_LEN];
+
+static void slist_setup(size_t param, size_t n_threads) {
+    for (size_t t = 0; t < n_threads; t++) {
+        atomic_store(&slist_heads[t].deleting, false);
+        atomic_store(&slist_heads[t].next, NULL);
+        for (size_t i = param; i > 0; i--) {
+            Slist_append(&slist_heads[t], &slist_nodes[t][i - 1]);
+        }
+    }
+}
+
+static void slist_append_delete_run(size_t thread, size_t n_ops) {
+    SlistNode *head = &slist_heads[thread];
+    SlistNode *node = &slist_nodes[thread][BENCH_SLIST_LEN - 1];
+    for (size_t i = 0; i < n_ops; i++) {
+        Slist_append(head, node);
+        Slist_delete_after(head, node);
+    }
+}
+
+static void slist_traverse_run(size_t thread, size_t n_ops) {
+    size_t n_nodes = 0;
+    for (size_t i = 0; i < n_ops; i++) {
+        for (SlistNode *n = Slist_next(&slist_heads[thread]); n != NULL;
+             n             = Slist_next(n)) {
+            n_nodes++;
+        }
+    }
+    __asm__ volatile("" : : "r"(n_nodes));
+}
+
+
+/* The param is the load factor in percent, ie. entries per 100 buckets. The
+ * finds share the map of thread 0, as a lookup doesn't modify it. Every
+ * thread deletes and inserts back its own entries in its own map, as a
+ * deleted entry is reused right away, without an EpochReclaim. The same is
+ * done with a chained table behind a pthread_mutex_t to compare. */
+#define BENCH_HASH_BUCKETS 1024
+#define BENCH_HASH_MAX_ENTRIES (BENCH_HASH_BUCKETS * 4)
+
+static MarkedSlistNode hash_buckets[BENCH_MAX_THREADS][BENCH_HASH_BUCKETS];
+static HashMapEntry hash_entries[BENCH_MAX_THREADS][BENCH_HASH_MAX_ENTRIES];
+static HashMap      hash_maps[BENCH_MAX_THREADS];
+static size_t       hash_n_entries;
+
+typedef struct LockedEntry {
+    struct LockedEntry *next;
+    uintptr_t           key;
+} LockedEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    LockedEntry *   buckets[BENCH_HASH_BUCKETS];
+} LockedMap;
+
+static LockedEntry locked_entries[BENCH_MAX_THREADS][BENCH_HASH_MAX_ENTRIES];
+static LockedMap   locked_maps[BENCH_MAX_THREADS];
+
+static inline size_t hash_bucket(uintptr_t key) {
+    /* As in hash_map.c */
+    const uint64_t hash = (uint64_t)key * UINT64_C(0x9e3779b97f4a7c15);
+    return (hash >> 32) % BENCH_HASH_BUCKETS;
+}
+
+static LockedEntry *locked_find(LockedMap *map, uintptr_t key) {
+    pthread_mutex_lock(&map->lock);
+    LockedEntry *e = map->buckets[hash_bucket(key)];
+    while (e != NULL && e->key != key) { e = e->next; }
+    pthread_mutex_unlock(&map->lock);
+    return e;
+}
+
+static void locked_insert(LockedMap *map, LockedEntry *entry) {
+    pthread_mutex_lock(&map->lock);
+    LockedEntry **bucket = &map->buckets[hash_bucket(entry->key)];
+    entry->next          = *bucket;
+    *bucket              = entry;
+    pthread_mutex_unlock(&map->lock);
+}
+
+static LockedEntry *locked_delete(LockedMap *map, uintptr_t key) {
+    pthread_mutex_lock(&map->lock);
+    LockedEntry **p = &map->buckets[hash_bucket(key)];
+    while (*p != NULL && (*p)->key != key) { p = &(*p)->next; }
+    LockedEntry *e = *p;
+    if (e != NULL) { *p = e->next; }
+    pthread_mutex_unlock(&map->lock);
+    return e;
+}
+
+static void hash_setup(size_t param, size_t n_threads) {
+    hash_n_entries = BENCH_HASH_BUCKETS * param / 100;
+    for (size_t t = 0; t < n_threads; t++) {
+        memset(hash_buckets[t], 0, sizeof(hash_buckets[t]));
+        const HashMap init =
+                HASH_MAP_STATIC_INIT(BENCH_HASH_BUCKETS, hash_buckets[t]);
+        memcpy(&hash_maps[t], &init, sizeof(init));
+        pthread_mutex_init(&locked_maps[t].lock, NULL);
+        memset(locked_maps[t].buckets, 0, sizeof(locked_maps[t].buckets));
+        for (size_t i = 0; i < hash_n_entries; i++) {
+            hash_entries[t][i].key = i;
+            HashMap_insert(&hash_maps[t], &hash_entries[t][i]);
+            locked_entries[t][i].key = i;
+            locked_insert(&locked_maps[t], &locked_entries[t][i]);
+        }
+    }
+}
+
+static void hash_find_run(size_t thread, size_t n_ops) {
+    size_t found = 0;
+    for (size_t i = 0; i < n_ops; i++) {
+        found += HashMap_find(&hash_maps[0], (thread + i) % hash_n_entries)
+                 != NULL;
+    }
+    __asm__ volatile("" : : "r"(found));
+}
+
+static void hash_delete_insert_run(size_t thread, size_t n_ops) {
+    HashMap *map = &hash_maps[thread];
+    for (size_t i = 0; i < n_ops; i++) {
+        HashMap_insert(map, HashMap_delete(map, i % hash_n_entries));
+    }
+}
+
+static void locked_find_run(size_t thread, size_t n_ops) {
+    size_t found = 0;
+    for (size_t i = 0; i < n_ops; i++) {
+        found += locked_find(&locked_maps[0], (thread + i) % hash_n_entries)
+                 != NULL;
+    }
+    __asm__ volatile("" : : "r"(found));
+}
+
+static void locked_delete_insert_run(size_t thread, size_t n_ops) {
+    LockedMap *map = &locked_maps[thread];
+    for (size_t i = 0; i < n_ops; i++) {
+        locked_insert(map, locked_delete(map, i % hash_n_entries));
+    }
+}
+
+
+/* The param is the number of timers kept outstanding in the wheel, armed at
+ * random ticks after the ones that are measured. Each thread has one measured
+ * timer per operation, placed before them, and an operation is
+ *  - \c timer_wheel_arm: arming an idle timer with a random delay of up to
+ *    param / 4 ticks,
+ *  - \c timer_wheel_cancel: cancelling a timer armed that way,
+ *  - \c timer_wheel_expire: a timer armed that way expiring, that is the time
+ *    of the #TimerWheel_advance calls, cascades included, per expired timer.
+ * The timers are allocated for each run, as a million of them per thread
+ * doesn't fit in static storage. */
+#define BENCH_TIMERS_MAX (1u << 20)
+
+typedef struct {
+    TimerWheel       wheel;
+    TimerWheelTimer *timers;
+    uint32_t         span;
+    uint64_t         rng;
+    size_t           n_expired;
+} TimerBench;
+
+static TimerBench               timer_benches[BENCH_MAX_THREADS];
+static _Thread_local TimerBench *timer_bench;
+
+static uint32_t timer_delay(TimerBench *tb) {
+    /* xorshift64 */
+    tb->rng ^= tb->rng << 13;
+    tb->rng ^= tb->rng >> 7;
+    tb->rng ^= tb->rng << 17;
+    return 1 + (uint32_t)(tb->rng % tb->span);
+}
+
+static void timer_callback(TimerWheelTimer *timer, bool expired) {
+    (void)timer;
+    if (expired) { timer_bench->n_expired++; }
+}
+
+static void timer_setup(size_t param, size_t n_threads, bool arm_measured) {
+    for (size_t t = 0; t < BENCH_MAX_THREADS; t++) {
+        TimerBench *tb = &timer_benches[t];
+        free(tb->timers);
+        tb->timers = NULL;
+        if (t >= n_threads) { continue; }
+
+        const TimerWheel init = TIMER_WHEEL_STATIC_INIT;
+        memcpy(&tb->wheel, &init, sizeof(init));
+        tb->timers = malloc((bench_n_ops + param) * sizeof(*tb->timers));
+        if (tb->timers == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        tb->span      = param / 4 > 0 ? (uint32_t)(param / 4) : 1;
+        tb->rng       = 0x9e3779b97f4a7c15u + t;
+        tb->n_expired = 0;
+        for (size_t i = 0; i < bench_n_ops + param; i++) {
+            tb->timers[i] = (TimerWheelTimer)TIMER_WHEEL_TIMER_INIT(
+                    timer_callback);
+            if (i >= bench_n_ops) {
+                /* Outstanding, after all the measured ones */
+                TimerWheel_arm(&tb->wheel,
+                               &tb->timers[i],
+                               1 + tb->span + timer_delay(tb));
+            } else if (arm_measured) {
+                TimerWheel_arm(
+                        &tb->wheel, &tb->timers[i], 1 + timer_delay(tb));
+            }
+        }
+        /* Sort them into the buckets before the timing starts */
+        TimerWheel_advance(&tb->wheel, 1);
+    }
+}
+
+static void timer_idle_setup(size_t param, size_t n_threads) {
+    timer_setup(param, n_threads, false);
+}
+
+static void timer_armed_setup(size_t param, size_t n_threads) {
+    timer_setup(param, n_threads, true);
+}
+
+static void timer_wheel_arm_run(size_t thread, size_t n_ops) {
+    TimerBench *   tb  = &timer_benches[thread];
+    const uint32_t now = TimerWheel_now(&tb->wheel);
+    for (size_t i = 0; i < n_ops; i++) {
+        TimerWheel_arm(&tb->wheel, &tb->timers[i], now + timer_delay(tb));
+    }
+}
+
+static void timer_wheel_cancel_run(size_t thread, size_t n_ops) {
+    TimerBench *tb = &timer_benches[thread];
+    for (size_t i = 0; i < n_ops; i++) {
+        TimerWheel_cancel(&tb->wheel, &tb->timers[i]);
+    }
+}
+
+static void timer_wheel_expire_run(size_t thread, size_t n_ops) {
+    TimerBench *tb = &timer_benches[thread];
+    timer_bench    = tb;
+    while (tb->n_expired < n_ops) {
+        TimerWheel_advance(&tb->wheel, TimerWheel_now(&tb->wheel) + 1);
+    }
+    timer_bench = NULL;
+}
+
+
+/* All the threads are workers of one scheduler, and an operation is a work
+ * item run by any of them. With param 0 every worker spawns its share of the
+ * items into its own deque, so that it mostly runs its own work. With param
+ * 1 worker 0 spawns all of them, and the other workers only run what they
+ * steal. */
+#define BENCH_WS_ITEMS 64
+
+typedef struct {
+    DeferredWork work;
+    atomic_bool  idle;
+} WsItem;
+
+typedef struct {
+    _Alignas(64) _Atomic size_t n_run;
+} WsCounter;
+
+static void *                ws_arrays[BENCH_MAX_THREADS][BENCH_WS_ITEMS];
+static WorkStealingDeque     ws_deques[BENCH_MAX_THREADS];
+static WorkStealingScheduler ws_scheduler;
+static WsItem                ws_items[BENCH_MAX_THREADS][BENCH_WS_ITEMS];
+static WsCounter             ws_counters[BENCH_MAX_THREADS];
+static size_t                ws_n_workers;
+static size_t                ws_one_producer;
+static _Thread_local size_t  ws_worker;
+
+static void ws_item_run(void *arg) {
+    WsItem *item = arg;
+    atomic_store(&item->idle, true);
+    atomic_fetch_add_explicit(
+            &ws_counters[ws_worker].n_run, 1, memory_order_relaxed);
+}
+
+static void ws_setup(size_t param, size_t n_threads) {
+    for (size_t t = 0; t < n_threads; t++) {
+        const WorkStealingDeque init =
+                WORK_STEALING_DEQUE_STATIC_INIT(BENCH_WS_ITEMS, ws_arrays[t]);
+        memcpy(&ws_deques[t], &init, sizeof(init));
+        for (size_t i = 0; i < BENCH_WS_ITEMS; i++) {
+            ws_items[t][i].work =
+                    (DeferredWork)DEFERRED_WORK_INIT(ws_item_run,
+                                                     &ws_items[t][i]);
+            atomic_store(&ws_items[t][i].idle, true);
+        }
+        atomic_store(&ws_counters[t].n_run, 0);
+    }
+    const WorkStealingScheduler init =
+            WORK_STEALING_SCHEDULER_STATIC_INIT(n_threads, ws_deques);
+    memcpy(&ws_scheduler, &init, sizeof(init));
+    ws_n_workers    = n_threads;
+    ws_one_producer = param;
+}
+
+static bool ws_all_run(size_t total) {
+    size_t n_run = 0;
+    for (size_t t = 0; t < ws_n_workers; t++) {
+        n_run += atomic_load_explicit(&ws_counters[t].n_run,
+                                      memory_order_relaxed);
+    }
+    return n_run == total;
+}
+
+static void ws_run(size_t thread, size_t n_ops) {
+    const size_t total = n_ops * ws_n_workers;
+    const size_t quota = !ws_one_producer ? n_ops : thread == 0 ? total : 0;
+    size_t       n_spawned = 0;
+    ws_worker              = thread;
+    while (1) {
+        /* Keep the own deque topped up with the items that have run */
+        for (size_t i = 0; i < BENCH_WS_ITEMS && n_spawned < quota; i++) {
+            WsItem *item = &ws_items[thread][i];
+            if (atomic_load(&item->idle)) {
+                atomic_store(&item->idle, false);
+                WorkStealingScheduler_spawn(
+                        &ws_scheduler, thread, &item->work);
+                n_spawned++;
+            }
+        }
+        if (!WorkStealingScheduler_run_one(&ws_scheduler, thread)
+            && n_spawned == quota && ws_all_run(total)) {
+            break;
+        }
+    }
+}
+
+
+static const Benchmark benchmarks[] = {
+        {"membag_acquire_release", 0, membag_setup, membag_run},
+        {"membag_acquire_ref_unref", 0, rc_membag_setup, rc_membag_run},
+        {"sharded_membag_acquire_release", 1, sharded_setup, sharded_run},
+        {"sharded_membag_acquire_release",
+         BENCH_SHARDED_BURST_MAX,
+         sharded_setup,
+         sharded_run},
+        {"mcas_read", 1, mcas_setup, mcas_read_run},
+        {"mcas_read", 2, mcas_setup, mcas_read_run},
+        {"mcas_read", 4, mcas_setup, mcas_read_run},
+        {"mcas_read", 8, mcas_setup, mcas_read_run},
+        {"mcas_read", 16, mcas_setup, mcas_read_run},
+        {"mcas_compare_exchange", 1, mcas_setup, mcas_compare_exchange_run},
+        {"mcas_compare_exchange", 2, mcas_setup, mcas_compare_exchange_run},
+        {"mcas_compare_exchange", 4, mcas_setup, mcas_compare_exchange_run},
+        {"mcas_compare_exchange", 8, mcas_setup, mcas_compare_exchange_run},
+        {"mcas_compare_exchange", 16, mcas_setup, mcas_compare_exchange_run},
+        {"mcas_retry_read", 1, mcas_setup, mcas_retry_read_run},
+        {"mcas_retry_read", 4, mcas_setup, mcas_retry_read_run},
+        {"mcas_retry_read", 16, mcas_setup, mcas_retry_read_run},
+        {"mcas_retry_fetch", 1, mcas_setup, mcas_retry_fetch_run},
+        {"mcas_retry_fetch", 4, mcas_setup, mcas_retry_fetch_run},
+        {"mcas_retry_fetch", 16, mcas_setup, mcas_retry_fetch_run},
+        {"mcas_contended", 1, mcas_contended_setup, mcas_contended_run},
+        {"mcas_contended", 4, mcas_contended_setup, mcas_contended_run},
+        {"mcas_contended", 16, mcas_contended_setup, mcas_contended_run},
+        {"nested_queue_enqueue_dequeue", 0, queue_setup, queue_run},
+        {"nested_queue_fanout", 1, queue_fanout_setup, queue_fanout_run},
+        {"nested_queue_fanout", 4, queue_fanout_setup, queue_fanout_run},
+        {"broadcast_ring_fanout", 1, ring_setup, ring_fanout_run},
+        {"broadcast_ring_fanout", 4, ring_setup, ring_fanout_run},
+        {"nested_queue_poll", 8, group_setup, queue_poll_run},
+        {"nested_queue_poll", BENCH_GROUP_LEN, group_setup, queue_poll_run},
+        {"nested_queue_group_select", 8, group_setup, group_select_run},
+        {"nested_queue_group_select",
+         BENCH_GROUP_LEN,
+         group_setup,
+         group_select_run},
+        {"nested_queue_convert", 8, convert_setup, queue_convert_run},
+        {"nested_queue_convert",
+         BENCH_QUEUE_LEN,
+         convert_setup,
+         queue_convert_run},
+        {"nested_queue_bulk_convert",
+         8,
+         convert_setup,
+         queue_bulk_convert_run},
+        {"nested_queue_bulk_convert",
+         BENCH_QUEUE_LEN,
+         convert_setup,
+         queue_bulk_convert_run},
+        {"double_buffer_write", 0, db_setup, db_write_run},
+        {"double_buffer_read", 0, db_setup, db_read_run},
+        {"slist_append_delete", 0, slist_setup, slist_append_delete_run},
+        {"slist_traverse", BENCH_SLIST_LEN, slist_setup, slist_traverse_run},
+        {"timer_wheel_arm", 1024, timer_idle_setup, timer_wheel_arm_run},
+        {"timer_wheel_arm",
+         BENCH_TIMERS_MAX,
+         timer_idle_setup,
+         timer_wheel_arm_run},
+        {"timer_wheel_cancel",
+         1024,
+         timer_armed_setup,
+         timer_wheel_cancel_run},
+        {"timer_wheel_cancel",
+         BENCH_TIMERS_MAX,
+         timer_armed_setup,
+         timer_wheel_cancel_run},
+        {"timer_wheel_expire",
+         1024,
+         timer_armed_setup,
+         timer_wheel_expire_run},
+        {"timer_wheel_expire",
+         BENCH_TIMERS_MAX,
+         timer_armed_setup,
+         timer_wheel_expire_run},
+        {"work_stealing_run", 0, ws_setup, ws_run},
+        {"work_stealing_run", 1, ws_setup, ws_run},
+        {"hash_map_find", 50, hash_setup, hash_find_run},
+        {"hash_map_find", 100, hash_setup, hash_find_run},
+        {"hash_map_find", 200, hash_setup, hash_find_run},
+        {"hash_map_find", 400, hash_setup, hash_find_run},
+        {"hash_map_delete_insert", 50, hash_setup, hash_delete_insert_run},
+        {"hash_map_delete_insert", 100, hash_setup, hash_delete_insert_run},
+        {"hash_map_delete_insert", 200, hash_setup, hash_delete_insert_run},
+        {"hash_map_delete_insert", 400, hash_setup, hash_delete_insert_run},
+        {"mutex_map_find", 50, hash_setup, locked_find_run},
+        {"mutex_map_find", 100, hash_setup, locked_find_run},
+        {"mutex_map_find", 200, hash_setup, locked_find_run},
+        {"mutex_map_find", 400, hash_setup, locked_find_run},
+        {"mutex_map_delete_insert", 50, hash_setup, locked_delete_insert_run},
+        {"mutex_map_delete_insert", 100, hash_setup, locked_delete_insert_run},
+        {"mutex_map_delete_insert", 200, hash_setup, locked_delete_insert_run},
+        {"mutex_map_delete_insert", 400, hash_setup, locked_delete_insert_run},
+};
+
+
+/* Runner *****************************************************************/
+
+typedef struct {
+    const Benchmark * benchmark;
+    size_t            thread;
+    size_t            n_ops;
+    pthread_barrier_t *start;
+    /** Results */
+    double   elapsed_ns;
+    bool     counted[NUMBER_OF_COUNTERS];
+    uint64_t counts[NUMBER_OF_COUNTERS];
+} Worker;
+
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    int     fds[NUMBER_OF_COUNTERS];
+    for (int c = 0; c < NUMBER_OF_COUNTERS; c++) {
+        fds[c] = counter_open((Counter)c);
+    }
+
+    pthread_barrier_wait(w->start);
+    for (int c = 0; c < NUMBER_OF_COUNTERS; c++) {
+        if (fds[c] >= 0) { ioctl(fds[c], PERF_EVENT_IOC_ENABLE, 0); }
+    }
+    const double begin = now_ns();
+    w->benchmark->run(w->thread, w->n_ops);
+    w->elapsed_ns = now_ns() - begin;
+    for (int c = 0; c < NUMBER_OF_COUNTERS; c++) {
+        if (fds[c] >= 0) { ioctl(fds[c], PERF_EVENT_IOC_DISABLE, 0); }
+    }
+
+    for (int c = 0; c < NUMBER_OF_COUNTERS; c++) {
+        w->counted[c] = fds[c] >= 0
+                        && read(fds[c], &w->counts[c], sizeof(w->counts[c]))
+                                   == sizeof(w->counts[c]);
+        if (fds[c] >= 0) { close(fds[c]); }
+    }
+    return NULL;
+}
+
+
+typedef enum { FORMAT_CSV, FORMAT_JSON } Format;
+
+
+static void print_header(Format format) {
+    if (format == FORMAT_JSON) {
+        printf("[\n");
+        return;
+    }
+    printf("benchmark,param,orders,threads,ops,ns_per_op,ops_per_sec");
+    for (int c = 0; c < NUMBER_OF_COUNTERS; c++) {
+        printf(",%s_per_op", counter_names[c]);
+    }
+    printf("\n");
+}
+
+
+static void print_result(Format           format,
+                         bool             first,
+                         const Benchmark *b,
+                         const Worker *   workers,
+                         size_t           n_threads) {
+    double elapsed_sum = 0;
+    double elapsed_max = 0;
+    size_t total_ops   = 0;
+    for (size_t t = 0; t < n_threads; t++) {
+        elapsed_sum += workers[t].elapsed_ns;
+        if (workers[t].elapsed_ns > elapsed_max) {
+            elapsed_max = workers[t].elapsed_ns;
+        }
+        total_ops += workers[t].n_ops;
+    }
+    const double ns_per_op   = elapsed_sum / (double)total_ops;
+    const double ops_per_sec = (double)total_ops * 1e9 / elapsed_max;
+
+    if (format == FORMAT_JSON) {
+        printf("%s  {\"benchmark\": \"%s\", \"param\": %zu, "
+               "\"orders\": \"%s\", \"threads\": %zu, \"ops\": %zu, "
+               "\"ns_per_op\": %.3f, \"ops_per_sec\": %.0f",
+               first ? "" : ",\n",
+               b->name,
+               b->param,
+               BENCH_ORDERS,
+               n_threads,
+               total_ops,
+               ns_per_op,
+               ops_per_sec);
+    } else {
+        printf("%s,%zu,%s,%zu,%zu,%.3f,%.0f",
+               b->name,
+               b->param,
+               BENCH_ORDERS,
+               n_threads,
+               total_ops,
+               ns_per_op,
+               ops_per_sec);
+    }
+
+    for (int c = 0; c < NUMBER_OF_COUNTERS; c++) {
+        bool     counted = true;
+        uint64_t count   = 0;
+        for (size_t t = 0; t < n_threads; t++) {
+            counted = counted && workers[t].counted[c];
+            count += workers[t].counts[c];
+        }
+        const double per_op = (double)count / (double)total_ops;
+        if (format == FORMAT_JSON) {
+            printf(", \"%s_per_op\": ", counter_names[c]);
+            if (counted) {
+                printf("%.3f", per_op);
+            } else {
+                printf("null");
+            }
+        } else {
+            printf(",");
+            if (counted) { printf("%.3f", per_op); }
+        }
+    }
+    printf(format == FORMAT_JSON ? "}" : "\n");
+}
+
+
+static void run(const Benchmark *b,
+                size_t           n_threads,
+                size_t           n_ops,
+                Worker *         workers) {
+    pthread_t         threads[BENCH_MAX_THREADS];
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, (unsigned)n_threads);
+    bench_n_ops = n_ops;
+    b->setup(b->param, n_threads);
+    for (size_t t = 0; t < n_threads; t++) {
+        workers[t] = (Worker){
+                .benchmark = b,
+                .thread    = t,
+                .n_ops     = n_ops,
+                .start     = &start,
+        };
+        if (pthread_create(&threads[t], NULL, worker_main, &workers[t])) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (size_t t = 0; t < n_threads; t++) { pthread_join(threads[t], NULL); }
+    pthread_barrier_destroy(&start);
+}
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [-t max_threads] [-n ops_per_thread] [-f csv|json] "
+            "[-b name] [-r raw_event]\n",
+            argv0);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char **argv) {
+    long        max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t      n_ops       = 1000000;
+    Format      format      = FORMAT_CSV;
+    const char *filter      = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:f:b:r:")) != -1) {
+        switch (opt) {
+        case 't': max_threads = strtol(optarg, NULL, 0); break;
+        case 'n': n_ops = strtoull(optarg, NULL, 0); break;
+        case 'f':
+            if (strcmp(optarg, "csv") == 0) {
+                format = FORMAT_CSV;
+            } else if (strcmp(optarg, "json") == 0) {
+                format = FORMAT_JSON;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'b': filter = optarg; break;
+        case 'r':
+            raw_enabled = true;
+            raw_config  = strtoull(optarg, NULL, 16);
+            break;
+        default: usage(argv[0]);
+        }
+    }
+    if (max_threads < 1) { max_threads = 1; }
+    if (max_threads > BENCH_MAX_THREADS) { max_threads = BENCH_MAX_THREADS; }
+    if (n_ops == 0) { usage(argv[0]); }
+
+    static Worker workers[BENCH_MAX_THREADS];
+    bool          first = true;
+    print_header(format);
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        const Benchmark *b = &benchmarks[i];
+        if (filter != NULL && strstr(b->name, filter) == NULL) { continue; }
+        /* 1, 2, 4, ... and max_threads itself */
+        for (size_t n = 1;; n = n * 2 < (size_t)max_threads
+                                        ? n * 2
+                                        : (size_t)max_threads) {
+            run(b, n, n_ops, workers);
+            print_result(format, first, b, workers, n);
+            first = false;
+            if (n == (size_t)max_threads) { break; }
+        }
+        fflush(stdout);
+    }
+    if (format == FORMAT_JSON) { printf("\n]\n"); }
+    return EXIT_SUCCESS;
+}
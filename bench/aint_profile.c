@@ -0,0 +1,839 @@
+/** \file aint_profile.c
+ *
+ * Count the atomic operations of the public functions, uninterrupted and
+ * with a nested operation injected before each of their atomic operations
+ *
+ * The functions profiled are the acquires, commits and releases of #Membag,
+ * #NestedQueue, #DoubleBuffer and #BroadcastRing, #Mcas, the inserts, finds
+ * and deletes of #SkipList and #HashMap, the pushes and pops of #SlistStack
+ * and #WorkStealingDeque, and all of #EpochReclaim and #TimerWheel.
+ *
+ * Every profiled function is called once on a data structure set up for
+ * it, with the counting shim of atomic_profile.h, and then once more for
+ * every atomic operation n of that call, with an interrupt on the same data
+ * structure injected before operation n. The worst of these is the most the
+ * call can cost when it is interrupted, including helping the interrupt or
+ * being helped by it. The results are written as CSV, one record per
+ * function, with
+ *  - \c loads, \c stores, \c rmws, \c fences and \c failed_cas of the
+ *    uninterrupted call, and its operations by memory order,
+ *  - \c worst_step the operation before which the interrupt costs the most,
+ *  - \c worst_ops and \c worst_failed_cas of the call when interrupted there,
+ *    and \c interrupt_ops of the interrupt itself.
+ *
+ * The counts don't depend on the machine or the timing, so the output of two
+ * versions can be diffed directly.
+ *
+ * Build (Linux, GCC):
+ * \code{.sh}
+ * cc -std=gnu11 -O2 -DAINT_SAFE_PROFILE=1 -Isrc -o aint_profile \
+ *         bench/aint_profile.c $(find src -name '*.c')
+ * ./aint_profile > profile.csv
+ * \endcode
+ *
+ * Options:
+ *  - \c -b NAME only profile the functions whose name contains NAME
+ *  - \c -a write a record per injection step instead, with the columns
+ *    \c function, \c step, \c caller_ops, \c failed_cas and \c interrupt_ops
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#if !defined(AINT_SAFE_PROFILE) || !AINT_SAFE_PROFILE
+#error "Build with -DAINT_SAFE_PROFILE=1"
+/* Declare the profiling API anyway, so that the error above is the only
+ * one */
+#undef AINT_SAFE_PROFILE
+#define AINT_SAFE_PROFILE 1
+#endif
+
+#include "atomic_profile.h"
+#include "broadcast_ring.h"
+#include "container.h"
+#include "double_buffer.h"
+#include "epoch_reclaim.h"
+#include "hash_map.h"
+#include "mcas.h"
+#include "membag.h"
+#include "nested_queue.h"
+#include "skip_list.h"
+#include "slist_stack.h"
+#include "timer_wheel.h"
+#include "work_stealing.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PROFILE_ELEM_SIZE 64
+#define PROFILE_MEMBAG_LEN 8
+#define PROFILE_MCAS_LEN 4
+#define PROFILE_QUEUE_LEN 8
+#define PROFILE_RING_LEN 8
+#define PROFILE_SKIP_LIST_LEN 8
+#define PROFILE_HASH_MAP_LEN 8
+#define PROFILE_HASH_MAP_BUCKETS 2
+#define PROFILE_STACK_LEN 8
+#define PROFILE_EPOCH_LEN 8
+#define PROFILE_TIMER_LEN 8
+#define PROFILE_DEQUE_LEN 8
+
+
+/* Profiled calls *********************************************************/
+
+typedef struct {
+    /** Name of the function in the output */
+    const char *name;
+    /** Reset the data structure and do what the call needs first */
+    void (*setup)(void);
+    /** Call the function once */
+    void (*call)(void);
+    /** Operation nested in the call, on the same data structure */
+    AintSafeProfileInterrupt interrupt;
+} Profile;
+
+
+/* Some slots are taken, so that acquire has to look past them */
+static membag_alloc_status_t membag_status[PROFILE_MEMBAG_LEN];
+static char   membag_data[PROFILE_MEMBAG_LEN][PROFILE_ELEM_SIZE];
+static Membag membag = MEMBAG_STATIC_INIT(PROFILE_ELEM_SIZE,
+                                          PROFILE_MEMBAG_LEN,
+                                          membag_status,
+                                          membag_data);
+static void * membag_slot;
+
+static void membag_setup(void) {
+    Membag_init(&membag);
+    for (size_t i = 0; i < PROFILE_MEMBAG_LEN / 2; i++) {
+        membag_slot = Membag_acquire(&membag);
+    }
+}
+
+static void membag_acquire_call(void) {
+    membag_slot = Membag_acquire(&membag);
+}
+
+static void membag_release_call(void) {
+    Membag_release(&membag, membag_slot);
+}
+
+static void membag_interrupt(void *arg) {
+    (void)arg;
+    void *slot = Membag_acquire(&membag);
+    if (slot != NULL) { Membag_release(&membag, slot); }
+}
+
+
+static _Atomic mcas_base_t mcas_data[PROFILE_MCAS_LEN];
+static mcas_base_t         mcas_expected[PROFILE_MCAS_LEN];
+static Mcas mcas = MCAS_STATIC_INIT(PROFILE_MCAS_LEN, mcas_data);
+
+static void mcas_setup(void) {
+    for (size_t i = 0; i < PROFILE_MCAS_LEN; i++) {
+        atomic_init(&mcas_data[i], 0);
+        mcas_expected[i] = 0;
+    }
+}
+
+static void mcas_increment(void) {
+    mcas_base_t expected[PROFILE_MCAS_LEN];
+    mcas_base_t desired[PROFILE_MCAS_LEN];
+    Mcas_read(&mcas, expected);
+    for (size_t i = 0; i < PROFILE_MCAS_LEN; i++) {
+        desired[i] = expected[i] + 1;
+    }
+    Mcas_compare_exchange(&mcas, expected, desired);
+}
+
+static void mcas_read_call(void) {
+    mcas_base_t data[PROFILE_MCAS_LEN];
+    Mcas_read(&mcas, data);
+}
+
+static void mcas_compare_exchange_call(void) {
+    mcas_base_t desired[PROFILE_MCAS_LEN];
+    for (size_t i = 0; i < PROFILE_MCAS_LEN; i++) {
+        desired[i] = mcas_expected[i] + 1;
+    }
+    Mcas_compare_exchange(&mcas, mcas_expected, desired);
+}
+
+static void mcas_interrupt(void *arg) {
+    (void)arg;
+    mcas_increment();
+}
+
+
+/* Half full, with a write and a read in progress for the commit and release
+ * calls */
+static char            queue_data[PROFILE_QUEUE_LEN][PROFILE_ELEM_SIZE];
+static NestedQueue     queue;
+static void *          queue_write_slot;
+static const void *    queue_read_slot;
+static NestedQueueSpan queue_spans[2];
+
+static void queue_setup(void) {
+    const NestedQueue init =
+            NESTED_QUEUE_STATIC_INIT(queue,
+                                     PROFILE_ELEM_SIZE,
+                                     PROFILE_QUEUE_LEN,
+                                     queue_data,
+                                     NESTED_QUEUE_OPERATION_ORDER_NESTED,
+                                     NESTED_QUEUE_OPERATION_ORDER_NESTED);
+    memcpy(&queue, &init, sizeof(init));
+    for (size_t i = 0; i < PROFILE_QUEUE_LEN / 2; i++) {
+        NestedQueue_write_commit(&queue, NestedQueue_write_acquire(&queue));
+    }
+}
+
+static void queue_write_setup(void) {
+    queue_setup();
+    queue_write_slot = NestedQueue_write_acquire(&queue);
+}
+
+static void queue_read_setup(void) {
+    queue_setup();
+    queue_read_slot = NestedQueue_read_acquire(&queue);
+}
+
+static void queue_bulk_setup(void) {
+    queue_setup();
+    NestedQueue_read_acquire_bulk(&queue, PROFILE_QUEUE_LEN, queue_spans);
+}
+
+static void queue_write_acquire_call(void) {
+    queue_write_slot = NestedQueue_write_acquire(&queue);
+}
+
+static void queue_write_commit_call(void) {
+    NestedQueue_write_commit(&queue, queue_write_slot);
+}
+
+static void queue_read_acquire_call(void) {
+    queue_read_slot = NestedQueue_read_acquire(&queue);
+}
+
+static void queue_read_release_call(void) {
+    NestedQueue_read_release(&queue, queue_read_slot);
+}
+
+static void queue_read_acquire_bulk_call(void) {
+    NestedQueue_read_acquire_bulk(&queue, PROFILE_QUEUE_LEN, queue_spans);
+}
+
+static void queue_read_release_bulk_call(void) {
+    NestedQueue_read_release_bulk(&queue, queue_spans);
+}
+
+static void queue_write_interrupt(void *arg) {
+    (void)arg;
+    void *slot = NestedQueue_write_acquire(&queue);
+    if (slot != NULL) { NestedQueue_write_commit(&queue, slot); }
+}
+
+static void queue_read_interrupt(void *arg) {
+    (void)arg;
+    const void *slot = NestedQueue_read_acquire(&queue);
+    if (slot != NULL) { NestedQueue_read_release(&queue, slot); }
+}
+
+
+/* The writer interrupts both writers and readers */
+static char         double_buffer_data[2][PROFILE_ELEM_SIZE];
+static DoubleBuffer double_buffer;
+static void *       double_buffer_write_slot;
+static const void * double_buffer_read_slot;
+
+static void double_buffer_setup(void) {
+    const DoubleBuffer init =
+            DOUBLE_BUFFER_STATIC_INIT(PROFILE_ELEM_SIZE, double_buffer_data);
+    memcpy(&double_buffer, &init, sizeof(init));
+}
+
+static void double_buffer_write_setup(void) {
+    double_buffer_setup();
+    double_buffer_write_slot = DoubleBuffer_write_acquire(&double_buffer);
+}
+
+static void double_buffer_read_setup(void) {
+    double_buffer_setup();
+    double_buffer_read_slot = DoubleBuffer_read_acquire(&double_buffer);
+}
+
+static void double_buffer_write_acquire_call(void) {
+    double_buffer_write_slot = DoubleBuffer_write_acquire(&double_buffer);
+}
+
+static void double_buffer_write_commit_call(void) {
+    DoubleBuffer_write_commit(&double_buffer, double_buffer_write_slot);
+}
+
+static void double_buffer_read_acquire_call(void) {
+    double_buffer_read_slot = DoubleBuffer_read_acquire(&double_buffer);
+}
+
+static void double_buffer_read_release_call(void) {
+    DoubleBuffer_read_release(&double_buffer, double_buffer_read_slot);
+}
+
+static void double_buffer_interrupt(void *arg) {
+    (void)arg;
+    DoubleBuffer_write_commit(&double_buffer,
+                              DoubleBuffer_write_acquire(&double_buffer));
+}
+
+
+/* One subscribed consumer, with a message to read */
+static char                   ring_data[PROFILE_RING_LEN][PROFILE_ELEM_SIZE];
+static BroadcastRingConsumer  ring_consumers[1];
+static BroadcastRing          ring;
+static BroadcastRingConsumer *ring_consumer;
+static void *                 ring_write_slot;
+
+static void ring_setup(void) {
+    const BroadcastRing init =
+            BROADCAST_RING_STATIC_INIT(PROFILE_ELEM_SIZE,
+                                       PROFILE_RING_LEN,
+                                       ring_data,
+                                       1,
+                                       ring_consumers,
+                                       BROADCAST_RING_LAG_DROP);
+    memcpy(&ring, &init, sizeof(init));
+    memset(ring_consumers, 0, sizeof(ring_consumers));
+    ring_consumer = BroadcastRing_subscribe(&ring);
+    BroadcastRing_write_commit(&ring, BroadcastRing_write_acquire(&ring));
+    ring_write_slot = BroadcastRing_write_acquire(&ring);
+}
+
+static void ring_write_commit_call(void) {
+    BroadcastRing_write_commit(&ring, ring_write_slot);
+}
+
+static void ring_read_call(void) {
+    const void *slot = BroadcastRing_read_acquire(&ring, ring_consumer);
+    if (slot != NULL) {
+        BroadcastRing_read_release(&ring, ring_consumer, slot);
+    }
+}
+
+static void ring_interrupt(void *arg) {
+    (void)arg;
+    ring_read_call();
+}
+
+
+/* Half the keys in the list, inserting and deleting one more key interrupts
+ * the calls */
+typedef struct {
+    SkipListNode node;
+    int          key;
+} SkipListElem;
+
+static int skip_list_compare(const SkipListNode *a, const SkipListNode *b) {
+    return CONTAINER_OF(a, SkipListElem, node)->key
+           - CONTAINER_OF(b, SkipListElem, node)->key;
+}
+
+static SkipListElem skip_list_elems[PROFILE_SKIP_LIST_LEN];
+static SkipList     skip_list;
+
+static void skip_list_setup(void) {
+    const SkipList init = SKIP_LIST_STATIC_INIT(skip_list_compare);
+    memcpy(&skip_list, &init, sizeof(init));
+    memset(skip_list_elems, 0, sizeof(skip_list_elems));
+    for (int i = 0; i < PROFILE_SKIP_LIST_LEN; i++) {
+        skip_list_elems[i].key = 2 * i;
+    }
+    for (int i = 0; i < PROFILE_SKIP_LIST_LEN / 2; i++) {
+        SkipList_insert(&skip_list, &skip_list_elems[2 * i].node);
+    }
+}
+
+static void skip_list_insert_call(void) {
+    SkipList_insert(&skip_list, &skip_list_elems[3].node);
+}
+
+static void skip_list_find_call(void) {
+    SkipList_find(&skip_list, &skip_list_elems[4].node);
+}
+
+static void skip_list_delete_call(void) {
+    SkipList_delete(&skip_list, &skip_list_elems[4].node);
+}
+
+static void skip_list_interrupt(void *arg) {
+    (void)arg;
+    SkipListNode *node = &skip_list_elems[5].node;
+    if (SkipList_insert(&skip_list, node) != NULL) {
+        SkipList_delete(&skip_list, node);
+    }
+}
+
+
+/* Two entries per bucket, the same as the skip list otherwise */
+static MarkedSlistNode hash_map_buckets[PROFILE_HASH_MAP_BUCKETS];
+static HashMapEntry    hash_map_entries[PROFILE_HASH_MAP_LEN];
+static HashMap         hash_map =
+        HASH_MAP_STATIC_INIT(PROFILE_HASH_MAP_BUCKETS, hash_map_buckets);
+
+static void hash_map_setup(void) {
+    memset(hash_map_buckets, 0, sizeof(hash_map_buckets));
+    memset(hash_map_entries, 0, sizeof(hash_map_entries));
+    for (size_t i = 0; i < PROFILE_HASH_MAP_LEN; i++) {
+        hash_map_entries[i].key = i;
+    }
+    for (size_t i = 0; i < PROFILE_HASH_MAP_LEN / 2; i++) {
+        HashMap_insert(&hash_map, &hash_map_entries[i]);
+    }
+}
+
+static void hash_map_find_call(void) {
+    HashMap_find(&hash_map, PROFILE_HASH_MAP_LEN / 2 - 1);
+}
+
+static void hash_map_insert_call(void) {
+    HashMap_insert(&hash_map, &hash_map_entries[PROFILE_HASH_MAP_LEN / 2]);
+}
+
+static void hash_map_delete_call(void) {
+    HashMap_delete(&hash_map, PROFILE_HASH_MAP_LEN / 2 - 1);
+}
+
+static void hash_map_interrupt(void *arg) {
+    (void)arg;
+    HashMapEntry *entry = &hash_map_entries[PROFILE_HASH_MAP_LEN - 1];
+    if (HashMap_insert(&hash_map, entry) != NULL) {
+        HashMap_delete(&hash_map, entry->key);
+    }
+}
+
+
+/* Half the slots on the stack, and one more to push */
+typedef struct {
+    SlistNode node;
+} StackElem;
+
+static membag_alloc_status_t stack_status[PROFILE_STACK_LEN];
+static StackElem             stack_data[PROFILE_STACK_LEN];
+static Membag                stack_membag = MEMBAG_STATIC_INIT(
+        sizeof(StackElem), PROFILE_STACK_LEN, stack_status, stack_data);
+static SlistStack stack =
+        SLIST_STACK_STATIC_INIT(&stack_membag, offsetof(StackElem, node));
+static StackElem *stack_elem;
+
+static void stack_setup(void) {
+    Membag_init(&stack_membag);
+    atomic_init(&stack.head, 0);
+    for (size_t i = 0; i < PROFILE_STACK_LEN / 2; i++) {
+        StackElem *elem = Membag_acquire(&stack_membag);
+        SlistStack_push(&stack, &elem->node);
+    }
+    stack_elem = Membag_acquire(&stack_membag);
+}
+
+static void stack_push_call(void) {
+    SlistStack_push(&stack, &stack_elem->node);
+}
+
+static void stack_pop_call(void) {
+    SlistStack_pop(&stack);
+}
+
+static void stack_pop_all_call(void) {
+    SlistStack_pop_all(&stack);
+}
+
+static void stack_interrupt(void *arg) {
+    (void)arg;
+    SlistNode *node = SlistStack_pop(&stack);
+    if (node != NULL) { SlistStack_push(&stack, node); }
+}
+
+
+/* Slots retired in the previous epoch, which collect releases. A reader
+ * entering and exiting and a collect interrupt the calls. */
+static membag_alloc_status_t epoch_record_status[PROFILE_EPOCH_LEN];
+static EpochReclaimRecord    epoch_records[PROFILE_EPOCH_LEN];
+static EpochReclaim          epoch_reclaim = EPOCH_RECLAIM_STATIC_INIT(
+        PROFILE_EPOCH_LEN, epoch_record_status, epoch_records);
+static membag_alloc_status_t epoch_slot_status[PROFILE_EPOCH_LEN];
+static char   epoch_slot_data[PROFILE_EPOCH_LEN][PROFILE_ELEM_SIZE];
+static Membag epoch_slots = MEMBAG_STATIC_INIT(PROFILE_ELEM_SIZE,
+                                               PROFILE_EPOCH_LEN,
+                                               epoch_slot_status,
+                                               epoch_slot_data);
+static void *            epoch_slot;
+static EpochReclaimToken epoch_token;
+
+static void epoch_setup(void) {
+    EpochReclaim_init(&epoch_reclaim);
+    Membag_init(&epoch_slots);
+    for (size_t i = 0; i < PROFILE_EPOCH_LEN / 2; i++) {
+        EpochReclaim_retire(
+                &epoch_reclaim, &epoch_slots, Membag_acquire(&epoch_slots));
+    }
+    EpochReclaim_collect(&epoch_reclaim);
+    epoch_slot = Membag_acquire(&epoch_slots);
+}
+
+static void epoch_exit_setup(void) {
+    epoch_setup();
+    epoch_token = EpochReclaim_enter(&epoch_reclaim);
+}
+
+static void epoch_enter_call(void) {
+    epoch_token = EpochReclaim_enter(&epoch_reclaim);
+}
+
+static void epoch_exit_call(void) {
+    EpochReclaim_exit(&epoch_reclaim, epoch_token);
+}
+
+static void epoch_retire_call(void) {
+    EpochReclaim_retire(&epoch_reclaim, &epoch_slots, epoch_slot);
+}
+
+static void epoch_collect_call(void) {
+    EpochReclaim_collect(&epoch_reclaim);
+}
+
+static void epoch_interrupt(void *arg) {
+    (void)arg;
+    EpochReclaim_exit(&epoch_reclaim, EpochReclaim_enter(&epoch_reclaim));
+    EpochReclaim_collect(&epoch_reclaim);
+}
+
+
+/* Half the timers armed at the next ticks. The tick interrupt arms a timer
+ * and advances the wheel past it. */
+static void timer_callback(TimerWheelTimer *timer, bool expired) {
+    (void)timer;
+    (void)expired;
+}
+
+static TimerWheel      timer_wheel;
+static TimerWheelTimer timers[PROFILE_TIMER_LEN];
+
+static void timer_setup(void) {
+    const TimerWheel init = TIMER_WHEEL_STATIC_INIT;
+    memcpy(&timer_wheel, &init, sizeof(init));
+    for (size_t i = 0; i < PROFILE_TIMER_LEN; i++) {
+        timers[i] = (TimerWheelTimer)TIMER_WHEEL_TIMER_INIT(timer_callback);
+    }
+    for (size_t i = 0; i < PROFILE_TIMER_LEN / 2; i++) {
+        TimerWheel_arm(&timer_wheel, &timers[i], (uint32_t)i + 1);
+    }
+}
+
+static void timer_arm_call(void) {
+    TimerWheel_arm(&timer_wheel, &timers[PROFILE_TIMER_LEN / 2], 2);
+}
+
+static void timer_cancel_call(void) {
+    TimerWheel_cancel(&timer_wheel, &timers[0]);
+}
+
+static void timer_advance_call(void) {
+    TimerWheel_advance(&timer_wheel, 2);
+}
+
+static void timer_interrupt(void *arg) {
+    (void)arg;
+    const uint32_t next = TimerWheel_now(&timer_wheel) + 1;
+    TimerWheel_arm(&timer_wheel, &timers[PROFILE_TIMER_LEN - 1], next);
+    TimerWheel_advance(&timer_wheel, next);
+}
+
+
+/* Half full. Thieves only steal, so the interrupt is a steal. */
+static void *            deque_data[PROFILE_DEQUE_LEN];
+static WorkStealingDeque deque;
+static char              deque_elems[PROFILE_DEQUE_LEN];
+
+static void deque_setup(void) {
+    const WorkStealingDeque init =
+            WORK_STEALING_DEQUE_STATIC_INIT(PROFILE_DEQUE_LEN, deque_data);
+    memcpy(&deque, &init, sizeof(init));
+    for (size_t i = 0; i < PROFILE_DEQUE_LEN / 2; i++) {
+        WorkStealingDeque_push(&deque, &deque_elems[i]);
+    }
+}
+
+static void deque_push_call(void) {
+    WorkStealingDeque_push(&deque, &deque_elems[PROFILE_DEQUE_LEN / 2]);
+}
+
+static void deque_pop_call(void) {
+    WorkStealingDeque_pop(&deque);
+}
+
+static void deque_steal_call(void) {
+    WorkStealingDeque_steal(&deque);
+}
+
+static void deque_interrupt(void *arg) {
+    (void)arg;
+    WorkStealingDeque_steal(&deque);
+}
+
+
+static const Profile profiles[] = {
+        {"Membag_acquire",
+         membag_setup,
+         membag_acquire_call,
+         membag_interrupt},
+        {"Membag_release",
+         membag_setup,
+         membag_release_call,
+         membag_interrupt},
+        {"Mcas_read", mcas_setup, mcas_read_call, mcas_interrupt},
+        {"Mcas_compare_exchange",
+         mcas_setup,
+         mcas_compare_exchange_call,
+         mcas_interrupt},
+        {"NestedQueue_write_acquire",
+         queue_setup,
+         queue_write_acquire_call,
+         queue_write_interrupt},
+        {"NestedQueue_write_commit",
+         queue_write_setup,
+         queue_write_commit_call,
+         queue_write_interrupt},
+        {"NestedQueue_read_acquire",
+         queue_setup,
+         queue_read_acquire_call,
+         queue_read_interrupt},
+        {"NestedQueue_read_release",
+         queue_read_setup,
+         queue_read_release_call,
+         queue_read_interrupt},
+        {"NestedQueue_read_acquire_bulk",
+         queue_setup,
+         queue_read_acquire_bulk_call,
+         queue_read_interrupt},
+        {"NestedQueue_read_release_bulk",
+         queue_bulk_setup,
+         queue_read_release_bulk_call,
+         queue_read_interrupt},
+        {"DoubleBuffer_write_acquire",
+         double_buffer_setup,
+         double_buffer_write_acquire_call,
+         double_buffer_interrupt},
+        {"DoubleBuffer_write_commit",
+         double_buffer_write_setup,
+         double_buffer_write_commit_call,
+         double_buffer_interrupt},
+        {"DoubleBuffer_read_acquire",
+         double_buffer_setup,
+         double_buffer_read_acquire_call,
+         double_buffer_interrupt},
+        {"DoubleBuffer_read_release",
+         double_buffer_read_setup,
+         double_buffer_read_release_call,
+         double_buffer_interrupt},
+        {"BroadcastRing_write_commit",
+         ring_setup,
+         ring_write_commit_call,
+         ring_interrupt},
+        {"BroadcastRing_read", ring_setup, ring_read_call, ring_interrupt},
+        {"SkipList_insert",
+         skip_list_setup,
+         skip_list_insert_call,
+         skip_list_interrupt},
+        {"SkipList_find",
+         skip_list_setup,
+         skip_list_find_call,
+         skip_list_interrupt},
+        {"SkipList_delete",
+         skip_list_setup,
+         skip_list_delete_call,
+         skip_list_interrupt},
+        {"HashMap_find",
+         hash_map_setup,
+         hash_map_find_call,
+         hash_map_interrupt},
+        {"HashMap_insert",
+         hash_map_setup,
+         hash_map_insert_call,
+         hash_map_interrupt},
+        {"HashMap_delete",
+         hash_map_setup,
+         hash_map_delete_call,
+         hash_map_interrupt},
+        {"SlistStack_push", stack_setup, stack_push_call, stack_interrupt},
+        {"SlistStack_pop", stack_setup, stack_pop_call, stack_interrupt},
+        {"SlistStack_pop_all",
+         stack_setup,
+         stack_pop_all_call,
+         stack_interrupt},
+        {"EpochReclaim_enter",
+         epoch_setup,
+         epoch_enter_call,
+         epoch_interrupt},
+        {"EpochReclaim_exit",
+         epoch_exit_setup,
+         epoch_exit_call,
+         epoch_interrupt},
+        {"EpochReclaim_retire",
+         epoch_setup,
+         epoch_retire_call,
+         epoch_interrupt},
+        {"EpochReclaim_collect",
+         epoch_setup,
+         epoch_collect_call,
+         epoch_interrupt},
+        {"TimerWheel_arm", timer_setup, timer_arm_call, timer_interrupt},
+        {"TimerWheel_cancel",
+         timer_setup,
+         timer_cancel_call,
+         timer_interrupt},
+        {"TimerWheel_advance",
+         timer_setup,
+         timer_advance_call,
+         timer_interrupt},
+        {"WorkStealingDeque_push",
+         deque_setup,
+         deque_push_call,
+         deque_interrupt},
+        {"WorkStealingDeque_pop",
+         deque_setup,
+         deque_pop_call,
+         deque_interrupt},
+        {"WorkStealingDeque_steal",
+         deque_setup,
+         deque_steal_call,
+         deque_interrupt},
+};
+
+
+/* Profiling **************************************************************/
+
+static const char *const order_names[AINT_SAFE_PROFILE_NUMBER_OF_ORDERS] = {
+        "relaxed", "consume", "acquire", "release", "acq_rel", "seq_cst"};
+
+
+static uint64_t total_ops(const AintSafeProfileCounts *counts) {
+    uint64_t total = 0;
+    for (int k = 0; k < AINT_SAFE_PROFILE_NUMBER_OF_KINDS; k++) {
+        total += AintSafeProfileCounts_total(counts, (AintSafeProfileKind)k);
+    }
+    return total;
+}
+
+
+static uint64_t order_ops(const AintSafeProfileCounts *counts, size_t order) {
+    uint64_t total = 0;
+    for (int k = 0; k < AINT_SAFE_PROFILE_NUMBER_OF_KINDS; k++) {
+        total += counts->ops[k][order];
+    }
+    return total;
+}
+
+
+/* Call p once, interrupted before operation step, or not if step is
+ * UINT64_MAX. Returns false if the call had fewer operations than step. */
+static bool profile_call(const Profile *        p,
+                         uint64_t               step,
+                         AintSafeProfileCounts *caller,
+                         AintSafeProfileCounts *interrupt) {
+    p->setup();
+    AintSafeProfile_reset();
+    if (step != UINT64_MAX) {
+        AintSafeProfile_inject(step, p->interrupt, NULL);
+    }
+    p->call();
+    AintSafeProfile_get(caller, interrupt);
+    return step == UINT64_MAX || AintSafeProfile_injected();
+}
+
+
+static void profile(const Profile *p, bool all_steps) {
+    AintSafeProfileCounts plain;
+    AintSafeProfileCounts caller;
+    AintSafeProfileCounts interrupt;
+    AintSafeProfileCounts worst_caller    = {0};
+    AintSafeProfileCounts worst_interrupt = {0};
+    uint64_t              worst_step      = 0;
+    uint64_t              worst_ops       = 0;
+
+    profile_call(p, UINT64_MAX, &plain, NULL);
+    for (uint64_t step = 0; profile_call(p, step, &caller, &interrupt);
+         step++) {
+        if (all_steps) {
+            printf("%s,%llu,%llu,%llu,%llu\n",
+                   p->name,
+                   (unsigned long long)step,
+                   (unsigned long long)total_ops(&caller),
+                   (unsigned long long)caller.failed_cas,
+                   (unsigned long long)total_ops(&interrupt));
+        }
+        const uint64_t ops = total_ops(&caller) + total_ops(&interrupt);
+        if (ops > worst_ops) {
+            worst_ops       = ops;
+            worst_step      = step;
+            worst_caller    = caller;
+            worst_interrupt = interrupt;
+        }
+    }
+    if (all_steps) { return; }
+
+    printf("%s,%llu,%llu,%llu,%llu,%llu",
+           p->name,
+           (unsigned long long)AintSafeProfileCounts_total(
+                   &plain, AINT_SAFE_PROFILE_LOAD),
+           (unsigned long long)AintSafeProfileCounts_total(
+                   &plain, AINT_SAFE_PROFILE_STORE),
+           (unsigned long long)AintSafeProfileCounts_total(
+                   &plain, AINT_SAFE_PROFILE_RMW),
+           (unsigned long long)AintSafeProfileCounts_total(
+                   &plain, AINT_SAFE_PROFILE_FENCE),
+           (unsigned long long)plain.failed_cas);
+    for (size_t o = 0; o < AINT_SAFE_PROFILE_NUMBER_OF_ORDERS; o++) {
+        printf(",%llu", (unsigned long long)order_ops(&plain, o));
+    }
+    printf(",%llu,%llu,%llu,%llu\n",
+           (unsigned long long)worst_step,
+           (unsigned long long)total_ops(&worst_caller),
+           (unsigned long long)worst_caller.failed_cas,
+           (unsigned long long)total_ops(&worst_interrupt));
+}
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-b name] [-a]\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char **argv) {
+    const char *filter    = NULL;
+    bool        all_steps = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:a")) != -1) {
+        switch (opt) {
+        case 'b': filter = optarg; break;
+        case 'a': all_steps = true; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (all_steps) {
+        printf("function,step,caller_ops,failed_cas,interrupt_ops\n");
+    } else {
+        printf("function,loads,stores,rmws,fences,failed_cas");
+        for (size_t o = 0; o < AINT_SAFE_PROFILE_NUMBER_OF_ORDERS; o++) {
+            printf(",%s", order_names[o]);
+        }
+        printf(",worst_step,worst_ops,worst_failed_cas,interrupt_ops\n");
+    }
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+        const Profile *p = &profiles[i];
+        if (filter != NULL && strstr(p->name, filter) == NULL) { continue; }
+        profile(p, all_steps);
+    }
+    return EXIT_SUCCESS;
+}
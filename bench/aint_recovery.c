@@ -0,0 +1,293 @@
+/** \file aint_recovery.c
+ *
+ * Crash recovery check of #DurableQueue with torn and reordered writeback
+ *
+ * Every round runs random writes, reads and syncs on a new queue file, and
+ * keeps a copy of the file as of the last sync and after every operation
+ * since. A crash is then simulated by building a file in which every 8 byte
+ * word comes from a random one of these copies, as the kernel may write the
+ * pages of the mapping back at any time and in any order, and the storage
+ * may tear a page. Some rounds crash in the middle of a write, or of a sync
+ * whose positions may then be partly written. The queue is reopened from
+ * that file, and the recovered elements are checked:
+ *  - every element committed before the last sync and not read since is
+ *    there,
+ *  - the elements are consecutive and in order, and were all committed,
+ *  - none of them was released before the last sync.
+ *
+ * The rounds are deterministic for a seed, and the program exits with a
+ * failure if any check failed.
+ *
+ * Build and run (Linux):
+ * \code{.sh}
+ * cc -std=gnu11 -O2 -Isrc -o aint_recovery bench/aint_recovery.c \
+ *         $(find src -name '*.c')
+ * ./aint_recovery -r 10000
+ * \endcode
+ *
+ * Options:
+ *  - \c -r N rounds (default: 2000)
+ *  - \c -s SEED seed of the random operations (default: 1)
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "durable_queue.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECOVERY_N_ELEMS 8
+#define RECOVERY_MAX_OPS 200
+/* Copies of the file kept between syncs, a sync is forced when they run out */
+#define RECOVERY_MAX_COPIES 64
+#define RECOVERY_MAX_FILE_SIZE 4096
+#define RECOVERY_WORD 8
+
+/* Only the first few failed checks are printed */
+#define RECOVERY_MAX_ERRORS_PRINTED 10
+
+
+typedef struct {
+    /** Position of the element in the queue */
+    uint64_t id;
+    /** Derived from id, to catch elements that aren't what they claim */
+    uint64_t check;
+} Element;
+
+
+static uint64_t element_check(uint64_t id) {
+    return id * 0x9e3779b97f4a7c15u ^ 0xa5a5a5a5a5a5a5a5u;
+}
+
+
+static unsigned long errors;
+
+static void check(bool ok, unsigned long round, const char *what) {
+    if (!ok && errors++ < RECOVERY_MAX_ERRORS_PRINTED) {
+        fprintf(stderr, "round %lu: %s\n", round, what);
+    }
+}
+
+
+/* State of a round ********************************************************/
+
+typedef struct {
+    DurableQueue dq;
+    int          fd;
+    size_t       size;
+    /** Copies of the file, [0] as of the last sync */
+    unsigned char copies[RECOVERY_MAX_COPIES][RECOVERY_MAX_FILE_SIZE];
+    size_t        n_copies;
+    /** Elements committed, and read, so far */
+    uint64_t committed;
+    uint64_t released;
+    /** The same at the last sync */
+    uint64_t synced_committed;
+    uint64_t synced_released;
+} Round;
+
+
+static void copy_file(Round *r) {
+    if (pread(r->fd, r->copies[r->n_copies], r->size, 0) != (ssize_t)r->size) {
+        perror("pread");
+        exit(EXIT_FAILURE);
+    }
+    r->n_copies++;
+}
+
+
+static void sync_queue(Round *r) {
+    if (!DurableQueue_sync(&r->dq)) {
+        perror("DurableQueue_sync");
+        exit(EXIT_FAILURE);
+    }
+    r->synced_committed = r->committed;
+    r->synced_released  = r->released;
+    r->n_copies         = 0;
+    copy_file(r);
+}
+
+
+static void write_element(Round *r, bool commit) {
+    Element *e = NestedQueue_write_acquire(&r->dq.queue);
+    if (e == NULL) { return; }
+    e->id    = r->committed;
+    e->check = element_check(e->id);
+    if (commit) {
+        DurableQueue_write_commit(&r->dq, e);
+        r->committed++;
+    }
+}
+
+
+static void read_element(Round *r, unsigned long round) {
+    const Element *e = NestedQueue_read_acquire(&r->dq.queue);
+    if (e == NULL) { return; }
+    check(e->id == r->released, round, "read out of order before the crash");
+    NestedQueue_read_release(&r->dq.queue, e);
+    r->released++;
+}
+
+
+/* Write the file as it may be after a crash now to path */
+static void write_crash_image(Round *r, const char *path) {
+    static unsigned char image[RECOVERY_MAX_FILE_SIZE];
+    for (size_t w = 0; w < r->size; w += RECOVERY_WORD) {
+        const size_t c   = (size_t)rand() % r->n_copies;
+        const size_t len = r->size - w < RECOVERY_WORD ? r->size - w
+                                                       : RECOVERY_WORD;
+        memcpy(&image[w], &r->copies[c][w], len);
+    }
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || write(fd, image, r->size) != (ssize_t)r->size) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+}
+
+
+static void check_recovered(Round *r, const char *path, unsigned long round) {
+    DurableQueue dq;
+    if (!DurableQueue_open(&dq,
+                           path,
+                           sizeof(Element),
+                           RECOVERY_N_ELEMS,
+                           NESTED_QUEUE_OPERATION_ORDER_NESTED,
+                           NESTED_QUEUE_OPERATION_ORDER_NESTED)) {
+        check(false, round, "crash image not reopened");
+        return;
+    }
+    uint64_t       first = 0, next = 0;
+    bool           any   = false;
+    const Element *e;
+    while ((e = NestedQueue_read_acquire(&dq.queue)) != NULL) {
+        check(e->check == element_check(e->id), round, "element corrupted");
+        check(!any || e->id == next, round, "elements not consecutive");
+        check(e->id < r->committed, round, "element never committed");
+        check(e->id >= r->synced_released,
+              round,
+              "element released before the sync");
+        if (!any) { first = e->id; }
+        any  = true;
+        next = e->id + 1;
+        NestedQueue_read_release(&dq.queue, e);
+    }
+    if (r->released < r->synced_committed) {
+        check(any && first <= r->released && next >= r->synced_committed,
+              round,
+              "element committed before the sync lost");
+    }
+    DurableQueue_close(&dq);
+}
+
+
+static void run_round(Round *r,
+                      const char *path,
+                      const char *crash_path,
+                      unsigned long round) {
+    r->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (r->fd < 0
+        || !DurableQueue_open(&r->dq,
+                              path,
+                              sizeof(Element),
+                              RECOVERY_N_ELEMS,
+                              NESTED_QUEUE_OPERATION_ORDER_NESTED,
+                              NESTED_QUEUE_OPERATION_ORDER_NESTED)) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    if (r->dq.size > RECOVERY_MAX_FILE_SIZE) {
+        fprintf(stderr, "Queue file too large\n");
+        exit(EXIT_FAILURE);
+    }
+    r->size      = r->dq.size;
+    r->committed = r->released = 0;
+    sync_queue(r);
+
+    const int n_ops = rand() % RECOVERY_MAX_OPS;
+    for (int i = 0; i < n_ops; i++) {
+        const int op = rand() % 16;
+        if (op < 8) {
+            write_element(r, true);
+        } else if (op < 15) {
+            read_element(r, round);
+        } else {
+            sync_queue(r);
+            continue;
+        }
+        if (r->n_copies == RECOVERY_MAX_COPIES) {
+            sync_queue(r);
+        } else {
+            copy_file(r);
+        }
+    }
+    /* Crash in the middle of a write or of a sync, sometimes */
+    const int crash = rand() % 4;
+    if (crash == 0 && r->n_copies < RECOVERY_MAX_COPIES) {
+        write_element(r, false);
+        copy_file(r);
+    } else if (crash == 1) {
+        /* The data is all written when the sync writes the header */
+        r->n_copies = 0;
+        copy_file(r);
+        if (!DurableQueue_sync(&r->dq)) {
+            perror("DurableQueue_sync");
+            exit(EXIT_FAILURE);
+        }
+        copy_file(r);
+    }
+
+    write_crash_image(r, crash_path);
+    DurableQueue_close(&r->dq);
+    close(r->fd);
+    check_recovered(r, crash_path, round);
+}
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-r rounds] [-s seed]\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char **argv) {
+    unsigned long rounds = 2000;
+    unsigned int  seed   = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:s:")) != -1) {
+        switch (opt) {
+        case 'r': rounds = strtoul(optarg, NULL, 0); break;
+        case 's': seed = (unsigned int)strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+    srand(seed);
+
+    char path[]       = "/tmp/aint_recovery_XXXXXX";
+    char crash_path[] = "/tmp/aint_recovery_crash_XXXXXX";
+    const int fd       = mkstemp(path);
+    const int crash_fd = mkstemp(crash_path);
+    if (fd < 0 || crash_fd < 0) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    close(crash_fd);
+
+    static Round r;
+    for (unsigned long round = 0; round < rounds; round++) {
+        run_round(&r, path, crash_path, round);
+    }
+    unlink(path);
+    unlink(crash_path);
+
+    printf("%lu rounds, %lu checks failed\n", rounds, errors);
+    return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,668 @@
+/** \file aint_stress.c
+ *
+ * Nested interrupt stress test and worst case latency measurement
+ *
+ * The main program loop and up to #STRESS_MAX_DEPTH signal handlers, driven
+ * by POSIX timers, all run the same operations on shared instances of
+ * #Membag, #NestedQueue, #DoubleBuffer and #Mcas. Handler k blocks the
+ * signals of the levels below it only, so a higher level handler preempts
+ * a lower level one (or the main loop) in the middle of any operation, the
+ * same as prioritized nested interrupts.
+ *
+ * The latency of every operation is recorded in a histogram per operation,
+ * excluding the time spent in the handlers that preempted it. This is the
+ * time the operation itself takes, including any work it does to complete
+ * the operations it preempted. At the end, the data structures are checked
+ * for consistency.
+ *
+ * Then, litmus tests run on two threads, as a reordering by the CPU only
+ * shows between CPUs. Each is a pattern whose outcome the relaxed memory
+ * orders of memory_order.h must still forbid:
+ *  - message passing: a writer fills in a message and inserts it into a
+ *    #HashMap and a #SkipList, and a reader that finds it must see what was
+ *    filled in. This is the release of the inserts pairing with the acquire
+ *    of the finds.
+ *  - store buffering: a reader enters an #EpochReclaim and loads a pointer,
+ *    while a writer replaces the pointer, retires the old slot and collects.
+ *    The slot must not be reused while the reader holds it, which only the
+ *    seq_cst operations of epoch_reclaim.c guarantee.
+ *
+ * The program exits with a failure if any check failed.
+ *
+ * Build and run (Linux):
+ * \code{.sh}
+ * cc -std=gnu11 -O2 -Isrc -o aint_stress bench/aint_stress.c \
+ *         $(find src -name '*.c') -pthread -lrt
+ * ./aint_stress -d 3 -r 20000 -s 10
+ * \endcode
+ *
+ * Options:
+ *  - \c -d N nesting depth, the number of handler levels (default: 2)
+ *  - \c -r HZ interrupt rate of each level (default: 10000)
+ *  - \c -s SECONDS duration (default: 5)
+ *  - \c -k N rounds of all the operations per interrupt (default: 1)
+ *  - \c -l N rounds of each litmus test, 0 to skip them (default: 100000)
+ *
+ * The latencies are written as CSV, with a row per operation.
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "container.h"
+#include "double_buffer.h"
+#include "epoch_reclaim.h"
+#include "hash_map.h"
+#include "mcas.h"
+#include "membag.h"
+#include "nested_queue.h"
+#include "skip_list.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STRESS_MAX_DEPTH 8
+#define STRESS_N_LEVELS (STRESS_MAX_DEPTH + 1)
+#define STRESS_N_SLOTS 16
+#define STRESS_DB_WORDS 8
+
+/* Histogram buckets are exact below 2^STRESS_HIST_SUB_BITS ns, and have a
+ * relative error of 2^-STRESS_HIST_SUB_BITS above */
+#define STRESS_HIST_SUB_BITS 5
+#define STRESS_HIST_LEN \
+    ((64 - STRESS_HIST_SUB_BITS + 1) << STRESS_HIST_SUB_BITS)
+
+/* Messages in flight in the message passing test */
+#define LITMUS_N_MESSAGES 64
+#define LITMUS_N_BUCKETS 16
+/* Slots of the store buffering test, and records to retire them */
+#define LITMUS_N_SLOTS 8
+
+/* Only the first few failed checks are printed */
+#define STRESS_MAX_ERRORS_PRINTED 10
+
+
+typedef enum {
+    OP_MEMBAG,
+    OP_MEMBAG_BULK,
+    OP_QUEUE_WRITE,
+    OP_QUEUE_READ,
+    OP_DB_WRITE,
+    OP_DB_READ,
+    OP_MCAS,
+    NUMBER_OF_OPS,
+} Op;
+
+static const char *const op_names[NUMBER_OF_OPS] = {
+        [OP_MEMBAG]      = "membag_acquire_release",
+        [OP_MEMBAG_BULK] = "membag_acquire_bulk_release",
+        [OP_QUEUE_WRITE] = "nested_queue_write",
+        [OP_QUEUE_READ]  = "nested_queue_read",
+        [OP_DB_WRITE]    = "double_buffer_write",
+        [OP_DB_READ]     = "double_buffer_read",
+        [OP_MCAS]        = "mcas_read_compare_exchange",
+};
+
+
+/* Latency recording ******************************************************/
+
+/* Only level l writes the statistics of level l, as it can't preempt
+ * itself, so these need not be atomic */
+typedef struct {
+    uint64_t count;
+    uint64_t interrupted;
+    uint64_t max;
+    uint64_t hist[STRESS_HIST_LEN];
+} Stats;
+
+static Stats stats[STRESS_N_LEVELS][NUMBER_OF_OPS];
+
+/** Total time spent in handlers, excluding nested handlers */
+static _Atomic uint64_t isr_ns;
+
+
+static size_t hist_index(uint64_t ns) {
+    if (ns < (1u << STRESS_HIST_SUB_BITS)) { return ns; }
+    const int shift = 63 - __builtin_clzll(ns) - STRESS_HIST_SUB_BITS;
+    return ((size_t)(shift + 1) << STRESS_HIST_SUB_BITS)
+           + ((ns >> shift) & ((1u << STRESS_HIST_SUB_BITS) - 1));
+}
+
+
+/* Lower bound of the latencies in bucket i */
+static uint64_t hist_value(size_t i) {
+    if (i < (1u << STRESS_HIST_SUB_BITS)) { return i; }
+    const int shift = (int)(i >> STRESS_HIST_SUB_BITS) - 1;
+    return ((uint64_t)(1u << STRESS_HIST_SUB_BITS)
+            + (i & ((1u << STRESS_HIST_SUB_BITS) - 1)))
+           << shift;
+}
+
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+
+/* Read the clock and isr_ns with no handler completing in between */
+static void sample(uint64_t *time, uint64_t *isr) {
+    uint64_t before;
+    do {
+        before = atomic_load(&isr_ns);
+        *time  = now_ns();
+        *isr   = atomic_load(&isr_ns);
+    } while (*isr != before);
+}
+
+
+static void measure(size_t level, Op op, void (*fn)(size_t level)) {
+    uint64_t begin, begin_isr, end, end_isr;
+    sample(&begin, &begin_isr);
+    fn(level);
+    sample(&end, &end_isr);
+
+    const uint64_t ns = (end - begin) - (end_isr - begin_isr);
+    Stats *        s  = &stats[level][op];
+    s->count++;
+    if (end_isr != begin_isr) { s->interrupted++; }
+    if (ns > s->max) { s->max = ns; }
+    s->hist[hist_index(ns)]++;
+}
+
+
+/* Operations *************************************************************/
+
+static _Atomic unsigned long errors;
+
+static void check(bool ok, const char *what) {
+    if (!ok && atomic_fetch_add(&errors, 1) < STRESS_MAX_ERRORS_PRINTED) {
+        /* write() is async-signal-safe, printf is not */
+        if (write(STDERR_FILENO, what, strlen(what)) < 0) {}
+    }
+}
+
+
+static membag_alloc_status_t membag_status[STRESS_N_SLOTS];
+static unsigned char         membag_data[STRESS_N_SLOTS][64];
+static Membag                membag = MEMBAG_STATIC_INIT(
+        sizeof(membag_data[0]), STRESS_N_SLOTS, membag_status, membag_data);
+
+/* A slot handed out twice gets overwritten by the other owner */
+static void fill_membag_slot(unsigned char *slot, size_t level) {
+    memset(slot, (int)level + 1, sizeof(membag_data[0]));
+}
+
+static void check_membag_slot(const unsigned char *slot, size_t level) {
+    for (size_t i = 0; i < sizeof(membag_data[0]); i++) {
+        if (slot[i] != level + 1) {
+            check(false, "membag: slot acquired twice\n");
+            break;
+        }
+    }
+}
+
+static void op_membag(size_t level) {
+    unsigned char *slot = Membag_acquire(&membag);
+    if (slot == NULL) { return; }
+    fill_membag_slot(slot, level);
+    check_membag_slot(slot, level);
+    Membag_release(&membag, slot);
+}
+
+static void op_membag_bulk(size_t level) {
+    void *       slots[STRESS_N_SLOTS / 4];
+    const size_t n = Membag_acquire_bulk(
+            &membag, slots, sizeof(slots) / sizeof(slots[0]));
+    for (size_t i = 0; i < n; i++) { fill_membag_slot(slots[i], level); }
+    for (size_t i = 0; i < n; i++) {
+        check_membag_slot(slots[i], level);
+        Membag_release(&membag, slots[i]);
+    }
+}
+
+
+typedef struct {
+    uint64_t value;
+    uint64_t check;
+} Message;
+
+static Message     queue_data[STRESS_N_SLOTS];
+static NestedQueue queue =
+        NESTED_QUEUE_STATIC_INIT(queue,
+                                 sizeof(Message),
+                                 STRESS_N_SLOTS,
+                                 queue_data,
+                                 NESTED_QUEUE_OPERATION_ORDER_NESTED,
+                                 NESTED_QUEUE_OPERATION_ORDER_NESTED);
+static uint64_t    enqueued[STRESS_N_LEVELS];
+static uint64_t    dequeued[STRESS_N_LEVELS];
+
+static void op_queue_write(size_t level) {
+    Message *msg = NestedQueue_write_acquire(&queue);
+    if (msg == NULL) { return; }
+    msg->value = ((uint64_t)level << 56) | enqueued[level];
+    msg->check = ~msg->value;
+    NestedQueue_write_commit(&queue, msg);
+    enqueued[level]++;
+}
+
+static void op_queue_read(size_t level) {
+    const Message *msg = NestedQueue_read_acquire(&queue);
+    if (msg == NULL) { return; }
+    check(msg->check == ~msg->value, "nested_queue: torn message\n");
+    NestedQueue_read_release(&queue, msg);
+    dequeued[level]++;
+}
+
+
+static uint64_t     db_data[2][STRESS_DB_WORDS];
+static DoubleBuffer db = DOUBLE_BUFFER_STATIC_INIT(sizeof(db_data[0]),
+                                                   db_data);
+static uint64_t     db_writes[STRESS_N_LEVELS];
+
+static void op_db_write(size_t level) {
+    uint64_t *slot = DoubleBuffer_write_acquire(&db);
+    if (slot == NULL) { return; }
+    const uint64_t value = ((uint64_t)level << 56) | ++db_writes[level];
+    for (size_t i = 0; i < STRESS_DB_WORDS; i++) { slot[i] = value; }
+    DoubleBuffer_write_commit(&db, slot);
+}
+
+static void op_db_read(size_t level) {
+    (void)level;
+    const uint64_t *slot = DoubleBuffer_read_acquire(&db);
+    bool            same = true;
+    for (size_t i = 1; i < STRESS_DB_WORDS; i++) {
+        same = same && slot[i] == slot[0];
+    }
+    check(same, "double_buffer: read a slot being written\n");
+    DoubleBuffer_read_release(&db, slot);
+}
+
+
+static _Atomic mcas_base_t mcas_data[2];
+static Mcas                mcas = MCAS_STATIC_INIT(2, mcas_data);
+static uint64_t            mcas_successes[STRESS_N_LEVELS];
+
+static void op_mcas(size_t level) {
+    mcas_base_t expected[2];
+    Mcas_read(&mcas, expected);
+    check(expected[0] == expected[1], "mcas: words not updated together\n");
+    const mcas_base_t desired[2] = {expected[0] + 1, expected[1] + 1};
+    if (Mcas_compare_exchange(&mcas, expected, desired)) {
+        mcas_successes[level]++;
+    }
+}
+
+
+static void run_round(size_t level) {
+    measure(level, OP_MEMBAG, op_membag);
+    measure(level, OP_MEMBAG_BULK, op_membag_bulk);
+    measure(level, OP_QUEUE_WRITE, op_queue_write);
+    measure(level, OP_QUEUE_READ, op_queue_read);
+    measure(level, OP_DB_WRITE, op_db_write);
+    measure(level, OP_DB_READ, op_db_read);
+    measure(level, OP_MCAS, op_mcas);
+}
+
+
+/* Interrupts *************************************************************/
+
+static unsigned long rounds_per_irq = 1;
+
+
+static void handler(int sig) {
+    const int    saved_errno = errno;
+    const size_t level       = (size_t)(sig - SIGRTMIN) + 1;
+    uint64_t     begin, isr;
+    sample(&begin, &isr);
+    const uint64_t begin_isr = isr;
+
+    for (unsigned long i = 0; i < rounds_per_irq; i++) { run_round(level); }
+
+    /* The nested handlers have added their time already, so the time of
+     * this one excluding them is the total since begin_isr */
+    uint64_t end;
+    isr = atomic_load(&isr_ns);
+    do {
+        end = now_ns();
+    } while (!atomic_compare_exchange_weak(
+            &isr_ns, &isr, begin_isr + (end - begin)));
+    errno = saved_errno;
+}
+
+
+static void start_interrupts(timer_t *timers, size_t depth, double rate_hz) {
+    for (size_t k = 1; k <= depth; k++) {
+        struct sigaction sa = {.sa_handler = handler};
+        sigemptyset(&sa.sa_mask);
+        for (size_t j = 1; j <= k; j++) {
+            sigaddset(&sa.sa_mask, SIGRTMIN + (int)j - 1);
+        }
+        if (sigaction(SIGRTMIN + (int)k - 1, &sa, NULL)) {
+            perror("sigaction");
+            exit(EXIT_FAILURE);
+        }
+
+        struct sigevent sev = {
+                .sigev_notify = SIGEV_SIGNAL,
+                .sigev_signo  = SIGRTMIN + (int)k - 1,
+        };
+        if (timer_create(CLOCK_MONOTONIC, &sev, &timers[k - 1])) {
+            perror("timer_create");
+            exit(EXIT_FAILURE);
+        }
+        /* Slightly different periods, so that the levels don't fire in
+         * lockstep and every phase between them occurs */
+        const uint64_t period =
+                (uint64_t)(1e9 / rate_hz * (1.0 + 0.013 * (double)(k - 1)));
+        const struct itimerspec its = {
+                .it_interval = {.tv_sec  = (time_t)(period / 1000000000u),
+                                .tv_nsec = (long)(period % 1000000000u)},
+                .it_value    = {.tv_sec  = (time_t)(period / 1000000000u),
+                                .tv_nsec = (long)(period % 1000000000u)},
+        };
+        if (timer_settime(timers[k - 1], 0, &its, NULL)) {
+            perror("timer_settime");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+static void stop_interrupts(timer_t *timers, size_t depth) {
+    sigset_t all;
+    sigemptyset(&all);
+    for (size_t k = 1; k <= depth; k++) {
+        sigaddset(&all, SIGRTMIN + (int)k - 1);
+    }
+    sigprocmask(SIG_BLOCK, &all, NULL);
+    for (size_t k = 1; k <= depth; k++) { timer_delete(timers[k - 1]); }
+}
+
+
+/* Litmus tests ***********************************************************/
+
+static unsigned long litmus_rounds = 100000;
+
+
+typedef struct {
+    HashMapEntry entry;
+    SkipListNode node;
+    uint64_t     payload;
+} LitmusMessage;
+
+static int litmus_compare(const SkipListNode *a, const SkipListNode *b) {
+    const uintptr_t ka = CONTAINER_OF(a, LitmusMessage, node)->entry.key;
+    const uintptr_t kb = CONTAINER_OF(b, LitmusMessage, node)->entry.key;
+    return (ka > kb) - (ka < kb);
+}
+
+static LitmusMessage   litmus_messages[LITMUS_N_MESSAGES];
+static MarkedSlistNode litmus_buckets[LITMUS_N_BUCKETS];
+static HashMap  litmus_map  = HASH_MAP_STATIC_INIT(LITMUS_N_BUCKETS,
+                                                 litmus_buckets);
+static SkipList litmus_list = SKIP_LIST_STATIC_INIT(litmus_compare);
+/* Messages read and deleted, whose slots can be written again */
+static _Atomic unsigned long litmus_consumed;
+
+static void *mp_writer(void *arg) {
+    (void)arg;
+    for (unsigned long i = 0; i < litmus_rounds; i++) {
+        while (i >= atomic_load(&litmus_consumed) + LITMUS_N_MESSAGES) {
+            sched_yield();
+        }
+        LitmusMessage *msg = &litmus_messages[i % LITMUS_N_MESSAGES];
+        msg->entry.key     = i;
+        msg->payload       = ~(uint64_t)i;
+        HashMap_insert(&litmus_map, &msg->entry);
+        SkipList_insert(&litmus_list, &msg->node);
+    }
+    return NULL;
+}
+
+static void litmus_message_passing(void) {
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, mp_writer, NULL)) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned long i = 0; i < litmus_rounds; i++) {
+        HashMapEntry *entry;
+        while ((entry = HashMap_find(&litmus_map, i)) == NULL) {
+            sched_yield();
+        }
+        check(CONTAINER_OF(entry, LitmusMessage, entry)->payload
+                      == ~(uint64_t)i,
+              "hash_map: found an entry without its contents\n");
+
+        const LitmusMessage key = {.entry.key = i};
+        SkipListNode *      node;
+        while ((node = SkipList_find(&litmus_list, &key.node)) == NULL) {
+            sched_yield();
+        }
+        check(CONTAINER_OF(node, LitmusMessage, node)->payload
+                      == ~(uint64_t)i,
+              "skip_list: found a node without its contents\n");
+
+        check(HashMap_delete(&litmus_map, i) == entry
+                      && SkipList_delete(&litmus_list, node) == node,
+              "litmus: message not deleted\n");
+        atomic_store(&litmus_consumed, i + 1);
+    }
+    pthread_join(writer, NULL);
+}
+
+
+typedef struct {
+    /** Changed by the writer only when it reuses the slot */
+    _Atomic uint64_t generation;
+} LitmusSlot;
+
+static membag_alloc_status_t
+        litmus_slot_status[MEMBAG_ALLOC_STATUS_LEN(LITMUS_N_SLOTS)];
+static LitmusSlot litmus_slots[LITMUS_N_SLOTS];
+static Membag     litmus_bag = MEMBAG_STATIC_INIT(
+        sizeof(LitmusSlot), LITMUS_N_SLOTS, litmus_slot_status, litmus_slots);
+static membag_alloc_status_t
+        litmus_record_status[MEMBAG_ALLOC_STATUS_LEN(LITMUS_N_SLOTS)];
+static EpochReclaimRecord litmus_records[LITMUS_N_SLOTS];
+static EpochReclaim       litmus_er = EPOCH_RECLAIM_STATIC_INIT(
+        LITMUS_N_SLOTS, litmus_record_status, litmus_records);
+static LitmusSlot *_Atomic litmus_current;
+static atomic_bool         litmus_done;
+
+static void *sb_writer(void *arg) {
+    (void)arg;
+    uint64_t generation = 0;
+    while (!atomic_load(&litmus_done)) {
+        LitmusSlot *slot;
+        while ((slot = Membag_acquire(&litmus_bag)) == NULL) {
+            EpochReclaim_collect(&litmus_er);
+            sched_yield();
+        }
+        atomic_store_explicit(
+                &slot->generation, ++generation, memory_order_relaxed);
+        LitmusSlot *old = atomic_exchange(&litmus_current, slot);
+        while (!EpochReclaim_retire(&litmus_er, &litmus_bag, old)) {
+            sched_yield();
+        }
+        EpochReclaim_collect(&litmus_er);
+    }
+    return NULL;
+}
+
+static void litmus_store_buffering(void) {
+    Membag_init(&litmus_bag);
+    EpochReclaim_init(&litmus_er);
+    atomic_store(&litmus_current, Membag_acquire(&litmus_bag));
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, sb_writer, NULL)) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned long i = 0; i < litmus_rounds; i++) {
+        const EpochReclaimToken token = EpochReclaim_enter(&litmus_er);
+        LitmusSlot *            slot  = atomic_load(&litmus_current);
+        const uint64_t          generation =
+                atomic_load_explicit(&slot->generation, memory_order_relaxed);
+        /* Give the writer time to reuse the slot */
+        for (int k = 0; k < 16; k++) {
+            check(atomic_load_explicit(&slot->generation,
+                                       memory_order_relaxed)
+                          == generation,
+                  "epoch_reclaim: slot reused while a reader held it\n");
+        }
+        EpochReclaim_exit(&litmus_er, token);
+    }
+    atomic_store(&litmus_done, true);
+    pthread_join(writer, NULL);
+}
+
+
+/* Results ****************************************************************/
+
+static void check_invariants(void) {
+    check(atomic_load(&membag.n_free) == STRESS_N_SLOTS,
+          "membag: slots not released\n");
+    for (size_t i = 0; i < STRESS_N_SLOTS; i++) {
+        check(!atomic_flag_test_and_set(&membag.alloc_status[i]),
+              "membag: slot marked allocated\n");
+        atomic_flag_clear(&membag.alloc_status[i]);
+    }
+
+    /* Drain the queue, then every message written must have been read */
+    const void *msg;
+    while ((msg = NestedQueue_read_acquire(&queue)) != NULL) {
+        NestedQueue_read_release(&queue, msg);
+        dequeued[0]++;
+    }
+    uint64_t n_enqueued = 0, n_dequeued = 0, n_successes = 0;
+    for (size_t l = 0; l < STRESS_N_LEVELS; l++) {
+        n_enqueued += enqueued[l];
+        n_dequeued += dequeued[l];
+        n_successes += mcas_successes[l];
+    }
+    check(n_enqueued == n_dequeued, "nested_queue: messages lost\n");
+    mcas_base_t indexes[NESTED_QUEUE_NUMBER_OF_INDEXES];
+    Mcas_read(&queue.indexes, indexes);
+    check(indexes[NESTED_QUEUE_WRITE_ALLOCATED]
+                          == indexes[NESTED_QUEUE_WRITE_COMMITTED]
+                  && indexes[NESTED_QUEUE_WRITE_COMMITTED]
+                             == indexes[NESTED_QUEUE_READ_ACQUIRED]
+                  && indexes[NESTED_QUEUE_READ_ACQUIRED]
+                             == indexes[NESTED_QUEUE_READ_RELEASED],
+          "nested_queue: indexes don't add up\n");
+
+    check(atomic_load(&db.n_readers) == 0, "double_buffer: readers left\n");
+    check(!atomic_flag_test_and_set(&db.write_mutex),
+          "double_buffer: write mutex held\n");
+
+    mcas_base_t words[2];
+    Mcas_read(&mcas, words);
+    check(words[0] == words[1] && (uint64_t)words[0] == n_successes,
+          "mcas: successful compare_exchanges lost\n");
+}
+
+
+static uint64_t percentile(const uint64_t *hist, uint64_t count, double q) {
+    const uint64_t rank = (uint64_t)(q * (double)count);
+    uint64_t       seen = 0;
+    for (size_t i = 0; i < STRESS_HIST_LEN; i++) {
+        seen += hist[i];
+        if (seen > rank) { return hist_value(i); }
+    }
+    return 0;
+}
+
+
+static void print_results(void) {
+    static uint64_t hist[STRESS_HIST_LEN];
+    printf("operation,count,interrupted,p50_ns,p99_ns,p99_9_ns,max_ns\n");
+    for (int op = 0; op < NUMBER_OF_OPS; op++) {
+        uint64_t count = 0, interrupted = 0, max = 0;
+        memset(hist, 0, sizeof(hist));
+        for (size_t l = 0; l < STRESS_N_LEVELS; l++) {
+            const Stats *s = &stats[l][op];
+            count += s->count;
+            interrupted += s->interrupted;
+            if (s->max > max) { max = s->max; }
+            for (size_t i = 0; i < STRESS_HIST_LEN; i++) {
+                hist[i] += s->hist[i];
+            }
+        }
+        printf("%s,%llu,%llu,%llu,%llu,%llu,%llu\n",
+               op_names[op],
+               (unsigned long long)count,
+               (unsigned long long)interrupted,
+               (unsigned long long)percentile(hist, count, 0.5),
+               (unsigned long long)percentile(hist, count, 0.99),
+               (unsigned long long)percentile(hist, count, 0.999),
+               (unsigned long long)max);
+    }
+}
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [-d depth] [-r rate_hz] [-s seconds] [-k rounds] "
+            "[-l litmus_rounds]\n",
+            argv0);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char **argv) {
+    unsigned long depth   = 2;
+    double        rate_hz = 10000;
+    double        seconds = 5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:r:s:k:l:")) != -1) {
+        switch (opt) {
+        case 'd': depth = strtoul(optarg, NULL, 0); break;
+        case 'r': rate_hz = strtod(optarg, NULL); break;
+        case 's': seconds = strtod(optarg, NULL); break;
+        case 'k': rounds_per_irq = strtoul(optarg, NULL, 0); break;
+        case 'l': litmus_rounds = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (depth < 1 || depth > STRESS_MAX_DEPTH || rate_hz <= 0
+        || seconds <= 0) {
+        usage(argv[0]);
+    }
+    if (SIGRTMIN + (int)depth - 1 > SIGRTMAX) {
+        fprintf(stderr, "Not enough real-time signals for depth %lu\n", depth);
+        return EXIT_FAILURE;
+    }
+
+    Membag_init(&membag);
+    timer_t        timers[STRESS_MAX_DEPTH];
+    const uint64_t end = now_ns() + (uint64_t)(seconds * 1e9);
+    start_interrupts(timers, depth, rate_hz);
+    while (now_ns() < end) { run_round(0); }
+    stop_interrupts(timers, depth);
+
+    check_invariants();
+    if (litmus_rounds != 0) {
+        litmus_message_passing();
+        litmus_store_buffering();
+    }
+    print_results();
+    const unsigned long n_errors = atomic_load(&errors);
+    if (n_errors != 0) {
+        fprintf(stderr, "%lu consistency checks failed\n", n_errors);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
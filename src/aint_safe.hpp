@@ -0,0 +1,465 @@
+/** \file aint_safe.hpp
+ *
+ * Header-only C++ templates of the data structures with typed static storage
+ *
+ * These are C++17 versions of #Membag, #NestedQueue and #DoubleBuffer that own
+ * their storage and take the element type and capacity as template
+ * parameters, so the slot arithmetic is done on typed pointers with sizes
+ * known at compile time and every operation can be inlined. They use the same
+ * algorithms as the C versions, on \c std::atomic, since C11 \c _Atomic
+ * headers can't be included from C++. The atomic operations have the same
+ * memory orders as in the C versions, and #AINT_SAFE_SEQ_CST makes them all
+ * \c std::memory_order_seq_cst here too.
+ *
+ * Slots are handed out as guards that commit or release the slot when they go
+ * out of scope. The queue and double buffer guards can't be copied or moved,
+ * so the acquire and commit/release pairs always nest like the scopes that
+ * hold them.
+ *
+ * Usage:
+ * \code{.cpp}
+ * static aint::Membag<Packet, 64> packet_pool;
+ * static aint::NestedQueue<Event, 32> events;
+ * static aint::DoubleBuffer<Pose> latest_pose;
+ *
+ * void rx_interrupt() {
+ *     if (auto slot = events.write_acquire()) {
+ *         slot->type = EVENT_RX;
+ *     } // committed here
+ * }
+ *
+ * void main_loop() {
+ *     while (auto slot = events.read_acquire()) {
+ *         handle(*slot);
+ *     } // released here
+ *     auto pose = latest_pose.read_acquire();
+ *     ...
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__AINT_SAFE_HPP
+#define AINT_SAFE__AINT_SAFE_HPP 1
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+
+#ifndef AINT_SAFE_SEQ_CST
+/* See memory_order.h */
+#define AINT_SAFE_SEQ_CST 0
+#endif
+
+
+namespace aint {
+
+namespace detail {
+/* The memory orders of memory_order.h */
+#if AINT_SAFE_SEQ_CST
+constexpr std::memory_order relaxed = std::memory_order_seq_cst;
+constexpr std::memory_order acquire = std::memory_order_seq_cst;
+constexpr std::memory_order release = std::memory_order_seq_cst;
+constexpr std::memory_order acq_rel = std::memory_order_seq_cst;
+#else
+constexpr std::memory_order relaxed = std::memory_order_relaxed;
+constexpr std::memory_order acquire = std::memory_order_acquire;
+constexpr std::memory_order release = std::memory_order_release;
+constexpr std::memory_order acq_rel = std::memory_order_acq_rel;
+#endif
+} // namespace detail
+
+static_assert(std::atomic<int>::is_always_lock_free,
+              "Your stdlib implementation does not have lock-free int "
+              "atomics");
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "Your stdlib implementation does not have lock-free 64-bit "
+              "atomics");
+static_assert(std::atomic<void *>::is_always_lock_free,
+              "Your stdlib implementation does not have lock-free pointer "
+              "atomics");
+
+
+/** \brief Ordering of acquires and commits/releases, see
+ * #NestedQueueOperationOrder */
+enum class OperationOrder {
+    /** See #NESTED_QUEUE_OPERATION_ORDER_NESTED */
+    nested,
+    /** See #NESTED_QUEUE_OPERATION_ORDER_FCFS */
+    fcfs,
+};
+
+
+/** \brief Memory bag of \p N slots of \p T, see #Membag
+ *
+ * Slots hold raw storage, so \p T must be a trivial type.
+ */
+template <typename T, std::size_t N>
+class Membag {
+    static_assert(std::is_trivial<T>::value, "T must be a trivial type");
+    static_assert(N > 0, "A Membag must have at least one slot");
+
+  public:
+    /** \brief An acquired slot, released when it goes out of scope */
+    class Slot {
+      public:
+        Slot(Slot &&other) noexcept : bag_(other.bag_), ptr_(other.ptr_) {
+            other.ptr_ = nullptr;
+        }
+        Slot(const Slot &) = delete;
+        Slot &operator=(const Slot &) = delete;
+        Slot &operator=(Slot &&) = delete;
+        ~Slot() { bag_.release(ptr_); }
+
+        /** \retval false if no slot was available */
+        explicit operator bool() const noexcept { return ptr_ != nullptr; }
+        T &      operator*() const noexcept { return *ptr_; }
+        T *      operator->() const noexcept { return ptr_; }
+        T *      get() const noexcept { return ptr_; }
+
+        /** \brief Give up ownership, the slot must be released manually
+         *
+         * \return the slot
+         */
+        T *release() noexcept {
+            T *ptr = ptr_;
+            ptr_   = nullptr;
+            return ptr;
+        }
+
+      private:
+        friend class Membag;
+        Slot(Membag &bag, T *ptr) noexcept : bag_(bag), ptr_(ptr) {}
+        Membag &bag_;
+        T *     ptr_;
+    };
+
+    /** \brief Acquire an available slot
+     *
+     * \return the slot guard, which is empty if no slot is available
+     */
+    Slot acquire() noexcept { return Slot(*this, acquire_raw()); }
+
+    /** \brief Acquire an available slot without a guard
+     *
+     * \return the slot
+     * \retval nullptr if no slot is available
+     */
+    T *acquire_raw() noexcept {
+        if (!(n_free_.fetch_sub(1, detail::acquire) > 0)) {
+            /* Restore the acquire as there is no free slot available */
+            n_free_.fetch_add(1, detail::relaxed);
+            return nullptr;
+        }
+        std::size_t i = 0;
+        while (alloc_status_[i].test_and_set(detail::acquire)) {
+            i = (i + 1) % N;
+        }
+        return &data_[i];
+    }
+
+    /** \brief Release a slot acquired by #acquire_raw or \c nullptr */
+    void release(T *slot) noexcept {
+        if (slot == nullptr) return;
+        alloc_status_[slot - data_].clear(detail::release);
+        n_free_.fetch_add(1, detail::release);
+    }
+
+    /** \brief Number of slots */
+    static constexpr std::size_t capacity() noexcept { return N; }
+
+  private:
+    std::atomic_flag alloc_status_[N] = {};
+    std::atomic<int> n_free_{static_cast<int>(N)};
+    T                data_[N];
+};
+
+
+/** \brief Queue of \p N elements of \p T, see #NestedQueue
+ *
+ * As the capacity is known at compile time, all the indexes of the queue are
+ * packed in a single word, which is updated with a plain compare-and-swap
+ * instead of an #Mcas. \p T must be a trivial type.
+ */
+template <typename T,
+          std::size_t    N,
+          OperationOrder WriteOrder = OperationOrder::nested,
+          OperationOrder ReadOrder  = OperationOrder::nested>
+class NestedQueue {
+    static_assert(std::is_trivial<T>::value, "T must be a trivial type");
+    static_assert(N > 0, "A NestedQueue must have at least one element");
+
+    /* Bits needed to hold a value from 0 to N */
+    static constexpr unsigned bits_for(std::size_t n) noexcept {
+        return n == 0 ? 0 : 1 + bits_for(n >> 1);
+    }
+    static constexpr unsigned      bits = bits_for(N);
+    static constexpr std::uint64_t mask = (std::uint64_t(1) << bits) - 1;
+
+    enum Index : unsigned {
+        write_allocated,
+        write_committed,
+        read_acquired,
+        read_released,
+        count_writable,
+        count_readable,
+        number_of_indexes,
+    };
+    static_assert(bits * number_of_indexes <= 64,
+                  "N is too large to pack the indexes in a word");
+
+    static constexpr std::size_t get(std::uint64_t s, Index i) noexcept {
+        return (s >> (bits * i)) & mask;
+    }
+    static constexpr std::uint64_t
+    set(std::uint64_t s, Index i, std::size_t value) noexcept {
+        return (s & ~(mask << (bits * i)))
+               | (std::uint64_t(value) << (bits * i));
+    }
+
+    /* The acquire takes the slot after the commit or release of whoever had
+     * it last, and the commit or release hands it on, through the release
+     * sequence of the CASes on state_ in between */
+    T *acquire(Index count_idx, Index acquire_idx) noexcept {
+        std::uint64_t old_state = state_.load(detail::relaxed);
+        std::uint64_t new_state;
+        do {
+            if (get(old_state, count_idx) == 0) { return nullptr; }
+            new_state = set(old_state,
+                            acquire_idx,
+                            (get(old_state, acquire_idx) + 1) % N);
+            new_state = set(
+                    new_state, count_idx, get(old_state, count_idx) - 1);
+        } while (!state_.compare_exchange_weak(
+                old_state, new_state, detail::acquire, detail::relaxed));
+        return &data_[get(old_state, acquire_idx)];
+    }
+
+    void commit(Index          commit_idx,
+                Index          acquire_idx,
+                Index          count_idx,
+                const T *      slot,
+                OperationOrder order) noexcept {
+        const std::size_t idx       = static_cast<std::size_t>(slot - data_);
+        std::uint64_t     old_state = state_.load(detail::relaxed);
+        std::uint64_t     new_state;
+        do {
+            const std::size_t committed = get(old_state, commit_idx);
+            std::size_t       n_done;
+            if (order == OperationOrder::nested) {
+                /* Only the outermost commit publishes the whole region */
+                if (committed != idx) { return; }
+                n_done = (get(old_state, acquire_idx) + N - committed) % N;
+                /* The caller holds a slot, so an empty region means all N */
+                if (n_done == 0) { n_done = N; }
+            } else {
+                n_done = 1;
+            }
+            new_state = set(old_state, commit_idx, (committed + n_done) % N);
+            new_state = set(new_state,
+                            count_idx,
+                            get(old_state, count_idx) + n_done);
+        } while (!state_.compare_exchange_weak(
+                old_state, new_state, detail::release, detail::relaxed));
+    }
+
+  public:
+    /** \brief A slot acquired for writing, committed when it goes out of
+     * scope */
+    class WriteSlot {
+      public:
+        WriteSlot(const WriteSlot &) = delete;
+        WriteSlot &operator=(const WriteSlot &) = delete;
+        ~WriteSlot() {
+            if (ptr_ != nullptr) {
+                q_.commit(write_committed,
+                          write_allocated,
+                          count_readable,
+                          ptr_,
+                          WriteOrder);
+            }
+        }
+
+        /** \retval false if no slot was available */
+        explicit operator bool() const noexcept { return ptr_ != nullptr; }
+        T &      operator*() const noexcept { return *ptr_; }
+        T *      operator->() const noexcept { return ptr_; }
+
+      private:
+        friend class NestedQueue;
+        WriteSlot(NestedQueue &q, T *ptr) noexcept : q_(q), ptr_(ptr) {}
+        NestedQueue &q_;
+        T *const     ptr_;
+    };
+
+    /** \brief A slot acquired for reading, released when it goes out of
+     * scope */
+    class ReadSlot {
+      public:
+        ReadSlot(const ReadSlot &) = delete;
+        ReadSlot &operator=(const ReadSlot &) = delete;
+        ~ReadSlot() {
+            if (ptr_ != nullptr) {
+                q_.commit(read_released,
+                          read_acquired,
+                          count_writable,
+                          ptr_,
+                          ReadOrder);
+            }
+        }
+
+        /** \retval false if no slot was available */
+        explicit operator bool() const noexcept { return ptr_ != nullptr; }
+        const T &operator*() const noexcept { return *ptr_; }
+        const T *operator->() const noexcept { return ptr_; }
+
+      private:
+        friend class NestedQueue;
+        ReadSlot(NestedQueue &q, const T *ptr) noexcept : q_(q), ptr_(ptr) {}
+        NestedQueue &  q_;
+        const T *const ptr_;
+    };
+
+    /** \brief Acquire a slot for writing
+     *
+     * \return the slot guard, which is empty if the queue is full
+     */
+    WriteSlot write_acquire() noexcept {
+        return WriteSlot(*this, acquire(count_writable, write_allocated));
+    }
+
+    /** \brief Acquire a slot for reading
+     *
+     * \return the slot guard, which is empty if the queue is empty
+     */
+    ReadSlot read_acquire() noexcept {
+        return ReadSlot(*this, acquire(count_readable, read_acquired));
+    }
+
+    /** \brief Number of elements */
+    static constexpr std::size_t capacity() noexcept { return N; }
+
+  private:
+    std::atomic<std::uint64_t> state_{std::uint64_t(N)
+                                      << (bits * count_writable)};
+    T                          data_[N];
+};
+
+
+/** \brief Double buffer of the most recent \p T, see #DoubleBuffer
+ *
+ * \p T must be a trivial type. Both slots start value-initialized, which is
+ * the value returned to readers before the first write.
+ */
+template <typename T>
+class DoubleBuffer {
+    static_assert(std::is_trivial<T>::value, "T must be a trivial type");
+
+    /* The same orderings as double_buffer.c */
+    T *write_acquire_raw() noexcept {
+        if (write_mutex_.test_and_set(detail::acquire)) {
+            /* Another writer is writing */
+            return nullptr;
+        }
+        /* Point the next slot to read at the one being read, so that no
+         * reader touches the other slot */
+        T *last_selected;
+        do {
+            last_selected = selected_read_.load(detail::acquire);
+        } while (last_selected
+                 != next_read_.exchange(last_selected, detail::acq_rel));
+        return last_selected == &data_[0] ? &data_[1] : &data_[0];
+    }
+
+    void write_commit(T *slot) noexcept {
+        next_read_.store(slot, detail::release);
+        write_mutex_.clear(detail::release);
+    }
+
+    const T *read_acquire_raw() noexcept {
+        if (n_readers_.fetch_add(1, detail::acquire) == 0) {
+            /* We are the first reader, select the latest slot */
+            T *last_next_read;
+            do {
+                last_next_read = next_read_.load(detail::acquire);
+            } while (last_next_read
+                     != selected_read_.exchange(last_next_read,
+                                                detail::acq_rel));
+        }
+        return selected_read_.load(detail::acquire);
+    }
+
+    void read_release() noexcept { n_readers_.fetch_sub(1, detail::release); }
+
+  public:
+    /** \brief A slot acquired for writing, committed when it goes out of
+     * scope */
+    class WriteSlot {
+      public:
+        WriteSlot(const WriteSlot &) = delete;
+        WriteSlot &operator=(const WriteSlot &) = delete;
+        ~WriteSlot() {
+            if (ptr_ != nullptr) { db_.write_commit(ptr_); }
+        }
+
+        /** \retval false if another writer has acquired the slot first */
+        explicit operator bool() const noexcept { return ptr_ != nullptr; }
+        T &      operator*() const noexcept { return *ptr_; }
+        T *      operator->() const noexcept { return ptr_; }
+
+      private:
+        friend class DoubleBuffer;
+        WriteSlot(DoubleBuffer &db, T *ptr) noexcept : db_(db), ptr_(ptr) {}
+        DoubleBuffer &db_;
+        T *const      ptr_;
+    };
+
+    /** \brief A slot acquired for reading, released when it goes out of
+     * scope */
+    class ReadSlot {
+      public:
+        ReadSlot(const ReadSlot &) = delete;
+        ReadSlot &operator=(const ReadSlot &) = delete;
+        ~ReadSlot() { db_.read_release(); }
+
+        const T &operator*() const noexcept { return *ptr_; }
+        const T *operator->() const noexcept { return ptr_; }
+
+      private:
+        friend class DoubleBuffer;
+        ReadSlot(DoubleBuffer &db, const T *ptr) noexcept
+            : db_(db), ptr_(ptr) {}
+        DoubleBuffer & db_;
+        const T *const ptr_;
+    };
+
+    /** \brief Acquire a slot for writing
+     *
+     * \return the slot guard, which is empty if another writer has acquired
+     *     the slot first
+     */
+    WriteSlot write_acquire() noexcept {
+        return WriteSlot(*this, write_acquire_raw());
+    }
+
+    /** \brief Acquire the slot with the latest value for reading
+     *
+     * \return the slot guard
+     */
+    ReadSlot read_acquire() noexcept {
+        return ReadSlot(*this, read_acquire_raw());
+    }
+
+  private:
+    T                data_[2] = {};
+    std::atomic<T *> selected_read_{&data_[0]};
+    std::atomic<T *> next_read_{&data_[0]};
+    std::atomic<int> n_readers_{0};
+    std::atomic_flag write_mutex_ = ATOMIC_FLAG_INIT;
+};
+
+} // namespace aint
+
+#endif /* ifndef AINT_SAFE__AINT_SAFE_HPP */
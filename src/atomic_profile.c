@@ -0,0 +1,87 @@
+/** \file atomic_profile.c
+ *
+ * Optional shim that counts the atomic operations of the library and can
+ * inject a nested "interrupt" before any of them
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "atomic_profile.h"
+
+#if AINT_SAFE_PROFILE
+
+#include <assert.h>
+#include <string.h>
+
+/* Plain globals, as profiling is single-threaded. Operations of the
+ * injected interrupt go to counted[1]. */
+static AintSafeProfileCounts    counted[2];
+static bool                     in_interrupt;
+static bool                     armed;
+static bool                     injected;
+static uint64_t                 steps_left;
+static AintSafeProfileInterrupt inject_fn;
+static void *                   inject_arg;
+
+
+void AintSafeProfile_op_(AintSafeProfileKind kind, memory_order order) {
+    if (armed && !in_interrupt) {
+        if (steps_left == 0) {
+            armed        = false;
+            in_interrupt = true;
+            inject_fn(inject_arg);
+            in_interrupt = false;
+            injected     = true;
+        } else {
+            steps_left--;
+        }
+    }
+    const size_t o = (size_t)order & 0xffff; /* Without HLE flags */
+    assert(o < AINT_SAFE_PROFILE_NUMBER_OF_ORDERS);
+    counted[in_interrupt].ops[kind][o]++;
+}
+
+
+_Bool AintSafeProfile_cas_(_Bool success) {
+    if (!success) { counted[in_interrupt].failed_cas++; }
+    return success;
+}
+
+
+void AintSafeProfile_reset(void) {
+    memset(counted, 0, sizeof(counted));
+    armed    = false;
+    injected = false;
+}
+
+
+void AintSafeProfile_get(AintSafeProfileCounts *caller,
+                         AintSafeProfileCounts *interrupt) {
+    if (caller != NULL) { *caller = counted[0]; }
+    if (interrupt != NULL) { *interrupt = counted[1]; }
+}
+
+
+uint64_t AintSafeProfileCounts_total(const AintSafeProfileCounts *counts,
+                                     AintSafeProfileKind          kind) {
+    uint64_t total = 0;
+    for (size_t o = 0; o < AINT_SAFE_PROFILE_NUMBER_OF_ORDERS; o++) {
+        total += counts->ops[kind][o];
+    }
+    return total;
+}
+
+
+void AintSafeProfile_inject(uint64_t                 step,
+                            AintSafeProfileInterrupt interrupt,
+                            void *                   arg) {
+    steps_left = step;
+    inject_fn  = interrupt;
+    inject_arg = arg;
+    injected   = false;
+    armed      = true;
+}
+
+
+bool AintSafeProfile_injected(void) { return injected; }
+
+#endif /* if AINT_SAFE_PROFILE */
@@ -0,0 +1,275 @@
+/** \file atomic_profile.h
+ *
+ * Optional shim that counts the atomic operations of the library and can
+ * inject a nested "interrupt" before any of them
+ *
+ * With #AINT_SAFE_PROFILE set to 1 for the whole build, the C11 atomic
+ * operations in the library are redefined to count themselves by kind and
+ * memory order before doing the operation. A harness resets the counts,
+ * calls one function and reads how many loads, stores and read-modify-writes
+ * it did (see \c bench/aint_profile.c).
+ *
+ * #AintSafeProfile_inject runs a callback just before the n-th atomic
+ * operation from then on, as an interrupt would. Sweeping n over all the
+ * operations of a call deterministically gives the worst case cost of being
+ * interrupted, including the helping done by and for the nested operation,
+ * whose operations are counted separately.
+ *
+ * The counts are plain globals, so profiling must be single-threaded, and
+ * should be done without #AINT_SAFE_STATS, whose counters would be counted
+ * as well. The shim needs GCC, as it is written with the \c __atomic
+ * builtins that GCC's \c <stdatomic.h> is made of.
+ *
+ * Usage:
+ * \code{.c}
+ * AintSafeProfileCounts counts;
+ * AintSafeProfile_reset();
+ * Membag_acquire(&pool);
+ * AintSafeProfile_get(&counts, NULL);
+ * printf("%llu RMWs\n",
+ *        (unsigned long long)AintSafeProfileCounts_total(
+ *                &counts, AINT_SAFE_PROFILE_RMW));
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__ATOMIC_PROFILE_H
+#define AINT_SAFE__ATOMIC_PROFILE_H 1
+
+#ifndef AINT_SAFE_PROFILE
+/** \brief Route the atomic operations of the library through the shim
+ *
+ * Define it to 1 for the whole build to override. Every atomic operation
+ * then also costs a function call.
+ */
+#define AINT_SAFE_PROFILE 0
+#endif
+
+
+#if AINT_SAFE_PROFILE
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#if !defined(__GNUC__) || defined(__clang__)
+#error "AINT_SAFE_PROFILE needs GCC"
+#endif
+
+
+/** Kinds of atomic operations counted */
+typedef enum {
+    /** Loads */
+    AINT_SAFE_PROFILE_LOAD,
+    /** Stores, including \c atomic_flag_clear */
+    AINT_SAFE_PROFILE_STORE,
+    /** Read-modify-writes: exchanges, compare-exchanges, fetch-ops and
+     * \c atomic_flag_test_and_set */
+    AINT_SAFE_PROFILE_RMW,
+    /** Thread fences */
+    AINT_SAFE_PROFILE_FENCE,
+    /** Number of kinds */
+    AINT_SAFE_PROFILE_NUMBER_OF_KINDS,
+} AintSafeProfileKind;
+
+
+/** \brief Number of memory orders, \c memory_order_relaxed to
+ * \c memory_order_seq_cst */
+#define AINT_SAFE_PROFILE_NUMBER_OF_ORDERS 6
+
+
+/** \brief Counts of atomic operations */
+typedef struct {
+    /** Operations by kind and memory order, indexed by the \c memory_order
+     * value. Compare-exchanges count under their success order. */
+    uint64_t ops[AINT_SAFE_PROFILE_NUMBER_OF_KINDS]
+                [AINT_SAFE_PROFILE_NUMBER_OF_ORDERS];
+    /** Compare-exchanges that failed */
+    uint64_t failed_cas;
+} AintSafeProfileCounts;
+
+
+/** \brief Nested operation run by #AintSafeProfile_inject */
+typedef void (*AintSafeProfileInterrupt)(void *arg);
+
+
+/** \brief Reset the counts to 0 and cancel any pending injection */
+void AintSafeProfile_reset(void);
+
+
+/** \brief Get the counts since the last reset
+ *
+ * \param [out] caller    operations outside of injected interrupts, or
+ *     \c NULL
+ * \param [out] interrupt operations in injected interrupts, or \c NULL
+ */
+void AintSafeProfile_get(AintSafeProfileCounts *caller,
+                         AintSafeProfileCounts *interrupt);
+
+
+/** \brief Sum the operations of one kind over all memory orders
+ *
+ * \param counts counts from #AintSafeProfile_get
+ * \param kind   an #AintSafeProfileKind
+ *
+ * \return the number of operations of \p kind
+ */
+uint64_t AintSafeProfileCounts_total(const AintSafeProfileCounts *counts,
+                                     AintSafeProfileKind          kind);
+
+
+/** \brief Run an interrupt before an upcoming atomic operation
+ *
+ * \param step      number of atomic operations to let through first
+ * \param interrupt callback to run once, before operation \p step
+ * \param arg       argument for \p interrupt
+ *
+ * The operations done by \p interrupt are not counted as steps.
+ */
+void AintSafeProfile_inject(uint64_t                 step,
+                            AintSafeProfileInterrupt interrupt,
+                            void *                   arg);
+
+
+/** \brief Check whether the interrupt of #AintSafeProfile_inject has run
+ *
+ * \retval false if fewer than \c step operations ran since the injection
+ */
+bool AintSafeProfile_injected(void);
+
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+/* Internal, called by the redefined operations below */
+void AintSafeProfile_op_(AintSafeProfileKind kind, memory_order order);
+_Bool AintSafeProfile_cas_(_Bool success);
+
+/* The same as GCC's <stdatomic.h>, with the operation counted before it */
+#undef atomic_init
+#define atomic_init(PTR, VAL)                                          \
+    __extension__({                                                    \
+        __auto_type aint_safe_ptr_               = (PTR);              \
+        __typeof__((void)0, *aint_safe_ptr_) aint_safe_val_ = (VAL);   \
+        __atomic_store(aint_safe_ptr_, &aint_safe_val_, __ATOMIC_RELAXED); \
+    })
+
+#undef atomic_load_explicit
+#define atomic_load_explicit(PTR, MO)                           \
+    __extension__({                                             \
+        __auto_type aint_safe_ptr_ = (PTR);                     \
+        __typeof__((void)0, *aint_safe_ptr_) aint_safe_val_;    \
+        AintSafeProfile_op_(AINT_SAFE_PROFILE_LOAD, (MO));      \
+        __atomic_load(aint_safe_ptr_, &aint_safe_val_, (MO));   \
+        aint_safe_val_;                                         \
+    })
+
+#undef atomic_store_explicit
+#define atomic_store_explicit(PTR, VAL, MO)                            \
+    __extension__({                                                    \
+        __auto_type aint_safe_ptr_               = (PTR);              \
+        __typeof__((void)0, *aint_safe_ptr_) aint_safe_val_ = (VAL);   \
+        AintSafeProfile_op_(AINT_SAFE_PROFILE_STORE, (MO));            \
+        __atomic_store(aint_safe_ptr_, &aint_safe_val_, (MO));         \
+    })
+
+#undef atomic_exchange_explicit
+#define atomic_exchange_explicit(PTR, VAL, MO)                         \
+    __extension__({                                                    \
+        __auto_type aint_safe_ptr_               = (PTR);              \
+        __typeof__((void)0, *aint_safe_ptr_) aint_safe_val_ = (VAL);   \
+        __typeof__((void)0, *aint_safe_ptr_) aint_safe_old_;           \
+        AintSafeProfile_op_(AINT_SAFE_PROFILE_RMW, (MO));              \
+        __atomic_exchange(                                             \
+                aint_safe_ptr_, &aint_safe_val_, &aint_safe_old_, (MO)); \
+        aint_safe_old_;                                                \
+    })
+
+#define AINT_SAFE_PROFILE_CAS_(PTR, VAL, DES, WEAK, SUC, FAIL)          \
+    __extension__({                                                     \
+        __auto_type aint_safe_ptr_               = (PTR);               \
+        __typeof__((void)0, *aint_safe_ptr_) aint_safe_val_ = (DES);    \
+        AintSafeProfile_op_(AINT_SAFE_PROFILE_RMW, (SUC));              \
+        AintSafeProfile_cas_(__atomic_compare_exchange(aint_safe_ptr_,  \
+                                                       (VAL),           \
+                                                       &aint_safe_val_, \
+                                                       WEAK,            \
+                                                       (SUC),           \
+                                                       (FAIL)));        \
+    })
+
+#undef atomic_compare_exchange_strong_explicit
+#define atomic_compare_exchange_strong_explicit(PTR, VAL, DES, SUC, FAIL) \
+    AINT_SAFE_PROFILE_CAS_(PTR, VAL, DES, 0, SUC, FAIL)
+
+#undef atomic_compare_exchange_weak_explicit
+#define atomic_compare_exchange_weak_explicit(PTR, VAL, DES, SUC, FAIL) \
+    AINT_SAFE_PROFILE_CAS_(PTR, VAL, DES, 1, SUC, FAIL)
+
+#define AINT_SAFE_PROFILE_RMW_(OP, MO) \
+    (AintSafeProfile_op_(AINT_SAFE_PROFILE_RMW, (MO)), OP)
+
+#undef atomic_fetch_add_explicit
+#define atomic_fetch_add_explicit(PTR, VAL, MO) \
+    AINT_SAFE_PROFILE_RMW_(__atomic_fetch_add((PTR), (VAL), (MO)), MO)
+#undef atomic_fetch_sub_explicit
+#define atomic_fetch_sub_explicit(PTR, VAL, MO) \
+    AINT_SAFE_PROFILE_RMW_(__atomic_fetch_sub((PTR), (VAL), (MO)), MO)
+#undef atomic_fetch_or_explicit
+#define atomic_fetch_or_explicit(PTR, VAL, MO) \
+    AINT_SAFE_PROFILE_RMW_(__atomic_fetch_or((PTR), (VAL), (MO)), MO)
+#undef atomic_fetch_and_explicit
+#define atomic_fetch_and_explicit(PTR, VAL, MO) \
+    AINT_SAFE_PROFILE_RMW_(__atomic_fetch_and((PTR), (VAL), (MO)), MO)
+#undef atomic_flag_test_and_set_explicit
+#define atomic_flag_test_and_set_explicit(PTR, MO) \
+    AINT_SAFE_PROFILE_RMW_(__atomic_test_and_set((PTR), (MO)), MO)
+
+#undef atomic_flag_clear_explicit
+#define atomic_flag_clear_explicit(PTR, MO)                   \
+    (AintSafeProfile_op_(AINT_SAFE_PROFILE_STORE, (MO)),      \
+     __atomic_clear((PTR), (MO)))
+
+#undef atomic_thread_fence
+#define atomic_thread_fence(MO)                               \
+    (AintSafeProfile_op_(AINT_SAFE_PROFILE_FENCE, (MO)),      \
+     __atomic_thread_fence(MO))
+
+#undef atomic_load
+#define atomic_load(PTR) atomic_load_explicit(PTR, memory_order_seq_cst)
+#undef atomic_store
+#define atomic_store(PTR, VAL) \
+    atomic_store_explicit(PTR, VAL, memory_order_seq_cst)
+#undef atomic_exchange
+#define atomic_exchange(PTR, VAL) \
+    atomic_exchange_explicit(PTR, VAL, memory_order_seq_cst)
+#undef atomic_compare_exchange_strong
+#define atomic_compare_exchange_strong(PTR, VAL, DES) \
+    atomic_compare_exchange_strong_explicit(          \
+            PTR, VAL, DES, memory_order_seq_cst, memory_order_seq_cst)
+#undef atomic_compare_exchange_weak
+#define atomic_compare_exchange_weak(PTR, VAL, DES) \
+    atomic_compare_exchange_weak_explicit(          \
+            PTR, VAL, DES, memory_order_seq_cst, memory_order_seq_cst)
+#undef atomic_fetch_add
+#define atomic_fetch_add(PTR, VAL) \
+    atomic_fetch_add_explicit(PTR, VAL, memory_order_seq_cst)
+#undef atomic_fetch_sub
+#define atomic_fetch_sub(PTR, VAL) \
+    atomic_fetch_sub_explicit(PTR, VAL, memory_order_seq_cst)
+#undef atomic_fetch_or
+#define atomic_fetch_or(PTR, VAL) \
+    atomic_fetch_or_explicit(PTR, VAL, memory_order_seq_cst)
+#undef atomic_fetch_and
+#define atomic_fetch_and(PTR, VAL) \
+    atomic_fetch_and_explicit(PTR, VAL, memory_order_seq_cst)
+#undef atomic_flag_test_and_set
+#define atomic_flag_test_and_set(PTR) \
+    atomic_flag_test_and_set_explicit(PTR, memory_order_seq_cst)
+#undef atomic_flag_clear
+#define atomic_flag_clear(PTR) \
+    atomic_flag_clear_explicit(PTR, memory_order_seq_cst)
+#endif
+
+#endif /* if AINT_SAFE_PROFILE */
+
+
+#endif /* ifndef AINT_SAFE__ATOMIC_PROFILE_H */
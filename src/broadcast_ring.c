@@ -0,0 +1,162 @@
+/** \file broadcast_ring.c
+ *
+ * Single producer broadcast ring with static storage, read in place by many
+ * independent consumers
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "broadcast_ring.h"
+
+#include "memory_order.h"
+
+#include <assert.h>
+
+/* published_ and the cursors are free running positions in units of
+ * POSITION_STEP, so that the low bits of a cursor can hold its state. The
+ * message at position pos is in slot (pos / POSITION_STEP) % n_elems, which
+ * stays consistent when the positions wrap around as n_elems is a power of 2.
+ *
+ * A cursor is the position of the next message that its consumer will read,
+ * or 0 when the consumer is unsubscribed. Only the consumer moves its own
+ * cursor, except that with BROADCAST_RING_LAG_DROP the producer moves a
+ * cursor that is a whole ring behind up to the oldest message that isn't
+ * written over. It does that with a CAS that fails if the consumer acquired
+ * the slot meanwhile (set CURSOR_READING), so a slot that is being read is
+ * never written over.
+ *
+ * A consumer that subscribes while the producer is scanning the cursors may
+ * be missed by that scan. Its first cursor may then be written over by the
+ * message being written, so it moves its cursor up to published_ once the
+ * subscription is visible. The scan, the subscription, the store of
+ * published_ and its loads in subscribe are seq_cst, so that the second load
+ * of published_ sees at least the position of a scan that missed the
+ * subscription. */
+
+#define CURSOR_READING ((uintptr_t)1)
+#define CURSOR_SUBSCRIBED ((uintptr_t)2)
+#define POSITION_STEP ((uintptr_t)4)
+#define POSITION_MASK (~(POSITION_STEP - 1))
+
+
+static inline void *slot_at(const BroadcastRing *ring, uintptr_t position) {
+    const size_t i = (size_t)(position / POSITION_STEP) & (ring->n_elems - 1);
+    return (char *)ring->data + i * ring->elem_size;
+}
+
+
+static inline size_t lag(uintptr_t published, uintptr_t cursor) {
+    return (size_t)((published - (cursor & POSITION_MASK)) / POSITION_STEP);
+}
+
+
+BroadcastRingConsumer *BroadcastRing_subscribe(BroadcastRing *ring) {
+    for (size_t i = 0; i < ring->n_consumers; i++) {
+        BroadcastRingConsumer *consumer = &ring->consumers[i];
+        uintptr_t              cursor   = 0;
+        const uintptr_t        first =
+                atomic_load(&ring->published_) | CURSOR_SUBSCRIBED;
+        if (!atomic_compare_exchange_strong(
+                    &consumer->cursor_, &cursor, first)) {
+            continue;
+        }
+
+        /* Catch up with a write that may have missed the subscription. The
+         * CAS fails only if the producer dropped messages meanwhile. */
+        cursor = first;
+        while (!atomic_compare_exchange_weak(
+                &consumer->cursor_,
+                &cursor,
+                atomic_load(&ring->published_) | CURSOR_SUBSCRIBED)) {
+        }
+        atomic_store_explicit(&consumer->dropped, 0, AINT_SAFE_RELAXED);
+        return consumer;
+    }
+    return NULL;
+}
+
+
+void BroadcastRing_unsubscribe(BroadcastRing *        ring,
+                               BroadcastRingConsumer *consumer) {
+    (void)ring;
+    assert(!(atomic_load_explicit(&consumer->cursor_, AINT_SAFE_RELAXED)
+             & CURSOR_READING));
+    atomic_store_explicit(&consumer->cursor_, 0, AINT_SAFE_RELEASE);
+}
+
+
+void *BroadcastRing_write_acquire(BroadcastRing *ring) {
+    assert((ring->n_elems & (ring->n_elems - 1)) == 0);
+    /* Only the producer stores published_ */
+    const uintptr_t published =
+            atomic_load_explicit(&ring->published_, AINT_SAFE_RELAXED);
+
+    for (size_t i = 0; i < ring->n_consumers; i++) {
+        BroadcastRingConsumer *consumer = &ring->consumers[i];
+        uintptr_t              cursor   = atomic_load(&consumer->cursor_);
+        while ((cursor & CURSOR_SUBSCRIBED)
+               && lag(published, cursor) >= ring->n_elems) {
+            if (ring->lag_policy != BROADCAST_RING_LAG_DROP
+                || (cursor & CURSOR_READING)) {
+                return NULL;
+            }
+            /* Leave the consumer the n_elems - 1 newest messages */
+            const uintptr_t oldest =
+                    published - (ring->n_elems - 1) * POSITION_STEP;
+            if (atomic_compare_exchange_weak(&consumer->cursor_,
+                                             &cursor,
+                                             oldest | CURSOR_SUBSCRIBED)) {
+                atomic_fetch_add_explicit(&consumer->dropped,
+                                          lag(oldest, cursor),
+                                          AINT_SAFE_RELAXED);
+                break;
+            }
+            /* The consumer moved, cursor holds its new state */
+        }
+    }
+    return slot_at(ring, published);
+}
+
+
+void BroadcastRing_write_commit(BroadcastRing *ring, void *slot) {
+    (void)slot;
+    const uintptr_t published =
+            atomic_load_explicit(&ring->published_, AINT_SAFE_RELAXED);
+    atomic_store(&ring->published_, published + POSITION_STEP);
+}
+
+
+const void *BroadcastRing_read_acquire(BroadcastRing *        ring,
+                                       BroadcastRingConsumer *consumer) {
+    uintptr_t cursor =
+            atomic_load_explicit(&consumer->cursor_, AINT_SAFE_RELAXED);
+    do {
+        if (cursor & CURSOR_READING) { return NULL; }
+        /* Pairs with the store in write_commit, for the slot contents */
+        const uintptr_t published =
+                atomic_load_explicit(&ring->published_, AINT_SAFE_ACQUIRE);
+        if (lag(published, cursor) == 0) { return NULL; }
+        /* Fails if the producer dropped the message at cursor meanwhile */
+    } while (!atomic_compare_exchange_weak_explicit(&consumer->cursor_,
+                                                    &cursor,
+                                                    cursor | CURSOR_READING,
+                                                    AINT_SAFE_ACQUIRE,
+                                                    AINT_SAFE_RELAXED));
+    return slot_at(ring, cursor);
+}
+
+
+void BroadcastRing_read_release(BroadcastRing *        ring,
+                                BroadcastRingConsumer *consumer,
+                                const void *           slot) {
+    (void)ring;
+    (void)slot;
+    /* The producer doesn't move a cursor that is reading */
+    const uintptr_t cursor =
+            atomic_load_explicit(&consumer->cursor_, AINT_SAFE_RELAXED);
+    assert(cursor & CURSOR_READING);
+    /* Pairs with the cursor loads in write_acquire, so that the slot is read
+     * before it is written over */
+    atomic_store_explicit(&consumer->cursor_,
+                          (cursor & ~CURSOR_READING) + POSITION_STEP,
+                          AINT_SAFE_RELEASE);
+}
@@ -0,0 +1,197 @@
+/** \file broadcast_ring.h
+ *
+ * Single producer broadcast ring with static storage, read in place by many
+ * independent consumers
+ *
+ * Every consumer sees every message, so fanning a stream out to K consumers
+ * needs one ring and one copy of each message instead of K #NestedQueue and K
+ * copies. Each subscribed consumer has its own cursor, and a slot is written
+ * again only after the slowest consumer has released it. With
+ * #BROADCAST_RING_LAG_DROP, a consumer that falls a whole ring behind loses
+ * its oldest messages instead of stalling the producer.
+ *
+ * Usage:
+ * \code{.c}
+ * static Sample samples[16];
+ * static BroadcastRingConsumer sample_consumers[4];
+ * static BroadcastRing sample_ring = BROADCAST_RING_STATIC_INIT(
+ *         sizeof(samples[0]), 16, samples, 4, sample_consumers,
+ *         BROADCAST_RING_LAG_DROP);
+ *
+ * void adc_interrupt(void) {
+ *     Sample *s = BroadcastRing_write_acquire(&sample_ring);
+ *     if (s != NULL) {
+ *         ... // fill in *s
+ *         BroadcastRing_write_commit(&sample_ring, s);
+ *     }
+ * }
+ *
+ * void logger_task(void) {
+ *     static BroadcastRingConsumer *me;
+ *     if (me == NULL) { me = BroadcastRing_subscribe(&sample_ring); }
+ *     const Sample *s;
+ *     while ((s = BroadcastRing_read_acquire(&sample_ring, me)) != NULL) {
+ *         ... // use *s
+ *         BroadcastRing_read_release(&sample_ring, me, s);
+ *     }
+ * }
+ * \endcode
+ *
+ * \note There must be only one producer, ie. write_acquire() and
+ * write_commit() must not interrupt each other. A consumer holds at most one
+ * slot at a time and must be used from only one context, but different
+ * consumers and the producer can interrupt each other in any way.
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__BROADCAST_RING_H
+#define AINT_SAFE__BROADCAST_RING_H 1
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(
+        ATOMIC_POINTER_LOCK_FREE,
+        "Your stdlib implementation does not have lock-free pointer atomics");
+#endif
+
+
+/** What the producer does when a consumer is a whole ring behind */
+typedef enum {
+    /** #BroadcastRing_write_acquire fails until the consumer catches up */
+    BROADCAST_RING_LAG_GATE,
+    /** The consumer skips its oldest message, which is then written over
+     *
+     * A consumer that is reading that message at the time still gates the
+     * producer.
+     */
+    BROADCAST_RING_LAG_DROP,
+} BroadcastRingLagPolicy;
+
+
+/** \brief A consumer of a #BroadcastRing
+ *
+ * An array of these must be zero-initialized (eg. have static storage), which
+ * is the unsubscribed state.
+ */
+typedef struct {
+    _Atomic uintptr_t cursor_;
+    /** Number of messages this consumer lost with #BROADCAST_RING_LAG_DROP */
+    _Atomic size_t dropped;
+} BroadcastRingConsumer;
+
+
+/** \brief Internal data structure of the broadcast ring
+ *
+ * This must be initialized with #BROADCAST_RING_STATIC_INIT at declaration
+ */
+typedef struct {
+    _Atomic uintptr_t published_;
+    /** Data to write the messages in */
+    void *const data;
+    /** Number of elements in #data, a power of 2 */
+    const size_t n_elems;
+    /** Size of a slot in #data */
+    const size_t elem_size;
+    /** Consumers that can subscribe */
+    BroadcastRingConsumer *const consumers;
+    /** Number of elements in #consumers */
+    const size_t n_consumers;
+    /** What to do when a consumer falls a whole ring behind */
+    const BroadcastRingLagPolicy lag_policy;
+} BroadcastRing;
+
+
+/** \brief Statically initialize a #BroadcastRing
+ *
+ * \param p_elem_size       size of one element of \p p_data_array
+ * \param p_n_elems         number of elements in \p p_data_array, a power of 2
+ * \param p_data_array      data array to write the messages in
+ * \param p_n_consumers     number of elements in \p p_consumers_array
+ * \param p_consumers_array zero-initialized #BroadcastRingConsumer array
+ * \param p_lag_policy      a #BroadcastRingLagPolicy
+ *
+ * \return A #BroadcastRing static initializer
+ */
+#define BROADCAST_RING_STATIC_INIT(p_elem_size,                          \
+                                   p_n_elems,                            \
+                                   p_data_array,                         \
+                                   p_n_consumers,                        \
+                                   p_consumers_array,                    \
+                                   p_lag_policy)                         \
+    {                                                                    \
+        .published_ = 0, .data = p_data_array, .n_elems = p_n_elems,     \
+        .elem_size = p_elem_size, .consumers = p_consumers_array,        \
+        .n_consumers = p_n_consumers, .lag_policy = p_lag_policy         \
+    }
+
+
+/** \brief Subscribe a new consumer
+ *
+ * \param ring #BroadcastRing to subscribe to
+ *
+ * \return A consumer that receives the messages committed from now on
+ * \retval NULL if all of \p ring->consumers are subscribed
+ */
+BroadcastRingConsumer *BroadcastRing_subscribe(BroadcastRing *ring);
+
+
+/** \brief Unsubscribe a consumer, so that it no longer gates the producer
+ *
+ * \param ring     #BroadcastRing that \p consumer is subscribed to
+ * \param consumer consumer returned by #BroadcastRing_subscribe()
+ *
+ * \pre \p consumer must not hold a slot.
+ */
+void BroadcastRing_unsubscribe(BroadcastRing *        ring,
+                               BroadcastRingConsumer *consumer);
+
+
+/** \brief Acquire the next slot for writing
+ *
+ * \param ring #BroadcastRing to acquire the slot from
+ *
+ * \return Pointer to the slot in \p ring->data
+ * \retval NULL if a consumer hasn't released the slot yet
+ *
+ * \post #BroadcastRing_write_commit() must be called after writing to the
+ * slot, before the next write_acquire().
+ */
+void *BroadcastRing_write_acquire(BroadcastRing *ring);
+
+
+/** \brief Publish a slot acquired for writing to all the consumers
+ *
+ * \param ring #BroadcastRing from which \p slot was acquired
+ * \param slot slot acquired by #BroadcastRing_write_acquire()
+ */
+void BroadcastRing_write_commit(BroadcastRing *ring, void *slot);
+
+
+/** \brief Acquire the oldest message that a consumer hasn't read yet
+ *
+ * \param ring     #BroadcastRing that \p consumer is subscribed to
+ * \param consumer consumer returned by #BroadcastRing_subscribe()
+ *
+ * \return Pointer to the slot in \p ring->data
+ * \retval NULL if there is no new message, or \p consumer already holds a slot
+ *
+ * \post #BroadcastRing_read_release() must be called after using the slot.
+ */
+const void *BroadcastRing_read_acquire(BroadcastRing *        ring,
+                                       BroadcastRingConsumer *consumer);
+
+
+/** \brief Release a slot acquired for reading
+ *
+ * \param ring     #BroadcastRing from which \p slot was acquired
+ * \param consumer consumer that acquired \p slot
+ * \param slot     slot acquired by #BroadcastRing_read_acquire()
+ */
+void BroadcastRing_read_release(BroadcastRing *        ring,
+                                BroadcastRingConsumer *consumer,
+                                const void *           slot);
+
+
+#endif /* ifndef AINT_SAFE__BROADCAST_RING_H */
@@ -7,6 +7,8 @@
 #ifndef CONTAINER_H
 #define CONTAINER_H 1
 
+#include <stddef.h>
+
 /** \brief Get the container struct from member address and type
  * See https://stackoverflow.com/questions/15832301/understanding-container-of-macro-in-the-linux-kernel
  * \param ptr    address of member
@@ -14,9 +16,18 @@
  * \param member member name of \p ptr within \p type
  *
  * \return address of \p type structure containing \p
+ *
+ * With GCC and Clang, \p ptr is checked to point to the type of \p member.
+ * The \c __typeof__ and \c __extension__ spellings keep that working with
+ * \c -std=c11, and other compilers get the plain \c offsetof version.
  */
-#define CONTAINER_OF(ptr, type, member) ({                      \
-        const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
+#if defined(__GNUC__)
+#define CONTAINER_OF(ptr, type, member) __extension__ ({        \
+        const __typeof__( ((type *)0)->member ) *__mptr = (ptr); \
         (type *)( (char *)__mptr - offsetof(type,member) );})
+#else
+#define CONTAINER_OF(ptr, type, member) \
+        ((type *)( (char *)(ptr) - offsetof(type,member) ))
+#endif
 
 #endif /* ifndef CONTAINER_H */
@@ -0,0 +1,97 @@
+/** \file deferred_executor.c
+ *
+ * Interrupt-safe deferred work executor with per-priority queues
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "deferred_executor.h"
+
+#include "memory_order.h"
+
+
+static bool enqueue(NestedQueue *q, DeferredWork *work) {
+    DeferredWork **slot = NestedQueue_write_acquire(q);
+    if (slot == NULL) return false;
+    *slot = work;
+    NestedQueue_write_commit(q, slot);
+    return true;
+}
+
+
+void DeferredWork_run(DeferredWork *work) {
+    /* Clear pending first, so that the work can be scheduled again while it
+     * is running */
+    atomic_flag_clear(&work->pending);
+    work->function(work->arg);
+    if (work->owner != NULL) { Membag_release(work->owner, work); }
+}
+
+
+bool DeferredExecutor_schedule(DeferredExecutor *ex,
+                               size_t            priority,
+                               DeferredWork *    work) {
+    if (atomic_flag_test_and_set(&work->pending)) {
+        /* Already queued and not yet run, coalesce with it */
+        return true;
+    }
+    if (!enqueue(&ex->queues[priority], work)) {
+        atomic_flag_clear(&work->pending);
+        return false;
+    }
+    return true;
+}
+
+
+bool DeferredExecutor_call(DeferredExecutor *ex,
+                           size_t            priority,
+                           DeferredFunction  function,
+                           void *            arg) {
+    if (ex->pool == NULL) { return false; }
+    DeferredWork *work = Membag_acquire(ex->pool);
+    if (work == NULL) return false;
+    work->function = function;
+    work->arg      = arg;
+    work->owner    = ex->pool;
+    atomic_flag_test_and_set(&work->pending);
+    if (!enqueue(&ex->queues[priority], work)) {
+        Membag_release(ex->pool, work);
+        return false;
+    }
+    return true;
+}
+
+
+size_t DeferredExecutor_drain(DeferredExecutor *    ex,
+                              size_t                max_items,
+                              DeferredBudgetExpired out_of_time,
+                              void *                context) {
+    size_t n_run    = 0;
+    size_t priority = 0;
+    while (priority < ex->n_priorities && n_run < max_items) {
+        if (out_of_time != NULL && out_of_time(context)) { break; }
+
+        NestedQueue *       q = &ex->queues[priority];
+        DeferredWork *const *slots[DEFERRED_EXECUTOR_BATCH_SIZE];
+        size_t               n_slots = 0;
+        while (n_slots < DEFERRED_EXECUTOR_BATCH_SIZE
+               && n_run + n_slots < max_items
+               && (slots[n_slots] = NestedQueue_read_acquire(q)) != NULL) {
+            n_slots++;
+        }
+        if (n_slots == 0) {
+            priority++;
+            continue;
+        }
+
+        for (size_t i = 0; i < n_slots; i++) { DeferredWork_run(*slots[i]); }
+        /* Release in the nested order. Only the release of the first slot
+         * updates the queue indexes, releasing the whole batch at once. */
+        for (size_t i = n_slots; i-- > 0;) {
+            NestedQueue_read_release(q, slots[i]);
+        }
+        n_run += n_slots;
+        /* Higher priority work may have been scheduled meanwhile */
+        priority = 0;
+    }
+    return n_run;
+}
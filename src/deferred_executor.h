@@ -0,0 +1,215 @@
+/** \file deferred_executor.h
+ *
+ * Interrupt-safe deferred work executor with per-priority queues
+ *
+ * Interrupt handlers schedule work that is run later by a lower priority
+ * context (the "bottom half") calling #DeferredExecutor_drain. Work is queued
+ * as pointers to #DeferredWork in one #NestedQueue per priority.
+ *
+ * A #DeferredWork that is scheduled again while it is still pending is not
+ * queued twice, so statically declared work items coalesce. One-off calls can
+ * use work items acquired from a #Membag instead, which are released after
+ * they run.
+ *
+ * Usage:
+ * \code{.c}
+ * static DeferredWork *urgent_array[8];
+ * static DeferredWork *normal_array[32];
+ * static NestedQueue queues[2];
+ * static NestedQueue queues[2] = {
+ *     NESTED_QUEUE_STATIC_INIT(queues[0], sizeof(DeferredWork *), 8,
+ *             urgent_array, NESTED_QUEUE_OPERATION_ORDER_NESTED,
+ *             NESTED_QUEUE_OPERATION_ORDER_NESTED),
+ *     NESTED_QUEUE_STATIC_INIT(queues[1], sizeof(DeferredWork *), 32,
+ *             normal_array, NESTED_QUEUE_OPERATION_ORDER_NESTED,
+ *             NESTED_QUEUE_OPERATION_ORDER_NESTED),
+ * };
+ *
+ * static DeferredWork work_array[16];
+ * static membag_alloc_status_t work_status[MEMBAG_ALLOC_STATUS_LEN(16)];
+ * static Membag work_pool = MEMBAG_STATIC_INIT(
+ *         sizeof(DeferredWork), 16, work_status, work_array);
+ *
+ * static DeferredExecutor executor = DEFERRED_EXECUTOR_STATIC_INIT(
+ *         2, queues, &work_pool);
+ *
+ * static void rx_process(void *arg) { ... }
+ * static DeferredWork rx_work = DEFERRED_WORK_INIT(rx_process, NULL);
+ *
+ * void rx_interrupt(void) {
+ *     // Coalesces with a previous rx interrupt that hasn't been processed
+ *     DeferredExecutor_schedule(&executor, 0, &rx_work);
+ * }
+ *
+ * void error_interrupt(void) {
+ *     DeferredExecutor_call(&executor, 1, log_error, (void *)ERROR_CODE);
+ * }
+ *
+ * void main_loop(void) {
+ *     while (1) {
+ *         DeferredExecutor_drain(&executor, 16, NULL, NULL);
+ *         ...
+ *     }
+ * }
+ * \endcode
+ *
+ * \note Since the queues must use #NESTED_QUEUE_OPERATION_ORDER_NESTED, the
+ * executor is safe with nested interrupts, but not with work scheduled from
+ * parallel threads.
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__DEFERRED_EXECUTOR_H
+#define AINT_SAFE__DEFERRED_EXECUTOR_H 1
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "membag.h"
+#include "nested_queue.h"
+
+
+#ifndef DEFERRED_EXECUTOR_BATCH_SIZE
+/** \brief Maximum number of work items acquired from a queue at once
+ *
+ * The slots of a batch are released together after all of them are run, so
+ * only one index update is needed per batch. Define it before including this
+ * header to override.
+ */
+#define DEFERRED_EXECUTOR_BATCH_SIZE 8
+#endif
+
+
+/** \brief Function run as deferred work */
+typedef void (*DeferredFunction)(void *arg);
+
+
+/** \brief A unit of deferred work
+ *
+ * This must be initialized with #DEFERRED_WORK_INIT.
+ */
+typedef struct {
+    /** Function to run */
+    DeferredFunction function;
+    /** Argument to pass to #function */
+    void *arg;
+    /** Set while the work is queued and hasn't started running */
+    atomic_flag pending;
+    /** #Membag to release the work to after it runs, or \c NULL */
+    Membag *owner;
+} DeferredWork;
+
+
+/** \brief Initialize a #DeferredWork
+ *
+ * \param p_function #DeferredFunction to run
+ * \param p_arg      argument to pass to \p p_function
+ *
+ * \return A #DeferredWork initializer
+ */
+#define DEFERRED_WORK_INIT(p_function, p_arg)                    \
+    {                                                            \
+        .function = p_function, .arg = p_arg,                    \
+        .pending = ATOMIC_FLAG_INIT, .owner = NULL               \
+    }
+
+
+/** \brief Run a #DeferredWork that was taken off a queue
+ *
+ * The work can be scheduled again as soon as this starts running it. Work
+ * from a #Membag is released after it runs.
+ *
+ * \param work the work to run
+ */
+void DeferredWork_run(DeferredWork *work);
+
+
+/** \brief Returns \c true when a #DeferredExecutor_drain should stop */
+typedef bool (*DeferredBudgetExpired)(void *context);
+
+
+/** \brief Internal data structure of the deferred work executor
+ *
+ * This must be initialized with #DEFERRED_EXECUTOR_STATIC_INIT at
+ * declaration.
+ */
+typedef struct {
+    /** Queues of <tt>DeferredWork *</tt>, highest priority first */
+    NestedQueue *const queues;
+    /** Number of elements in #queues */
+    const size_t n_priorities;
+    /** #Membag of #DeferredWork used by #DeferredExecutor_call, or \c NULL */
+    Membag *const pool;
+} DeferredExecutor;
+
+
+/** \brief Statically initialize a #DeferredExecutor
+ *
+ * \param p_n_priorities number of elements in \p p_queues
+ * \param p_queues       array of #NestedQueue of <tt>DeferredWork *</tt>
+ *                       using #NESTED_QUEUE_OPERATION_ORDER_NESTED for both
+ *                       reads and writes, highest priority first
+ * \param p_pool         pointer to a #Membag of #DeferredWork for
+ *                       #DeferredExecutor_call, or \c NULL
+ *
+ * \return A #DeferredExecutor static initializer
+ */
+#define DEFERRED_EXECUTOR_STATIC_INIT(p_n_priorities, p_queues, p_pool) \
+    { .queues = p_queues, .n_priorities = p_n_priorities, .pool = p_pool }
+
+
+/** \brief Schedule work to be run
+ *
+ * \param ex       #DeferredExecutor to run \p work
+ * \param priority index of the queue in \p ex->queues to use
+ * \param work     work to run
+ *
+ * \retval true  if \p work was queued, or was already pending
+ * \retval false if the queue is full
+ */
+bool DeferredExecutor_schedule(DeferredExecutor *ex,
+                               size_t            priority,
+                               DeferredWork *    work);
+
+
+/** \brief Schedule a one-off function call
+ *
+ * A #DeferredWork is acquired from \p ex->pool for the call and released
+ * after it runs. Calls are never coalesced.
+ *
+ * \param ex       #DeferredExecutor to run the call
+ * \param priority index of the queue in \p ex->queues to use
+ * \param function function to call
+ * \param arg      argument to pass to \p function
+ *
+ * \retval true  if the call was queued
+ * \retval false if \p ex->pool is \c NULL or full, or the queue is full
+ */
+bool DeferredExecutor_call(DeferredExecutor *ex,
+                           size_t            priority,
+                           DeferredFunction  function,
+                           void *            arg);
+
+
+/** \brief Run pending work, highest priority first
+ *
+ * Higher priority queues are checked again after every batch, so work
+ * scheduled meanwhile is run before the lower priority work.
+ *
+ * \param ex          #DeferredExecutor to drain
+ * \param max_items   maximum number of work items to run
+ * \param out_of_time checked before every batch of up to
+ *                    #DEFERRED_EXECUTOR_BATCH_SIZE work items to stop early,
+ *                    or \c NULL
+ * \param context     argument to pass to \p out_of_time
+ *
+ * \return the number of work items run
+ */
+size_t DeferredExecutor_drain(DeferredExecutor *    ex,
+                              size_t                max_items,
+                              DeferredBudgetExpired out_of_time,
+                              void *                context);
+
+
+#endif /* ifndef AINT_SAFE__DEFERRED_EXECUTOR_H */
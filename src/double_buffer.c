@@ -6,9 +6,21 @@
 /* Copyright 2019 Gaurav Juvekar */
 #include "double_buffer.h"
 
+#include "memory_order.h"
+
+/* A DoubleBuffer is only safe against nesting, so a nested reader or writer
+ * runs to completion before the one it interrupted resumes, on the same CPU.
+ * The loops that select the slots only need each load and exchange to stay
+ * in program order, so that whatever nests between them sees them in that
+ * order, which acquire loads and acq_rel exchanges guarantee. A commit
+ * releases the slot written through next_read, and readers acquire it from
+ * next_read and selected_read. The version counter of the wait variant stays
+ * seq_cst, as it pairs with the waiter count of the #EventCount. */
+
 
 void *DoubleBuffer_write_acquire(DoubleBuffer *db) {
-    if (atomic_flag_test_and_set(&db->write_mutex)) {
+    if (atomic_flag_test_and_set_explicit(&db->write_mutex,
+                                          AINT_SAFE_ACQUIRE)) {
         /* Another writer is writing */
         return NULL;
     } else {
@@ -20,9 +32,11 @@ void *DoubleBuffer_write_acquire(DoubleBuffer *db) {
          * This is *NOT* async-safe, but only async-interrupt-safe */
         void *last_selected;
         do {
-            last_selected = atomic_load(&db->selected_read);
+            last_selected = atomic_load_explicit(&db->selected_read,
+                                                 AINT_SAFE_ACQUIRE);
         } while (last_selected
-                 != atomic_exchange(&db->next_read, last_selected));
+                 != atomic_exchange_explicit(
+                         &db->next_read, last_selected, AINT_SAFE_ACQ_REL));
         /* Now both current read and next to read point to the same slot. We
          * will now actually acquire the other slot for writing. Readers can
          * now keep reading from the last_selected slot. */
@@ -37,13 +51,19 @@ void *DoubleBuffer_write_acquire(DoubleBuffer *db) {
 void DoubleBuffer_write_commit(DoubleBuffer *db, void *slot) {
     if (slot == NULL) return;
     /* It's up to the caller to ensure correct slot pointer is passed */
-    atomic_store(&db->next_read, slot);
-    atomic_flag_clear(&db->write_mutex);
+    atomic_store_explicit(&db->next_read, slot, AINT_SAFE_RELEASE);
+#if AINT_SAFE_WAIT
+    atomic_fetch_add(&db->version, 1);
+#endif
+    atomic_flag_clear_explicit(&db->write_mutex, AINT_SAFE_RELEASE);
+#if AINT_SAFE_WAIT
+    EventCount_notify(&db->updated);
+#endif
 }
 
 
 const void *DoubleBuffer_read_acquire(DoubleBuffer *db) {
-    if (0 == atomic_fetch_add(&db->n_readers, 1)) {
+    if (0 == atomic_fetch_add_explicit(&db->n_readers, 1, AINT_SAFE_ACQUIRE)) {
         /* We are the first reader */
         /* We check if there is a new slot with updated data, and set it as the
          * slot to read from. All readers that can interrupt this reader after
@@ -54,18 +74,50 @@ const void *DoubleBuffer_read_acquire(DoubleBuffer *db) {
          * This is *NOT* async-safe, but only async-interrupt-safe */
         void *last_next_read;
         do {
-            last_next_read = atomic_load(&db->next_read);
+            last_next_read =
+                    atomic_load_explicit(&db->next_read, AINT_SAFE_ACQUIRE);
         } while (last_next_read
-                 != atomic_exchange(&db->selected_read, last_next_read));
+                 != atomic_exchange_explicit(&db->selected_read,
+                                             last_next_read,
+                                             AINT_SAFE_ACQ_REL));
     }
     /* Now, just pick the slot selected for reading */
-    return atomic_load(&db->selected_read);
+    return atomic_load_explicit(&db->selected_read, AINT_SAFE_ACQUIRE);
+}
+
+
+#if AINT_SAFE_WAIT
+const void *DoubleBuffer_read_acquire_wait(DoubleBuffer *         db,
+                                           uint32_t *             version,
+                                           const struct timespec *timeout) {
+    struct timespec deadline;
+    if (timeout != NULL) { EventCount_deadline(&deadline, timeout); }
+
+    uint32_t current;
+    while ((current = atomic_load(&db->version)) == *version) {
+        const uint32_t key = EventCount_prepare_wait(&db->updated);
+        /* Check again, a commit before prepare_wait doesn't wake us */
+        if ((current = atomic_load(&db->version)) != *version) {
+            EventCount_cancel_wait(&db->updated);
+            break;
+        }
+        if (!EventCount_wait(
+                    &db->updated, key, timeout != NULL ? &deadline : NULL)) {
+            if ((current = atomic_load(&db->version)) != *version) { break; }
+            return NULL;
+        }
+    }
+    /* The value read may be even newer than current, which is fine */
+    *version = current;
+    return DoubleBuffer_read_acquire(db);
 }
+#endif
 
 
 void DoubleBuffer_read_release(DoubleBuffer *db, const void *slot) {
     if (slot == NULL) return;
     /* We don't really care about the value of slot since all readers will be
      * reading from the same slot (only the first reader changes the slot) */
-    atomic_fetch_sub(&db->n_readers, 1);
+    /* Release, so that reading the slot is done before it can be reused */
+    atomic_fetch_sub_explicit(&db->n_readers, 1, AINT_SAFE_RELEASE);
 }
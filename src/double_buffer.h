@@ -49,6 +49,9 @@
 #define AINT_SAFE__DOUBLE_BUFFER_H 1
 #include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "event_count.h"
 
 #if !defined(__DOXYGEN__AINT_SAFE__)
 _Static_assert(
@@ -76,6 +79,12 @@ typedef struct {
     _Atomic int n_readers;
     /** Write mutex that allows only one writer at a time */
     atomic_flag write_mutex;
+#if AINT_SAFE_WAIT
+    /** Incremented by every #DoubleBuffer_write_commit */
+    _Atomic uint32_t version;
+    /** Notified by #DoubleBuffer_write_commit */
+    EventCount updated;
+#endif
 } DoubleBuffer;
 
 
@@ -131,6 +140,30 @@ void DoubleBuffer_write_commit(DoubleBuffer *db, void *slot);
 const void *DoubleBuffer_read_acquire(DoubleBuffer *db);
 
 
+#if AINT_SAFE_WAIT
+/** \brief Acquire a slot for reading, waiting for a new value
+ *
+ * \param         db      #DoubleBuffer to acquire the slot from
+ * \param[in,out] version version of the last value seen by the caller,
+ *     updated to the version of the returned value. Start with 0 to wait for
+ *     the first write.
+ * \param         timeout maximum time to wait, or \c NULL to wait forever
+ *
+ * \return Pointer to a slot in \p db->data with a value newer than
+ *     \p version
+ * \retval NULL if no new value was written within \p timeout
+ *
+ * \note This blocks, so it must be called from a thread, and the writes that
+ *     end the wait must come from signal handlers that interrupt that same
+ *     thread, see event_count.h. Writers running in parallel with the
+ *     readers are a data race.
+ */
+const void *DoubleBuffer_read_acquire_wait(DoubleBuffer *         db,
+                                           uint32_t *             version,
+                                           const struct timespec *timeout);
+#endif
+
+
 /** \brief Release a slot previously acquired for reading
  *
  * \param db   #DoubleBuffer from which \p slot was acquired
@@ -0,0 +1,330 @@
+/** \file durable_queue.c
+ *
+ * #NestedQueue whose elements are kept in a file, so that they survive a
+ * crash
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+/* For ftruncate() */
+#define _POSIX_C_SOURCE 200809L
+
+#include "durable_queue.h"
+
+#include "memory_order.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The file holds a header, then a record per slot, then the data array.
+ *
+ * Nothing is written in any particular order, as the kernel may write the
+ * pages of a shared mapping back in any order, and only partly if the
+ * system crashes. Instead, every record says which position its slot holds
+ * (plus 1, so that 0 is an empty slot) and has a checksum of that and the
+ * element. Recovery can then tell which slots hold an intact element, and
+ * at which position. A slot is only written again once its element is
+ * released, so a torn or newer slot means that the element that was there
+ * is released.
+ *
+ * A sync first writes everything to the file, and only then stores the
+ * READ_RELEASED and WRITE_COMMITTED positions in the header and writes that.
+ * The header has two of these sync points with a checksum, and a sync
+ * overwrites the older one, so that a crash in the middle of it leaves the
+ * one of the sync before. Between the two positions of a sync point, the
+ * elements that were released after the sync come first, and their slots
+ * may be stale, torn or rewritten. The ones after them are still in the
+ * queue, so they weren't written since, and are intact. Recovery therefore
+ * starts after the last position below WRITE_COMMITTED that isn't intact,
+ * and takes the intact positions that follow it, including those committed
+ * after the sync. */
+
+#define DURABLE_QUEUE_ALIGN _Alignof(max_align_t)
+
+typedef struct {
+    /** READ_RELEASED at the sync */
+    uint64_t released;
+    /** WRITE_COMMITTED at the sync */
+    uint64_t committed;
+    /** Number of the sync */
+    uint64_t number;
+    /** Checksum of the fields above */
+    uint32_t crc;
+    uint32_t reserved_;
+} DurableQueueSyncPoint;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t elem_size;
+    uint64_t n_elems;
+    /** Sync points, the intact one with the larger number is the last */
+    DurableQueueSyncPoint syncs[2];
+} DurableQueueHeader;
+
+typedef struct {
+    /** Position of the element in the slot plus 1, or 0 */
+    uint64_t seq;
+    /** Checksum of seq and the element */
+    uint32_t crc;
+    uint32_t reserved_;
+} DurableQueueRecord;
+
+
+static inline size_t align_up(size_t n) {
+    return (n + DURABLE_QUEUE_ALIGN - 1) & ~(DURABLE_QUEUE_ALIGN - 1);
+}
+
+
+static inline size_t records_offset(void) {
+    return align_up(sizeof(DurableQueueHeader));
+}
+
+
+static inline size_t data_offset(size_t n_elems) {
+    return align_up(records_offset() + sizeof(DurableQueueRecord) * n_elems);
+}
+
+
+static inline DurableQueueRecord *records(const DurableQueue *dq) {
+    return (DurableQueueRecord *)((char *)dq->base + records_offset());
+}
+
+
+/* As in nested_queue.c */
+static inline uintptr_t position_wrap(size_t n_elems) {
+    return (uintptr_t)INTPTR_MAX / n_elems * n_elems;
+}
+
+
+/* CRC-32 (IEEE 802.3), with a table per nibble to stay small */
+static uint32_t crc32_update(uint32_t crc, const void *buf, size_t len) {
+    static const uint32_t table[16] = {
+            0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+            0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+            0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+            0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    const unsigned char *p = buf;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+    }
+    return crc;
+}
+
+
+static uint32_t record_crc(uint64_t seq, const void *elem, size_t elem_size) {
+    uint32_t crc = crc32_update(0xffffffffu, &seq, sizeof(seq));
+    return ~crc32_update(crc, elem, elem_size);
+}
+
+
+static bool is_intact(const DurableQueue *dq, uintptr_t position) {
+    const NestedQueue *       q    = &dq->queue;
+    const size_t              i    = position % q->n_elems;
+    const DurableQueueRecord *r    = &records(dq)[i];
+    const void *              elem = (char *)q->data + i * q->elem_size;
+    return r->seq == (uint64_t)position + 1
+           && r->crc == record_crc(r->seq, elem, q->elem_size);
+}
+
+
+static uint32_t sync_point_crc(const DurableQueueSyncPoint *sp) {
+    const size_t len = offsetof(DurableQueueSyncPoint, crc);
+    return ~crc32_update(0xffffffffu, sp, len);
+}
+
+
+static void sync_point_store(DurableQueueSyncPoint *sp,
+                             uint64_t               released,
+                             uint64_t               committed,
+                             uint64_t               number) {
+    sp->released  = released;
+    sp->committed = committed;
+    sp->number    = number;
+    sp->reserved_ = 0;
+    sp->crc       = sync_point_crc(sp);
+}
+
+
+/* Whether sp is intact and its positions are of a queue of n_elems */
+static bool sync_point_valid(const DurableQueueSyncPoint *sp, size_t n_elems) {
+    const uint64_t wrap = position_wrap(n_elems);
+    return sp->crc == sync_point_crc(sp) && sp->released < wrap
+           && sp->committed < wrap
+           && (sp->committed + wrap - sp->released) % wrap <= n_elems;
+}
+
+
+/* The sync point of the last sync that completed, or NULL */
+static const DurableQueueSyncPoint *
+last_sync_point(const DurableQueueHeader *header) {
+    const DurableQueueSyncPoint *last = NULL;
+    for (size_t i = 0; i < 2; i++) {
+        const DurableQueueSyncPoint *sp = &header->syncs[i];
+        if (sync_point_valid(sp, header->n_elems)
+            && (last == NULL || sp->number > last->number)) {
+            last = sp;
+        }
+    }
+    return last;
+}
+
+
+/* Rebuild the positions of dq->queue from the records and the positions
+ * stored at the last sync */
+static void
+recover(DurableQueue *dq, uintptr_t released, uintptr_t committed) {
+    NestedQueue *   q    = &dq->queue;
+    const uintptr_t wrap = position_wrap(q->n_elems);
+
+    uintptr_t first = released;
+    for (uintptr_t p = released; p != committed; p = (p + 1) % wrap) {
+        if (!is_intact(dq, p)) { first = (p + 1) % wrap; }
+    }
+    uintptr_t end = first;
+    for (size_t n = 0; n < q->n_elems && is_intact(dq, end); n++) {
+        end = (end + 1) % wrap;
+    }
+
+    atomic_store(&q->index_storage_[NESTED_QUEUE_READ_RELEASED],
+                 (mcas_base_t)first);
+    atomic_store(&q->index_storage_[NESTED_QUEUE_READ_ACQUIRED],
+                 (mcas_base_t)first);
+    atomic_store(&q->index_storage_[NESTED_QUEUE_WRITE_COMMITTED],
+                 (mcas_base_t)end);
+    atomic_store(&q->index_storage_[NESTED_QUEUE_WRITE_ALLOCATED],
+                 (mcas_base_t)end);
+}
+
+
+bool DurableQueue_open(DurableQueue *            dq,
+                       const char *              path,
+                       size_t                    elem_size,
+                       size_t                    n_elems,
+                       NestedQueueOperationOrder write_order,
+                       NestedQueueOperationOrder read_order) {
+    if (n_elems == 0 || n_elems > INTPTR_MAX || elem_size == 0
+        || (SIZE_MAX - data_offset(n_elems)) / n_elems < elem_size) {
+        errno = EINVAL;
+        return false;
+    }
+    const size_t size = data_offset(n_elems) + elem_size * n_elems;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) { return false; }
+    struct stat st;
+    int         error = 0;
+    if (fstat(fd, &st) != 0) {
+        error = errno;
+    } else if (st.st_size == 0) {
+        /* New, or created by an open that crashed before writing the
+         * header */
+        if (ftruncate(fd, (off_t)size) != 0) { error = errno; }
+    } else if ((uint64_t)st.st_size != size) {
+        error = EINVAL;
+    }
+    void *base = MAP_FAILED;
+    if (!error) {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) { error = errno; }
+    }
+    close(fd);
+    if (error) {
+        errno = error;
+        return false;
+    }
+
+    DurableQueueHeader *header = base;
+    if (header->magic == 0) {
+        /* The file is zero-filled by ftruncate, which is an empty queue */
+        header->version   = DURABLE_QUEUE_VERSION;
+        header->elem_size = elem_size;
+        header->n_elems   = n_elems;
+        sync_point_store(&header->syncs[0], 0, 0, 0);
+        sync_point_store(&header->syncs[1], 0, 0, 1);
+        /* The magic last, so that a file without it is initialized again */
+        if (msync(base, size, MS_SYNC) != 0) {
+            error = errno;
+        } else {
+            header->magic = DURABLE_QUEUE_MAGIC;
+            if (msync(base, sizeof(*header), MS_SYNC) != 0) { error = errno; }
+        }
+    } else if (header->magic != DURABLE_QUEUE_MAGIC) {
+        error = EINVAL;
+    } else if (header->version != DURABLE_QUEUE_VERSION) {
+        error = EPROTO;
+    } else if (header->elem_size != elem_size || header->n_elems != n_elems
+               || last_sync_point(header) == NULL) {
+        error = EINVAL;
+    }
+    if (error) {
+        munmap(base, size);
+        errno = error;
+        return false;
+    }
+
+    dq->base = base;
+    dq->size = size;
+    const NestedQueue init =
+            NESTED_QUEUE_STATIC_INIT(dq->queue,
+                                     elem_size,
+                                     n_elems,
+                                     (char *)base + data_offset(n_elems),
+                                     write_order,
+                                     read_order);
+    memcpy(&dq->queue, &init, sizeof(init));
+    const DurableQueueSyncPoint *sp = last_sync_point(header);
+    recover(dq, (uintptr_t)sp->released, (uintptr_t)sp->committed);
+    return true;
+}
+
+
+void DurableQueue_close(DurableQueue *dq) {
+    munmap(dq->base, dq->size);
+    dq->base = NULL;
+}
+
+
+void DurableQueue_write_commit(DurableQueue *dq, const void *slot) {
+    NestedQueue *q = &dq->queue;
+    const size_t i = ((const char *)slot - (char *)q->data) / q->elem_size;
+
+    /* The slot is the only acquired one at its index, between the committed
+     * and allocated positions. Commits of nested writers can't pass it. */
+    mcas_base_t indexes[NESTED_QUEUE_NUMBER_OF_INDEXES];
+    Mcas_read(&q->indexes, indexes);
+    const uintptr_t committed =
+            (uintptr_t)indexes[NESTED_QUEUE_WRITE_COMMITTED];
+    const size_t ahead =
+            (i + q->n_elems - committed % q->n_elems) % q->n_elems;
+    const uintptr_t position = (committed + ahead) % position_wrap(q->n_elems);
+
+    DurableQueueRecord *r = &records(dq)[i];
+    r->seq                = (uint64_t)position + 1;
+    r->crc                = record_crc(r->seq, slot, q->elem_size);
+    NestedQueue_write_commit(q, slot);
+}
+
+
+bool DurableQueue_sync(DurableQueue *dq) {
+    mcas_base_t indexes[NESTED_QUEUE_NUMBER_OF_INDEXES];
+    Mcas_read(&dq->queue.indexes, indexes);
+    /* The elements up to the positions first, see the top */
+    if (msync(dq->base, dq->size, MS_SYNC) != 0) { return false; }
+    DurableQueueHeader *         header = dq->base;
+    const DurableQueueSyncPoint *last   = last_sync_point(header);
+    const uint64_t               number = last->number + 1;
+    sync_point_store(&header->syncs[number % 2],
+                     (uintptr_t)indexes[NESTED_QUEUE_READ_RELEASED],
+                     (uintptr_t)indexes[NESTED_QUEUE_WRITE_COMMITTED],
+                     number);
+    return msync(dq->base, sizeof(*header), MS_SYNC) == 0;
+}
@@ -0,0 +1,149 @@
+/** \file durable_queue.h
+ *
+ * #NestedQueue whose elements are kept in a file, so that they survive a
+ * crash
+ *
+ * The data array of the queue is a shared mapping of the file, along with a
+ * small record per slot with the position of the element in it and a
+ * checksum, written by #DurableQueue_write_commit. Elements are written and
+ * read in place with the usual #NestedQueue functions on \c &dq.queue, so
+ * the queue can replace a staging queue followed by a write-ahead log,
+ * without copying or writing elements twice.
+ *
+ * Durability is up to the caller: #DurableQueue_sync writes everything
+ * committed so far to the storage, and can be called as rarely as the
+ * application can afford to lose. On open, the queue is rebuilt from the
+ * records that are intact:
+ *  - an element committed before a sync is never lost, and one committed
+ *    after the last sync is kept if its record and data reached the file,
+ *  - elements that were acquired and not committed are dropped,
+ *  - elements released after the last sync may be read again, ie. reads are
+ *    at-least-once.
+ *
+ * Usage:
+ * \code{.c}
+ * static DurableQueue events;
+ *
+ * if (!DurableQueue_open(&events, "/var/lib/app/events", sizeof(Event), 4096,
+ *                        NESTED_QUEUE_OPERATION_ORDER_NESTED,
+ *                        NESTED_QUEUE_OPERATION_ORDER_NESTED)) {
+ *     perror(...);
+ * }
+ *
+ * void event_interrupt(void) {
+ *     Event *e = NestedQueue_write_acquire(&events.queue);
+ *     if (e != NULL) {
+ *         ... // fill in *e
+ *         DurableQueue_write_commit(&events, e);
+ *     }
+ * }
+ *
+ * void persist_thread(void) {
+ *     for (;;) {
+ *         sleep(1);
+ *         DurableQueue_sync(&events);
+ *     }
+ * }
+ * \endcode
+ *
+ * \note The file layout depends on the size of the elements and the byte
+ * order, so files must be reopened by a build for the same architecture.
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__DURABLE_QUEUE_H
+#define AINT_SAFE__DURABLE_QUEUE_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nested_queue.h"
+
+
+/** \brief Magic number at the start of every queue file ("AINQ") */
+#define DURABLE_QUEUE_MAGIC 0x514e4941u
+
+/** \brief Version of the layout of the queue file
+ *
+ * This must be incremented whenever the layout changes, so that files
+ * written with a different layout are refused.
+ */
+#define DURABLE_QUEUE_VERSION 2u
+
+
+/** \brief Process local handle of a queue file
+ *
+ * This must not be moved once opened, as #queue refers to itself.
+ */
+typedef struct {
+    /** The queue, with its data array in the file */
+    NestedQueue queue;
+    /** Start of the mapping of the file */
+    void *base;
+    /** Size of the mapping */
+    size_t size;
+} DurableQueue;
+
+
+/** \brief Open a queue file, creating it if it doesn't exist
+ *
+ * An existing file is recovered as described at the top.
+ *
+ * \param[out] dq          handle of the opened queue
+ * \param      path        path of the file
+ * \param      elem_size   size of an element
+ * \param      n_elems     number of elements
+ * \param      write_order ordering of acquire and release that will be used
+ *     for writes
+ * \param      read_order  ordering of acquire and release that will be used
+ *     for reads
+ *
+ * \retval true  if the queue was opened
+ * \retval false on failure, with \c errno set. \c EINVAL if the file isn't a
+ *     queue file or was made with another \p elem_size or \p n_elems, and
+ *     \c EPROTO if it was made with a different #DURABLE_QUEUE_VERSION.
+ */
+bool DurableQueue_open(DurableQueue *            dq,
+                       const char *              path,
+                       size_t                    elem_size,
+                       size_t                    n_elems,
+                       NestedQueueOperationOrder write_order,
+                       NestedQueueOperationOrder read_order);
+
+
+/** \brief Unmap a queue file
+ *
+ * This doesn't sync the queue, but elements committed so far still reach
+ * the file unless the system crashes.
+ *
+ * \param dq handle returned by #DurableQueue_open
+ */
+void DurableQueue_close(DurableQueue *dq);
+
+
+/** \brief Commit a slot acquired for writing, and record it in the file
+ *
+ * Use this instead of #NestedQueue_write_commit. It checksums the element,
+ * so it costs about one pass over the element more.
+ *
+ * \param dq   #DurableQueue from which \p slot was acquired
+ * \param slot slot acquired by #NestedQueue_write_acquire() on \c &dq->queue
+ *
+ * \note Calls must follow the \c write_order of the queue
+ */
+void DurableQueue_write_commit(DurableQueue *dq, const void *slot);
+
+
+/** \brief Write the elements committed so far to the storage
+ *
+ * Waits until they are written, so it must only be called from threads.
+ *
+ * \param dq #DurableQueue to sync
+ *
+ * \retval true  if the elements committed before the call are durable
+ * \retval false on failure, with \c errno set
+ */
+bool DurableQueue_sync(DurableQueue *dq);
+
+
+#endif /* ifndef AINT_SAFE__DURABLE_QUEUE_H */
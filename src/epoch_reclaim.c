@@ -0,0 +1,135 @@
+/** \file epoch_reclaim.c
+ *
+ * Interrupt-safe epoch based memory reclamation with static storage
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "epoch_reclaim.h"
+
+#include "memory_order.h"
+
+/* Readers register themselves in the counter of the current epoch. The epoch
+ * advances from e to e+1 only when there are no readers left in e-1, so at
+ * any point, only readers of the current and the previous epoch can be active.
+ *
+ * A slot retired in epoch e was unlinked before e was observed, so only
+ * readers that registered in e or earlier can hold a reference to it. When
+ * the epoch advances from e+1 to e+2, readers of e have all exited (and
+ * readers of e-1 exited before the previous advance), so the slots retired in
+ * e are released at that point.
+ *
+ * Since only 3 epochs are live at a time, the epoch is stored modulo
+ * EPOCH_RECLAIM_N_EPOCHS and indexes the reader counters and limbo lists
+ * directly.
+ *
+ * The epoch, the increments of the reader counters and the checks that
+ * they are 0 stay seq_cst. A reader increments a counter and then loads the
+ * epoch, while the collector loads the counter and then stores the epoch,
+ * and a retirer unlinks a slot and then loads the epoch. Each pair is a
+ * store followed by a load of another variable, which only a single total
+ * order keeps from both reading the old values (store buffering). The
+ * decrement in EpochReclaim_exit only has to publish the reads of the
+ * reader (release), and the limbo lists and collect_mutex only publish the
+ * records and the collector state (release/acquire). */
+
+static inline unsigned int next_epoch(unsigned int epoch) {
+    return (epoch + 1) % EPOCH_RECLAIM_N_EPOCHS;
+}
+
+static inline unsigned int prev_epoch(unsigned int epoch) {
+    return (epoch + EPOCH_RECLAIM_N_EPOCHS - 1) % EPOCH_RECLAIM_N_EPOCHS;
+}
+
+
+void EpochReclaim_init(EpochReclaim *er) {
+    Membag_init(&er->records);
+    atomic_init(&er->epoch, 0);
+    for (size_t i = 0; i < EPOCH_RECLAIM_N_EPOCHS; i++) {
+        atomic_init(&er->n_readers[i], 0);
+        atomic_init(&er->limbo[i], NULL);
+    }
+    atomic_flag_clear(&er->collect_mutex);
+}
+
+
+EpochReclaimToken EpochReclaim_enter(EpochReclaim *er) {
+    unsigned int epoch = atomic_load(&er->epoch);
+    while (1) {
+        atomic_fetch_add(&er->n_readers[epoch], 1);
+        /* The epoch may have advanced between the load and the increment, in
+         * which case we are counted in a stale epoch that a collector may
+         * already have considered empty. Once the counter is incremented, the
+         * epoch cannot advance past it, so we are registered if the epoch
+         * still matches. */
+        unsigned int current = atomic_load(&er->epoch);
+        if (current == epoch) { return epoch; }
+        atomic_fetch_sub(&er->n_readers[epoch], 1);
+        epoch = current;
+    }
+}
+
+
+void EpochReclaim_exit(EpochReclaim *er, EpochReclaimToken token) {
+    atomic_fetch_sub_explicit(&er->n_readers[token], 1, AINT_SAFE_RELEASE);
+}
+
+
+bool EpochReclaim_retire(EpochReclaim *er, Membag *owner, const void *slot) {
+    if (slot == NULL) return true;
+    EpochReclaimRecord *record = Membag_acquire(&er->records);
+    if (record == NULL) {
+        EpochReclaim_collect(er);
+        record = Membag_acquire(&er->records);
+        if (record == NULL) return false;
+    }
+    record->owner = owner;
+    record->slot  = slot;
+
+    /* If the epoch advances after this load, the slot is pushed to an older
+     * limbo list than necessary. That only delays its release, which is
+     * always safe. */
+    unsigned int        epoch = atomic_load(&er->epoch);
+    EpochReclaimRecord *head =
+            atomic_load_explicit(&er->limbo[epoch], AINT_SAFE_RELAXED);
+    do {
+        record->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&er->limbo[epoch],
+                                                    &head,
+                                                    record,
+                                                    AINT_SAFE_RELEASE,
+                                                    AINT_SAFE_RELAXED));
+    return true;
+}
+
+
+size_t EpochReclaim_collect(EpochReclaim *er) {
+    if (atomic_flag_test_and_set_explicit(&er->collect_mutex,
+                                          AINT_SAFE_ACQUIRE)) {
+        /* Another collector is running */
+        return 0;
+    }
+    /* Now we are the exclusive collector, and the only one advancing the
+     * epoch */
+    size_t       n_released = 0;
+    unsigned int epoch      = atomic_load(&er->epoch);
+    unsigned int prev       = prev_epoch(epoch);
+    if (atomic_load(&er->n_readers[prev]) == 0) {
+        /* No reader can register in prev anymore, and readers of epoch are
+         * allowed to remain active in the previous epoch after advancing */
+        atomic_store(&er->epoch, next_epoch(epoch));
+        /* The limbo list of prev now only has slots that no reader can
+         * reference. Slots pushed into it after the exchange wait for the
+         * next time around. */
+        EpochReclaimRecord *record = atomic_exchange_explicit(
+                &er->limbo[prev], NULL, AINT_SAFE_ACQUIRE);
+        while (record != NULL) {
+            EpochReclaimRecord *next = record->next;
+            Membag_release(record->owner, record->slot);
+            Membag_release(&er->records, record);
+            n_released++;
+            record = next;
+        }
+    }
+    atomic_flag_clear_explicit(&er->collect_mutex, AINT_SAFE_RELEASE);
+    return n_released;
+}
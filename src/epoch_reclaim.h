@@ -0,0 +1,195 @@
+/** \file epoch_reclaim.h
+ *
+ * Interrupt-safe epoch based memory reclamation with static storage
+ *
+ * Nodes unlinked from a lock-free structure (eg. by #Slist_delete_after) may
+ * still be referenced by a concurrent or interrupted traversal. Instead of
+ * releasing them to their #Membag immediately, they are \e retired and
+ * released only after every read-side critical section that could have
+ * observed them has exited.
+ *
+ * Usage:
+ * \code{.c}
+ * static MyNode nodes[64];
+ * static membag_alloc_status_t nodes_status[MEMBAG_ALLOC_STATUS_LEN(64)];
+ * static Membag node_pool = MEMBAG_STATIC_INIT(
+ *         sizeof(MyNode), 64, nodes_status, nodes);
+ *
+ * static EpochReclaimRecord records[16];
+ * static membag_alloc_status_t records_status[MEMBAG_ALLOC_STATUS_LEN(16)];
+ * static EpochReclaim reclaim = EPOCH_RECLAIM_STATIC_INIT(
+ *         16, records_status, records);
+ *
+ * void reader(void) {
+ *     EpochReclaimToken token = EpochReclaim_enter(&reclaim);
+ *     for (SlistNode *n = Slist_next(&head); n != NULL; n = Slist_next(n)) {
+ *         // n will not be released to node_pool till EpochReclaim_exit
+ *     }
+ *     EpochReclaim_exit(&reclaim, token);
+ * }
+ *
+ * void deleter(SlistNode *to_delete) {
+ *     SlistNode *deleted = Slist_delete_after(&head, to_delete);
+ *     if (!EpochReclaim_retire(&reclaim, &node_pool,
+ *                              CONTAINER_OF(deleted, MyNode, node))) {
+ *         // Too much garbage, retry later
+ *     }
+ * }
+ *
+ * void idle_loop(void) {
+ *     EpochReclaim_collect(&reclaim);
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__EPOCH_RECLAIM_H
+#define AINT_SAFE__EPOCH_RECLAIM_H 1
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "membag.h"
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(
+        ATOMIC_POINTER_LOCK_FREE,
+        "Your stdlib implementation does not have lock-free pointer atomics");
+_Static_assert(
+        ATOMIC_INT_LOCK_FREE,
+        "Your stdlib implementation does not have lock-free int atomics");
+#endif
+
+
+/** Number of epochs that may have live readers or garbage at any time */
+#define EPOCH_RECLAIM_N_EPOCHS 3
+
+
+/** \brief A retired slot waiting to be released to its #Membag
+ *
+ * Use this type to declare the record array passed to
+ * #EPOCH_RECLAIM_STATIC_INIT. The number of records bounds the amount of
+ * unreleased garbage.
+ */
+typedef struct EpochReclaimRecord {
+    /** Next record retired in the same epoch */
+    struct EpochReclaimRecord *next;
+    /** #Membag that #slot is released to */
+    Membag *owner;
+    /** The retired slot */
+    const void *slot;
+} EpochReclaimRecord;
+
+
+/** \brief Token identifying a read-side critical section
+ *
+ * Returned by #EpochReclaim_enter and passed back to #EpochReclaim_exit
+ */
+typedef unsigned int EpochReclaimToken;
+
+
+/** \brief Internal data structure of the epoch reclaimer
+ *
+ * This must be initialized with #EPOCH_RECLAIM_STATIC_INIT at declaration AND
+ * #EpochReclaim_init at runtime.
+ */
+typedef struct {
+    /** Pool of #EpochReclaimRecord to track retired slots */
+    Membag records;
+    /** Current epoch in [0, #EPOCH_RECLAIM_N_EPOCHS) */
+    atomic_uint epoch;
+    /** Number of read-side critical sections active in each epoch */
+    _Atomic int n_readers[EPOCH_RECLAIM_N_EPOCHS];
+    /** Slots retired in each epoch */
+    EpochReclaimRecord *_Atomic limbo[EPOCH_RECLAIM_N_EPOCHS];
+    /** Mutex that allows only one collector at a time */
+    atomic_flag collect_mutex;
+} EpochReclaim;
+
+
+/** \brief Statically initialize an #EpochReclaim
+ *
+ * \param p_n_records     number of elements in \p p_record_array
+ * \param p_status_array  #membag_alloc_status_t array of length
+ *     \c #MEMBAG_ALLOC_STATUS_LEN(\p p_n_records)
+ * \param p_record_array  #EpochReclaimRecord array to track retired slots
+ *
+ * \return An #EpochReclaim static initializer
+ */
+#define EPOCH_RECLAIM_STATIC_INIT(                                      \
+        p_n_records, p_status_array, p_record_array)                    \
+    {                                                                   \
+        .records = MEMBAG_STATIC_INIT(sizeof(EpochReclaimRecord),       \
+                                      p_n_records,                      \
+                                      p_status_array,                   \
+                                      p_record_array),                  \
+        .epoch = 0, .collect_mutex = ATOMIC_FLAG_INIT                   \
+    }
+
+
+/** \brief Initialize an #EpochReclaim instance at runtime
+ *
+ * \param er #EpochReclaim to initialize
+ *
+ * \pre \p er must be initialized with #EPOCH_RECLAIM_STATIC_INIT first
+ */
+void EpochReclaim_init(EpochReclaim *er);
+
+
+/** \brief Enter a read-side critical section
+ *
+ * Slots retired after this call are not released till the corresponding
+ * #EpochReclaim_exit.
+ *
+ * \param er #EpochReclaim protecting the traversed structure
+ *
+ * \return A token to pass to #EpochReclaim_exit
+ *
+ * \note enter() and exit() must happen in a nested order, just like
+ * acquire() and release() of the other data structures.
+ */
+EpochReclaimToken EpochReclaim_enter(EpochReclaim *er);
+
+
+/** \brief Exit a read-side critical section
+ *
+ * \param er    #EpochReclaim passed to #EpochReclaim_enter
+ * \param token token returned by the corresponding #EpochReclaim_enter
+ */
+void EpochReclaim_exit(EpochReclaim *er, EpochReclaimToken token);
+
+
+/** \brief Defer releasing a slot to its #Membag
+ *
+ * \param er    #EpochReclaim protecting the structure \p slot was unlinked
+ *     from
+ * \param owner #Membag that \p slot was acquired from
+ * \param slot  slot to release, that must already be unreachable by new
+ *     traversals, or \c NULL
+ *
+ * \retval true  if \p slot was retired
+ * \retval false if there was no free record to track \p slot even after an
+ *     #EpochReclaim_collect. The caller still owns \p slot.
+ *
+ * \note This may be called from within a read-side critical section.
+ */
+bool EpochReclaim_retire(EpochReclaim *er, Membag *owner, const void *slot);
+
+
+/** \brief Try to advance the epoch and release slots that are now safe
+ *
+ * Call this periodically from a low priority context. Slots are released
+ * only after the epoch has advanced twice since they were retired.
+ *
+ * \param er #EpochReclaim to collect
+ *
+ * \return the number of slots released
+ *
+ * \note This returns immediately if it interrupted another collect(), or if
+ * a read-side critical section from the previous epoch is still active
+ * (possibly the one that this call interrupted).
+ */
+size_t EpochReclaim_collect(EpochReclaim *er);
+
+
+#endif /* ifndef AINT_SAFE__EPOCH_RECLAIM_H */
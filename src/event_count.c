@@ -0,0 +1,93 @@
+/** \file event_count.c
+ *
+ * Eventcount for blocking threads until a lock-free structure changes
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+/* For clock_gettime() and syscall() */
+#define _GNU_SOURCE
+
+#include "event_count.h"
+
+#include "memory_order.h"
+
+#if AINT_SAFE_WAIT
+
+#if !defined(__linux__)
+#error "AINT_SAFE_WAIT is only implemented for Linux"
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* A waiter increments n_waiters before reading seq and checking its
+ * condition. A notifier makes the condition true before reading n_waiters.
+ * Both are seq_cst, so either the waiter sees the condition, or the notifier
+ * sees the waiter and increments seq, which makes the FUTEX_WAIT of the
+ * waiter return immediately if it hasn't started sleeping yet.
+ *
+ * The futexes are not process private, so this works for structures in shared
+ * memory too. */
+
+
+void EventCount_deadline(struct timespec *      deadline,
+                         const struct timespec *timeout) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout->tv_sec;
+    deadline->tv_nsec += timeout->tv_nsec;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec += 1;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+
+uint32_t EventCount_prepare_wait(EventCount *ec) {
+    atomic_fetch_add(&ec->n_waiters, 1);
+    return atomic_load(&ec->seq);
+}
+
+
+void EventCount_cancel_wait(EventCount *ec) {
+    atomic_fetch_sub(&ec->n_waiters, 1);
+}
+
+
+bool EventCount_wait(EventCount *           ec,
+                     uint32_t               key,
+                     const struct timespec *deadline) {
+    /* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout, unlike
+     * FUTEX_WAIT, so spurious wake ups don't extend the wait */
+    long ret = syscall(SYS_futex,
+                       (uint32_t *)&ec->seq,
+                       FUTEX_WAIT_BITSET,
+                       key,
+                       deadline,
+                       NULL,
+                       FUTEX_BITSET_MATCH_ANY);
+    bool timed_out = ret == -1 && errno == ETIMEDOUT;
+    atomic_fetch_sub(&ec->n_waiters, 1);
+    return !timed_out;
+}
+
+
+void EventCount_notify(EventCount *ec) {
+    if (atomic_load(&ec->n_waiters) == 0) { return; }
+    atomic_fetch_add(&ec->seq, 1);
+    /* May be called from a signal handler */
+    int saved_errno = errno;
+    syscall(SYS_futex,
+            (uint32_t *)&ec->seq,
+            FUTEX_WAKE,
+            INT_MAX,
+            NULL,
+            NULL,
+            0);
+    errno = saved_errno;
+}
+
+
+#endif /* if AINT_SAFE_WAIT */
@@ -0,0 +1,183 @@
+/** \file event_count.h
+ *
+ * Eventcount for blocking threads until a lock-free structure changes
+ *
+ * This is the optional layer that lets threads sleep instead of busy-polling
+ * functions that return \c NULL when a structure is empty or full. It is only
+ * built when #AINT_SAFE_WAIT is set, and is only implemented for Linux, where
+ * it waits on a futex.
+ *
+ * A waiter announces itself with #EventCount_prepare_wait, checks its
+ * condition once more and then calls #EventCount_wait, which returns as soon
+ * as any #EventCount_notify happens after the announcement. Notifiers only
+ * make a system call when there are waiters, so they remain a couple of
+ * atomic operations otherwise and can still be called from signal handlers.
+ *
+ * \warning The \c _wait functions of #NestedQueue, #NestedQueueGroup and
+ * #DoubleBuffer block a thread, but the commits, releases and writes that
+ * wake it must still only nest with its operations: #Mcas, and so
+ * #NestedQueue, and #DoubleBuffer are only safe against nesting, not against
+ * threads running in parallel. The only valid producers are therefore
+ * signal handlers that interrupt the waiting thread itself, eg. of a timer
+ * or an I/O signal directed at it. The wait returns when such a handler
+ * notifies, whether it interrupted the sleep or ran just before it.
+ *
+ * Usage:
+ * \code{.c}
+ * static EventCount ready = EVENT_COUNT_INIT;
+ *
+ * void producer(void) {
+ *     ... // make the condition true
+ *     EventCount_notify(&ready);
+ * }
+ *
+ * void consumer(void) {
+ *     while (!condition()) {
+ *         uint32_t key = EventCount_prepare_wait(&ready);
+ *         if (condition()) {
+ *             EventCount_cancel_wait(&ready);
+ *             break;
+ *         }
+ *         EventCount_wait(&ready, key, NULL);
+ *     }
+ * }
+ * \endcode
+ *
+ * A thread sleeping on a #NestedQueue that a timer signal handler on that
+ * same thread fills:
+ * \code{.c}
+ * static NestedQueue samples = NESTED_QUEUE_STATIC_INIT(...);
+ *
+ * // Runs on the consumer thread, interrupting its wait
+ * static void on_tick(int sig) {
+ *     Sample *s = NestedQueue_write_acquire(&samples);
+ *     if (s != NULL) {
+ *         read_sensor(s);
+ *         NestedQueue_write_commit(&samples, s); // wakes the wait below
+ *     }
+ * }
+ *
+ * void *consumer(void *arg) {
+ *     struct sigaction sa = {.sa_handler = on_tick};
+ *     sigaction(SIGRTMIN, &sa, NULL);
+ *     // Deliver the timer signal to this thread only
+ *     struct sigevent sev = {.sigev_notify = SIGEV_THREAD_ID,
+ *                            .sigev_signo  = SIGRTMIN,
+ *                            .sigev_notify_thread_id = gettid()};
+ *     timer_t timer;
+ *     timer_create(CLOCK_MONOTONIC, &sev, &timer);
+ *     timer_settime(timer, 0, &period, NULL);
+ *     while (1) {
+ *         const Sample *s = NestedQueue_read_acquire_wait(&samples, NULL);
+ *         process(s);
+ *         NestedQueue_read_release(&samples, s);
+ *     }
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__EVENT_COUNT_H
+#define AINT_SAFE__EVENT_COUNT_H 1
+
+#ifndef AINT_SAFE_WAIT
+/** \brief Enable blocking waits on the data structures
+ *
+ * When defined to 1, #NestedQueue and #DoubleBuffer get an #EventCount each
+ * and the \c _wait variants of their acquire functions, for threads woken
+ * by their own signal handlers. This needs Linux.
+ * Define it for the whole build to override.
+ */
+#define AINT_SAFE_WAIT 0
+#endif
+
+#if AINT_SAFE_WAIT
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(
+        atomic_is_lock_free((uint32_t *)NULL),
+        "Your stdlib implementation does not have lock-free uint32_t atomics");
+#endif
+
+
+/** \brief Internal data structure of the eventcount
+ *
+ * This must be initialized with #EVENT_COUNT_INIT.
+ */
+typedef struct {
+    /** Futex word, incremented by every #EventCount_notify with waiters */
+    _Atomic uint32_t seq;
+    /** Number of waiters between #EventCount_prepare_wait and returning */
+    _Atomic uint32_t n_waiters;
+} EventCount;
+
+
+/** \brief Initialize an #EventCount
+ *
+ * \return An #EventCount initializer
+ */
+#define EVENT_COUNT_INIT \
+    { .seq = 0, .n_waiters = 0 }
+
+
+/** \brief Convert a relative timeout to an absolute deadline
+ *
+ * \param[out] deadline the deadline on \c CLOCK_MONOTONIC
+ * \param      timeout  time from now
+ */
+void EventCount_deadline(struct timespec *      deadline,
+                         const struct timespec *timeout);
+
+
+/** \brief Announce that the caller is about to wait
+ *
+ * The caller must check its condition after this, and then either call
+ * #EventCount_wait or #EventCount_cancel_wait.
+ *
+ * \param ec #EventCount to wait on
+ *
+ * \return key to pass to #EventCount_wait
+ */
+uint32_t EventCount_prepare_wait(EventCount *ec);
+
+
+/** \brief Withdraw an announcement made by #EventCount_prepare_wait
+ *
+ * \param ec #EventCount passed to #EventCount_prepare_wait
+ */
+void EventCount_cancel_wait(EventCount *ec);
+
+
+/** \brief Sleep until a notification after #EventCount_prepare_wait
+ *
+ * \param ec       #EventCount passed to #EventCount_prepare_wait
+ * \param key      key returned by #EventCount_prepare_wait
+ * \param deadline absolute time on \c CLOCK_MONOTONIC to give up at, or
+ *     \c NULL to wait forever
+ *
+ * \retval true  if woken up, possibly spuriously
+ * \retval false if \p deadline has passed
+ */
+bool EventCount_wait(EventCount *           ec,
+                     uint32_t               key,
+                     const struct timespec *deadline);
+
+
+/** \brief Wake up all the waiters
+ *
+ * This doesn't make any system call if there are no waiters. It is
+ * async-signal-safe.
+ *
+ * \param ec #EventCount to notify
+ */
+void EventCount_notify(EventCount *ec);
+
+
+#endif /* if AINT_SAFE_WAIT */
+
+#endif /* ifndef AINT_SAFE__EVENT_COUNT_H */
@@ -0,0 +1,142 @@
+/** \file hash_map.c
+ *
+ * Interrupt-safe lock-free fixed capacity hash map of intrusive entries
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "hash_map.h"
+#include "memory_order.h"
+#include <stdbool.h>
+
+#include "container.h"
+
+/* Every bucket is kept sorted by key, so that an insert can check that the key
+ * is absent and link the entry with one compare_exchange on the predecessor
+ * link. An entry is deleted in the same way as in marked_slist.c, by marking
+ * its own link and then unlinking it. The memory orders are those of
+ * marked_slist.c. */
+
+
+static inline MarkedSlistNode *bucket_of(HashMap *map, uintptr_t key) {
+    /* Fibonacci hashing, so that sequential keys are spread over buckets */
+    uint64_t hash = (uint64_t)key * UINT64_C(0x9e3779b97f4a7c15);
+    return &map->buckets[(hash >> 32) % map->n_buckets];
+}
+
+static inline HashMapEntry *node_to_entry(MarkedSlistNode *node) {
+    return node == NULL ? NULL : CONTAINER_OF(node, HashMapEntry, node);
+}
+
+
+/* Find the first entry in bucket with a key not less than key, and the node
+ * just before it, unlinking all marked entries on the way */
+static HashMapEntry *HashMap_search(MarkedSlistNode * bucket,
+                                    uintptr_t         key,
+                                    MarkedSlistNode **pred_out) {
+    MarkedSlistNode *pred      = bucket;
+    uintptr_t pred_link = atomic_load_explicit(&pred->next, AINT_SAFE_ACQUIRE);
+    while (1) {
+        MarkedSlistNode *current = MarkedSlist_link_to_node(pred_link);
+        if (current == NULL) { break; }
+        uintptr_t current_link =
+                atomic_load_explicit(&current->next, AINT_SAFE_ACQUIRE);
+        if (!MarkedSlist_is_marked(current_link)) {
+            if (node_to_entry(current)->key >= key) { break; }
+            pred      = current;
+            pred_link = current_link;
+        } else if (atomic_compare_exchange_strong_explicit(
+                           &pred->next,
+                           &pred_link,
+                           MarkedSlist_unmarked(current_link),
+                           AINT_SAFE_ACQ_REL,
+                           AINT_SAFE_ACQUIRE)) {
+            pred_link = MarkedSlist_unmarked(current_link);
+        } else if (MarkedSlist_is_marked(pred_link)) {
+            /* pred got deleted meanwhile. Start again from the bucket head,
+             * which is never deleted. */
+            pred      = bucket;
+            pred_link = atomic_load_explicit(&pred->next, AINT_SAFE_ACQUIRE);
+        }
+        /* Otherwise the compare_exchange failed as something was inserted
+         * after pred, and pred_link now points to it */
+    }
+    *pred_out = pred;
+    return node_to_entry(MarkedSlist_link_to_node(pred_link));
+}
+
+
+HashMapEntry *HashMap_find(HashMap *map, uintptr_t key) {
+    MarkedSlistNode *bucket = bucket_of(map, key);
+    uintptr_t        link =
+            atomic_load_explicit(&bucket->next, AINT_SAFE_ACQUIRE);
+    for (MarkedSlistNode *node = MarkedSlist_link_to_node(link); node != NULL;
+         node                  = MarkedSlist_link_to_node(link)) {
+        link = atomic_load_explicit(&node->next, AINT_SAFE_ACQUIRE);
+        HashMapEntry *entry = node_to_entry(node);
+        if (entry->key >= key) {
+            if (entry->key == key && !MarkedSlist_is_marked(link)) {
+                return entry;
+            }
+            /* A marked entry with the same key was deleted before this
+             * read, and any new entry with the key was inserted after it */
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+HashMapEntry *HashMap_insert(HashMap *map, HashMapEntry *entry) {
+    MarkedSlistNode *bucket = bucket_of(map, entry->key);
+    MarkedSlistNode *pred;
+    uintptr_t        expected;
+    do {
+        HashMapEntry *current = HashMap_search(bucket, entry->key, &pred);
+        if (current != NULL && current->key == entry->key) { return NULL; }
+
+        expected = current == NULL ? 0 : (uintptr_t)&current->node;
+        atomic_store_explicit(&entry->node.next, expected, AINT_SAFE_RELAXED);
+        /* This fails if pred was deleted or something was inserted after it
+         * since the search */
+    } while (!atomic_compare_exchange_strong_explicit(&pred->next,
+                                                      &expected,
+                                                      (uintptr_t)&entry->node,
+                                                      AINT_SAFE_RELEASE,
+                                                      AINT_SAFE_RELAXED));
+    return entry;
+}
+
+
+HashMapEntry *HashMap_delete(HashMap *map, uintptr_t key) {
+    MarkedSlistNode *bucket = bucket_of(map, key);
+    MarkedSlistNode *pred;
+    while (1) {
+        HashMapEntry *current = HashMap_search(bucket, key, &pred);
+        if (current == NULL || current->key != key) { return NULL; }
+
+        uintptr_t link =
+                atomic_load_explicit(&current->node.next, AINT_SAFE_RELAXED);
+        if (MarkedSlist_is_marked(link)
+            || !atomic_compare_exchange_strong_explicit(
+                    &current->node.next,
+                    &link,
+                    link | MARKED_SLIST_MARK,
+                    AINT_SAFE_ACQUIRE,
+                    AINT_SAFE_RELAXED)) {
+            /* Someone else is deleting it, or something was inserted after it.
+             * Search again, which unlinks it in the former case. */
+            continue;
+        }
+        /* We own the delete now */
+        uintptr_t expected = (uintptr_t)&current->node;
+        if (!atomic_compare_exchange_strong_explicit(&pred->next,
+                                                     &expected,
+                                                     link,
+                                                     AINT_SAFE_ACQ_REL,
+                                                     AINT_SAFE_RELAXED)) {
+            /* Searching for it unlinks it */
+            HashMap_search(bucket, key, &pred);
+        }
+        return current;
+    }
+}
@@ -0,0 +1,132 @@
+/** \file hash_map.h
+ *
+ * Interrupt-safe lock-free fixed capacity hash map of intrusive entries
+ *
+ * Each bucket is a \ref marked_slist.h list sorted by key. Looking up an entry
+ * only reads the bucket, while insert and delete use a single
+ * compare_exchange each in the common case.
+ *
+ * Usage:
+ * \code{.c}
+ * typedef struct {
+ *     HashMapEntry entry;
+ *     ... // per-flow state
+ * } Flow;
+ *
+ * static Flow flow_array[256];
+ * static membag_alloc_status_t flow_status[MEMBAG_ALLOC_STATUS_LEN(256)];
+ * static Membag flow_pool = MEMBAG_STATIC_INIT(
+ *         sizeof(Flow), 256, flow_status, flow_array);
+ *
+ * static MarkedSlistNode flow_buckets[64];
+ * static HashMap flows = HASH_MAP_STATIC_INIT(64, flow_buckets);
+ *
+ * Flow *flow_get(uintptr_t flow_id) {
+ *     HashMapEntry *e = HashMap_find(&flows, flow_id);
+ *     if (e != NULL) return CONTAINER_OF(e, Flow, entry);
+ *
+ *     Flow *flow = Membag_acquire(&flow_pool);
+ *     if (flow == NULL) return NULL;
+ *     flow->entry.key = flow_id;
+ *     if (HashMap_insert(&flows, &flow->entry) == NULL) {
+ *         // Someone else inserted it meanwhile
+ *         Membag_release(&flow_pool, flow);
+ *         return flow_get(flow_id);
+ *     }
+ *     return flow;
+ * }
+ *
+ * void flow_end(uintptr_t flow_id) {
+ *     HashMapEntry *e = HashMap_delete(&flows, flow_id);
+ *     // Retire to an EpochReclaim if there are concurrent lookups
+ *     EpochReclaim_retire(&reclaim, &flow_pool, CONTAINER_OF(e, Flow, entry));
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__HASH_MAP_H
+#define AINT_SAFE__HASH_MAP_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "marked_slist.h"
+
+
+/** \brief Entry of the hash map
+ *
+ * Embed this in the structure to store and use #CONTAINER_OF to get back to
+ * it.
+ */
+typedef struct {
+    /** Link in the bucket list */
+    MarkedSlistNode node;
+    /** Key of the entry. This must not be changed while it is in a map. */
+    uintptr_t key;
+} HashMapEntry;
+
+
+/** \brief Internal data structure of the hash map
+ *
+ * This must be initialized with #HASH_MAP_STATIC_INIT at declaration.
+ */
+typedef struct {
+    /** Dummy heads of the bucket lists */
+    MarkedSlistNode *const buckets;
+    /** Number of elements in #buckets */
+    const size_t n_buckets;
+} HashMap;
+
+
+/** \brief Statically initialize a #HashMap
+ *
+ * \param p_n_buckets     number of elements in \p p_bucket_array
+ * \param p_bucket_array  zero initialized array of #MarkedSlistNode to use as
+ *                        the bucket heads
+ *
+ * \return A #HashMap static initializer
+ */
+#define HASH_MAP_STATIC_INIT(p_n_buckets, p_bucket_array) \
+    { .buckets = p_bucket_array, .n_buckets = p_n_buckets }
+
+
+/** \brief Find the entry with a key
+ *
+ * This does not modify \p map.
+ *
+ * \param map #HashMap to search
+ * \param key key to find
+ *
+ * \return the entry with \p key
+ * \retval NULL if there is no entry with \p key
+ */
+HashMapEntry *HashMap_find(HashMap *map, uintptr_t key);
+
+
+/** \brief Insert an entry if there isn't one with the same key
+ *
+ * \param map   #HashMap to insert into
+ * \param entry entry with HashMapEntry::key set
+ *
+ * \return \p entry
+ * \retval NULL if \p map already has an entry with the same key
+ */
+HashMapEntry *HashMap_insert(HashMap *map, HashMapEntry *entry);
+
+
+/** \brief Delete the entry with a key
+ *
+ * \param map #HashMap to delete from
+ * \param key key of the entry to delete
+ *
+ * \return the deleted entry, once it is unlinked from \p map
+ * \retval NULL if there is no entry with \p key
+ *
+ * \note A concurrent lookup may still hold the entry after this returns. Use
+ * an #EpochReclaim to defer releasing it to its #Membag.
+ */
+HashMapEntry *HashMap_delete(HashMap *map, uintptr_t key);
+
+
+#endif /* ifndef AINT_SAFE__HASH_MAP_H */
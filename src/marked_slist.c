@@ -0,0 +1,152 @@
+/** \file marked_slist.c
+ *
+ * Interrupt-safe singly linked list with the deletion mark in the link
+ *
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "marked_slist.h"
+#include "memory_order.h"
+#include <assert.h>
+#include <stdbool.h>
+
+/* A node is deleted in two steps. First, the mark bit is set in its own next
+ * link. This is the point at which it is visibly deleted, and it also freezes
+ * the link as appends and unlinks that expect an unmarked link will fail.
+ * Second, the predecessor link is swung past it. The second step can be done
+ * by anyone that finds the node marked (the deleter, or a traversal passing
+ * over it), so an interrupted delete never blocks anyone.
+ *
+ * Every decision is made by a compare_exchange on a single link, so no
+ * operation relies on a total order over several links, and none is
+ * seq_cst. A link is loaded with acquire, as the node it points to is read
+ * next. Linking a node in releases its contents. Swinging a link past a
+ * deleted node is acquire and release, as it stores a successor that was
+ * itself loaded from another link, and on failure it is acquire as the new
+ * link is followed. Marking is acquire for the same reason, and the stores
+ * to a node before it is linked in are relaxed. hash_map.c and skip_list.c
+ * use the same orderings. */
+
+static inline uintptr_t node_to_link(MarkedSlistNode *node) {
+    return (uintptr_t)node;
+}
+
+
+MarkedSlistNode *MarkedSlist_next(MarkedSlistNode *node) {
+    uintptr_t link = atomic_load_explicit(&node->next, AINT_SAFE_ACQUIRE);
+    MarkedSlistNode *next = MarkedSlist_link_to_node(link);
+    while (next != NULL) {
+        uintptr_t next_link =
+                atomic_load_explicit(&next->next, AINT_SAFE_ACQUIRE);
+        if (!MarkedSlist_is_marked(next_link)) { break; }
+        if (MarkedSlist_is_marked(link)) {
+            /* node is deleted itself, so we can't unlink through it. Just
+             * skip over the deleted node. */
+            next = MarkedSlist_link_to_node(next_link);
+        } else {
+            /* Help unlink the deleted node. On failure, link is updated with
+             * whatever was inserted or unlinked after node meanwhile. */
+            if (atomic_compare_exchange_strong_explicit(
+                        &node->next,
+                        &link,
+                        MarkedSlist_unmarked(next_link),
+                        AINT_SAFE_ACQ_REL,
+                        AINT_SAFE_ACQUIRE)) {
+                link = MarkedSlist_unmarked(next_link);
+            }
+            next = MarkedSlist_link_to_node(link);
+        }
+    }
+    return next;
+}
+
+
+MarkedSlistNode *MarkedSlist_append(MarkedSlistNode *node,
+                                    MarkedSlistNode *new) {
+    uintptr_t link = atomic_load_explicit(&node->next, AINT_SAFE_RELAXED);
+    do {
+        if (MarkedSlist_is_marked(link)) {
+            /* Don't append to a deleted node. The mark is checked as a part
+             * of the compare_exchange, so a delete that occurs before it makes
+             * it fail. */
+            return NULL;
+        }
+        atomic_store_explicit(&new->next, link, AINT_SAFE_RELAXED);
+    } while (!atomic_compare_exchange_strong_explicit(&node->next,
+                                                      &link,
+                                                      node_to_link(new),
+                                                      AINT_SAFE_RELEASE,
+                                                      AINT_SAFE_RELAXED));
+    return new;
+}
+
+
+MarkedSlistNode *MarkedSlist_delete_after(MarkedSlistNode *node,
+                                          MarkedSlistNode *to_delete) {
+    if (MarkedSlist_is_marked(
+                atomic_load_explicit(&node->next, AINT_SAFE_RELAXED))) {
+        /* Don't modify a deleted node. This is mostly a user error */
+        return NULL;
+    }
+
+    uintptr_t link = atomic_load_explicit(&to_delete->next, AINT_SAFE_RELAXED);
+    do {
+        if (MarkedSlist_is_marked(link)) {
+            /* Someone else is deleting this node */
+            return NULL;
+        }
+    } while (!atomic_compare_exchange_strong_explicit(&to_delete->next,
+                                                      &link,
+                                                      link | MARKED_SLIST_MARK,
+                                                      AINT_SAFE_ACQUIRE,
+                                                      AINT_SAFE_RELAXED));
+    /* to_delete is now visibly deleted and link is its frozen successor */
+
+    uintptr_t expected = node_to_link(to_delete);
+    if (atomic_compare_exchange_strong_explicit(&node->next,
+                                                &expected,
+                                                link,
+                                                AINT_SAFE_ACQ_REL,
+                                                AINT_SAFE_RELAXED)) {
+        /* Common case: node was the predecessor */
+        return to_delete;
+    }
+
+    /* Walk from node, unlinking every deleted node on the way. We are done
+     * when either we unlink to_delete, or we find that someone else already
+     * has. A deleted node can never be linked back into the list. */
+    MarkedSlistNode *prev      = node;
+    uintptr_t prev_link = atomic_load_explicit(&prev->next, AINT_SAFE_ACQUIRE);
+    while (1) {
+        MarkedSlistNode *current = MarkedSlist_link_to_node(prev_link);
+        if (current == NULL) {
+            /* Walked past the end, someone else unlinked it */
+            return to_delete;
+        }
+        uintptr_t current_link =
+                atomic_load_explicit(&current->next, AINT_SAFE_ACQUIRE);
+        if (!MarkedSlist_is_marked(current_link)) {
+            prev      = current;
+            prev_link = current_link;
+        } else if (atomic_compare_exchange_strong_explicit(
+                           &prev->next,
+                           &prev_link,
+                           MarkedSlist_unmarked(current_link),
+                           AINT_SAFE_ACQ_REL,
+                           AINT_SAFE_ACQUIRE)) {
+            if (current == to_delete) { return to_delete; }
+            prev_link = MarkedSlist_unmarked(current_link);
+        } else if (MarkedSlist_is_marked(prev_link)) {
+            /* prev got deleted meanwhile. Start again from node. */
+            prev      = node;
+            prev_link = atomic_load_explicit(&prev->next, AINT_SAFE_ACQUIRE);
+            if (MarkedSlist_is_marked(prev_link)) {
+                /* node must not be deleted while we are using it */
+                assert(false);
+                return NULL;
+            }
+        }
+        /* Otherwise the compare_exchange failed as something was inserted
+         * after prev, and prev_link now points to it */
+    }
+}
@@ -0,0 +1,135 @@
+/** \file marked_slist.h
+ *
+ * Interrupt-safe singly linked list with the deletion mark in the link
+ *
+ * This is a variant of \ref slist.h in which a node is logically deleted by
+ * setting the lowest bit of its \c next link (Harris' algorithm). A traversal
+ * learns whether a node is deleted from the same word that it loads to hop to
+ * the next node, and physically unlinks deleted nodes that it passes over.
+ *
+ * Usage:
+ * \code{.c}
+ * typedef struct {
+ *     int             value;
+ *     MarkedSlistNode node;
+ * } MyStruct;
+ *
+ * // The head is a dummy node that is never deleted
+ * static MarkedSlistNode head;
+ *
+ * void handler(MyStruct *new_elem) {
+ *     MarkedSlist_append(&head, &new_elem->node);
+ *     for (MarkedSlistNode *n = MarkedSlist_next(&head); n != NULL;
+ *          n                  = MarkedSlist_next(n)) {
+ *         MyStruct *elem = CONTAINER_OF(n, MyStruct, node);
+ *         ...
+ *     }
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__MARKED_SLIST_H
+#define AINT_SAFE__MARKED_SLIST_H 1
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(
+        atomic_is_lock_free((uintptr_t *)NULL),
+        "Your stdlib implementation does not have lock-free uintptr_t atomics");
+#endif
+
+
+/** \brief Node of the marked singly linked list
+ *
+ * Embed this in the structure to link and use #CONTAINER_OF to get back to
+ * it.
+ */
+struct MarkedSlistNode {
+    /** Address of the next node, with the lowest bit set if \b this node is
+     * deleted */
+    _Atomic uintptr_t next;
+};
+typedef struct MarkedSlistNode MarkedSlistNode;
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(_Alignof(MarkedSlistNode) >= 2,
+               "The lowest bit of a node address must be free for the mark");
+#endif
+
+
+/** Bit set in MarkedSlistNode::next when the node is deleted */
+#define MARKED_SLIST_MARK ((uintptr_t)1)
+
+
+/** \brief Check if a MarkedSlistNode::next link has the deletion mark */
+static inline bool MarkedSlist_is_marked(uintptr_t link) {
+    return link & MARKED_SLIST_MARK;
+}
+
+
+/** \brief Clear the deletion mark from a MarkedSlistNode::next link */
+static inline uintptr_t MarkedSlist_unmarked(uintptr_t link) {
+    return link & ~MARKED_SLIST_MARK;
+}
+
+
+/** \brief Get the node that a MarkedSlistNode::next link points to */
+static inline MarkedSlistNode *MarkedSlist_link_to_node(uintptr_t link) {
+    return (MarkedSlistNode *)MarkedSlist_unmarked(link);
+}
+
+
+/** \brief Get the next node that is not deleted
+ *
+ * Deleted nodes that are passed over are unlinked from \p node if \p node is
+ * not deleted itself.
+ *
+ * \param node node to start from
+ *
+ * \return the next node after \p node
+ * \retval NULL if \p node is the last node
+ */
+MarkedSlistNode *MarkedSlist_next(MarkedSlistNode *node);
+
+
+/** \brief Insert a node just after another
+ *
+ * \param node node to insert after
+ * \param new  node to insert
+ *
+ * \return \p new
+ * \retval NULL if \p node is deleted
+ */
+MarkedSlistNode *MarkedSlist_append(MarkedSlistNode *node,
+                                    MarkedSlistNode *new);
+
+
+/** \brief Delete a node
+ *
+ * \param node a node before \p to_delete, ideally its immediate predecessor
+ * \param to_delete node to delete
+ *
+ * \return \p to_delete once it is unlinked and no longer reachable from
+ *     \p node
+ * \retval NULL if \p node or \p to_delete is already deleted
+ *
+ * Deleting is O(1) if \p node is the predecessor of \p to_delete. Otherwise
+ * the list is walked from \p node, unlinking any other deleted nodes on the
+ * way.
+ *
+ * \pre \p node must not be deleted while this call is in progress. A dummy
+ * list head satisfies this trivially.
+ * \note A traversal that was already at \p to_delete may still hold it after
+ * this returns. Use an #EpochReclaim to defer reusing it.
+ */
+MarkedSlistNode *MarkedSlist_delete_after(MarkedSlistNode *node,
+                                          MarkedSlistNode *to_delete);
+
+
+#endif /* ifndef AINT_SAFE__MARKED_SLIST_H */
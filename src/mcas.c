@@ -5,6 +5,8 @@
 /* Copyright 2018 Gaurav Juvekar */
 
 #include "mcas.h"
+#include "memory_order.h"
+#include "stats.h"
 #include <assert.h>
 #include <stdbool.h>
 
@@ -15,6 +17,25 @@
  * the list.
  * Essentially, every interrupt will first try and complete the work of the
  * operation that it interrupted before performing it's own operations.
+ *
+ * An Mcas is only safe against nesting, so every operation on it runs on one
+ * CPU, and a nested one runs to completion before the one it interrupted
+ * resumes. A CPU sees its own accesses in program order, so the orderings
+ * only have to stop the compiler from moving an access across another one
+ * that a nested operation could observe in between:
+ *  - Linking a journal releases its fields, and following a chain link
+ *    acquires them.
+ *  - The status and the swapping flag are released after the work that they
+ *    report, and acquired before acting on them. The per-word compare-
+ *    exchanges are acq_rel, so that they stay between the swapping flag and
+ *    the status, and so that the data written before an operation is
+ *    published with the words (eg. the slots of a #NestedQueue).
+ *  - The comparisons with the expected values only need the value.
+ *  - Unlinking a journal is followed by a signal fence, so that a later
+ *    operation reusing the same stack for its journal can't be moved before
+ *    it, while a nested operation could still find the old one linked.
+ * Nothing here relies on a single total order over several variables. That
+ * only matters between CPUs, and an Mcas is only used on one.
  */
 
 /** An operation status */
@@ -22,6 +43,8 @@ typedef enum {
     MCAS_STATUS_SUCCESS,
     MCAS_STATUS_FAILURE,
     MCAS_STATUS_UNDEFINED,
+    /** Failed, but the current values are still being fetched */
+    MCAS_STATUS_FETCHING,
 } McasStatus;
 
 _Static_assert(atomic_is_lock_free((McasStatus *)NULL),
@@ -55,6 +78,10 @@ struct McasJournal {
             /* We start swapping if data == expected, otherwise, data ==
              * expected is still being compared */
             atomic_bool swapping;
+            /** For Mcas_compare_exchange_fetch, destination to fetch the
+             * current values to on failure (or NULL) */
+            mcas_base_t *const fetch_dest;
+            atomic_flag *const fetch_flags;
         };
         /* For Mcas_read */
         struct {
@@ -67,83 +94,168 @@ struct McasJournal {
 
 
 static McasJournal *_Atomic *link_McasJournal(Mcas *       mcas,
-                                              McasJournal *journal) {
+                                              McasJournal *journal,
+                                              size_t *     chain_length) {
     McasJournal *_Atomic *j    = &mcas->journal;
     McasJournal *         next = NULL;
-    while (!atomic_compare_exchange_strong(j, &next, journal)) {
+    *chain_length              = 0;
+    while (!atomic_compare_exchange_strong_explicit(
+            j, &next, journal, AINT_SAFE_ACQ_REL, AINT_SAFE_ACQUIRE)) {
         j    = &next->operation_chain;
         next = NULL;
+        *chain_length += 1;
     }
     return j;
 }
 
 
+/* Read all the words into dest. Each word is written to dest only once, by
+ * whoever gets its flag first, as a nested call may finish the read while an
+ * interrupted one is halfway through it. */
+static void read_words(Mcas *mcas, mcas_base_t *dest, atomic_flag *flags) {
+    for (size_t i = 0; i < mcas->n_elems; i++) {
+        mcas_base_t value =
+                atomic_load_explicit(&mcas->data[i], AINT_SAFE_ACQUIRE);
+        if (!atomic_flag_test_and_set_explicit(&flags[i], AINT_SAFE_ACQUIRE)) {
+            /* No need for this write to dest to be atomic as the flag acts
+             * like a once-only mutex */
+            dest[i] = value;
+        }
+    }
+}
+
+
+static void complete_fetch(Mcas *mcas, McasJournal *journal) {
+    read_words(mcas, journal->fetch_dest, journal->fetch_flags);
+    atomic_store_explicit(
+            &journal->status, MCAS_STATUS_FAILURE, AINT_SAFE_RELEASE);
+}
+
+
 static void complete_mcas(Mcas *mcas, McasJournal *journal) {
-    McasStatus status = atomic_load(&journal->status);
-    if (status == MCAS_STATUS_UNDEFINED) {
-        if (!atomic_load(&journal->swapping)) {
+    McasStatus status =
+            atomic_load_explicit(&journal->status, AINT_SAFE_ACQUIRE);
+    if (status == MCAS_STATUS_FETCHING) {
+        complete_fetch(mcas, journal);
+    } else if (status == MCAS_STATUS_UNDEFINED) {
+        if (!atomic_load_explicit(&journal->swapping, AINT_SAFE_ACQUIRE)) {
             /* Still comparing */
             for (size_t i = 0; i < mcas->n_elems; i++) {
-                if (atomic_load(&mcas->data[i]) != journal->expected[i]) {
+                if (atomic_load_explicit(&mcas->data[i], AINT_SAFE_RELAXED)
+                    != journal->expected[i]) {
                     /* We need the strong version so that there aren't any
                      * spurious failures. If journal->status has changed, it
                      * could be a SUCCESS or a FAILURE. A success means that
                      * someone completed the MCAS or data != expected. In
                      * either cases, the MCAS has been completed and we just
                      * return. Otherwise, we set it to a FAILURE and return */
-                    atomic_compare_exchange_strong(
-                            &journal->status, &status, MCAS_STATUS_FAILURE);
+                    const McasStatus failed = journal->fetch_dest != NULL
+                                                      ? MCAS_STATUS_FETCHING
+                                                      : MCAS_STATUS_FAILURE;
+                    atomic_compare_exchange_strong_explicit(
+                            &journal->status,
+                            &status,
+                            failed,
+                            AINT_SAFE_ACQ_REL,
+                            AINT_SAFE_ACQUIRE);
+                    if (atomic_load_explicit(&journal->status,
+                                             AINT_SAFE_ACQUIRE)
+                        == MCAS_STATUS_FETCHING) {
+                        /* The words can't change until this operation is
+                         * complete, so this reads the values that made it
+                         * fail */
+                        complete_fetch(mcas, journal);
+                    }
                     return;
                 }
             }
             /* data == expected, now to actually set desired => data */
-            atomic_store(&journal->swapping, true);
+            atomic_store_explicit(
+                    &journal->swapping, true, AINT_SAFE_RELEASE);
         }
-        /* Now, we set data to desired value (compare is successful) */
+        /* Now, we set data to desired value (compare is successful). This
+         * can't be a plain store: if we are interrupted just before it, the
+         * interrupt completes this operation and may then do its own, which
+         * a plain store here would overwrite once we resume. Only words still
+         * at their expected value are stored. (A word changed by later
+         * operations back to exactly its expected value, all within the
+         * interrupt, is still overwritten.) */
         for (size_t i = 0; i < mcas->n_elems; i++) {
-            atomic_store(&mcas->data[i], journal->desired[i]);
+            mcas_base_t expected = journal->expected[i];
+            if (!atomic_compare_exchange_strong_explicit(
+                        &mcas->data[i],
+                        &expected,
+                        journal->desired[i],
+                        AINT_SAFE_ACQ_REL,
+                        AINT_SAFE_RELAXED)) {
+                /* Already stored by whoever interrupted us */
+                AINT_SAFE_STAT_ADD(MCAS_REDUNDANT_STORES, 1);
+                AINT_SAFE_PROBE2(mcas_redundant_store, mcas, i);
+            }
         }
-        atomic_store(&journal->status, MCAS_STATUS_SUCCESS);
+        atomic_store_explicit(
+                &journal->status, MCAS_STATUS_SUCCESS, AINT_SAFE_RELEASE);
     }
 }
 
 
 static void complete_read(Mcas *mcas, McasJournal *journal) {
-    if (atomic_load(&journal->status) == MCAS_STATUS_UNDEFINED) {
-        for (size_t i = 0; i < mcas->n_elems; i++) {
-            mcas_base_t value = atomic_load(&mcas->data[i]);
-            if (!atomic_flag_test_and_set(&journal->read_flags[i])) {
-                /* No need for this write to dest to be atomic as the flag acts
-                 * like a once-only mutex */
-                journal->read_dest[i] = value;
-            }
-        }
-        atomic_store(&journal->status, MCAS_STATUS_SUCCESS);
+    if (atomic_load_explicit(&journal->status, AINT_SAFE_ACQUIRE)
+        == MCAS_STATUS_UNDEFINED) {
+        read_words(mcas, journal->read_dest, journal->read_flags);
+        atomic_store_explicit(
+                &journal->status, MCAS_STATUS_SUCCESS, AINT_SAFE_RELEASE);
     }
 }
 
 
-static void complete_operation(Mcas *mcas, McasJournal *journal) {
+/* Returns whether the operation was still pending */
+static _Bool complete_operation(Mcas *mcas, McasJournal *journal) {
+    const McasStatus status =
+            atomic_load_explicit(&journal->status, AINT_SAFE_ACQUIRE);
+    if (status != MCAS_STATUS_UNDEFINED && status != MCAS_STATUS_FETCHING) {
+        return false;
+    }
     switch (journal->operation) {
     case MCAS_OPERATION_READ: complete_read(mcas, journal); break;
     case MCAS_OPERATION_CAS: complete_mcas(mcas, journal); break;
     }
+    return true;
 }
 
 static void execute_operation(Mcas *mcas, McasJournal *journal) {
-    McasJournal *_Atomic *prev_node = link_McasJournal(mcas, journal);
+    size_t                chain_length;
+    McasJournal *_Atomic *prev_node =
+            link_McasJournal(mcas, journal, &chain_length);
+    AINT_SAFE_STAT_ADD(MCAS_OPERATIONS, 1);
+    AINT_SAFE_STAT_ADD(MCAS_CHAIN_LENGTH_SUM, chain_length);
+    AINT_SAFE_STAT_MAX(MCAS_CHAIN_LENGTH_MAX, chain_length);
+    AINT_SAFE_PROBE2(mcas_link, mcas, chain_length);
+
     /* Traverse the journal chain and complete operations */
-    for (McasJournal *j = atomic_load(&mcas->journal); j != NULL;
-         j              = atomic_load(&j->operation_chain)) {
-        complete_operation(mcas, j);
+    size_t helped = 0;
+    for (McasJournal *j = atomic_load_explicit(&mcas->journal,
+                                               AINT_SAFE_ACQUIRE);
+         j != NULL;
+         j = atomic_load_explicit(&j->operation_chain, AINT_SAFE_ACQUIRE)) {
+        if (complete_operation(mcas, j) && j != journal) { helped++; }
     }
+    AINT_SAFE_STAT_ADD(MCAS_HELPED_SUM, helped);
+    AINT_SAFE_STAT_MAX(MCAS_HELPED_MAX, helped);
+    AINT_SAFE_PROBE2(mcas_helped, mcas, helped);
     /* Must be NULL as this function preserves state with nesting. Every
      * appended journal entry is unlinked before it returns */
-    assert(atomic_load(&journal->operation_chain) == NULL);
+    assert(atomic_load_explicit(&journal->operation_chain, AINT_SAFE_RELAXED)
+           == NULL);
     /* unlink this journal that we added. We could equivalently just set the
      * previous journal's chain pointer to NULL (see previous assert) */
-    atomic_store(prev_node, journal->operation_chain);
-    assert(atomic_load(&journal->operation_chain) == NULL);
+    atomic_store_explicit(prev_node,
+                          atomic_load_explicit(&journal->operation_chain,
+                                               AINT_SAFE_RELAXED),
+                          AINT_SAFE_RELEASE);
+    atomic_signal_fence(memory_order_seq_cst);
+    assert(atomic_load_explicit(&journal->operation_chain, AINT_SAFE_RELAXED)
+           == NULL);
 }
 
 
@@ -157,9 +269,12 @@ _Bool Mcas_compare_exchange(Mcas *     mcas,
             .expected        = expected,
             .desired         = desired,
             .swapping        = false,
+            .fetch_dest      = NULL,
+            .fetch_flags     = NULL,
     };
     execute_operation(mcas, &journal);
-    McasStatus status = atomic_load(&journal.status);
+    McasStatus status =
+            atomic_load_explicit(&journal.status, AINT_SAFE_ACQUIRE);
     if (status == MCAS_STATUS_SUCCESS) {
         return true;
     } else {
@@ -168,13 +283,43 @@ _Bool Mcas_compare_exchange(Mcas *     mcas,
 }
 
 
+_Bool Mcas_compare_exchange_fetch(Mcas *             mcas,
+                                  mcas_base_t *      expected,
+                                  const mcas_base_t *desired) {
+    /* Fetched separately, as expected is still being compared with by the
+     * nested calls until the operation is complete */
+    mcas_base_t current[mcas->n_elems];
+    atomic_flag fetch_flags[mcas->n_elems];
+    for (size_t i = 0; i < mcas->n_elems; i++) {
+        atomic_flag_clear_explicit(&fetch_flags[i], AINT_SAFE_RELAXED);
+    }
+    McasJournal journal = {
+            .operation_chain = NULL,
+            .operation       = MCAS_OPERATION_CAS,
+            .status          = MCAS_STATUS_UNDEFINED,
+            .expected        = expected,
+            .desired         = desired,
+            .swapping        = false,
+            .fetch_dest      = current,
+            .fetch_flags     = fetch_flags,
+    };
+    execute_operation(mcas, &journal);
+    if (atomic_load_explicit(&journal.status, AINT_SAFE_ACQUIRE)
+        == MCAS_STATUS_SUCCESS) {
+        return true;
+    }
+    for (size_t i = 0; i < mcas->n_elems; i++) { expected[i] = current[i]; }
+    return false;
+}
+
+
 _Bool Mcas_read(Mcas *mcas, mcas_base_t *data) {
     /* one flag after reading one mcas_base_t. The call that acquires this flag
      * will write it to the destination. */
     atomic_flag read_flags[mcas->n_elems];
 
     for (size_t i = 0; i < mcas->n_elems; i++) {
-        atomic_flag_clear(&read_flags[i]);
+        atomic_flag_clear_explicit(&read_flags[i], AINT_SAFE_RELAXED);
     }
     McasJournal journal = {
             .operation_chain = NULL,
@@ -185,6 +330,7 @@ _Bool Mcas_read(Mcas *mcas, mcas_base_t *data) {
     };
 
     execute_operation(mcas, &journal);
-    assert(atomic_load(&journal.status) == MCAS_STATUS_SUCCESS);
+    assert(atomic_load_explicit(&journal.status, AINT_SAFE_RELAXED)
+           == MCAS_STATUS_SUCCESS);
     return true;
 }
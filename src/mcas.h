@@ -83,9 +83,96 @@ _Bool Mcas_read(Mcas *mcas, mcas_base_t *data);
  *
  * \note This function does \b NOT replace \p expected with the current values
  * if \p mcas->data and \p expected are not equal.
+ *
+ * \note The values of each word should never repeat (eg. free running
+ * counters). If an interrupt completes this operation and then changes a word
+ * back to its value in \p expected, the interrupted call overwrites it with
+ * the value in \p desired when it resumes.
  */
 _Bool Mcas_compare_exchange(Mcas *             mcas,
                             const mcas_base_t *expected,
                             const mcas_base_t *desired);
 
+
+/** \brief Atomically compare and swap values of the MCAS, fetching the
+ * current values on failure
+ *
+ * The same as #Mcas_compare_exchange, except that if the values are not equal
+ * to \p expected, \p expected is replaced with the current values, as with
+ * \c atomic_compare_exchange_strong. In a read-modify-CAS loop, this saves
+ * the #Mcas_read before every retry.
+ *
+ * \param mcas     to perform the CAS on
+ * \param expected values before the CAS, replaced with the current values on
+ * failure (array of \p mcas->n_elems mcas_base_t)
+ * \param desired  values after the CAS (array of \p mcas->n_elems
+ * mcas_base_t)
+ *
+ * \retval true  if the MCAS opearation succeeded
+ * \retval false otherwise
+ */
+_Bool Mcas_compare_exchange_fetch(Mcas *             mcas,
+                                  mcas_base_t *      expected,
+                                  const mcas_base_t *desired);
+
+
+#ifndef AINT_SAFE_MCAS_BACKOFF
+/** \brief Bounded exponential backoff in Mcas retry loops
+ *
+ * The most CPU relax instructions (\c pause on x86, \c yield on ARMv7 and
+ * later) the default #AINT_SAFE_MCAS_RETRY spins for before a retry. The
+ * spin starts at 1 and doubles with every failed attempt up to this. Define
+ * it for the whole build to override. The default 0 retries immediately.
+ *
+ * It is off by default for the reason given at #AINT_SAFE_MCAS_RETRY. The
+ * \c mcas_contended benchmark of bench/aint_bench.c measures its cost.
+ */
+#define AINT_SAFE_MCAS_BACKOFF 0
+#endif
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MCAS_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__GNUC__) \
+        && (defined(__aarch64__) || (defined(__ARM_ARCH) && __ARM_ARCH >= 7))
+#define MCAS_CPU_RELAX() __asm__ volatile("yield" ::: "memory")
+#else
+#define MCAS_CPU_RELAX() atomic_signal_fence(memory_order_seq_cst)
+#endif
+
+
+#if AINT_SAFE_MCAS_BACKOFF
+/** \brief Spin before the next retry of an Mcas retry loop
+ *
+ * \param attempt number of failed attempts so far, from 1
+ */
+static inline void Mcas_backoff(unsigned int attempt) {
+    unsigned int spins = 1;
+    while (--attempt > 0 && spins < AINT_SAFE_MCAS_BACKOFF) { spins *= 2; }
+    if (spins > AINT_SAFE_MCAS_BACKOFF) { spins = AINT_SAFE_MCAS_BACKOFF; }
+    for (unsigned int i = 0; i < spins; i++) { MCAS_CPU_RELAX(); }
+}
+#endif
+
+
+#ifndef AINT_SAFE_MCAS_RETRY
+/** \brief Contention management hook for Mcas retry loops
+ *
+ * Expanded with the number of failed attempts so far (from 1) before every
+ * retry of a read-modify-CAS loop on an #Mcas (those of #NestedQueue).
+ * Define it for the whole build to override, eg. to yield when a thread
+ * retries too often.
+ *
+ * The default calls Mcas_backoff() if #AINT_SAFE_MCAS_BACKOFF is set, and
+ * otherwise retries immediately. A compare-exchange only fails when a
+ * nested operation changed the values, and the interrupted operation can't
+ * run until that one returns, so waiting before the retry only adds latency.
+ */
+#if AINT_SAFE_MCAS_BACKOFF
+#define AINT_SAFE_MCAS_RETRY(attempt) Mcas_backoff(attempt)
+#else
+#define AINT_SAFE_MCAS_RETRY(attempt) ((void)0)
+#endif
+#endif
+
 #endif /* ifndef AINT_SAFE__MCAS_H */
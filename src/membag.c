@@ -6,9 +6,32 @@
 
 #include "membag.h"
 
+#include "memory_order.h"
+
+#include <assert.h>
+#include <limits.h>
+
+/* n_free reserves a slot and alloc_status hands it over. The reservation is
+ * acquire and the return of a slot to n_free is release, so that a slot is
+ * always cleared in alloc_status before it is counted as free. Otherwise an
+ * interrupt between the two could find n_free > 0 and search forever for a
+ * slot that the interrupted release hasn't cleared yet.
+ *
+ * A bulk acquire reserves with a compare-exchange rather than a fetch_sub, so
+ * that it never takes more than is free. Overshooting and giving the rest
+ * back, as the single acquire does, would make a nested acquire fail while
+ * there are still free slots for up to the whole batch instead of one. The
+ * search hint is only a starting point, so it is relaxed.
+ *
+ * A slot of a refcounted membag is only written to by its holders, so its
+ * count is set with a plain store on acquire. Dropping a reference is release
+ * and dropping the last one also acquire, so that all the uses of the slot
+ * happen before it is released. */
+
 
 void Membag_init(Membag *membag) {
     atomic_init(&membag->n_free, membag->n_elems);
+    atomic_init(&membag->next_scan, 0);
     for (size_t i = 0; i < membag->n_elems; i++) {
         atomic_flag_clear(&membag->alloc_status[i]);
     }
@@ -16,27 +39,66 @@ void Membag_init(Membag *membag) {
 
 
 void *Membag_acquire(Membag *membag) {
-    int acquired = atomic_fetch_sub(&membag->n_free, 1);
+    int acquired =
+            atomic_fetch_sub_explicit(&membag->n_free, 1, AINT_SAFE_ACQUIRE);
     if (!(acquired > 0)) {
         /* Restore the acquire as there is no free slot available */
-        atomic_fetch_add(&membag->n_free, 1);
+        atomic_fetch_add_explicit(&membag->n_free, 1, AINT_SAFE_RELAXED);
         return NULL;
     } else {
         /* We have reserved a free slot somewhere in the membag. Now to
          * actually find and acquire it */
         size_t i = 0;
-        while (atomic_flag_test_and_set(&membag->alloc_status[i])) {
+        while (atomic_flag_test_and_set_explicit(&membag->alloc_status[i],
+                                                 AINT_SAFE_ACQUIRE)) {
             i = (i + 1) % membag->n_elems;
         }
+        if (membag->refcounts != NULL) {
+            atomic_store_explicit(&membag->refcounts[i], 1, AINT_SAFE_RELAXED);
+        }
         return (char *)membag->data + (membag->elem_size * i);
     }
 }
 
 
+size_t Membag_acquire_bulk(Membag *membag, void **slots, size_t max_slots) {
+    int available = atomic_load_explicit(&membag->n_free, AINT_SAFE_RELAXED);
+    int reserved;
+    do {
+        if (!(available > 0)) { return 0; }
+        reserved = (size_t)available < max_slots ? available : (int)max_slots;
+    } while (!atomic_compare_exchange_weak_explicit(&membag->n_free,
+                                                    &available,
+                                                    available - reserved,
+                                                    AINT_SAFE_ACQUIRE,
+                                                    AINT_SAFE_RELAXED));
+
+    size_t i = atomic_load_explicit(&membag->next_scan, AINT_SAFE_RELAXED)
+               % membag->n_elems;
+    for (int n = 0; n < reserved; n++) {
+        while (atomic_flag_test_and_set_explicit(&membag->alloc_status[i],
+                                                 AINT_SAFE_ACQUIRE)) {
+            i = (i + 1) % membag->n_elems;
+        }
+        if (membag->refcounts != NULL) {
+            atomic_store_explicit(&membag->refcounts[i], 1, AINT_SAFE_RELAXED);
+        }
+        slots[n] = (char *)membag->data + (membag->elem_size * i);
+        i        = (i + 1) % membag->n_elems;
+    }
+    atomic_store_explicit(&membag->next_scan, i, AINT_SAFE_RELAXED);
+    return (size_t)reserved;
+}
+
+
+static inline size_t slot_index(const Membag *membag, const void *slot) {
+    return ((char *)slot - (char *)membag->data) / membag->elem_size;
+}
+
+
 void Membag_release(Membag *membag, const void *slot) {
     if (slot == NULL) return;
-    const size_t idx =
-            ((char *)slot - (char *)membag->data) / membag->elem_size;
+    const size_t idx = slot_index(membag, slot);
     /* Simple enough, though note that a "double release" will wreak havoc with
      * acquire as n_free is incremented without actually releasing a slot. This
      * may cause acquire() to be stuck in an infinite loop as it will search
@@ -45,6 +107,28 @@ void Membag_release(Membag *membag, const void *slot) {
      * This can be fixed by checking the value in the status array before
      * blindly clearing it, though reading the value of a atomic_flag is not
      * possible without modifying it */
-    atomic_flag_clear(&membag->alloc_status[idx]);
-    atomic_fetch_add(&membag->n_free, 1);
+    atomic_flag_clear_explicit(&membag->alloc_status[idx], AINT_SAFE_RELEASE);
+    atomic_fetch_add_explicit(&membag->n_free, 1, AINT_SAFE_RELEASE);
+}
+
+
+void Membag_ref(Membag *membag, const void *slot) {
+    assert(membag->refcounts != NULL);
+    membag_refcount_t *  count = &membag->refcounts[slot_index(membag, slot)];
+    const unsigned char old =
+            atomic_fetch_add_explicit(count, 1, AINT_SAFE_RELAXED);
+    assert(old > 0 && old < UCHAR_MAX);
+    (void)old;
+}
+
+
+void Membag_unref(Membag *membag, const void *slot) {
+    if (slot == NULL) return;
+    assert(membag->refcounts != NULL);
+    membag_refcount_t *  count = &membag->refcounts[slot_index(membag, slot)];
+    const unsigned char old =
+            atomic_fetch_sub_explicit(count, 1, AINT_SAFE_ACQ_REL);
+    /* Over-release of a free slot */
+    assert(old > 0);
+    if (old == 1) { Membag_release(membag, slot); }
 }
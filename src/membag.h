@@ -22,6 +22,22 @@
  *     Membag_release(&struct_pool, elem);
  * }
  * \endcode
+ *
+ * A membag initialized with #MEMBAG_REFCOUNTED_STATIC_INIT also keeps a
+ * reference count per slot, so that one slot can be handed to several users
+ * (eg. pushed to several queues) without copying it:
+ * \code{.c}
+ * static membag_refcount_t packet_refcounts[10];
+ * static Membag packet_pool = MEMBAG_REFCOUNTED_STATIC_INIT(
+ *     sizeof(Packet), 10, packet_status, packet_refcounts, packets);
+ * ...
+ * Packet *p = Membag_acquire(&packet_pool); // 1 reference
+ * Membag_ref(&packet_pool, p);              // 2 references
+ * push(&queue1, p);
+ * push(&queue2, p);
+ * ...
+ * Membag_unref(&packet_pool, p); // by each consumer, the last one frees it
+ * \endcode
  */
 /* Copyright 2018 Gaurav Juvekar */
 
@@ -34,6 +50,9 @@
 _Static_assert(
         ATOMIC_INT_LOCK_FREE,
         "Your stdlib implementation does not have lock-free atomics for int");
+_Static_assert(
+        ATOMIC_CHAR_LOCK_FREE,
+        "Your stdlib implementation does not have lock-free atomics for char");
 #endif
 
 
@@ -56,6 +75,14 @@ typedef atomic_flag membag_alloc_status_t;
 #define MEMBAG_ALLOC_STATUS_LEN(N_ELEMENTS) (N_ELEMENTS)
 
 
+/** \brief Reference count of a slot of a refcounted membag
+ *
+ * Declare an array of these with as many elements as the data array. A slot
+ * can have at most \c UCHAR_MAX references.
+ */
+typedef atomic_uchar membag_refcount_t;
+
+
 /** \brief Internal data structure of the membag
  *
  * This must be initialized with #MEMBAG_STATIC_INIT at declaration AND
@@ -64,6 +91,8 @@ typedef atomic_flag membag_alloc_status_t;
 typedef struct {
     /** Status array marking allocated slots */
     membag_alloc_status_t *const alloc_status;
+    /** Reference counts of the slots, or \c NULL if not refcounted */
+    membag_refcount_t *const refcounts;
     /** Data to allocate slots from */
     void *const data;
     /** Number of elements in #data */
@@ -72,6 +101,8 @@ typedef struct {
     const size_t elem_size;
     /** Number of slots currently free */
     _Atomic int n_free;
+    /** Slot that #Membag_acquire_bulk starts searching from */
+    _Atomic size_t next_scan;
 } Membag;
 
 
@@ -95,6 +126,32 @@ typedef struct {
     }
 
 
+/** \brief Statically initialize a Membag with reference counted slots
+ *
+ * Use this macro instead of #MEMBAG_STATIC_INIT to be able to use
+ * #Membag_ref and #Membag_unref.
+ *
+ * \param p_elem_size      size of one element of \p data
+ * \param p_n_elems        number of elements in \p data
+ * \param p_status_array   #membag_alloc_status_t array of length
+ *     \c #MEMBAG_ALLOC_STATUS_LEN(\p p_n_elems)
+ * \param p_refcount_array #membag_refcount_t array of length \p p_n_elems
+ * \param p_data_array     data array to allocate from
+ *
+ * \return A #Membag static initializer
+ */
+#define MEMBAG_REFCOUNTED_STATIC_INIT(p_elem_size,                     \
+                                      p_n_elems,                       \
+                                      p_status_array,                  \
+                                      p_refcount_array,                \
+                                      p_data_array)                    \
+    {                                                                  \
+        .alloc_status = p_status_array, .refcounts = p_refcount_array, \
+        .data = p_data_array, .n_elems = p_n_elems,                    \
+        .elem_size = p_elem_size                                       \
+    }
+
+
 /** \brief Initialize a #Membag instance at runtime
  *
  * \param membag #Membag to initialize
@@ -108,7 +165,8 @@ void Membag_init(Membag *membag);
  *
  * \param membag #Membag to acquire the slot from
  *
- * \return Pointer to an available slot in \p membag->data
+ * \return Pointer to an available slot in \p membag->data, with 1 reference
+ *     if \p membag is refcounted
  * \retval NULL if no slot is available in \p membag->data
  *
  * \pre \p membag must be initialized with #Membag_init
@@ -116,11 +174,31 @@ void Membag_init(Membag *membag);
 void *Membag_acquire(Membag *membag);
 
 
+/** \brief Acquire up to \p max_slots available slots from the membag at once
+ *
+ * This reserves all the slots with one atomic operation on the free count,
+ * and searches for them from where the last call stopped, instead of from the
+ * first slot, so that refilling a cache of slots costs about as much as one
+ * #Membag_acquire.
+ *
+ * \param membag    #Membag to acquire the slots from
+ * \param slots     array of at least \p max_slots pointers, filled with the
+ *     acquired slots, each with 1 reference if \p membag is refcounted
+ * \param max_slots maximum number of slots to acquire
+ *
+ * \return the number of slots acquired, fewer than \p max_slots (possibly 0)
+ *     only if no more are available
+ *
+ * \pre \p membag must be initialized with #Membag_init
+ */
+size_t Membag_acquire_bulk(Membag *membag, void **slots, size_t max_slots);
+
+
 /** \brief Release an acquired slot
  *
  * \param membag #Membag that the slot belongs to
  * \param slot   pointer to a slot previously acquired by #Membag_acquire or
- *     \c NULL
+ *     #Membag_acquire_bulk, or \c NULL
  *
  *  \warning A "double release" / "double free" \b WILL wreak havoc with the
  *  entire data structure. Subsequent #Membag_acquire() calls may get stuck in
@@ -129,4 +207,27 @@ void *Membag_acquire(Membag *membag);
 void Membag_release(Membag *membag, const void *slot);
 
 
+/** \brief Add a reference to an acquired slot of a refcounted membag
+ *
+ * \param membag #Membag that the slot belongs to, initialized with
+ *     #MEMBAG_REFCOUNTED_STATIC_INIT
+ * \param slot   pointer to a slot that the caller holds a reference to
+ */
+void Membag_ref(Membag *membag, const void *slot);
+
+
+/** \brief Drop a reference to a slot, and release it if it was the last one
+ *
+ * \param membag #Membag that the slot belongs to, initialized with
+ *     #MEMBAG_REFCOUNTED_STATIC_INIT
+ * \param slot   pointer to a slot that the caller holds a reference to, or
+ *     \c NULL
+ *
+ * \note Unless \c NDEBUG is defined, dropping a reference to a free slot
+ * fails an assertion. Dropping one more reference than taken can't be
+ * caught if the slot has already been acquired again meanwhile.
+ */
+void Membag_unref(Membag *membag, const void *slot);
+
+
 #endif /* ifndef AINT_SAFE__MEMBAG_H */
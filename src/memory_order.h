@@ -0,0 +1,56 @@
+/** \file memory_order.h
+ *
+ * Memory orders used by the explicitly ordered atomic operations
+ *
+ * Atomic operations that only need to publish or consume data use the
+ * weakest ordering that is correct for them, through the macros below, so
+ * that weakly ordered architectures (eg. ARM) don't get a full barrier on
+ * every operation. Operations that rely on a single total order over
+ * several variables (such as a store to one followed by a load of another)
+ * keep using the default \c memory_order_seq_cst, and say so where they are.
+ *
+ * Define #AINT_SAFE_SEQ_CST to 1 for the whole build to make all the
+ * operations \c memory_order_seq_cst again, eg. to check whether a problem is
+ * caused by the relaxed orderings.
+ *
+ * Every file that does atomic operations includes this, which is also how
+ * the operations are routed through the shim of atomic_profile.h.
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__MEMORY_ORDER_H
+#define AINT_SAFE__MEMORY_ORDER_H 1
+
+#include <stdatomic.h>
+
+
+#ifndef AINT_SAFE_SEQ_CST
+/** \brief Use \c memory_order_seq_cst for all atomic operations
+ *
+ * Define it to 1 for the whole build to override.
+ */
+#define AINT_SAFE_SEQ_CST 0
+#endif
+
+
+#if AINT_SAFE_SEQ_CST
+#define AINT_SAFE_RELAXED memory_order_seq_cst
+#define AINT_SAFE_ACQUIRE memory_order_seq_cst
+#define AINT_SAFE_RELEASE memory_order_seq_cst
+#define AINT_SAFE_ACQ_REL memory_order_seq_cst
+#else
+/** \brief Order of operations that don't publish or consume other data */
+#define AINT_SAFE_RELAXED memory_order_relaxed
+/** \brief Order of loads that consume data published by a release */
+#define AINT_SAFE_ACQUIRE memory_order_acquire
+/** \brief Order of stores that publish data written before them */
+#define AINT_SAFE_RELEASE memory_order_release
+/** \brief Order of read-modify-writes that both consume and publish */
+#define AINT_SAFE_ACQ_REL memory_order_acq_rel
+#endif
+
+
+#include "atomic_profile.h"
+
+
+#endif /* ifndef AINT_SAFE__MEMORY_ORDER_H */
@@ -0,0 +1,237 @@
+/** \file mmap_alloc.c
+ *
+ * Runtime constructors backed by \c mmap for large structures
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+/* For MAP_ANONYMOUS, madvise() and syscall() */
+#define _GNU_SOURCE
+
+#include "mmap_alloc.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/mempolicy.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Every mapping starts with a header holding its length, so that Mmap_free
+ * needs only the pointer. The structures are placed right after the header,
+ * followed by their storage, and are initialized by copying in an initializer
+ * built with their _STATIC_INIT macro. */
+
+#define MMAP_ALLOC_ALIGN _Alignof(max_align_t)
+#define MMAP_ALLOC_HEADER_SIZE \
+    ((sizeof(size_t) + MMAP_ALLOC_ALIGN - 1) & ~(MMAP_ALLOC_ALIGN - 1))
+#define MMAP_ALLOC_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+
+static inline size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+
+/* Size of a header, a structure and an array of n_elems elements after it, or
+ * 0 on overflow */
+static size_t
+layout_size(size_t struct_size, size_t elem_size, size_t n_elems) {
+    if (n_elems != 0 && elem_size > SIZE_MAX / n_elems) { return 0; }
+    const size_t array_size = elem_size * n_elems;
+    const size_t offset     = align_up(struct_size, MMAP_ALLOC_ALIGN);
+    if (array_size > SIZE_MAX - offset - MMAP_ALLOC_HUGE_PAGE_SIZE) {
+        return 0;
+    }
+    return offset + array_size;
+}
+
+
+static void *map_anonymous(size_t length, int extra_flags) {
+    void *base = mmap(NULL,
+                      length,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | extra_flags,
+                      -1,
+                      0);
+    return base == MAP_FAILED ? NULL : base;
+}
+
+
+/* Map length bytes aligned to a huge page, so that transparent huge pages can
+ * back all of it */
+static void *map_huge_aligned(size_t length) {
+    char *base = map_anonymous(length + MMAP_ALLOC_HUGE_PAGE_SIZE, 0);
+    if (base == NULL) { return NULL; }
+    char *aligned =
+            (char *)align_up((uintptr_t)base, MMAP_ALLOC_HUGE_PAGE_SIZE);
+    char *end = base + length + MMAP_ALLOC_HUGE_PAGE_SIZE;
+    if (aligned != base) { munmap(base, (size_t)(aligned - base)); }
+    if (aligned + length != end) {
+        munmap(aligned + length, (size_t)(end - (aligned + length)));
+    }
+    /* Only a hint, the memory is usable either way */
+    madvise(aligned, length, MADV_HUGEPAGE);
+    return aligned;
+}
+
+
+static bool bind_to_node(void *addr, size_t length, int node) {
+    enum { BITS_PER_LONG = sizeof(unsigned long) * CHAR_BIT };
+    const size_t  n_longs = (size_t)node / BITS_PER_LONG + 1;
+    unsigned long mask[n_longs];
+    memset(mask, 0, sizeof(mask));
+    mask[node / BITS_PER_LONG] = 1UL << (node % BITS_PER_LONG);
+    /* The kernel ignores the last bit of maxnode */
+    return syscall(SYS_mbind,
+                   addr,
+                   length,
+                   MPOL_BIND,
+                   mask,
+                   n_longs * BITS_PER_LONG + 1,
+                   0)
+           == 0;
+}
+
+
+void *Mmap_alloc(size_t size, const MmapOptions *opts) {
+    static const MmapOptions defaults = MMAP_OPTIONS_DEFAULT;
+    if (opts == NULL) { opts = &defaults; }
+    if (size > SIZE_MAX - MMAP_ALLOC_HEADER_SIZE - MMAP_ALLOC_HUGE_PAGE_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size_t length = size + MMAP_ALLOC_HEADER_SIZE;
+    char * base   = NULL;
+    if (opts->huge_pages) {
+        length = align_up(length, MMAP_ALLOC_HUGE_PAGE_SIZE);
+        /* Fails unless huge pages are reserved, fall back to transparent
+         * huge pages then */
+        base = map_anonymous(length, MAP_HUGETLB);
+        if (base == NULL) { base = map_huge_aligned(length); }
+    } else {
+        base = map_anonymous(length, 0);
+    }
+    if (base == NULL) { return NULL; }
+
+    /* Bind before anything is faulted in, so all pages come from the node */
+    if (opts->numa_node >= 0 && !bind_to_node(base, length, opts->numa_node)) {
+        int saved_errno = errno;
+        munmap(base, length);
+        errno = saved_errno;
+        return NULL;
+    }
+    if (opts->prefault) {
+        const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        for (size_t i = 0; i < length; i += page_size) {
+            ((volatile char *)base)[i] = 0;
+        }
+    }
+
+    *(size_t *)base = length;
+    return base + MMAP_ALLOC_HEADER_SIZE;
+}
+
+
+void Mmap_free(void *ptr) {
+    if (ptr == NULL) return;
+    char *base = (char *)ptr - MMAP_ALLOC_HEADER_SIZE;
+    munmap(base, *(size_t *)base);
+}
+
+
+Membag *Membag_create(size_t             elem_size,
+                      size_t             n_elems,
+                      const MmapOptions *opts) {
+    if (n_elems > INT_MAX) {
+        /* n_free is an int */
+        errno = EINVAL;
+        return NULL;
+    }
+    const size_t status_size =
+            sizeof(membag_alloc_status_t) * MEMBAG_ALLOC_STATUS_LEN(n_elems);
+    const size_t status_offset = align_up(sizeof(Membag), MMAP_ALLOC_ALIGN);
+    const size_t data_offset =
+            align_up(status_offset + status_size, MMAP_ALLOC_ALIGN);
+    const size_t size = layout_size(data_offset, elem_size, n_elems);
+    if (size == 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    char *mem = Mmap_alloc(size, opts);
+    if (mem == NULL) { return NULL; }
+
+    Membag *membag = (Membag *)mem;
+    Membag  init   = MEMBAG_STATIC_INIT(
+            elem_size,
+            n_elems,
+            (membag_alloc_status_t *)(mem + status_offset),
+            mem + data_offset);
+    memcpy(membag, &init, sizeof(init));
+    Membag_init(membag);
+    return membag;
+}
+
+
+void Membag_destroy(Membag *membag) {
+    Mmap_free(membag);
+}
+
+
+NestedQueue *NestedQueue_create(size_t                    elem_size,
+                                size_t                    n_elems,
+                                NestedQueueOperationOrder write_order,
+                                NestedQueueOperationOrder read_order,
+                                const MmapOptions *       opts) {
+    if (n_elems == 0 || n_elems > INTPTR_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+    const size_t data_offset = align_up(sizeof(NestedQueue), MMAP_ALLOC_ALIGN);
+    const size_t size = layout_size(data_offset, elem_size, n_elems);
+    if (size == 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    char *mem = Mmap_alloc(size, opts);
+    if (mem == NULL) { return NULL; }
+
+    /* The indexes refer to the storage inside the mapped queue itself */
+    NestedQueue *q    = (NestedQueue *)mem;
+    NestedQueue  init = NESTED_QUEUE_STATIC_INIT(
+            (*q), elem_size, n_elems, mem + data_offset, write_order,
+            read_order);
+    memcpy(q, &init, sizeof(init));
+    return q;
+}
+
+
+void NestedQueue_destroy(NestedQueue *q) {
+    Mmap_free(q);
+}
+
+
+DoubleBuffer *DoubleBuffer_create(size_t elem_size, const MmapOptions *opts) {
+    const size_t data_offset =
+            align_up(sizeof(DoubleBuffer), MMAP_ALLOC_ALIGN);
+    const size_t size = layout_size(data_offset, elem_size, 2);
+    if (size == 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    char *mem = Mmap_alloc(size, opts);
+    if (mem == NULL) { return NULL; }
+
+    DoubleBuffer *db   = (DoubleBuffer *)mem;
+    DoubleBuffer  init =
+            DOUBLE_BUFFER_STATIC_INIT(elem_size, mem + data_offset);
+    memcpy(db, &init, sizeof(init));
+    return db;
+}
+
+
+void DoubleBuffer_destroy(DoubleBuffer *db) {
+    Mmap_free(db);
+}
@@ -0,0 +1,146 @@
+/** \file mmap_alloc.h
+ *
+ * Runtime constructors backed by \c mmap for large structures
+ *
+ * The \c _STATIC_INIT macros fix the size of a structure at compile time and
+ * put its storage in \c .bss. On hosted (Linux) systems, the constructors here
+ * size the structures at runtime instead, and place each structure along with
+ * its storage in a single anonymous mapping. The mapping can use huge pages
+ * to reduce TLB misses on large pools, be pre-faulted so that the first
+ * accesses from an interrupt or a latency-sensitive thread don't page fault,
+ * and be bound to a NUMA node.
+ *
+ * Usage:
+ * \code{.c}
+ * MmapOptions opts = MMAP_OPTIONS_DEFAULT;
+ * opts.huge_pages  = true;
+ * opts.prefault    = true;
+ * opts.numa_node   = 0;
+ *
+ * Membag *pool = Membag_create(sizeof(Packet), config.n_packets, &opts);
+ * if (pool == NULL) { perror(...); }
+ * ...
+ * Membag_destroy(pool);
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__MMAP_ALLOC_H
+#define AINT_SAFE__MMAP_ALLOC_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "double_buffer.h"
+#include "membag.h"
+#include "nested_queue.h"
+
+
+/** \brief Options for the memory mapped by #Mmap_alloc */
+typedef struct {
+    /** Use huge pages. Explicit (\c MAP_HUGETLB) huge pages are tried first,
+     * then transparent huge pages. */
+    bool huge_pages;
+    /** Fault in all the pages before returning */
+    bool prefault;
+    /** NUMA node to bind the memory to, or -1 for the default policy */
+    int numa_node;
+} MmapOptions;
+
+
+/** \brief Default #MmapOptions
+ *
+ * \return An #MmapOptions initializer for plain, lazily faulted pages
+ */
+#define MMAP_OPTIONS_DEFAULT \
+    { .huge_pages = false, .prefault = false, .numa_node = -1 }
+
+
+/** \brief Map zero-filled memory
+ *
+ * \param size number of bytes to map
+ * \param opts options for the mapping, or \c NULL for #MMAP_OPTIONS_DEFAULT
+ *
+ * \return memory aligned to \c max_align_t
+ * \retval NULL on failure, with \c errno set
+ */
+void *Mmap_alloc(size_t size, const MmapOptions *opts);
+
+
+/** \brief Unmap memory
+ *
+ * \param ptr memory returned by #Mmap_alloc, or \c NULL
+ */
+void Mmap_free(void *ptr);
+
+
+/** \brief Create a #Membag at runtime
+ *
+ * \param elem_size size of a slot
+ * \param n_elems   number of slots
+ * \param opts      options for the mapping, or \c NULL for the defaults
+ *
+ * \return an initialized #Membag
+ * \retval NULL on failure, with \c errno set
+ */
+Membag *Membag_create(size_t             elem_size,
+                      size_t             n_elems,
+                      const MmapOptions *opts);
+
+
+/** \brief Destroy a #Membag made by #Membag_create
+ *
+ * \param membag the #Membag, or \c NULL
+ */
+void Membag_destroy(Membag *membag);
+
+
+/** \brief Create a #NestedQueue at runtime
+ *
+ * \param elem_size   size of an element
+ * \param n_elems     number of elements
+ * \param write_order ordering of acquire and release that will be used for
+ *                    writes
+ * \param read_order  ordering of acquire and release that will be used for
+ *                    reads
+ * \param opts        options for the mapping, or \c NULL for the defaults
+ *
+ * \return an initialized #NestedQueue
+ * \retval NULL on failure, with \c errno set
+ */
+NestedQueue *NestedQueue_create(size_t                    elem_size,
+                                size_t                    n_elems,
+                                NestedQueueOperationOrder write_order,
+                                NestedQueueOperationOrder read_order,
+                                const MmapOptions *       opts);
+
+
+/** \brief Destroy a #NestedQueue made by #NestedQueue_create
+ *
+ * \param q the #NestedQueue, or \c NULL
+ */
+void NestedQueue_destroy(NestedQueue *q);
+
+
+/** \brief Create a #DoubleBuffer at runtime
+ *
+ * Both slots start zero-filled, which is the value returned to readers before
+ * the first write.
+ *
+ * \param elem_size size of a slot
+ * \param opts      options for the mapping, or \c NULL for the defaults
+ *
+ * \return an initialized #DoubleBuffer
+ * \retval NULL on failure, with \c errno set
+ */
+DoubleBuffer *DoubleBuffer_create(size_t elem_size, const MmapOptions *opts);
+
+
+/** \brief Destroy a #DoubleBuffer made by #DoubleBuffer_create
+ *
+ * \param db the #DoubleBuffer, or \c NULL
+ */
+void DoubleBuffer_destroy(DoubleBuffer *db);
+
+
+#endif /* ifndef AINT_SAFE__MMAP_ALLOC_H */
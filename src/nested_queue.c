@@ -5,8 +5,10 @@
  */
 /* Copyright 2018 Gaurav Juvekar */
 #include "nested_queue.h"
+#include "stats.h"
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 
 static inline void *idx_to_ptr(const NestedQueue *q, unsigned int index) {
     return (char *)q->data + (q->elem_size * index);
@@ -17,66 +19,140 @@ static inline unsigned int ptr_to_idx(const NestedQueue *q, const void *ptr) {
 }
 
 
-static void *
-NestedQueue_acquire(NestedQueue *q, int count_idx, int acquire_idx) {
-    mcas_base_t old_indexes[NESTED_QUEUE_NUMBER_OF_INDEXES];
-    mcas_base_t new_indexes[NESTED_QUEUE_NUMBER_OF_INDEXES];
-    do {
-        Mcas_read(&q->indexes, old_indexes);
-        if (!old_indexes[count_idx]) { return NULL; }
+/* The indexes are free running positions rather than indexes in data, so
+ * that they never return to an earlier value while a nested operation is
+ * interrupted, which Mcas_compare_exchange relies on. They wrap around at the
+ * largest multiple of n_elems that fits, which keeps (position % n_elems) the
+ * index in data across the wrap. */
+static inline uintptr_t position_wrap(const NestedQueue *q) {
+    return (uintptr_t)INTPTR_MAX / q->n_elems * q->n_elems;
+}
+
+static inline mcas_base_t
+position_add(uintptr_t wrap, mcas_base_t position, size_t n) {
+    return (mcas_base_t)(((uintptr_t)position + n) % wrap);
+}
+
+/* Number of positions from `from` up to `to` */
+static inline uintptr_t
+position_diff(uintptr_t wrap, mcas_base_t to, mcas_base_t from) {
+    return ((uintptr_t)to + wrap - (uintptr_t)from) % wrap;
+}
+
+
+/* Acquire up to max_n slots from acquire_idx on, that are before
+ * limit_idx + limit_offset. Returns the number of slots acquired, and the
+ * position of the first one in *first. */
+static size_t NestedQueue_acquire_n(NestedQueue *q,
+                                    int          acquire_idx,
+                                    int          limit_idx,
+                                    size_t       limit_offset,
+                                    size_t       max_n,
+                                    uintptr_t *  first) {
+    const uintptr_t wrap = position_wrap(q);
+    mcas_base_t     old_indexes[NESTED_QUEUE_NUMBER_OF_INDEXES];
+    mcas_base_t     new_indexes[NESTED_QUEUE_NUMBER_OF_INDEXES];
+    size_t          n;
+    if (max_n == 0) { return 0; }
+    Mcas_read(&q->indexes, old_indexes);
+    for (unsigned int attempt = 1;; attempt++) {
+        const mcas_base_t limit =
+                position_add(wrap, old_indexes[limit_idx], limit_offset);
+        const uintptr_t available =
+                position_diff(wrap, limit, old_indexes[acquire_idx]);
+        if (available == 0) { return 0; }
+        n = available < max_n ? available : max_n;
 
         memcpy(new_indexes, old_indexes, sizeof(new_indexes));
-        new_indexes[acquire_idx] = (new_indexes[acquire_idx] + 1) % q->n_elems;
-        new_indexes[count_idx] -= 1;
-    } while (!Mcas_compare_exchange(&q->indexes, old_indexes, new_indexes));
+        new_indexes[acquire_idx] =
+                position_add(wrap, old_indexes[acquire_idx], n);
+        if (Mcas_compare_exchange_fetch(
+                    &q->indexes, old_indexes, new_indexes)) {
+            break;
+        }
+        AINT_SAFE_STAT_ADD(QUEUE_ACQUIRE_RETRIES, 1);
+        AINT_SAFE_PROBE1(queue_acquire_retry, q);
+        AINT_SAFE_MCAS_RETRY(attempt);
+    }
+
+    *first = (uintptr_t)old_indexes[acquire_idx];
+    return n;
+}
+
 
-    return idx_to_ptr(q, old_indexes[acquire_idx]);
+/* Acquire the slot at acquire_idx if it is before limit_idx + limit_offset */
+static void *NestedQueue_acquire(NestedQueue *q,
+                                 int          acquire_idx,
+                                 int          limit_idx,
+                                 size_t       limit_offset) {
+    uintptr_t first;
+    if (NestedQueue_acquire_n(
+                q, acquire_idx, limit_idx, limit_offset, 1, &first)
+        == 0) {
+        return NULL;
+    }
+    return idx_to_ptr(q, first % q->n_elems);
 }
 
 
 static void NestedQueue_commit(NestedQueue *q,
                                int          commit_idx,
                                int          acquire_idx,
-                               int          count_idx,
                                const void * slot_ptr,
+                               size_t       n,
                                NestedQueueOperationOrder order) {
-    mcas_base_t idx = ptr_to_idx(q, slot_ptr);
-    mcas_base_t old_indexes[NESTED_QUEUE_NUMBER_OF_INDEXES];
-    mcas_base_t new_indexes[NESTED_QUEUE_NUMBER_OF_INDEXES];
+    const uintptr_t wrap = position_wrap(q);
+    uintptr_t       idx  = ptr_to_idx(q, slot_ptr);
+    mcas_base_t     old_indexes[NESTED_QUEUE_NUMBER_OF_INDEXES];
+    mcas_base_t     new_indexes[NESTED_QUEUE_NUMBER_OF_INDEXES];
 
+    Mcas_read(&q->indexes, old_indexes);
     switch (order) {
     case NESTED_QUEUE_OPERATION_ORDER_NESTED:
-        do {
-            Mcas_read(&q->indexes, old_indexes);
-            if (old_indexes[commit_idx] != idx) { return; }
+        for (unsigned int attempt = 1;; attempt++) {
+            if ((uintptr_t)old_indexes[commit_idx] % q->n_elems != idx) {
+                return;
+            }
 
+            /* Commit everything acquired so far, including all the slots of
+             * the nested operations. Even all n_elems of them. This covers
+             * the n slots from slot_ptr as well. */
             memcpy(new_indexes, old_indexes, sizeof(new_indexes));
             new_indexes[commit_idx] = old_indexes[acquire_idx];
-            new_indexes[count_idx] += (old_indexes[acquire_idx] + q->n_elems
-                                       - new_indexes[commit_idx])
-                                      % q->n_elems;
-        } while (
-                !Mcas_compare_exchange(&q->indexes, old_indexes, new_indexes));
+            if (Mcas_compare_exchange_fetch(
+                        &q->indexes, old_indexes, new_indexes)) {
+                break;
+            }
+            AINT_SAFE_STAT_ADD(QUEUE_COMMIT_RETRIES, 1);
+            AINT_SAFE_PROBE1(queue_commit_retry, q);
+            AINT_SAFE_MCAS_RETRY(attempt);
+        }
         break;
 
     case NESTED_QUEUE_OPERATION_ORDER_FCFS:
-        do {
-            Mcas_read(&q->indexes, old_indexes);
-            assert(old_indexes[commit_idx] == idx);
+        for (unsigned int attempt = 1;; attempt++) {
+            assert((uintptr_t)old_indexes[commit_idx] % q->n_elems == idx);
 
             memcpy(new_indexes, old_indexes, sizeof(new_indexes));
-            new_indexes[commit_idx] += 1;
-            new_indexes[commit_idx] %= q->n_elems;
-            new_indexes[count_idx] += 1;
-        } while (
-                !Mcas_compare_exchange(&q->indexes, old_indexes, new_indexes));
+            new_indexes[commit_idx] =
+                    position_add(wrap, old_indexes[commit_idx], n);
+            if (Mcas_compare_exchange_fetch(
+                        &q->indexes, old_indexes, new_indexes)) {
+                break;
+            }
+            AINT_SAFE_STAT_ADD(QUEUE_COMMIT_RETRIES, 1);
+            AINT_SAFE_PROBE1(queue_commit_retry, q);
+            AINT_SAFE_MCAS_RETRY(attempt);
+        }
     }
 }
 
 
 void *NestedQueue_write_acquire(NestedQueue *q) {
-    return NestedQueue_acquire(
-            q, NESTED_QUEUE_COUNT_WRITABLE, NESTED_QUEUE_WRITE_ALLOCATED);
+    return NestedQueue_acquire(q,
+                               NESTED_QUEUE_WRITE_ALLOCATED,
+                               NESTED_QUEUE_READ_RELEASED,
+                               q->n_elems);
 }
 
 
@@ -84,15 +160,18 @@ void NestedQueue_write_commit(NestedQueue *q, const void *slot) {
     NestedQueue_commit(q,
                        NESTED_QUEUE_WRITE_COMMITTED,
                        NESTED_QUEUE_WRITE_ALLOCATED,
-                       NESTED_QUEUE_COUNT_READABLE,
                        slot,
+                       1,
                        q->write_order);
+#if AINT_SAFE_WAIT
+    EventCount_notify(&q->readable);
+#endif
 }
 
 
 const void *NestedQueue_read_acquire(NestedQueue *q) {
     return NestedQueue_acquire(
-            q, NESTED_QUEUE_COUNT_READABLE, NESTED_QUEUE_READ_ACQUIRED);
+            q, NESTED_QUEUE_READ_ACQUIRED, NESTED_QUEUE_WRITE_COMMITTED, 0);
 }
 
 
@@ -100,10 +179,102 @@ void NestedQueue_read_release(NestedQueue *q, const void *slot) {
     NestedQueue_commit(q,
                        NESTED_QUEUE_READ_RELEASED,
                        NESTED_QUEUE_READ_ACQUIRED,
-                       NESTED_QUEUE_COUNT_WRITABLE,
                        slot,
+                       1,
                        q->read_order);
+#if AINT_SAFE_WAIT
+    EventCount_notify(&q->writable);
+#endif
+}
+
+
+size_t NestedQueue_read_acquire_bulk(NestedQueue *   q,
+                                     size_t          max_elems,
+                                     NestedQueueSpan spans[2]) {
+    uintptr_t    first = 0;
+    const size_t n     = NestedQueue_acquire_n(q,
+                                           NESTED_QUEUE_READ_ACQUIRED,
+                                           NESTED_QUEUE_WRITE_COMMITTED,
+                                           0,
+                                           max_elems,
+                                           &first);
+    /* Up to the end of data, and the rest from its start */
+    const size_t i        = first % q->n_elems;
+    const size_t n_before = n < q->n_elems - i ? n : q->n_elems - i;
+    spans[0] = (NestedQueueSpan){
+            .data = idx_to_ptr(q, i), .n_elems = n_before};
+    spans[1] = (NestedQueueSpan){.data = q->data, .n_elems = n - n_before};
+    return n;
+}
+
+
+void NestedQueue_read_release_bulk(NestedQueue *         q,
+                                   const NestedQueueSpan spans[2]) {
+    const size_t n = spans[0].n_elems + spans[1].n_elems;
+    if (n == 0) { return; }
+    NestedQueue_commit(q,
+                       NESTED_QUEUE_READ_RELEASED,
+                       NESTED_QUEUE_READ_ACQUIRED,
+                       spans[0].data,
+                       n,
+                       q->read_order);
+#if AINT_SAFE_WAIT
+    EventCount_notify(&q->writable);
+#endif
+}
+
+
+#if AINT_SAFE_WAIT
+static void *NestedQueue_acquire_wait(NestedQueue *          q,
+                                      int                    acquire_idx,
+                                      int                    limit_idx,
+                                      size_t                 limit_offset,
+                                      EventCount *           ec,
+                                      const struct timespec *timeout) {
+    struct timespec deadline;
+    if (timeout != NULL) { EventCount_deadline(&deadline, timeout); }
+
+    void *slot;
+    while ((slot = NestedQueue_acquire(
+                    q, acquire_idx, limit_idx, limit_offset))
+           == NULL) {
+        const uint32_t key = EventCount_prepare_wait(ec);
+        /* Check again, a commit before prepare_wait doesn't wake us */
+        slot = NestedQueue_acquire(q, acquire_idx, limit_idx, limit_offset);
+        if (slot != NULL) {
+            EventCount_cancel_wait(ec);
+            break;
+        }
+        if (!EventCount_wait(ec, key, timeout != NULL ? &deadline : NULL)) {
+            return NestedQueue_acquire(
+                    q, acquire_idx, limit_idx, limit_offset);
+        }
+    }
+    return slot;
+}
+
+
+void *NestedQueue_write_acquire_wait(NestedQueue *          q,
+                                     const struct timespec *timeout) {
+    return NestedQueue_acquire_wait(q,
+                                    NESTED_QUEUE_WRITE_ALLOCATED,
+                                    NESTED_QUEUE_READ_RELEASED,
+                                    q->n_elems,
+                                    &q->writable,
+                                    timeout);
+}
+
+
+const void *NestedQueue_read_acquire_wait(NestedQueue *          q,
+                                          const struct timespec *timeout) {
+    return NestedQueue_acquire_wait(q,
+                                    NESTED_QUEUE_READ_ACQUIRED,
+                                    NESTED_QUEUE_WRITE_COMMITTED,
+                                    0,
+                                    &q->readable,
+                                    timeout);
 }
+#endif
 
 
 NestedQueueIterator NestedQueueIterator_init_read(NestedQueue *q) {
@@ -111,8 +282,10 @@ NestedQueueIterator NestedQueueIterator_init_read(NestedQueue *q) {
     Mcas_read(&q->indexes, indexes);
     return (NestedQueueIterator){
             .queue     = q,
-            .current_i = indexes[NESTED_QUEUE_READ_RELEASED],
-            .end_i     = indexes[NESTED_QUEUE_READ_ACQUIRED],
+            .current_i = (uintptr_t)indexes[NESTED_QUEUE_READ_RELEASED]
+                         % q->n_elems,
+            .end_i = (uintptr_t)indexes[NESTED_QUEUE_READ_ACQUIRED]
+                     % q->n_elems,
     };
 }
 
@@ -122,8 +295,10 @@ NestedQueueIterator NestedQueueIterator_init_write(NestedQueue *q) {
     Mcas_read(&q->indexes, indexes);
     return (NestedQueueIterator){
             .queue     = q,
-            .current_i = indexes[NESTED_QUEUE_WRITE_COMMITTED],
-            .end_i     = indexes[NESTED_QUEUE_WRITE_ALLOCATED],
+            .current_i = (uintptr_t)indexes[NESTED_QUEUE_WRITE_COMMITTED]
+                         % q->n_elems,
+            .end_i = (uintptr_t)indexes[NESTED_QUEUE_WRITE_ALLOCATED]
+                     % q->n_elems,
     };
 }
 
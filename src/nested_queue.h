@@ -14,6 +14,7 @@
 #include <stdatomic.h>
 #include <stddef.h>
 
+#include "event_count.h"
 #include "mcas.h"
 
 #if !defined(__DOXYGEN__AINT_SAFE__)
@@ -23,7 +24,13 @@ _Static_assert(
 #endif
 
 
-/** Indices of internal variables used */
+/** Indices of internal variables used
+ *
+ * These are free running positions, the slot in data at a position is at
+ * (position % n_elems). The count of writable slots is
+ * (READ_RELEASED + n_elems - WRITE_ALLOCATED) and of readable slots is
+ * (WRITE_COMMITTED - READ_ACQUIRED).
+ */
 typedef enum {
     /** Index in indexes of next slot in data that can be acquired for writing */
     NESTED_QUEUE_WRITE_ALLOCATED,
@@ -33,10 +40,6 @@ typedef enum {
     NESTED_QUEUE_READ_ACQUIRED,
     /** Index in indexes of oldest slot in data that is being read */
     NESTED_QUEUE_READ_RELEASED,
-    /** Index in indexes of count of writable slots left */
-    NESTED_QUEUE_COUNT_WRITABLE,
-    /** Index in indexes of count of readable slots available */
-    NESTED_QUEUE_COUNT_READABLE,
     /** Number of elements in the indexes array */
     NESTED_QUEUE_NUMBER_OF_INDEXES,
 } NestedQueueIndexes;
@@ -97,7 +100,7 @@ typedef enum {
  * This must be initialized with #NESTED_QUEUE_STATIC_INIT at declaration
  */
 typedef struct NestedQueue {
-    _Atomic mcas_base_t index_stoarge_[NESTED_QUEUE_NUMBER_OF_INDEXES];
+    _Atomic mcas_base_t index_storage_[NESTED_QUEUE_NUMBER_OF_INDEXES];
     Mcas indexes;
     /** Data to allocate slots from */
     void *const data;
@@ -109,6 +112,12 @@ typedef struct NestedQueue {
     const NestedQueueOperationOrder read_order;
     /** The ordering used for write operations */
     const NestedQueueOperationOrder write_order;
+#if AINT_SAFE_WAIT
+    /** Notified by #NestedQueue_write_commit */
+    EventCount readable;
+    /** Notified by #NestedQueue_read_release */
+    EventCount writable;
+#endif
 } NestedQueue;
 
 
@@ -147,14 +156,12 @@ typedef struct NestedQueue {
                                  p_read_order)                                \
     {                                                                         \
         .data = p_data_array, .n_elems = p_n_elems, .elem_size = p_elem_size, \
-        .index_storage = {[NESTED_QUEUE_WRITE_ALLOCATED] = 0,                 \
-                          [NESTED_QUEUE_WRITE_COMMITTED] = 0,                 \
-                          [NESTED_QUEUE_READ_ACQUIRED]   = 0,                 \
-                          [NESTED_QUEUE_READ_RELEASED]   = 0,                 \
-                          [NESTED_QUEUE_COUNT_READABLE]  = 0,                 \
-                          [NESTED_QUEUE_COUNT_WRITABLE]  = p_n_elems},        \
+        .index_storage_ = {[NESTED_QUEUE_WRITE_ALLOCATED] = 0,                \
+                           [NESTED_QUEUE_WRITE_COMMITTED] = 0,                \
+                           [NESTED_QUEUE_READ_ACQUIRED]   = 0,                \
+                           [NESTED_QUEUE_READ_RELEASED]   = 0},               \
         .indexes       = MCAS_STATIC_INIT(NESTED_QUEUE_NUMBER_OF_INDEXES,     \
-                                    &p_nested_queue.index_storage_),          \
+                                    p_nested_queue.index_storage_),           \
         .read_order = p_read_order, .write_order = p_write_order              \
     }
 
@@ -206,6 +213,88 @@ const void *NestedQueue_read_acquire(NestedQueue *q);
 void NestedQueue_read_release(NestedQueue *q, const void *slot);
 
 
+/** \brief Consecutive slots of a #NestedQueue
+ *
+ * A region of the queue wraps around the end of \c data at most once, so it
+ * is described by two of these, the second one starting at \c data.
+ */
+typedef struct {
+    /** First slot of the span */
+    const void *data;
+    /** Number of slots in the span, possibly 0 */
+    size_t n_elems;
+} NestedQueueSpan;
+
+
+/** \brief Acquire several slots from the queue for reading at once
+ *
+ * \param q         #NestedQueue to acquire the slots from
+ * \param max_elems maximum number of slots to acquire
+ * \param [out] spans the acquired slots, in order, as at most two spans.
+ *     \p spans[1] is empty unless the slots wrap around the end of
+ *     \p q->data.
+ *
+ * \return The number of slots acquired, which is 0 if none is available
+ *
+ * This costs the same as a single #NestedQueue_read_acquire, and the slots
+ * can be processed with loops over contiguous memory, eg. the kernels of
+ * nested_queue_span.h.
+ *
+ * \post #NestedQueue_read_release_bulk() must be called with \p spans after
+ * using the slots
+ */
+size_t NestedQueue_read_acquire_bulk(NestedQueue *   q,
+                                     size_t          max_elems,
+                                     NestedQueueSpan spans[2]);
+
+
+/** \brief Release all the slots acquired by #NestedQueue_read_acquire_bulk
+ *
+ * \param q     #NestedQueue from which the slots were acquired
+ * \param spans spans returned by #NestedQueue_read_acquire_bulk()
+ *
+ * \note Calls must follow \p q->read_order, as a single release
+ */
+void NestedQueue_read_release_bulk(NestedQueue *         q,
+                                   const NestedQueueSpan spans[2]);
+
+
+#if AINT_SAFE_WAIT
+/** \brief Acquire a slot for writing, waiting for one to be released
+ *
+ * \param q       #NestedQueue to acquire the slot from
+ * \param timeout maximum time to wait, or \c NULL to wait forever
+ *
+ * \return Pointer to an available slot in \p q->data
+ * \retval NULL if no slot became available within \p timeout
+ *
+ * \note This blocks, so it must be called from a thread, and the releases that
+ *     end the wait must come from signal handlers that interrupt that same
+ *     thread, see event_count.h. #Mcas is only safe against nesting, so a
+ *     producer on another thread is a data race.
+ */
+void *NestedQueue_write_acquire_wait(NestedQueue *          q,
+                                     const struct timespec *timeout);
+
+
+/** \brief Acquire a slot for reading, waiting for one to be committed
+ *
+ * \param q       #NestedQueue to acquire the slot from
+ * \param timeout maximum time to wait, or \c NULL to wait forever
+ *
+ * \return Pointer to an available slot in \p q->data for reading
+ * \retval NULL if no slot became available within \p timeout
+ *
+ * \note This blocks, so it must be called from a thread, and the commits that
+ *     end the wait must come from signal handlers that interrupt that same
+ *     thread, see event_count.h. #Mcas is only safe against nesting, so a
+ *     producer on another thread is a data race.
+ */
+const void *NestedQueue_read_acquire_wait(NestedQueue *          q,
+                                          const struct timespec *timeout);
+#endif
+
+
 /** \brief Iterate over acquired (read/write) regions
  *
  * Must be initialized with #NestedQueueIterator_init_read or
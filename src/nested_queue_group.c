@@ -0,0 +1,119 @@
+/** \file nested_queue_group.c
+ *
+ * Group of #NestedQueue read together, with a bitmap of the queues that have
+ * data
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "nested_queue_group.h"
+
+#include "memory_order.h"
+
+/* A set bit means that its queue may have data. Producers set it after every
+ * commit, and readers clear it when they find the queue empty, and then look
+ * at the queue once more. A commit that the second look misses must then
+ * come after the clear, and its producer sets the bit again. This is the
+ * store-then-load pattern on both sides, so the bitmap updates are seq_cst
+ * like the Mcas of the queues. */
+
+
+static inline const void *
+acquire_from(NestedQueueGroup *g, size_t queue, size_t *out_queue) {
+    const size_t word = queue / NESTED_QUEUE_GROUP_READY_BITS;
+    const unsigned long bit = 1UL << (queue % NESTED_QUEUE_GROUP_READY_BITS);
+
+    const void *slot = NestedQueue_read_acquire(g->queues[queue]);
+    if (slot == NULL) {
+        atomic_fetch_and(&g->ready[word], ~bit);
+        slot = NestedQueue_read_acquire(g->queues[queue]);
+        if (slot == NULL) { return NULL; }
+        /* Committed before the clear, it may have more data */
+        atomic_fetch_or(&g->ready[word], bit);
+    }
+    if (g->policy == NESTED_QUEUE_GROUP_ROUND_ROBIN) {
+        atomic_store_explicit(
+                &g->next_, (queue + 1) % g->n_queues, AINT_SAFE_RELAXED);
+    }
+    *out_queue = queue;
+    return slot;
+}
+
+
+/* Index of the first ready queue in [from, to), or to if there is none */
+static size_t next_ready(NestedQueueGroup *g, size_t from, size_t to) {
+    const size_t bits = NESTED_QUEUE_GROUP_READY_BITS;
+    for (size_t word = from / bits; word * bits < to; word++) {
+        unsigned long ready =
+                atomic_load_explicit(&g->ready[word], AINT_SAFE_RELAXED);
+        if (word == from / bits) { ready &= ~0UL << (from % bits); }
+        if (ready != 0) {
+            const size_t queue = word * bits + (size_t)__builtin_ctzl(ready);
+            return queue < to ? queue : to;
+        }
+    }
+    return to;
+}
+
+
+void NestedQueueGroup_mark_ready(NestedQueueGroup *g, size_t queue) {
+    atomic_fetch_or(&g->ready[queue / NESTED_QUEUE_GROUP_READY_BITS],
+                    1UL << (queue % NESTED_QUEUE_GROUP_READY_BITS));
+#if AINT_SAFE_WAIT
+    EventCount_notify(&g->readable);
+#endif
+}
+
+
+void NestedQueueGroup_write_commit(NestedQueueGroup *g,
+                                   size_t            queue,
+                                   const void *      slot) {
+    NestedQueue_write_commit(g->queues[queue], slot);
+    NestedQueueGroup_mark_ready(g, queue);
+}
+
+
+const void *NestedQueueGroup_read_acquire(NestedQueueGroup *g, size_t *queue) {
+    const size_t start =
+            g->policy == NESTED_QUEUE_GROUP_ROUND_ROBIN
+                    ? atomic_load_explicit(&g->next_, AINT_SAFE_RELAXED)
+                    : 0;
+    /* From start to the end, and then wrap around to start */
+    for (size_t i = next_ready(g, start, g->n_queues); i < g->n_queues;
+         i        = next_ready(g, i + 1, g->n_queues)) {
+        const void *slot = acquire_from(g, i, queue);
+        if (slot != NULL) { return slot; }
+    }
+    for (size_t i = next_ready(g, 0, start); i < start;
+         i        = next_ready(g, i + 1, start)) {
+        const void *slot = acquire_from(g, i, queue);
+        if (slot != NULL) { return slot; }
+    }
+    return NULL;
+}
+
+
+#if AINT_SAFE_WAIT
+const void *
+NestedQueueGroup_read_acquire_wait(NestedQueueGroup *     g,
+                                   size_t *               queue,
+                                   const struct timespec *timeout) {
+    struct timespec deadline;
+    if (timeout != NULL) { EventCount_deadline(&deadline, timeout); }
+
+    const void *slot;
+    while ((slot = NestedQueueGroup_read_acquire(g, queue)) == NULL) {
+        const uint32_t key = EventCount_prepare_wait(&g->readable);
+        /* Check again, a commit before prepare_wait doesn't wake us */
+        slot = NestedQueueGroup_read_acquire(g, queue);
+        if (slot != NULL) {
+            EventCount_cancel_wait(&g->readable);
+            break;
+        }
+        if (!EventCount_wait(
+                    &g->readable, key, timeout != NULL ? &deadline : NULL)) {
+            return NestedQueueGroup_read_acquire(g, queue);
+        }
+    }
+    return slot;
+}
+#endif
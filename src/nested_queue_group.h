@@ -0,0 +1,190 @@
+/** \file nested_queue_group.h
+ *
+ * Group of #NestedQueue read together, with a bitmap of the queues that have
+ * data
+ *
+ * A consumer that services many queues, eg. one per source and priority,
+ * would otherwise poll each one with #NestedQueue_read_acquire. Instead,
+ * producers commit through the group, which sets the bit of the queue in a
+ * readiness bitmap, and the consumer finds the next queue to read with a
+ * find-first-set over the bitmap. A bit is cleared only when a read finds
+ * its queue empty, so idle queues cost nothing to poll.
+ *
+ * Usage:
+ * \code{.c}
+ * static NestedQueue rx_queues[40]; // each with NESTED_QUEUE_STATIC_INIT
+ * static NestedQueue *const rx_queue_ptrs[40] = {&rx_queues[0], ...};
+ * static nested_queue_group_ready_t
+ *         rx_ready[NESTED_QUEUE_GROUP_READY_LEN(40)];
+ * static NestedQueueGroup rx = NESTED_QUEUE_GROUP_STATIC_INIT(
+ *         40, rx_queue_ptrs, rx_ready, NESTED_QUEUE_GROUP_ROUND_ROBIN);
+ *
+ * void rx_interrupt(size_t source) {
+ *     Packet *p = NestedQueue_write_acquire(rx_queue_ptrs[source]);
+ *     if (p != NULL) {
+ *         ... // fill in *p
+ *         NestedQueueGroup_write_commit(&rx, source, p);
+ *     }
+ * }
+ *
+ * void main_loop(void) {
+ *     size_t source;
+ *     const Packet *p;
+ *     while ((p = NestedQueueGroup_read_acquire(&rx, &source)) != NULL) {
+ *         ... // handle *p
+ *         NestedQueue_read_release(rx_queue_ptrs[source], p);
+ *     }
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__NESTED_QUEUE_GROUP_H
+#define AINT_SAFE__NESTED_QUEUE_GROUP_H 1
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "event_count.h"
+#include "nested_queue.h"
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(
+        ATOMIC_LONG_LOCK_FREE,
+        "Your stdlib implementation does not have lock-free atomics for long");
+#endif
+
+
+/** \brief Word of the readiness bitmap of a #NestedQueueGroup
+ *
+ * Use #NESTED_QUEUE_GROUP_READY_LEN to declare a zero-initialized array of
+ * these for a group of N_QUEUES queues.
+ */
+typedef atomic_ulong nested_queue_group_ready_t;
+
+
+/** \brief Number of queues per #nested_queue_group_ready_t */
+#define NESTED_QUEUE_GROUP_READY_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+
+/** \brief Calculate the length of the readiness bitmap for \p N_QUEUES */
+#define NESTED_QUEUE_GROUP_READY_LEN(N_QUEUES)        \
+    (((N_QUEUES) + NESTED_QUEUE_GROUP_READY_BITS - 1) \
+     / NESTED_QUEUE_GROUP_READY_BITS)
+
+
+/** The order in which #NestedQueueGroup_read_acquire picks queues */
+typedef enum {
+    /** The queue with the lowest index that has data, so the queues are in
+     * decreasing priority */
+    NESTED_QUEUE_GROUP_PRIORITY,
+    /** The next queue that has data after the one read last, so that every
+     * queue with data is read in turn */
+    NESTED_QUEUE_GROUP_ROUND_ROBIN,
+} NestedQueueGroupPolicy;
+
+
+/** \brief Internal data structure of the queue group
+ *
+ * This must be initialized with #NESTED_QUEUE_GROUP_STATIC_INIT at
+ * declaration
+ */
+typedef struct {
+    /** The queues of the group */
+    NestedQueue *const *const queues;
+    /** Number of elements in #queues */
+    const size_t n_queues;
+    /** Readiness bitmap, bit i is set if #queues[i] may have data */
+    nested_queue_group_ready_t *const ready;
+    /** The order in which queues are read */
+    const NestedQueueGroupPolicy policy;
+    /** Queue to start searching from with #NESTED_QUEUE_GROUP_ROUND_ROBIN */
+    _Atomic size_t next_;
+#if AINT_SAFE_WAIT
+    /** Notified by #NestedQueueGroup_mark_ready */
+    EventCount readable;
+#endif
+} NestedQueueGroup;
+
+
+/** \brief Statically initialize a #NestedQueueGroup
+ *
+ * \param p_n_queues     number of elements in \p p_queues_array
+ * \param p_queues_array array of pointers to the queues of the group
+ * \param p_ready_array  zero-initialized #nested_queue_group_ready_t array of
+ *     length \c #NESTED_QUEUE_GROUP_READY_LEN(\p p_n_queues)
+ * \param p_policy       a #NestedQueueGroupPolicy
+ *
+ * \return A #NestedQueueGroup static initializer
+ *
+ * \note The queues must be empty, or be marked with
+ * #NestedQueueGroup_mark_ready.
+ */
+#define NESTED_QUEUE_GROUP_STATIC_INIT(                                   \
+        p_n_queues, p_queues_array, p_ready_array, p_policy)              \
+    {                                                                     \
+        .queues = p_queues_array, .n_queues = p_n_queues,                 \
+        .ready = p_ready_array, .policy = p_policy, .next_ = 0            \
+    }
+
+
+/** \brief Mark a queue of the group as having data
+ *
+ * \param g     #NestedQueueGroup that the queue belongs to
+ * \param queue index of the queue in \p g->queues
+ *
+ * Call this after committing to the queue directly with
+ * #NestedQueue_write_commit.
+ */
+void NestedQueueGroup_mark_ready(NestedQueueGroup *g, size_t queue);
+
+
+/** \brief Commit a slot to a queue of the group and mark it as having data
+ *
+ * \param g     #NestedQueueGroup that the queue belongs to
+ * \param queue index of the queue in \p g->queues
+ * \param slot  slot acquired by #NestedQueue_write_acquire() on the queue
+ *
+ * \note Calls must follow the \c write_order of the queue
+ */
+void NestedQueueGroup_write_commit(NestedQueueGroup *g,
+                                   size_t            queue,
+                                   const void *      slot);
+
+
+/** \brief Acquire a slot for reading from the next queue that has data
+ *
+ * \param g          #NestedQueueGroup to read from
+ * \param [out] queue index in \p g->queues of the queue the slot is from
+ *
+ * \return Pointer to the slot, for reading
+ * \retval NULL if all the queues are empty
+ *
+ * \post #NestedQueue_read_release() must be called on \p g->queues[*queue]
+ * after using the slot
+ */
+const void *NestedQueueGroup_read_acquire(NestedQueueGroup *g, size_t *queue);
+
+
+#if AINT_SAFE_WAIT
+/** \brief Acquire a slot for reading, waiting for any queue to get data
+ *
+ * \param g          #NestedQueueGroup to read from
+ * \param [out] queue index in \p g->queues of the queue the slot is from
+ * \param timeout    maximum time to wait, or \c NULL to wait forever
+ *
+ * \return Pointer to the slot, for reading
+ * \retval NULL if no queue got data within \p timeout
+ *
+ * \note This blocks, so it must be called from a thread, and the commits that
+ *     end the wait must come from signal handlers that interrupt that same
+ *     thread, see event_count.h. #Mcas is only safe against nesting, so a
+ *     producer on another thread is a data race.
+ */
+const void *NestedQueueGroup_read_acquire_wait(NestedQueueGroup *     g,
+                                               size_t *               queue,
+                                               const struct timespec *timeout);
+#endif
+
+
+#endif /* ifndef AINT_SAFE__NESTED_QUEUE_GROUP_H */
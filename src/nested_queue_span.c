@@ -0,0 +1,202 @@
+/** \file nested_queue_span.c
+ *
+ * Bulk copy, conversion and reduction of the slots acquired by
+ * #NestedQueue_read_acquire_bulk
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "nested_queue_span.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Each SIMD kernel does as many whole vectors as it can and returns how many
+ * samples that is, and the caller does the rest with the plain loop. AVX2 is
+ * picked at run time, so that the same build runs on any x86-64. */
+#if AINT_SAFE_SIMD && defined(__SSE2__) && defined(__GNUC__)
+#define NESTED_QUEUE_SPAN_X86 1
+#include <immintrin.h>
+#elif AINT_SAFE_SIMD && defined(__ARM_NEON)
+#define NESTED_QUEUE_SPAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Vectors summed into 32-bit lanes before they are added to the 64-bit sum.
+ * A lane of _mm_madd_epi16 is at most 2^16 in magnitude, so this stays well
+ * below 2^31. */
+#define SUM_BLOCK_VECTORS 16384
+
+
+#if NESTED_QUEUE_SPAN_X86
+static inline bool have_avx2(void) {
+#if defined(__AVX2__)
+    return true;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+
+static size_t
+int16_to_float_sse2(const int16_t *src, size_t n, float scale, float *dst) {
+    const __m128 s = _mm_set1_ps(scale);
+    size_t       i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i x  = _mm_loadu_si128((const __m128i *)(src + i));
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), s));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), s));
+    }
+    return i;
+}
+
+
+__attribute__((target("avx2"))) static size_t
+int16_to_float_avx2(const int16_t *src, size_t n, float scale, float *dst) {
+    const __m256 s = _mm256_set1_ps(scale);
+    size_t       i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i lo = _mm256_cvtepi16_epi32(
+                _mm_loadu_si128((const __m128i *)(src + i)));
+        const __m256i hi = _mm256_cvtepi16_epi32(
+                _mm_loadu_si128((const __m128i *)(src + i + 8)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), s));
+        _mm256_storeu_ps(dst + i + 8,
+                         _mm256_mul_ps(_mm256_cvtepi32_ps(hi), s));
+    }
+    return i;
+}
+
+
+static size_t sum_int16_sse2(const int16_t *src, size_t n, int64_t *sum) {
+    const __m128i ones = _mm_set1_epi16(1);
+    size_t        i    = 0;
+    while (i + 8 <= n) {
+        const size_t end =
+                n - i > 8 * SUM_BLOCK_VECTORS ? i + 8 * SUM_BLOCK_VECTORS : n;
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 8 <= end; i += 8) {
+            const __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+            acc             = _mm_add_epi32(acc, _mm_madd_epi16(x, ones));
+        }
+        int32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        *sum += (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return i;
+}
+
+
+__attribute__((target("avx2"))) static size_t
+sum_int16_avx2(const int16_t *src, size_t n, int64_t *sum) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    size_t        i    = 0;
+    while (i + 16 <= n) {
+        const size_t end = n - i > 16 * SUM_BLOCK_VECTORS
+                                   ? i + 16 * SUM_BLOCK_VECTORS
+                                   : n;
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 16 <= end; i += 16) {
+            const __m256i x =
+                    _mm256_loadu_si256((const __m256i *)(src + i));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x, ones));
+        }
+        int32_t lanes[8];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        for (size_t l = 0; l < 8; l++) { *sum += lanes[l]; }
+    }
+    return i;
+}
+#endif /* if NESTED_QUEUE_SPAN_X86 */
+
+
+#if NESTED_QUEUE_SPAN_NEON
+static size_t
+int16_to_float_neon(const int16_t *src, size_t n, float scale, float *dst) {
+    const float32x4_t s = vdupq_n_f32(scale);
+    size_t            i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const int16x8_t x  = vld1q_s16(src + i);
+        const int32x4_t lo = vmovl_s16(vget_low_s16(x));
+        const int32x4_t hi = vmovl_s16(vget_high_s16(x));
+        vst1q_f32(dst + i, vmulq_f32(vcvtq_f32_s32(lo), s));
+        vst1q_f32(dst + i + 4, vmulq_f32(vcvtq_f32_s32(hi), s));
+    }
+    return i;
+}
+
+
+static size_t sum_int16_neon(const int16_t *src, size_t n, int64_t *sum) {
+    int64x2_t acc = vdupq_n_s64(0);
+    size_t    i   = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc = vpadalq_s32(acc, vpaddlq_s16(vld1q_s16(src + i)));
+    }
+    *sum += vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+    return i;
+}
+#endif /* if NESTED_QUEUE_SPAN_NEON */
+
+
+static void
+int16_to_float(const int16_t *src, size_t n, float scale, float *dst) {
+    size_t i = 0;
+#if NESTED_QUEUE_SPAN_X86
+    i = have_avx2() ? int16_to_float_avx2(src, n, scale, dst)
+                    : int16_to_float_sse2(src, n, scale, dst);
+#elif NESTED_QUEUE_SPAN_NEON
+    i = int16_to_float_neon(src, n, scale, dst);
+#endif
+    for (; i < n; i++) { dst[i] = src[i] * scale; }
+}
+
+
+static int64_t sum_int16(const int16_t *src, size_t n) {
+    int64_t sum = 0;
+    size_t  i   = 0;
+#if NESTED_QUEUE_SPAN_X86
+    i = have_avx2() ? sum_int16_avx2(src, n, &sum)
+                    : sum_int16_sse2(src, n, &sum);
+#elif NESTED_QUEUE_SPAN_NEON
+    i = sum_int16_neon(src, n, &sum);
+#endif
+    for (; i < n; i++) { sum += src[i]; }
+    return sum;
+}
+
+
+size_t NestedQueueSpan_copy_out(const NestedQueueSpan spans[2],
+                                size_t                elem_size,
+                                void *                dst) {
+    const size_t size0 = spans[0].n_elems * elem_size;
+    memcpy(dst, spans[0].data, size0);
+    memcpy((char *)dst + size0, spans[1].data, spans[1].n_elems * elem_size);
+    return spans[0].n_elems + spans[1].n_elems;
+}
+
+
+size_t NestedQueueSpan_int16_to_float(const NestedQueueSpan spans[2],
+                                      size_t                elem_size,
+                                      float                 scale,
+                                      float *               dst) {
+    assert(elem_size % sizeof(int16_t) == 0);
+    size_t n = 0;
+    for (size_t s = 0; s < 2; s++) {
+        const size_t samples = spans[s].n_elems * elem_size / sizeof(int16_t);
+        int16_to_float(spans[s].data, samples, scale, dst + n);
+        n += samples;
+    }
+    return n;
+}
+
+
+int64_t NestedQueueSpan_sum_int16(const NestedQueueSpan spans[2],
+                                  size_t                elem_size) {
+    assert(elem_size % sizeof(int16_t) == 0);
+    return sum_int16(spans[0].data,
+                     spans[0].n_elems * elem_size / sizeof(int16_t))
+           + sum_int16(spans[1].data,
+                       spans[1].n_elems * elem_size / sizeof(int16_t));
+}
@@ -0,0 +1,95 @@
+/** \file nested_queue_span.h
+ *
+ * Bulk copy, conversion and reduction of the slots acquired by
+ * #NestedQueue_read_acquire_bulk
+ *
+ * A consumer that runs the same conversion on every element would otherwise
+ * acquire, convert and release one slot at a time. These run over the at
+ * most two #NestedQueueSpan of a bulk acquire instead, with SIMD where it is
+ * available: SSE2, or AVX2 when the CPU has it, on x86, and NEON on ARM,
+ * falling back to plain loops everywhere else.
+ *
+ * The conversions treat the slots as an array of \c int16_t samples, eg. of
+ * an ADC, so \c elem_size must be a multiple of \c sizeof(int16_t) and the
+ * data array must be aligned for \c int16_t.
+ *
+ * Usage:
+ * \code{.c}
+ * static int16_t samples[1024]; // one sample per slot
+ * static NestedQueue adc_queue;
+ * static NestedQueue adc_queue = NESTED_QUEUE_STATIC_INIT(
+ *         adc_queue, sizeof(samples[0]), 1024, samples,
+ *         NESTED_QUEUE_OPERATION_ORDER_NESTED,
+ *         NESTED_QUEUE_OPERATION_ORDER_NESTED);
+ *
+ * void process(void) {
+ *     float volts[256];
+ *     NestedQueueSpan spans[2];
+ *     const size_t n = NestedQueue_read_acquire_bulk(&adc_queue, 256, spans);
+ *     NestedQueueSpan_int16_to_float(spans, sizeof(int16_t), 3.3f / 32768,
+ *                                    volts);
+ *     NestedQueue_read_release_bulk(&adc_queue, spans);
+ *     ... // use the n values in volts
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__NESTED_QUEUE_SPAN_H
+#define AINT_SAFE__NESTED_QUEUE_SPAN_H 1
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nested_queue.h"
+
+
+#ifndef AINT_SAFE_SIMD
+/** \brief Use SIMD instructions in the span kernels when available
+ *
+ * Define it to 0 for the whole build to override, eg. to compare against
+ * the plain loops.
+ */
+#define AINT_SAFE_SIMD 1
+#endif
+
+
+/** \brief Copy the slots of two spans to a contiguous buffer
+ *
+ * \param spans     spans from #NestedQueue_read_acquire_bulk()
+ * \param elem_size size of a slot of the queue
+ * \param [out] dst buffer for all the slots of \p spans
+ *
+ * \return The number of slots copied
+ */
+size_t NestedQueueSpan_copy_out(const NestedQueueSpan spans[2],
+                                size_t                elem_size,
+                                void *                dst);
+
+
+/** \brief Convert the \c int16_t samples in two spans to scaled \c float
+ *
+ * \param spans     spans from #NestedQueue_read_acquire_bulk()
+ * \param elem_size size of a slot of the queue
+ * \param scale     factor to multiply every sample with
+ * \param [out] dst buffer for a \c float per sample of \p spans
+ *
+ * \return The number of samples converted
+ */
+size_t NestedQueueSpan_int16_to_float(const NestedQueueSpan spans[2],
+                                      size_t                elem_size,
+                                      float                 scale,
+                                      float *               dst);
+
+
+/** \brief Sum the \c int16_t samples in two spans
+ *
+ * \param spans     spans from #NestedQueue_read_acquire_bulk()
+ * \param elem_size size of a slot of the queue
+ *
+ * \return The sum of all the samples of \p spans
+ */
+int64_t NestedQueueSpan_sum_int16(const NestedQueueSpan spans[2],
+                                  size_t                elem_size);
+
+
+#endif /* ifndef AINT_SAFE__NESTED_QUEUE_SPAN_H */
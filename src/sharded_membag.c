@@ -0,0 +1,130 @@
+/** \file sharded_membag.c
+ *
+ * Memory bag sharded over NUMA nodes with per-CPU caches of free slots
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "sharded_membag.h"
+
+#include "memory_order.h"
+
+#include <stdbool.h>
+
+#define SHARDED_MEMBAG_BATCH_SIZE (SHARDED_MEMBAG_MAGAZINE_SIZE / 2)
+
+_Static_assert(SHARDED_MEMBAG_BATCH_SIZE > 0,
+               "SHARDED_MEMBAG_MAGAZINE_SIZE must be at least 2");
+
+
+/* Return a slot to the node it was acquired from. Nodes own disjoint arrays,
+ * so the address tells which one. */
+static void release_to_node(ShardedMembag *sm, const void *slot) {
+    for (size_t i = 0; i < sm->n_nodes; i++) {
+        Membag *    node  = sm->nodes[i];
+        const char *begin = node->data;
+        const char *end   = begin + node->elem_size * node->n_elems;
+        if ((const char *)slot >= begin && (const char *)slot < end) {
+            Membag_release(node, slot);
+            return;
+        }
+    }
+}
+
+
+/* Acquire one slot from the local node, or failing that, from the other nodes
+ * in turn */
+static void *acquire_from_nodes(ShardedMembag *sm, size_t local) {
+    for (size_t i = 0; i < sm->n_nodes; i++) {
+        void *slot = Membag_acquire(sm->nodes[(local + i) % sm->n_nodes]);
+        if (slot != NULL) { return slot; }
+    }
+    return NULL;
+}
+
+
+/* Take one slot cached by another CPU, when there are none left on the nodes.
+ * A magazine that is in use is skipped, as its owner may be the one that is
+ * interrupted. */
+static void *steal_from_magazines(ShardedMembag *sm, size_t cpu) {
+    for (size_t i = 1; i <= sm->n_cpus; i++) {
+        MembagMagazine *mag = &sm->magazines[(cpu + i) % sm->n_cpus];
+        if (atomic_flag_test_and_set_explicit(&mag->busy,
+                                              AINT_SAFE_ACQUIRE)) {
+            continue;
+        }
+        void *slot = NULL;
+        if (mag->n_slots > 0) { slot = mag->slots[--mag->n_slots]; }
+        atomic_flag_clear_explicit(&mag->busy, AINT_SAFE_RELEASE);
+        if (slot != NULL) { return slot; }
+    }
+    return NULL;
+}
+
+
+void ShardedMembag_init(ShardedMembag *sm) {
+    for (size_t cpu = 0; cpu < sm->n_cpus; cpu++) {
+        atomic_flag_clear(&sm->magazines[cpu].busy);
+        sm->magazines[cpu].n_slots = 0;
+    }
+}
+
+
+void *ShardedMembag_acquire(ShardedMembag *sm, size_t cpu) {
+    const size_t    local = sm->cpu_node[cpu];
+    MembagMagazine *mag   = &sm->magazines[cpu];
+    if (atomic_flag_test_and_set_explicit(&mag->busy, AINT_SAFE_ACQUIRE)) {
+        /* Interrupted the owner of the magazine, or migrated */
+        void *slot = acquire_from_nodes(sm, local);
+        return slot != NULL ? slot : steal_from_magazines(sm, cpu);
+    }
+
+    if (mag->n_slots == 0) {
+        /* Refill from the local node only, remote slots are taken one at a
+         * time below so that they don't linger in the magazine */
+        mag->n_slots = Membag_acquire_bulk(
+                sm->nodes[local], mag->slots, SHARDED_MEMBAG_BATCH_SIZE);
+    }
+    void *slot = NULL;
+    if (mag->n_slots > 0) { slot = mag->slots[--mag->n_slots]; }
+    atomic_flag_clear_explicit(&mag->busy, AINT_SAFE_RELEASE);
+
+    if (slot == NULL) { slot = acquire_from_nodes(sm, local); }
+    if (slot == NULL) { slot = steal_from_magazines(sm, cpu); }
+    return slot;
+}
+
+
+void ShardedMembag_release(ShardedMembag *sm, size_t cpu, const void *slot) {
+    if (slot == NULL) return;
+    MembagMagazine *mag = &sm->magazines[cpu];
+    if (atomic_flag_test_and_set_explicit(&mag->busy, AINT_SAFE_ACQUIRE)) {
+        release_to_node(sm, slot);
+        return;
+    }
+
+    if (mag->n_slots == SHARDED_MEMBAG_MAGAZINE_SIZE) {
+        /* Flush the oldest half, keeping the recently used (cache hot) ones */
+        for (size_t i = 0; i < SHARDED_MEMBAG_BATCH_SIZE; i++) {
+            release_to_node(sm, mag->slots[i]);
+        }
+        for (size_t i = SHARDED_MEMBAG_BATCH_SIZE; i < mag->n_slots; i++) {
+            mag->slots[i - SHARDED_MEMBAG_BATCH_SIZE] = mag->slots[i];
+        }
+        mag->n_slots -= SHARDED_MEMBAG_BATCH_SIZE;
+    }
+    mag->slots[mag->n_slots++] = (void *)slot;
+    atomic_flag_clear_explicit(&mag->busy, AINT_SAFE_RELEASE);
+}
+
+
+void ShardedMembag_flush(ShardedMembag *sm, size_t cpu) {
+    MembagMagazine *mag = &sm->magazines[cpu];
+    if (atomic_flag_test_and_set_explicit(&mag->busy, AINT_SAFE_ACQUIRE)) {
+        /* The owner is using it, and will keep the slots */
+        return;
+    }
+    while (mag->n_slots > 0) {
+        release_to_node(sm, mag->slots[--mag->n_slots]);
+    }
+    atomic_flag_clear_explicit(&mag->busy, AINT_SAFE_RELEASE);
+}
@@ -0,0 +1,156 @@
+/** \file sharded_membag.h
+ *
+ * Memory bag sharded over NUMA nodes with per-CPU caches of free slots
+ *
+ * Every node has its own #Membag, and every CPU has a small magazine of free
+ * slots. Acquires and releases normally only touch the magazine of the
+ * calling CPU. An empty magazine is refilled from the #Membag of the node of
+ * the CPU in a batch, and a full one is flushed back in a batch. Slots are
+ * only taken from the other nodes when the local node has none left, and
+ * from the magazines of the other CPUs when no node has any left, so that
+ * up to \c n_cpus * #SHARDED_MEMBAG_MAGAZINE_SIZE slots cached by idle CPUs
+ * don't make an acquire fail. A magazine that is in use by its CPU at that
+ * moment is skipped.
+ *
+ * The CPU index is passed in by the caller, eg. from \c sched_getcpu() on
+ * Linux or the core number on a multi-core microcontroller. Each magazine is
+ * guarded by a try-lock, so a thread that has migrated away, or a nested
+ * interrupt, finds it busy and goes to the node #Membag directly instead. The
+ * CPU index is therefore only a hint, and any index below \c n_cpus is safe.
+ *
+ * Usage:
+ * \code{.c}
+ * #define N_NODES 2
+ * #define N_CPUS  8
+ *
+ * static Membag *nodes[N_NODES];
+ * static MembagMagazine magazines[N_CPUS];
+ * static const size_t cpu_node[N_CPUS] = {0, 0, 0, 0, 1, 1, 1, 1};
+ * static ShardedMembag pool = SHARDED_MEMBAG_STATIC_INIT(
+ *         N_NODES, nodes, N_CPUS, magazines, cpu_node);
+ *
+ * void setup(void) {
+ *     for (int node = 0; node < N_NODES; node++) {
+ *         MmapOptions opts = MMAP_OPTIONS_DEFAULT;
+ *         opts.numa_node   = node;
+ *         nodes[node] = Membag_create(sizeof(Packet), 1 << 20, &opts);
+ *     }
+ *     ShardedMembag_init(&pool);
+ * }
+ *
+ * void worker(void) {
+ *     Packet *p = ShardedMembag_acquire(&pool, sched_getcpu());
+ *     ...
+ *     ShardedMembag_release(&pool, sched_getcpu(), p);
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__SHARDED_MEMBAG_H
+#define AINT_SAFE__SHARDED_MEMBAG_H 1
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "membag.h"
+
+
+#ifndef SHARDED_MEMBAG_MAGAZINE_SIZE
+/** \brief Maximum number of free slots cached per CPU
+ *
+ * Magazines are refilled and flushed half of this at a time. Define it before
+ * including this header to override.
+ */
+#define SHARDED_MEMBAG_MAGAZINE_SIZE 32
+#endif
+
+
+/** \brief Per-CPU cache of free slots */
+typedef struct {
+    /** Try-lock of the magazine */
+    atomic_flag busy;
+    /** Number of elements of #slots in use */
+    size_t n_slots;
+    /** Free slots, acquired from a node #Membag */
+    void *slots[SHARDED_MEMBAG_MAGAZINE_SIZE];
+} MembagMagazine;
+
+
+/** \brief Internal data structure of the sharded membag
+ *
+ * This must be initialized with #SHARDED_MEMBAG_STATIC_INIT at declaration
+ * AND #ShardedMembag_init at runtime.
+ */
+typedef struct {
+    /** #Membag of each node */
+    Membag *const *const nodes;
+    /** Number of elements in #nodes */
+    const size_t n_nodes;
+    /** Magazine of each CPU */
+    MembagMagazine *const magazines;
+    /** Number of elements in #magazines */
+    const size_t n_cpus;
+    /** Index in #nodes of the node of each CPU */
+    const size_t *const cpu_node;
+} ShardedMembag;
+
+
+/** \brief Statically initialize a #ShardedMembag
+ *
+ * \param p_n_nodes   number of elements in \p p_nodes
+ * \param p_nodes     array of pointers to the #Membag of each node
+ * \param p_n_cpus    number of elements in \p p_magazines and \p p_cpu_node
+ * \param p_magazines array of #MembagMagazine
+ * \param p_cpu_node  array of the index in \p p_nodes of the node of each CPU
+ *
+ * \return A #ShardedMembag static initializer
+ */
+#define SHARDED_MEMBAG_STATIC_INIT(                                     \
+        p_n_nodes, p_nodes, p_n_cpus, p_magazines, p_cpu_node)          \
+    {                                                                   \
+        .nodes = p_nodes, .n_nodes = p_n_nodes, .magazines = p_magazines, \
+        .n_cpus = p_n_cpus, .cpu_node = p_cpu_node                      \
+    }
+
+
+/** \brief Initialize a #ShardedMembag at runtime
+ *
+ * \param sm #ShardedMembag to initialize
+ *
+ * \pre The node #Membag must be initialized
+ */
+void ShardedMembag_init(ShardedMembag *sm);
+
+
+/** \brief Acquire an available slot
+ *
+ * \param sm  #ShardedMembag to acquire the slot from
+ * \param cpu index of the calling CPU
+ *
+ * \return Pointer to an available slot
+ * \retval NULL if no slot is available on any node, nor in the magazine of
+ *     any CPU that isn't in use
+ */
+void *ShardedMembag_acquire(ShardedMembag *sm, size_t cpu);
+
+
+/** \brief Release an acquired slot
+ *
+ * \param sm   #ShardedMembag that the slot belongs to
+ * \param cpu  index of the calling CPU
+ * \param slot pointer to a slot acquired by #ShardedMembag_acquire on any
+ *     CPU, or \c NULL
+ */
+void ShardedMembag_release(ShardedMembag *sm, size_t cpu, const void *slot);
+
+
+/** \brief Return all the slots cached by a CPU to their node #Membag
+ *
+ * \param sm  #ShardedMembag to flush
+ * \param cpu index of the CPU whose magazine is flushed
+ */
+void ShardedMembag_flush(ShardedMembag *sm, size_t cpu);
+
+
+#endif /* ifndef AINT_SAFE__SHARDED_MEMBAG_H */
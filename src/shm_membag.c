@@ -0,0 +1,76 @@
+/** \file shm_membag.c
+ *
+ * Memory bag that can be shared between processes
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "shm_membag.h"
+
+#include "memory_order.h"
+
+/* Same algorithm as membag.c, with the arrays found through offsets */
+
+
+static inline atomic_flag *alloc_status(const ShmMembag *membag) {
+    return ShmRegion_relative_ptr(membag, membag->alloc_status);
+}
+
+
+static inline char *data(const ShmMembag *membag) {
+    return ShmRegion_relative_ptr(membag, membag->data);
+}
+
+
+ShmMembag *ShmMembag_create(ShmRegion *region,
+                            uint32_t   elem_size,
+                            uint32_t   n_elems) {
+    ShmMembag *  membag = ShmRegion_alloc(region, sizeof(*membag));
+    atomic_flag *status =
+            ShmRegion_alloc(region, sizeof(atomic_flag) * n_elems);
+    void *array = ShmRegion_alloc(region, (size_t)elem_size * n_elems);
+    if (membag == NULL || status == NULL || array == NULL) { return NULL; }
+
+    membag->alloc_status = ShmRegion_relative_offset(membag, status);
+    membag->data         = ShmRegion_relative_offset(membag, array);
+    membag->n_elems      = n_elems;
+    membag->elem_size    = elem_size;
+    atomic_init(&membag->n_free, (int32_t)n_elems);
+    for (uint32_t i = 0; i < n_elems; i++) { atomic_flag_clear(&status[i]); }
+    return membag;
+}
+
+
+void *ShmMembag_acquire(ShmMembag *membag) {
+    int32_t acquired =
+            atomic_fetch_sub_explicit(&membag->n_free, 1, AINT_SAFE_ACQUIRE);
+    if (!(acquired > 0)) {
+        /* Restore the acquire as there is no free slot available */
+        atomic_fetch_add_explicit(&membag->n_free, 1, AINT_SAFE_RELAXED);
+        return NULL;
+    }
+    atomic_flag *status = alloc_status(membag);
+    uint32_t     i      = 0;
+    while (atomic_flag_test_and_set_explicit(&status[i], AINT_SAFE_ACQUIRE)) {
+        i = (i + 1) % membag->n_elems;
+    }
+    return data(membag) + ((size_t)membag->elem_size * i);
+}
+
+
+void ShmMembag_release(ShmMembag *membag, const void *slot) {
+    if (slot == NULL) return;
+    const size_t idx =
+            ((const char *)slot - data(membag)) / membag->elem_size;
+    atomic_flag_clear_explicit(&alloc_status(membag)[idx], AINT_SAFE_RELEASE);
+    atomic_fetch_add_explicit(&membag->n_free, 1, AINT_SAFE_RELEASE);
+}
+
+
+int64_t ShmMembag_offset(const ShmMembag *membag, const void *slot) {
+    return ShmRegion_relative_offset(membag, slot);
+}
+
+
+void *ShmMembag_slot(const ShmMembag *membag, int64_t offset) {
+    return ShmRegion_relative_ptr(membag, offset);
+}
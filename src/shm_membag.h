@@ -0,0 +1,103 @@
+/** \file shm_membag.h
+ *
+ * Memory bag that can be shared between processes
+ *
+ * This is the same as #Membag, but lives in a #ShmRegion and refers to its
+ * arrays by offsets, so it works in every process that maps the region.
+ * Elements acquired in one process can be passed to another one as an offset
+ * (see #ShmMembag_offset), eg. through a #ShmQueue.
+ *
+ * Usage:
+ * \code{.c}
+ * ShmMembag *pool = ShmMembag_create(&region, sizeof(Frame), 64);
+ * ShmRegion_publish(&region, "frames", pool);
+ *
+ * Frame *frame = ShmMembag_acquire(pool);
+ * ...
+ * ShmMembag_release(pool, frame);
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__SHM_MEMBAG_H
+#define AINT_SAFE__SHM_MEMBAG_H 1
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shm_region.h"
+
+
+/** \brief Internal data structure of the shared membag
+ *
+ * This must be created with #ShmMembag_create.
+ */
+typedef struct {
+    /** Offset of the array of \c atomic_flag marking allocated slots */
+    int64_t alloc_status;
+    /** Offset of the data to allocate slots from */
+    int64_t data;
+    /** Number of slots in #data */
+    uint32_t n_elems;
+    /** Size of a slot in #data */
+    uint32_t elem_size;
+    /** Number of slots currently free */
+    _Atomic int32_t n_free;
+} ShmMembag;
+
+
+/** \brief Allocate and initialize a #ShmMembag in a region
+ *
+ * \param region    region to allocate the membag and its arrays from
+ * \param elem_size size of a slot
+ * \param n_elems   number of slots
+ *
+ * \return the membag
+ * \retval NULL if \p region is full
+ */
+ShmMembag *ShmMembag_create(ShmRegion *region,
+                            uint32_t   elem_size,
+                            uint32_t   n_elems);
+
+
+/** \brief Acquire an available slot
+ *
+ * \param membag #ShmMembag to acquire the slot from
+ *
+ * \return Pointer to an available slot in this process
+ * \retval NULL if no slot is available
+ */
+void *ShmMembag_acquire(ShmMembag *membag);
+
+
+/** \brief Release an acquired slot
+ *
+ * \param membag #ShmMembag that the slot belongs to
+ * \param slot   pointer to a slot previously acquired by #ShmMembag_acquire
+ *     in any process, or \c NULL
+ */
+void ShmMembag_release(ShmMembag *membag, const void *slot);
+
+
+/** \brief Get the position-independent offset of a slot
+ *
+ * \param membag #ShmMembag that the slot belongs to
+ * \param slot   pointer to a slot in this process
+ *
+ * \return offset to pass to #ShmMembag_slot in any process
+ */
+int64_t ShmMembag_offset(const ShmMembag *membag, const void *slot);
+
+
+/** \brief Get a slot from its position-independent offset
+ *
+ * \param membag #ShmMembag that the slot belongs to
+ * \param offset offset returned by #ShmMembag_offset
+ *
+ * \return pointer to the slot in this process
+ */
+void *ShmMembag_slot(const ShmMembag *membag, int64_t offset);
+
+
+#endif /* ifndef AINT_SAFE__SHM_MEMBAG_H */
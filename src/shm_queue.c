@@ -0,0 +1,133 @@
+/** \file shm_queue.c
+ *
+ * Bounded multi-producer multi-consumer queue that can be shared between
+ * processes
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "shm_queue.h"
+
+#include "memory_order.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Each slot is preceded by a sequence number. For the slot at position pos
+ * (with index pos % n_elems), the sequence number is
+ *   pos               when the slot is free for writing at pos,
+ *   pos + 1           when it is committed and can be read at pos,
+ *   pos + n_elems     when it is released and free for writing again.
+ * A writer or reader claims position pos by incrementing write_pos or
+ * read_pos with a CAS, but only if the sequence number says the slot is ready
+ * for it. Since the sequence number of a slot being written or read is
+ * neither, later writers and readers don't touch it, and commits and releases
+ * are plain stores. Positions wrap around, so n_elems is a power of 2.
+ *
+ * The sequence numbers alone publish the slot contents, with a release store
+ * on commit and release paired with an acquire load in claim. The position
+ * counters only hand out positions, so they are relaxed. */
+
+typedef struct {
+    _Atomic uint32_t seq;
+} ShmQueueCell;
+
+#define SHM_QUEUE_CELL_HEADER_SIZE                                 \
+    ((sizeof(ShmQueueCell) + _Alignof(max_align_t) - 1)            \
+     & ~(_Alignof(max_align_t) - 1))
+
+
+static inline ShmQueueCell *cell(const ShmQueue *q, uint32_t pos) {
+    return (ShmQueueCell *)((char *)ShmRegion_relative_ptr(q, q->cells)
+                            + (size_t)q->stride * (pos & (q->n_elems - 1)));
+}
+
+
+static inline void *cell_to_slot(ShmQueueCell *c) {
+    return (char *)c + SHM_QUEUE_CELL_HEADER_SIZE;
+}
+
+
+static inline ShmQueueCell *slot_to_cell(const void *slot) {
+    return (ShmQueueCell *)((char *)slot - SHM_QUEUE_CELL_HEADER_SIZE);
+}
+
+
+ShmQueue *ShmQueue_create(ShmRegion *region,
+                          uint32_t   elem_size,
+                          uint32_t   n_elems) {
+    if (n_elems == 0 || (n_elems & (n_elems - 1)) != 0) { return NULL; }
+    const size_t stride = (SHM_QUEUE_CELL_HEADER_SIZE + elem_size
+                           + _Alignof(max_align_t) - 1)
+                          & ~(_Alignof(max_align_t) - 1);
+    ShmQueue *q     = ShmRegion_alloc(region, sizeof(*q));
+    void *    cells = ShmRegion_alloc(region, stride * n_elems);
+    if (q == NULL || cells == NULL) { return NULL; }
+
+    atomic_init(&q->write_pos, 0);
+    atomic_init(&q->read_pos, 0);
+    q->n_elems = n_elems;
+    q->stride  = (uint32_t)stride;
+    q->cells   = ShmRegion_relative_offset(q, cells);
+    for (uint32_t i = 0; i < n_elems; i++) {
+        atomic_init(&cell(q, i)->seq, i);
+    }
+    return q;
+}
+
+
+/* Claim the next position of *pos_counter, whose slot is ready when its
+ * sequence number is pos + ready_offset */
+static ShmQueueCell *
+claim(ShmQueue *q, _Atomic uint32_t *pos_counter, uint32_t ready_offset) {
+    uint32_t pos = atomic_load_explicit(pos_counter, AINT_SAFE_RELAXED);
+    while (true) {
+        ShmQueueCell *c = cell(q, pos);
+        const int32_t diff =
+                (int32_t)(atomic_load_explicit(&c->seq, AINT_SAFE_ACQUIRE)
+                          - (pos + ready_offset));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(pos_counter,
+                                                      &pos,
+                                                      pos + 1,
+                                                      AINT_SAFE_RELAXED,
+                                                      AINT_SAFE_RELAXED)) {
+                return c;
+            }
+            /* pos now holds the latest position, try that */
+        } else if (diff < 0) {
+            /* Still in use from the previous lap around the queue */
+            return NULL;
+        } else {
+            /* Another writer or reader claimed pos meanwhile */
+            pos = atomic_load_explicit(pos_counter, AINT_SAFE_RELAXED);
+        }
+    }
+}
+
+
+void *ShmQueue_write_acquire(ShmQueue *q) {
+    ShmQueueCell *c = claim(q, &q->write_pos, 0);
+    return c == NULL ? NULL : cell_to_slot(c);
+}
+
+
+void ShmQueue_write_commit(ShmQueue *q, void *slot) {
+    (void)q;
+    ShmQueueCell *c = slot_to_cell(slot);
+    /* Only this writer touches seq until the store */
+    const uint32_t seq = atomic_load_explicit(&c->seq, AINT_SAFE_RELAXED);
+    atomic_store_explicit(&c->seq, seq + 1, AINT_SAFE_RELEASE);
+}
+
+
+const void *ShmQueue_read_acquire(ShmQueue *q) {
+    ShmQueueCell *c = claim(q, &q->read_pos, 1);
+    return c == NULL ? NULL : cell_to_slot(c);
+}
+
+
+void ShmQueue_read_release(ShmQueue *q, const void *slot) {
+    ShmQueueCell *c = slot_to_cell(slot);
+    const uint32_t seq = atomic_load_explicit(&c->seq, AINT_SAFE_RELAXED);
+    atomic_store_explicit(&c->seq, seq - 1 + q->n_elems, AINT_SAFE_RELEASE);
+}
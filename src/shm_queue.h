@@ -0,0 +1,116 @@
+/** \file shm_queue.h
+ *
+ * Bounded multi-producer multi-consumer queue that can be shared between
+ * processes
+ *
+ * The queue lives in a #ShmRegion and has an acquire/commit interface like
+ * #NestedQueue, so elements are written and read in place without copying.
+ * Every slot has a sequence number that tells whether it is free, being
+ * written, ready or being read, so slots can be committed and released in any
+ * order.
+ *
+ * Usage:
+ * \code{.c}
+ * // Producer process
+ * ShmQueue *q = ShmQueue_create(&region, sizeof(Sample), 256);
+ * ShmRegion_publish(&region, "samples", q);
+ * ...
+ * Sample *s = ShmQueue_write_acquire(q);
+ * if (s != NULL) {
+ *     ... // fill in *s
+ *     ShmQueue_write_commit(q, s);
+ * }
+ *
+ * // Consumer process
+ * ShmQueue *q = ShmRegion_lookup(&region, "samples");
+ * const Sample *s = ShmQueue_read_acquire(q);
+ * if (s != NULL) {
+ *     ... // use *s
+ *     ShmQueue_read_release(q, s);
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__SHM_QUEUE_H
+#define AINT_SAFE__SHM_QUEUE_H 1
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "shm_region.h"
+
+
+/** \brief Internal data structure of the shared queue
+ *
+ * This must be created with #ShmQueue_create.
+ */
+typedef struct {
+    /** Position of the next slot to acquire for writing */
+    _Atomic uint32_t write_pos;
+    /** Position of the next slot to acquire for reading */
+    _Atomic uint32_t read_pos;
+    /** Number of slots, a power of 2 */
+    uint32_t n_elems;
+    /** Distance between slots, including their sequence numbers */
+    uint32_t stride;
+    /** Offset of the array of slots */
+    int64_t cells;
+} ShmQueue;
+
+
+/** \brief Allocate and initialize a #ShmQueue in a region
+ *
+ * \param region    region to allocate the queue from
+ * \param elem_size size of an element
+ * \param n_elems   number of elements, which must be a power of 2
+ *
+ * \return the queue
+ * \retval NULL if \p region is full or \p n_elems isn't a power of 2
+ */
+ShmQueue *ShmQueue_create(ShmRegion *region,
+                          uint32_t   elem_size,
+                          uint32_t   n_elems);
+
+
+/** \brief Acquire a free slot for writing
+ *
+ * \param q #ShmQueue to acquire the slot from
+ *
+ * \return Pointer to the slot in this process
+ * \retval NULL if \p q is full
+ *
+ * \post #ShmQueue_write_commit() must be called after writing to the slot.
+ */
+void *ShmQueue_write_acquire(ShmQueue *q);
+
+
+/** \brief Commit a slot acquired for writing
+ *
+ * \param q    #ShmQueue from which \p slot was acquired
+ * \param slot slot acquired by #ShmQueue_write_acquire()
+ */
+void ShmQueue_write_commit(ShmQueue *q, void *slot);
+
+
+/** \brief Acquire the oldest slot for reading
+ *
+ * \param q #ShmQueue to acquire the slot from
+ *
+ * \return Pointer to the slot in this process
+ * \retval NULL if \p q is empty, or its oldest slot is still being written
+ *
+ * \post #ShmQueue_read_release() must be called after using the slot.
+ */
+const void *ShmQueue_read_acquire(ShmQueue *q);
+
+
+/** \brief Release a slot acquired for reading
+ *
+ * \param q    #ShmQueue from which \p slot was acquired
+ * \param slot slot acquired by #ShmQueue_read_acquire()
+ */
+void ShmQueue_read_release(ShmQueue *q, const void *slot);
+
+
+#endif /* ifndef AINT_SAFE__SHM_QUEUE_H */
@@ -0,0 +1,167 @@
+/** \file shm_region.c
+ *
+ * Shared memory region for position-independent data structures
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+/* For ftruncate() */
+#define _POSIX_C_SOURCE 200809L
+
+#include "shm_region.h"
+
+#include "memory_order.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_REGION_ALIGN _Alignof(max_align_t)
+
+static inline uint64_t align_up(uint64_t offset) {
+    return (offset + SHM_REGION_ALIGN - 1) & ~(uint64_t)(SHM_REGION_ALIGN - 1);
+}
+
+
+static void *map(int fd, size_t size) {
+    void *base =
+            mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return base == MAP_FAILED ? NULL : base;
+}
+
+
+bool ShmRegion_create(ShmRegion *region, const char *name, size_t size) {
+    if (size < sizeof(ShmRegionHeader)) {
+        errno = EINVAL;
+        return false;
+    }
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) { return false; }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        int saved_errno = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = saved_errno;
+        return false;
+    }
+    ShmRegionHeader *header = map(fd, size);
+    if (header == NULL) {
+        int saved_errno = errno;
+        shm_unlink(name);
+        errno = saved_errno;
+        return false;
+    }
+
+    /* The object is zero-filled by ftruncate, only non-zero fields are set */
+    header->magic   = SHM_REGION_MAGIC;
+    header->version = SHM_REGION_VERSION;
+    header->size    = size;
+    atomic_store(&header->brk, align_up(sizeof(*header)));
+    atomic_store(&header->ready, 1);
+
+    region->header = header;
+    region->size   = size;
+    return true;
+}
+
+
+bool ShmRegion_attach(ShmRegion *region, const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) { return false; }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return false;
+    }
+    if ((size_t)st.st_size < sizeof(ShmRegionHeader)) {
+        /* Not truncated to its size yet */
+        close(fd);
+        errno = EAGAIN;
+        return false;
+    }
+    ShmRegionHeader *header = map(fd, (size_t)st.st_size);
+    if (header == NULL) { return false; }
+
+    int error = 0;
+    if (!atomic_load(&header->ready)) {
+        error = EAGAIN;
+    } else if (header->magic != SHM_REGION_MAGIC
+               || header->size != (uint64_t)st.st_size) {
+        error = EINVAL;
+    } else if (header->version != SHM_REGION_VERSION) {
+        error = EPROTO;
+    }
+    if (error) {
+        munmap(header, (size_t)st.st_size);
+        errno = error;
+        return false;
+    }
+
+    region->header = header;
+    region->size   = (size_t)st.st_size;
+    return true;
+}
+
+
+void ShmRegion_detach(ShmRegion *region) {
+    munmap(region->header, region->size);
+    region->header = NULL;
+    region->size   = 0;
+}
+
+
+void *ShmRegion_alloc(ShmRegion *region, size_t size) {
+    ShmRegionHeader *header = region->header;
+    uint64_t         brk    = atomic_load(&header->brk);
+    uint64_t         new_brk;
+    do {
+        new_brk = align_up(brk + size);
+        if (new_brk > header->size || new_brk < brk) { return NULL; }
+    } while (!atomic_compare_exchange_weak(&header->brk, &brk, new_brk));
+    /* Never used before, so still zero-filled */
+    return (char *)header + brk;
+}
+
+
+bool ShmRegion_publish(ShmRegion * region,
+                       const char *name,
+                       const void *object) {
+    ShmRegionHeader *header = region->header;
+    size_t           len    = strlen(name);
+    if (len >= SHM_REGION_NAME_LEN) { return false; }
+
+    uint32_t i = atomic_fetch_add(&header->n_entries, 1);
+    if (i >= SHM_REGION_MAX_ENTRIES) {
+        /* n_entries stays saturated, later publishes fail too */
+        return false;
+    }
+    ShmRegionEntry *entry = &header->entries[i];
+    memcpy(entry->name, name, len + 1);
+    entry->offset = (uint64_t)((const char *)object - (const char *)header);
+    atomic_store(&entry->valid, 1);
+    return true;
+}
+
+
+void *ShmRegion_lookup(ShmRegion *region, const char *name) {
+    ShmRegionHeader *header    = region->header;
+    uint32_t         n_entries = atomic_load(&header->n_entries);
+    if (n_entries > SHM_REGION_MAX_ENTRIES) {
+        n_entries = SHM_REGION_MAX_ENTRIES;
+    }
+    for (uint32_t i = 0; i < n_entries; i++) {
+        ShmRegionEntry *entry = &header->entries[i];
+        if (atomic_load(&entry->valid)
+            && strncmp(entry->name, name, SHM_REGION_NAME_LEN) == 0) {
+            return (char *)header + entry->offset;
+        }
+    }
+    return NULL;
+}
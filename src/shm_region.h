@@ -0,0 +1,221 @@
+/** \file shm_region.h
+ *
+ * Shared memory region for position-independent data structures
+ *
+ * A region is a POSIX shared memory object that starts with a
+ * #ShmRegionHeader. The creating process allocates the shared data structures
+ * (#ShmMembag, #ShmQueue) from the region and publishes them by name. Other
+ * processes attach to the region, which may be mapped at a different address
+ * in each of them, and look the structures up by name.
+ *
+ * All links inside the shared structures are offsets relative to the
+ * structure itself or indexes, never absolute pointers, so they are valid in
+ * every mapping. Only the #ShmRegion handle is local to a process.
+ *
+ * Usage:
+ * \code{.c}
+ * // Producer process
+ * ShmRegion region;
+ * if (!ShmRegion_create(&region, "/sensors", 1 << 20)) { perror(...); }
+ * ShmQueue *q = ShmQueue_create(&region, sizeof(Sample), 256);
+ * ShmRegion_publish(&region, "samples", q);
+ *
+ * // Consumer process
+ * ShmRegion region;
+ * if (!ShmRegion_attach(&region, "/sensors")) { perror(...); }
+ * ShmQueue *q = ShmRegion_lookup(&region, "samples");
+ * \endcode
+ *
+ * \note The structures in a region are used by processes running in parallel,
+ * not by nested interrupts, so they use algorithms that are safe for that.
+ * #NestedQueue can't be shared this way, as #Mcas keeps its journal on the
+ * stack of the caller, and neither can #DoubleBuffer, whose readers must not
+ * run in parallel. A process that dies between an acquire and the
+ * corresponding commit or release leaves that slot acquired.
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__SHM_REGION_H
+#define AINT_SAFE__SHM_REGION_H 1
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(
+        atomic_is_lock_free((uint32_t *)NULL),
+        "Your stdlib implementation does not have lock-free uint32_t atomics");
+_Static_assert(
+        atomic_is_lock_free((uint64_t *)NULL),
+        "Your stdlib implementation does not have lock-free uint64_t atomics");
+#endif
+
+
+/** \brief Magic number at the start of every region ("AINT") */
+#define SHM_REGION_MAGIC 0x544e4941u
+
+/** \brief Version of the layout of the region and the shared structures
+ *
+ * This must be incremented whenever the layout of #ShmRegionHeader or of any
+ * of the shared structures changes, so that processes built against different
+ * layouts refuse to attach to each other's regions.
+ */
+#define SHM_REGION_VERSION 1u
+
+#ifndef SHM_REGION_MAX_ENTRIES
+/** \brief Maximum number of names published in a region
+ *
+ * Define it before including this header to override. This changes the
+ * region layout, so all processes must use the same value.
+ */
+#define SHM_REGION_MAX_ENTRIES 16
+#endif
+
+/** \brief Maximum length of a published name, including the terminating NUL
+ */
+#define SHM_REGION_NAME_LEN 32
+
+
+/** \brief A named structure published in a region */
+typedef struct {
+    /** Set once #name and #offset are written */
+    _Atomic uint32_t valid;
+    /** Name of the structure */
+    char name[SHM_REGION_NAME_LEN];
+    /** Offset of the structure from the start of the region */
+    uint64_t offset;
+} ShmRegionEntry;
+
+
+/** \brief Header at the start of a shared memory region */
+typedef struct {
+    /** #SHM_REGION_MAGIC */
+    uint32_t magic;
+    /** #SHM_REGION_VERSION of the creating process */
+    uint32_t version;
+    /** Size of the whole region in bytes */
+    uint64_t size;
+    /** Set once the header is initialized */
+    _Atomic uint32_t ready;
+    /** Number of elements of #entries claimed */
+    _Atomic uint32_t n_entries;
+    /** Offset of the first unallocated byte */
+    _Atomic uint64_t brk;
+    /** Published structures */
+    ShmRegionEntry entries[SHM_REGION_MAX_ENTRIES];
+} ShmRegionHeader;
+
+
+/** \brief Process local handle of a mapped region */
+typedef struct {
+    /** Start of the region in this process */
+    ShmRegionHeader *header;
+    /** Size of the mapping */
+    size_t size;
+} ShmRegion;
+
+
+/** \brief Get the address at an offset from a shared structure
+ *
+ * \param from   address of the shared structure holding \p offset
+ * \param offset offset returned by #ShmRegion_relative_offset
+ *
+ * \return the address in this process
+ */
+static inline void *ShmRegion_relative_ptr(const void *from, int64_t offset) {
+    return (char *)from + offset;
+}
+
+
+/** \brief Get the offset of an address from a shared structure
+ *
+ * \param from address of the shared structure that will hold the offset
+ * \param to   address in the same region
+ *
+ * \return offset to pass to #ShmRegion_relative_ptr
+ */
+static inline int64_t ShmRegion_relative_offset(const void *from,
+                                                const void *to) {
+    return (const char *)to - (const char *)from;
+}
+
+
+/** \brief Create and map a new region
+ *
+ * \param[out] region handle of the mapped region
+ * \param      name   name of the POSIX shared memory object, which must not
+ *     exist yet
+ * \param      size   size of the region in bytes, including the header
+ *
+ * \retval true  if the region was created
+ * \retval false on failure, with \c errno set
+ */
+bool ShmRegion_create(ShmRegion *region, const char *name, size_t size);
+
+
+/** \brief Map an existing region
+ *
+ * \param[out] region handle of the mapped region
+ * \param      name   name of the POSIX shared memory object
+ *
+ * \retval true  if the region was mapped
+ * \retval false on failure, with \c errno set. \c EAGAIN if the region is
+ *     still being created, \c EINVAL if it isn't a region, and \c EPROTO if
+ *     it was created with a different #SHM_REGION_VERSION.
+ */
+bool ShmRegion_attach(ShmRegion *region, const char *name);
+
+
+/** \brief Unmap a region
+ *
+ * The region stays in existence until it is removed with \c shm_unlink and
+ * all processes detach from it.
+ *
+ * \param region handle returned by #ShmRegion_create or #ShmRegion_attach
+ */
+void ShmRegion_detach(ShmRegion *region);
+
+
+/** \brief Allocate memory from a region
+ *
+ * Memory is never freed. Allocate the shared structures up front, and
+ * allocate elements from a #ShmMembag instead.
+ *
+ * \param region region to allocate from
+ * \param size   number of bytes to allocate
+ *
+ * \return zero-initialized memory aligned to \c max_align_t
+ * \retval NULL if \p region is full
+ */
+void *ShmRegion_alloc(ShmRegion *region, size_t size);
+
+
+/** \brief Publish a structure in a region by name
+ *
+ * \param region region holding \p object
+ * \param name   name to publish \p object under, shorter than
+ *     #SHM_REGION_NAME_LEN
+ * \param object structure allocated from \p region
+ *
+ * \retval true  if \p object was published
+ * \retval false if \p name is too long or all the entries are used
+ */
+bool ShmRegion_publish(ShmRegion * region,
+                       const char *name,
+                       const void *object);
+
+
+/** \brief Look up a published structure
+ *
+ * \param region region to look in
+ * \param name   name that the structure was published under
+ *
+ * \return the structure in this process
+ * \retval NULL if \p name isn't published
+ */
+void *ShmRegion_lookup(ShmRegion *region, const char *name);
+
+
+#endif /* ifndef AINT_SAFE__SHM_REGION_H */
@@ -0,0 +1,247 @@
+/** \file skip_list.c
+ *
+ * Interrupt-safe lock-free ordered set (skip list) of intrusive nodes
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "skip_list.h"
+#include "memory_order.h"
+#include <stdint.h>
+
+#include "container.h"
+
+/* A node is inserted by linking it at level 0 first and then at the upper
+ * levels one by one. It is deleted by marking its links from the top level
+ * down to level 0, where marking decides which deleter owns the node, and
+ * then searching for it, which unlinks it at every level.
+ *
+ * An insert that is interrupted half way through must not race with a delete
+ * of the same node, as the inserter could link the node back at an upper level
+ * after the deleter has unlinked it. So the node is visible to find() and
+ * delete() only once it is linked at all levels. To the interrupting
+ * operations, this is the same as the insert occuring just after them.
+ *
+ * The links use the memory orders of marked_slist.c. Setting linked
+ * releases all the links of the node, and it is loaded with acquire before
+ * the node is deleted or returned, so a thread that sees a node as linked
+ * also sees it at every level. The seed is only a counter. */
+
+static inline SkipListNode *link_to_node(uintptr_t link, unsigned int level) {
+    MarkedSlistNode *level_node = MarkedSlist_link_to_node(link);
+    if (level_node == NULL) return NULL;
+    return CONTAINER_OF(level_node - level, SkipListNode, next[0]);
+}
+
+static inline uintptr_t node_to_link(SkipListNode *node, unsigned int level) {
+    if (node == NULL) return 0;
+    return (uintptr_t)&node->next[level];
+}
+
+static inline _Atomic uintptr_t *link_at(SkipListNode *node,
+                                          unsigned int  level) {
+    return &node->next[level].next;
+}
+
+
+static unsigned int random_n_levels(SkipList *sl) {
+    /* Each call gets a different seed with a single atomic operation, which
+     * is then mixed (murmur3 finalizer) to get independent bits */
+    uint32_t x = atomic_fetch_add_explicit(
+            &sl->seed, 0x9e3779b9u, AINT_SAFE_RELAXED);
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    unsigned int n_levels = 1;
+    while ((x & 1) && n_levels < SKIP_LIST_MAX_LEVEL) {
+        n_levels++;
+        x >>= 1;
+    }
+    return n_levels;
+}
+
+
+/* Find the last node before key and the first node not before key at every
+ * level, unlinking all marked nodes on the way */
+static bool SkipList_search(SkipList *          sl,
+                            const SkipListNode *key,
+                            SkipListNode **     preds,
+                            SkipListNode **     succs) {
+    bool restart;
+    do {
+        restart            = false;
+        SkipListNode *pred = &sl->head;
+        for (int level = SKIP_LIST_MAX_LEVEL - 1; level >= 0 && !restart;
+             level--) {
+            SkipListNode *current = link_to_node(
+                    atomic_load_explicit(link_at(pred, level),
+                                         AINT_SAFE_ACQUIRE),
+                    level);
+            while (current != NULL) {
+                uintptr_t current_link = atomic_load_explicit(
+                        link_at(current, level), AINT_SAFE_ACQUIRE);
+                if (MarkedSlist_is_marked(current_link)) {
+                    /* current is being deleted, help unlink it. If pred was
+                     * deleted or something was inserted after it meanwhile,
+                     * the positions found so far are stale. */
+                    uintptr_t expected = node_to_link(current, level);
+                    if (!atomic_compare_exchange_strong_explicit(
+                                link_at(pred, level),
+                                &expected,
+                                MarkedSlist_unmarked(current_link),
+                                AINT_SAFE_ACQ_REL,
+                                AINT_SAFE_RELAXED)) {
+                        restart = true;
+                        break;
+                    }
+                    current = link_to_node(current_link, level);
+                } else if (sl->compare(current, key) < 0) {
+                    pred    = current;
+                    current = link_to_node(current_link, level);
+                } else {
+                    break;
+                }
+            }
+            preds[level] = pred;
+            succs[level] = current;
+        }
+    } while (restart);
+    return succs[0] != NULL && sl->compare(succs[0], key) == 0;
+}
+
+
+SkipListNode *SkipList_insert(SkipList *sl, SkipListNode *node) {
+    SkipListNode *preds[SKIP_LIST_MAX_LEVEL];
+    SkipListNode *succs[SKIP_LIST_MAX_LEVEL];
+
+    atomic_store_explicit(&node->linked, false, AINT_SAFE_RELAXED);
+    node->n_levels = random_n_levels(sl);
+
+    uintptr_t expected;
+    do {
+        if (SkipList_search(sl, node, preds, succs)) {
+            /* An equal node is already in the set */
+            return NULL;
+        }
+        for (unsigned int level = 0; level < node->n_levels; level++) {
+            atomic_store_explicit(link_at(node, level),
+                                  node_to_link(succs[level], level),
+                                  AINT_SAFE_RELAXED);
+        }
+        expected = node_to_link(succs[0], 0);
+    } while (!atomic_compare_exchange_strong_explicit(link_at(preds[0], 0),
+                                                      &expected,
+                                                      node_to_link(node, 0),
+                                                      AINT_SAFE_RELEASE,
+                                                      AINT_SAFE_RELAXED));
+
+    /* node is in the list now. Nobody can delete it till it is linked, so its
+     * own links can be written without a compare_exchange. */
+    for (unsigned int level = 1; level < node->n_levels; level++) {
+        while (1) {
+            expected = node_to_link(succs[level], level);
+            if (atomic_compare_exchange_strong_explicit(
+                        link_at(preds[level], level),
+                        &expected,
+                        node_to_link(node, level),
+                        AINT_SAFE_RELEASE,
+                        AINT_SAFE_RELAXED)) {
+                break;
+            }
+            /* Something changed around the position at this level */
+            SkipList_search(sl, node, preds, succs);
+            atomic_store_explicit(link_at(node, level),
+                                  node_to_link(succs[level], level),
+                                  AINT_SAFE_RELAXED);
+        }
+    }
+    atomic_store_explicit(&node->linked, true, AINT_SAFE_RELEASE);
+    return node;
+}
+
+
+SkipListNode *SkipList_delete(SkipList *sl, SkipListNode *node) {
+    if (!atomic_load_explicit(&node->linked, AINT_SAFE_ACQUIRE)) {
+        /* Not inserted yet, or already deleted */
+        return NULL;
+    }
+    for (unsigned int level = node->n_levels - 1; level > 0; level--) {
+        uintptr_t link =
+                atomic_load_explicit(link_at(node, level), AINT_SAFE_RELAXED);
+        while (!MarkedSlist_is_marked(link)
+               && !atomic_compare_exchange_weak_explicit(
+                       link_at(node, level),
+                       &link,
+                       link | MARKED_SLIST_MARK,
+                       AINT_SAFE_ACQUIRE,
+                       AINT_SAFE_RELAXED)) {
+        }
+    }
+    uintptr_t link = atomic_load_explicit(link_at(node, 0), AINT_SAFE_RELAXED);
+    do {
+        if (MarkedSlist_is_marked(link)) {
+            /* Someone else is deleting this node */
+            return NULL;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(link_at(node, 0),
+                                                    &link,
+                                                    link | MARKED_SLIST_MARK,
+                                                    AINT_SAFE_ACQUIRE,
+                                                    AINT_SAFE_RELAXED));
+
+    /* We own the delete now. Searching for the node unlinks it everywhere. */
+    SkipListNode *preds[SKIP_LIST_MAX_LEVEL];
+    SkipListNode *succs[SKIP_LIST_MAX_LEVEL];
+    SkipList_search(sl, node, preds, succs);
+    atomic_store_explicit(&node->linked, false, AINT_SAFE_RELAXED);
+    return node;
+}
+
+
+SkipListNode *SkipList_find(SkipList *sl, const SkipListNode *key) {
+    /* Same as SkipList_search, but marked nodes are skipped over instead of
+     * being unlinked */
+    SkipListNode *pred    = &sl->head;
+    SkipListNode *current = NULL;
+    for (int level = SKIP_LIST_MAX_LEVEL - 1; level >= 0; level--) {
+        current = link_to_node(
+                atomic_load_explicit(link_at(pred, level), AINT_SAFE_ACQUIRE),
+                level);
+        while (current != NULL) {
+            uintptr_t current_link = atomic_load_explicit(
+                    link_at(current, level), AINT_SAFE_ACQUIRE);
+            if (MarkedSlist_is_marked(current_link)) {
+                current = link_to_node(current_link, level);
+            } else if (sl->compare(current, key) < 0) {
+                pred    = current;
+                current = link_to_node(current_link, level);
+            } else {
+                break;
+            }
+        }
+    }
+    if (current != NULL && sl->compare(current, key) == 0
+        && atomic_load_explicit(&current->linked, AINT_SAFE_ACQUIRE)) {
+        return current;
+    }
+    return NULL;
+}
+
+
+SkipListNode *SkipList_first(SkipList *sl) {
+    return SkipList_next(&sl->head);
+}
+
+
+SkipListNode *SkipList_next(SkipListNode *node) {
+    MarkedSlistNode *next = &node->next[0];
+    while ((next = MarkedSlist_next(next)) != NULL) {
+        SkipListNode *next_node = CONTAINER_OF(next, SkipListNode, next[0]);
+        /* Skip nodes that are still being inserted */
+        if (atomic_load_explicit(&next_node->linked, AINT_SAFE_ACQUIRE)) {
+            return next_node;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,194 @@
+/** \file skip_list.h
+ *
+ * Interrupt-safe lock-free ordered set (skip list) of intrusive nodes
+ *
+ * Each level of the skip list is a \ref marked_slist.h list, so a node is
+ * deleted by marking its links top down and then unlinking it. Insert, delete
+ * and find take O(log n) expected time.
+ *
+ * Usage:
+ * \code{.c}
+ * typedef struct {
+ *     uint32_t     deadline;
+ *     SkipListNode node;
+ * } Timer;
+ *
+ * static int Timer_compare(const SkipListNode *a, const SkipListNode *b) {
+ *     const Timer *ta = CONTAINER_OF(a, Timer, node);
+ *     const Timer *tb = CONTAINER_OF(b, Timer, node);
+ *     return (ta->deadline > tb->deadline) - (ta->deadline < tb->deadline);
+ * }
+ *
+ * static Timer timer_array[100];
+ * static membag_alloc_status_t timer_status[MEMBAG_ALLOC_STATUS_LEN(100)];
+ * static Membag timer_pool = MEMBAG_STATIC_INIT(
+ *         sizeof(Timer), 100, timer_status, timer_array);
+ *
+ * static SkipList timers = SKIP_LIST_STATIC_INIT(Timer_compare);
+ *
+ * void arm(uint32_t deadline) {
+ *     Timer *t = Membag_acquire(&timer_pool);
+ *     if (t != NULL) {
+ *         t->deadline = deadline;
+ *         if (SkipList_insert(&timers, &t->node) == NULL) {
+ *             // A timer with the same deadline is already armed
+ *             Membag_release(&timer_pool, t);
+ *         }
+ *     }
+ * }
+ *
+ * void expire(uint32_t now) {
+ *     SkipListNode *n;
+ *     while ((n = SkipList_first(&timers)) != NULL
+ *            && CONTAINER_OF(n, Timer, node)->deadline <= now) {
+ *         if (SkipList_delete(&timers, n) != NULL) {
+ *             // Retire to an EpochReclaim if there are concurrent readers
+ *             Membag_release(&timer_pool, CONTAINER_OF(n, Timer, node));
+ *         }
+ *     }
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__SKIP_LIST_H
+#define AINT_SAFE__SKIP_LIST_H 1
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "marked_slist.h"
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(
+        ATOMIC_INT_LOCK_FREE,
+        "Your stdlib implementation does not have lock-free int atomics");
+_Static_assert(
+        ATOMIC_BOOL_LOCK_FREE,
+        "Your stdlib implementation does not have lock-free bool atomics");
+#endif
+
+
+#ifndef SKIP_LIST_MAX_LEVEL
+/** \brief Maximum number of levels of a #SkipListNode
+ *
+ * Each level halves the expected number of nodes linked at it, so this should
+ * be about log2 of the maximum number of nodes. Define it before including
+ * this header to override.
+ */
+#define SKIP_LIST_MAX_LEVEL 12
+#endif
+
+
+/** \brief Node of the skip list
+ *
+ * Embed this in the structure to link and use #CONTAINER_OF to get back to
+ * it.
+ */
+typedef struct SkipListNode {
+    /** Links to the next node at each level */
+    MarkedSlistNode next[SKIP_LIST_MAX_LEVEL];
+    /** Number of levels in #next that this node is linked at */
+    unsigned int n_levels;
+    /** Set once the node is linked at all its levels */
+    atomic_bool linked;
+} SkipListNode;
+
+
+/** \brief Comparison function for the ordered set
+ *
+ * \return a value less than, equal to, or greater than 0 if \p a is ordered
+ *     before, the same as, or after \p b
+ */
+typedef int (*SkipListCompare)(const SkipListNode *a, const SkipListNode *b);
+
+
+/** \brief Internal data structure of the skip list
+ *
+ * This must be initialized with #SKIP_LIST_STATIC_INIT at declaration.
+ */
+typedef struct {
+    /** Dummy head node linked at all levels */
+    SkipListNode head;
+    /** Ordering of the nodes */
+    const SkipListCompare compare;
+    /** Seed to pick the number of levels of inserted nodes */
+    atomic_uint seed;
+} SkipList;
+
+
+/** \brief Statically initialize a #SkipList
+ *
+ * \param p_compare #SkipListCompare ordering the nodes
+ *
+ * \return A #SkipList static initializer
+ */
+#define SKIP_LIST_STATIC_INIT(p_compare) \
+    { .compare = p_compare, .seed = 0 }
+
+
+/** \brief Insert a node
+ *
+ * \param sl   #SkipList to insert into
+ * \param node node to insert
+ *
+ * \return \p node
+ * \retval NULL if a node comparing equal to \p node is already in \p sl
+ *
+ * \note \p node is visible to #SkipList_find and #SkipList_delete only once
+ * this returns.
+ */
+SkipListNode *SkipList_insert(SkipList *sl, SkipListNode *node);
+
+
+/** \brief Delete a node
+ *
+ * \param sl   #SkipList to delete from
+ * \param node node to delete
+ *
+ * \return \p node once it is unlinked from all levels
+ * \retval NULL if \p node is not in \p sl, being inserted, or already being
+ *     deleted
+ *
+ * \note A concurrent traversal may still hold \p node after this returns.
+ * Use an #EpochReclaim to defer releasing it to its #Membag.
+ */
+SkipListNode *SkipList_delete(SkipList *sl, SkipListNode *node);
+
+
+/** \brief Find a node
+ *
+ * This does not modify \p sl.
+ *
+ * \param sl  #SkipList to search
+ * \param key node comparing equal to the one to find. It need not be in
+ *     \p sl.
+ *
+ * \return the node in \p sl that compares equal to \p key
+ * \retval NULL if there is no such node
+ */
+SkipListNode *SkipList_find(SkipList *sl, const SkipListNode *key);
+
+
+/** \brief Get the first (smallest) node
+ *
+ * \param sl #SkipList to iterate over
+ *
+ * \return the first node in \p sl
+ * \retval NULL if \p sl is empty
+ */
+SkipListNode *SkipList_first(SkipList *sl);
+
+
+/** \brief Get the next node in order
+ *
+ * \param node node to start from
+ *
+ * \return the node after \p node
+ * \retval NULL if \p node is the last node
+ */
+SkipListNode *SkipList_next(SkipListNode *node);
+
+
+#endif /* ifndef AINT_SAFE__SKIP_LIST_H */
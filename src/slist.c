@@ -6,6 +6,7 @@
 /* Copyright 2019 Gaurav Juvekar */
 
 #include "slist.h"
+#include "memory_order.h"
 #include <assert.h>
 #include <stdbool.h>
 
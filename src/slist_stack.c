@@ -0,0 +1,103 @@
+/** \file slist_stack.c
+ *
+ * Interrupt-safe lock-free LIFO stack of intrusive #SlistNode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "slist_stack.h"
+#include "memory_order.h"
+#include <assert.h>
+#include <stdbool.h>
+
+#define SLIST_STACK_INDEX_MASK (((uintptr_t)1 << SLIST_STACK_INDEX_BITS) - 1)
+
+/* The successful compare_exchange on head publishes the pushed node (release)
+ * and makes its contents visible to the popper (acquire). The loads of head
+ * pair with it for reading next before popping. */
+
+
+static inline uintptr_t head_index(uintptr_t head) {
+    return head & SLIST_STACK_INDEX_MASK;
+}
+
+static inline uintptr_t head_tag(uintptr_t head) {
+    return head >> SLIST_STACK_INDEX_BITS;
+}
+
+static inline uintptr_t make_head(uintptr_t index, uintptr_t tag) {
+    return (tag << SLIST_STACK_INDEX_BITS) | (index & SLIST_STACK_INDEX_MASK);
+}
+
+static inline SlistNode *index_to_node(const SlistStack *stack,
+                                       uintptr_t         index) {
+    if (index == 0) return NULL;
+    return (SlistNode *)((char *)stack->membag->data
+                         + (stack->membag->elem_size * (index - 1))
+                         + stack->node_offset);
+}
+
+static inline uintptr_t node_to_index(const SlistStack *stack,
+                                      const SlistNode * node) {
+    if (node == NULL) return 0;
+    return ((char *)node - stack->node_offset - (char *)stack->membag->data)
+                   / stack->membag->elem_size
+           + 1;
+}
+
+
+void SlistStack_push(SlistStack *stack, SlistNode *node) {
+    const uintptr_t index = node_to_index(stack, node);
+    assert(index < SLIST_STACK_INDEX_MASK);
+    /* So that the popped nodes can be walked with Slist_next */
+    atomic_store(&node->deleting, false);
+    uintptr_t head = atomic_load_explicit(&stack->head, AINT_SAFE_RELAXED);
+    do {
+        atomic_store_explicit(&node->next,
+                              index_to_node(stack, head_index(head)),
+                              AINT_SAFE_RELAXED);
+    } while (!atomic_compare_exchange_weak_explicit(
+            &stack->head,
+            &head,
+            make_head(index, head_tag(head) + 1),
+            AINT_SAFE_RELEASE,
+            AINT_SAFE_RELAXED));
+}
+
+
+SlistNode *SlistStack_pop(SlistStack *stack) {
+    uintptr_t head = atomic_load_explicit(&stack->head, AINT_SAFE_ACQUIRE);
+    SlistNode *top;
+    SlistNode *next;
+    do {
+        top = index_to_node(stack, head_index(head));
+        if (top == NULL) { return NULL; }
+        /* If top is popped (and possibly reused) by an interrupt after this
+         * load, next may be garbage. The tag would have changed then, so the
+         * compare_exchange fails. The slot memory itself is static, so the
+         * load is always safe. */
+        next = atomic_load_explicit(&top->next, AINT_SAFE_RELAXED);
+    } while (!atomic_compare_exchange_weak_explicit(
+            &stack->head,
+            &head,
+            make_head(node_to_index(stack, next), head_tag(head) + 1),
+            AINT_SAFE_ACQ_REL,
+            AINT_SAFE_ACQUIRE));
+    return top;
+}
+
+
+SlistNode *SlistStack_pop_all(SlistStack *stack) {
+    /* This can't be a plain exchange with an empty head, as the tag must keep
+     * changing monotonically for the ABA check in pop to hold. Without
+     * contention, this is still a single compare_exchange. */
+    uintptr_t head = atomic_load_explicit(&stack->head, AINT_SAFE_ACQUIRE);
+    while (head_index(head) != 0
+           && !atomic_compare_exchange_weak_explicit(
+                   &stack->head,
+                   &head,
+                   make_head(0, head_tag(head) + 1),
+                   AINT_SAFE_ACQ_REL,
+                   AINT_SAFE_ACQUIRE)) {
+    }
+    return index_to_node(stack, head_index(head));
+}
@@ -0,0 +1,128 @@
+/** \file slist_stack.h
+ *
+ * Interrupt-safe lock-free LIFO stack of intrusive #SlistNode
+ *
+ * The nodes must be embedded in slots of a #Membag. The head of the stack is
+ * a single word holding the index of the top slot and a tag that changes
+ * with every push and pop, so a pop that was interrupted by other pops and
+ * pushes can't mistake a reused top node for the one it started with (the
+ * ABA problem).
+ *
+ * Usage:
+ * \code{.c}
+ * typedef struct {
+ *     int       value;
+ *     SlistNode node;
+ * } MyStruct;
+ *
+ * static MyStruct array[10];
+ * static membag_alloc_status_t status[MEMBAG_ALLOC_STATUS_LEN(10)];
+ * static Membag pool = MEMBAG_STATIC_INIT(
+ *         sizeof(MyStruct), 10, status, array);
+ *
+ * static SlistStack stack = SLIST_STACK_STATIC_INIT(
+ *         &pool, offsetof(MyStruct, node));
+ *
+ * void producer(int value) {
+ *     MyStruct *elem = Membag_acquire(&pool);
+ *     if (elem != NULL) {
+ *         elem->value = value;
+ *         SlistStack_push(&stack, &elem->node);
+ *     }
+ * }
+ *
+ * void batch_consumer(void) {
+ *     SlistNode *n = SlistStack_pop_all(&stack);
+ *     while (n != NULL) {
+ *         MyStruct *elem = CONTAINER_OF(n, MyStruct, node);
+ *         n = Slist_next(n);
+ *         ... // Do something with elem
+ *         Membag_release(&pool, elem);
+ *     }
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__SLIST_STACK_H
+#define AINT_SAFE__SLIST_STACK_H 1
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "membag.h"
+#include "slist.h"
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(
+        atomic_is_lock_free((uintptr_t *)NULL),
+        "Your stdlib implementation does not have lock-free uintptr_t atomics");
+#endif
+
+
+/** \brief Number of bits of the head used for the slot index
+ *
+ * The rest of the bits are used for the tag. A #Membag used with a
+ * #SlistStack can't have more than <tt>2^SLIST_STACK_INDEX_BITS - 1</tt>
+ * slots.
+ */
+#define SLIST_STACK_INDEX_BITS (sizeof(uintptr_t) * CHAR_BIT / 2)
+
+
+/** \brief Internal data structure of the stack
+ *
+ * This must be initialized with #SLIST_STACK_STATIC_INIT at declaration.
+ */
+typedef struct {
+    /** #Membag whose slots hold the nodes */
+    const Membag *const membag;
+    /** Offset of the #SlistNode within a slot of #membag */
+    const size_t node_offset;
+    /** Tag and index of the top slot (plus one, 0 is empty) */
+    _Atomic uintptr_t head;
+} SlistStack;
+
+
+/** \brief Statically initialize a #SlistStack
+ *
+ * \param p_membag      pointer to the #Membag whose slots hold the nodes
+ * \param p_node_offset offset of the #SlistNode within a slot
+ *
+ * \return A #SlistStack static initializer
+ */
+#define SLIST_STACK_STATIC_INIT(p_membag, p_node_offset) \
+    { .membag = p_membag, .node_offset = p_node_offset, .head = 0 }
+
+
+/** \brief Push a node
+ *
+ * \param stack #SlistStack to push to
+ * \param node  node embedded in a slot of \p stack->membag
+ */
+void SlistStack_push(SlistStack *stack, SlistNode *node);
+
+
+/** \brief Pop the top node
+ *
+ * \param stack #SlistStack to pop from
+ *
+ * \return the top node
+ * \retval NULL if \p stack is empty
+ */
+SlistNode *SlistStack_pop(SlistStack *stack);
+
+
+/** \brief Pop all the nodes at once
+ *
+ * \param stack #SlistStack to pop from
+ *
+ * \return the top node, linked to the rest of the popped nodes in LIFO order
+ *     (use #Slist_next to walk them)
+ * \retval NULL if \p stack is empty
+ */
+SlistNode *SlistStack_pop_all(SlistStack *stack);
+
+
+#endif /* ifndef AINT_SAFE__SLIST_STACK_H */
@@ -0,0 +1,52 @@
+/** \file stats.c
+ *
+ * Optional instrumentation of the Mcas helping and the retry loops built on it
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "stats.h"
+
+#if AINT_SAFE_STATS
+
+_Atomic uint64_t aint_safe_stats_[AINT_SAFE_NUMBER_OF_STATS];
+
+
+void AintSafeStats_max_(AintSafeStat stat, uint64_t value) {
+    _Atomic uint64_t *counter = &aint_safe_stats_[stat];
+    uint64_t max = atomic_load_explicit(counter, memory_order_relaxed);
+    while (value > max
+           && !atomic_compare_exchange_weak_explicit(counter,
+                                                     &max,
+                                                     value,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed)) {
+    }
+}
+
+
+static uint64_t get(AintSafeStat stat) {
+    return atomic_load_explicit(&aint_safe_stats_[stat], memory_order_relaxed);
+}
+
+
+void AintSafeStats_get(AintSafeStats *stats) {
+    *stats = (AintSafeStats){
+            .mcas_operations       = get(AINT_SAFE_STAT_MCAS_OPERATIONS),
+            .mcas_chain_length_sum = get(AINT_SAFE_STAT_MCAS_CHAIN_LENGTH_SUM),
+            .mcas_chain_length_max = get(AINT_SAFE_STAT_MCAS_CHAIN_LENGTH_MAX),
+            .mcas_helped_sum       = get(AINT_SAFE_STAT_MCAS_HELPED_SUM),
+            .mcas_helped_max       = get(AINT_SAFE_STAT_MCAS_HELPED_MAX),
+            .mcas_redundant_stores = get(AINT_SAFE_STAT_MCAS_REDUNDANT_STORES),
+            .queue_acquire_retries = get(AINT_SAFE_STAT_QUEUE_ACQUIRE_RETRIES),
+            .queue_commit_retries  = get(AINT_SAFE_STAT_QUEUE_COMMIT_RETRIES),
+    };
+}
+
+
+void AintSafeStats_reset(void) {
+    for (int i = 0; i < AINT_SAFE_NUMBER_OF_STATS; i++) {
+        atomic_store_explicit(&aint_safe_stats_[i], 0, memory_order_relaxed);
+    }
+}
+
+#endif /* if AINT_SAFE_STATS */
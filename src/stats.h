@@ -0,0 +1,142 @@
+/** \file stats.h
+ *
+ * Optional instrumentation of the Mcas helping and the retry loops built on it
+ *
+ * When an Mcas operation is nested, it first completes all the operations in
+ * the journal chain that it interrupted. This instrumentation shows how much
+ * of that helping happens, through two independent options:
+ *  - #AINT_SAFE_STATS keeps global counters, read with #AintSafeStats_get.
+ *  - #AINT_SAFE_USDT places USDT probes (\c aint_safe provider) at the same
+ *    points, for tracing with eg. \c bpftrace or \c perf without counters.
+ *
+ * With both left at 0, all the instrumentation compiles to nothing.
+ *
+ * Usage:
+ * \code{.c}
+ * AintSafeStats stats;
+ * AintSafeStats_get(&stats);
+ * printf("%llu entries helped\n", (unsigned long long)stats.mcas_helped_sum);
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__STATS_H
+#define AINT_SAFE__STATS_H 1
+
+#ifndef AINT_SAFE_STATS
+/** \brief Count the Mcas helping work and retries
+ *
+ * Define it to 1 for the whole build to override. Every instrumented point
+ * then costs a relaxed atomic add.
+ */
+#define AINT_SAFE_STATS 0
+#endif
+
+#ifndef AINT_SAFE_USDT
+/** \brief Place USDT probes at the instrumented points
+ *
+ * Define it to 1 for the whole build to override. This needs \c <sys/sdt.h>
+ * (SystemTap headers).
+ */
+#define AINT_SAFE_USDT 0
+#endif
+
+
+#if AINT_SAFE_STATS
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+               "Your stdlib implementation does not have lock-free atomics "
+               "for 64-bit counters");
+#endif
+
+
+/** \brief Snapshot of the counters
+ *
+ * A chain length is the number of journal entries already linked when an
+ * Mcas operation links its own, ie. how deeply it is nested.
+ */
+typedef struct {
+    /** Mcas operations (reads and compare-exchanges) executed */
+    uint64_t mcas_operations;
+    /** Sum of the chain lengths of all operations */
+    uint64_t mcas_chain_length_sum;
+    /** Longest chain seen */
+    uint64_t mcas_chain_length_max;
+    /** Journal entries of other operations completed by callers */
+    uint64_t mcas_helped_sum;
+    /** Most entries of other operations completed by a single caller */
+    uint64_t mcas_helped_max;
+    /** Word stores skipped as the word was already stored by another caller */
+    uint64_t mcas_redundant_stores;
+    /** Retries of the compare-exchange when acquiring NestedQueue slots */
+    uint64_t queue_acquire_retries;
+    /** Retries of the compare-exchange when committing NestedQueue slots */
+    uint64_t queue_commit_retries;
+} AintSafeStats;
+
+
+/** \brief Take a snapshot of the counters
+ *
+ * \param [out] stats
+ *
+ * \note The counters are read one by one, so a snapshot taken while
+ * operations are running may be slightly inconsistent between counters.
+ */
+void AintSafeStats_get(AintSafeStats *stats);
+
+
+/** \brief Reset all the counters to 0 */
+void AintSafeStats_reset(void);
+
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+/* Internal, for the instrumented modules */
+typedef enum {
+    AINT_SAFE_STAT_MCAS_OPERATIONS,
+    AINT_SAFE_STAT_MCAS_CHAIN_LENGTH_SUM,
+    AINT_SAFE_STAT_MCAS_CHAIN_LENGTH_MAX,
+    AINT_SAFE_STAT_MCAS_HELPED_SUM,
+    AINT_SAFE_STAT_MCAS_HELPED_MAX,
+    AINT_SAFE_STAT_MCAS_REDUNDANT_STORES,
+    AINT_SAFE_STAT_QUEUE_ACQUIRE_RETRIES,
+    AINT_SAFE_STAT_QUEUE_COMMIT_RETRIES,
+    AINT_SAFE_NUMBER_OF_STATS,
+} AintSafeStat;
+
+extern _Atomic uint64_t aint_safe_stats_[AINT_SAFE_NUMBER_OF_STATS];
+
+void AintSafeStats_max_(AintSafeStat stat, uint64_t value);
+
+#define AINT_SAFE_STAT_ADD(stat, n)                                   \
+    atomic_fetch_add_explicit(&aint_safe_stats_[AINT_SAFE_STAT_##stat], \
+                              (uint64_t)(n),                          \
+                              memory_order_relaxed)
+#define AINT_SAFE_STAT_MAX(stat, value) \
+    AintSafeStats_max_(AINT_SAFE_STAT_##stat, (uint64_t)(value))
+#endif
+
+#else /* if AINT_SAFE_STATS */
+
+#define AINT_SAFE_STAT_ADD(stat, n) ((void)0)
+#define AINT_SAFE_STAT_MAX(stat, value) ((void)0)
+
+#endif /* if AINT_SAFE_STATS */
+
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+#if AINT_SAFE_USDT
+#include <sys/sdt.h>
+#define AINT_SAFE_PROBE1(name, a) DTRACE_PROBE1(aint_safe, name, a)
+#define AINT_SAFE_PROBE2(name, a, b) DTRACE_PROBE2(aint_safe, name, a, b)
+#else
+#define AINT_SAFE_PROBE1(name, a) ((void)0)
+#define AINT_SAFE_PROBE2(name, a, b) ((void)0)
+#endif
+#endif
+
+
+#endif /* ifndef AINT_SAFE__STATS_H */
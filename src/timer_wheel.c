@@ -0,0 +1,191 @@
+/** \file timer_wheel.c
+ *
+ * Interrupt-safe hierarchical timer wheel of intrusive timers
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "timer_wheel.h"
+
+#include "container.h"
+#include "memory_order.h"
+
+/* Level L of the wheel has buckets that each span 2^(SLOT_BITS * L) ticks. A
+ * timer is placed at the lowest level at which it is less than a full turn
+ * away. Whenever the lower bits of the tick roll over to 0, the current bucket
+ * of the next level is emptied and its timers are placed again (at the lower
+ * levels, as they are now closer).
+ *
+ * Only TimerWheel_advance touches the buckets (under advance_mutex), so
+ * placing timers in them can't race with a bucket being expired. Arming just
+ * pushes onto the incoming list, and the timer state decides whether an expiry
+ * or a cancel wins.
+ *
+ * A push publishes the timer (release) to the exchange that takes the list
+ * (acquire). Arming acquires the timer from the store of IDLE that the wheel
+ * releases once it is done with it, and a cancel releases the writes made
+ * before it to the callback. The tick is only a counter, which is read
+ * stale anyway. target_tick and advance_mutex stay seq_cst: an advance
+ * stores target_tick and then finds the mutex held, while the holder clears
+ * the mutex and then loads target_tick, and only a single total order makes
+ * sure that one of them sees the other (store buffering). */
+
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_N_SLOTS - 1)
+#define TIMER_WHEEL_MAX_DELTA \
+    (((uint32_t)1 << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_N_LEVELS)) - 1)
+
+_Static_assert(TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_N_LEVELS < 32,
+               "The wheel must span less than the range of a tick");
+
+
+static inline TimerWheelTimer *node_to_timer(SlistNode *node) {
+    return CONTAINER_OF(node, TimerWheelTimer, node);
+}
+
+
+static void push(Slist *list, TimerWheelTimer *timer) {
+    SlistNode *head = atomic_load_explicit(list, AINT_SAFE_RELAXED);
+    do {
+        atomic_store_explicit(&timer->node.next, head, AINT_SAFE_RELAXED);
+    } while (!atomic_compare_exchange_weak_explicit(list,
+                                                    &head,
+                                                    &timer->node,
+                                                    AINT_SAFE_RELEASE,
+                                                    AINT_SAFE_RELAXED));
+}
+
+
+/* Only called with advance_mutex held */
+static void place(TimerWheel *wheel, TimerWheelTimer *timer, uint32_t tick) {
+    int32_t delta = (int32_t)(timer->expires - tick);
+    if (delta <= 0) {
+        /* Already due, expire it on the next tick */
+        delta = 1;
+    } else if ((uint32_t)delta > TIMER_WHEEL_MAX_DELTA) {
+        /* Too far away, it will be placed again when this bucket is reached */
+        delta = TIMER_WHEEL_MAX_DELTA;
+    }
+    const uint32_t slot_tick = tick + (uint32_t)delta;
+    unsigned int   level     = 0;
+    while ((uint32_t)delta >> (TIMER_WHEEL_SLOT_BITS * (level + 1))) {
+        level++;
+    }
+    const unsigned int slot = (slot_tick >> (TIMER_WHEEL_SLOT_BITS * level))
+                              & TIMER_WHEEL_SLOT_MASK;
+    push(&wheel->buckets[level][slot], timer);
+}
+
+
+/* Only called with advance_mutex held. Takes the whole bucket list and either
+ * expires its timers or places them again */
+static void process_bucket(TimerWheel *wheel, Slist *bucket, uint32_t tick) {
+    SlistNode *node =
+            atomic_exchange_explicit(bucket, NULL, AINT_SAFE_ACQUIRE);
+    while (node != NULL) {
+        TimerWheelTimer *timer = node_to_timer(node);
+        /* The callback may arm the timer again */
+        node = atomic_load_explicit(&node->next, AINT_SAFE_RELAXED);
+
+        TimerWheelTimerState state = TIMER_WHEEL_TIMER_ARMED;
+        if ((int32_t)(timer->expires - tick) > 0) {
+            /* Acquires the cancel if it is dropped below */
+            if (atomic_load_explicit(&timer->state, AINT_SAFE_ACQUIRE)
+                == TIMER_WHEEL_TIMER_ARMED) {
+                place(wheel, timer, tick);
+                continue;
+            }
+            /* Cancelled, drop it below */
+        } else if (atomic_compare_exchange_strong_explicit(
+                           &timer->state,
+                           &state,
+                           TIMER_WHEEL_TIMER_IDLE,
+                           AINT_SAFE_ACQ_REL,
+                           AINT_SAFE_ACQUIRE)) {
+            timer->callback(timer, true);
+            continue;
+        }
+        /* Cancelled before it could expire. Only the wheel moves a timer out
+         * of the cancelled state, so this is a plain store. */
+        atomic_store_explicit(
+                &timer->state, TIMER_WHEEL_TIMER_IDLE, AINT_SAFE_RELEASE);
+        timer->callback(timer, false);
+    }
+}
+
+
+uint32_t TimerWheel_now(TimerWheel *wheel) {
+    return atomic_load_explicit(&wheel->tick, AINT_SAFE_RELAXED);
+}
+
+
+bool TimerWheel_arm(TimerWheel *     wheel,
+                    TimerWheelTimer *timer,
+                    uint32_t         expires) {
+    TimerWheelTimerState state = TIMER_WHEEL_TIMER_IDLE;
+    if (!atomic_compare_exchange_strong_explicit(&timer->state,
+                                                 &state,
+                                                 TIMER_WHEEL_TIMER_ARMED,
+                                                 AINT_SAFE_ACQUIRE,
+                                                 AINT_SAFE_RELAXED)) {
+        return false;
+    }
+    timer->expires = expires;
+    atomic_store_explicit(&timer->node.deleting, false, AINT_SAFE_RELAXED);
+    push(&wheel->incoming, timer);
+    return true;
+}
+
+
+bool TimerWheel_cancel(TimerWheel *wheel, TimerWheelTimer *timer) {
+    (void)wheel;
+    TimerWheelTimerState state = TIMER_WHEEL_TIMER_ARMED;
+    return atomic_compare_exchange_strong_explicit(&timer->state,
+                                                   &state,
+                                                   TIMER_WHEEL_TIMER_CANCELLED,
+                                                   AINT_SAFE_RELEASE,
+                                                   AINT_SAFE_RELAXED);
+}
+
+
+void TimerWheel_advance(TimerWheel *wheel, uint32_t tick) {
+    atomic_store(&wheel->target_tick, tick);
+    /* Loop in case we are interrupted by another advance() just after it
+     * finds advance_mutex held, but before we release it. */
+    while ((int32_t)(atomic_load(&wheel->target_tick)
+                     - atomic_load_explicit(&wheel->tick, AINT_SAFE_RELAXED))
+           > 0) {
+        if (atomic_flag_test_and_set(&wheel->advance_mutex)) {
+            /* The interrupted advance() will process up to target_tick */
+            return;
+        }
+        uint32_t current =
+                atomic_load_explicit(&wheel->tick, AINT_SAFE_RELAXED);
+        while ((int32_t)(atomic_load(&wheel->target_tick) - current) > 0) {
+            /* Place the timers armed so far relative to the current tick, so
+             * that they aren't put in an already expired bucket */
+            SlistNode *node = atomic_exchange_explicit(
+                    &wheel->incoming, NULL, AINT_SAFE_ACQUIRE);
+            while (node != NULL) {
+                TimerWheelTimer *timer = node_to_timer(node);
+                node = atomic_load_explicit(&node->next, AINT_SAFE_RELAXED);
+                place(wheel, timer, current);
+            }
+
+            current++;
+            /* Callbacks see the tick being expired as the current one */
+            atomic_store_explicit(&wheel->tick, current, AINT_SAFE_RELAXED);
+            /* Move timers from the higher levels whose bucket is reached */
+            for (unsigned int level = 1; level < TIMER_WHEEL_N_LEVELS;
+                 level++) {
+                const unsigned int shift = TIMER_WHEEL_SLOT_BITS * level;
+                if (current & (((uint32_t)1 << shift) - 1)) { break; }
+                const unsigned int slot =
+                        (current >> shift) & TIMER_WHEEL_SLOT_MASK;
+                process_bucket(wheel, &wheel->buckets[level][slot], current);
+            }
+            process_bucket(wheel,
+                           &wheel->buckets[0][current & TIMER_WHEEL_SLOT_MASK],
+                           current);
+        }
+        atomic_flag_clear(&wheel->advance_mutex);
+    }
+}
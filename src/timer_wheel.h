@@ -0,0 +1,217 @@
+/** \file timer_wheel.h
+ *
+ * Interrupt-safe hierarchical timer wheel of intrusive timers
+ *
+ * Arming and cancelling a timer are O(1) and can be done from any context.
+ * Armed timers are pushed onto a single incoming list, and are sorted into
+ * the wheel buckets by #TimerWheel_advance, which is the only function that
+ * touches the buckets. Each tick detaches the whole bucket that expires in one
+ * go.
+ *
+ * Cancelling only marks the timer. A cancelled timer is dropped (and reported
+ * to its callback) when the wheel reaches the bucket it is in, after which it
+ * can be armed again or released.
+ *
+ * Usage:
+ * \code{.c}
+ * typedef struct {
+ *     TimerWheelTimer timer;
+ *     ... // request state
+ * } Request;
+ *
+ * static void Request_timeout(TimerWheelTimer *timer, bool expired) {
+ *     Request *req = CONTAINER_OF(timer, Request, timer);
+ *     if (expired) {
+ *         ... // handle the timeout
+ *     }
+ *     Membag_release(&request_pool, req);
+ * }
+ *
+ * static TimerWheel wheel = TIMER_WHEEL_STATIC_INIT;
+ *
+ * void systick_handler(void) {
+ *     static uint32_t ticks;
+ *     TimerWheel_advance(&wheel, ++ticks);
+ * }
+ *
+ * void start(Request *req) {
+ *     req->timer = (TimerWheelTimer)TIMER_WHEEL_TIMER_INIT(Request_timeout);
+ *     TimerWheel_arm(&wheel, &req->timer, TimerWheel_now(&wheel) + 100);
+ * }
+ *
+ * void done(Request *req) {
+ *     // Request_timeout is called with expired == false, unless it has
+ *     // already expired
+ *     TimerWheel_cancel(&wheel, &req->timer);
+ * }
+ * \endcode
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__TIMER_WHEEL_H
+#define AINT_SAFE__TIMER_WHEEL_H 1
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "slist.h"
+
+
+#ifndef TIMER_WHEEL_SLOT_BITS
+/** \brief log2 of the number of buckets per level of the wheel
+ *
+ * Define it before including this header to override.
+ */
+#define TIMER_WHEEL_SLOT_BITS 6
+#endif
+
+#ifndef TIMER_WHEEL_N_LEVELS
+/** \brief Number of levels of the wheel
+ *
+ * Timers up to <tt>2^(TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_N_LEVELS)</tt>
+ * ticks away are placed in the wheel directly. Farther ones are placed at the
+ * farthest bucket and moved again when it is reached. Define it before
+ * including this header to override.
+ */
+#define TIMER_WHEEL_N_LEVELS 4
+#endif
+
+/** Number of buckets per level of the wheel */
+#define TIMER_WHEEL_N_SLOTS (1u << TIMER_WHEEL_SLOT_BITS)
+
+
+/** State of a #TimerWheelTimer */
+typedef enum {
+    /** Not in the wheel, can be armed */
+    TIMER_WHEEL_TIMER_IDLE,
+    /** Waiting to expire */
+    TIMER_WHEEL_TIMER_ARMED,
+    /** Cancelled, but not yet dropped from the wheel */
+    TIMER_WHEEL_TIMER_CANCELLED,
+} TimerWheelTimerState;
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(atomic_is_lock_free((TimerWheelTimerState *)NULL),
+               "TimerWheelTimerState enum should be lock-free.");
+#endif
+
+
+struct TimerWheelTimer;
+
+/** \brief Function called when a timer leaves the wheel
+ *
+ * It is called from #TimerWheel_advance, after the timer is back in
+ * #TIMER_WHEEL_TIMER_IDLE. It may arm the timer again.
+ *
+ * \param timer   the timer
+ * \param expired \c true if \p timer expired, \c false if it was cancelled
+ */
+typedef void (*TimerWheelCallback)(struct TimerWheelTimer *timer,
+                                   bool                    expired);
+
+
+/** \brief An intrusive timer
+ *
+ * Embed this in the structure to time and use #CONTAINER_OF to get back to
+ * it. It must be initialized with #TIMER_WHEEL_TIMER_INIT.
+ */
+typedef struct TimerWheelTimer {
+    /** Link in the wheel bucket */
+    SlistNode node;
+    /** Tick at which the timer expires */
+    uint32_t expires;
+    /** Current state of the timer */
+    _Atomic TimerWheelTimerState state;
+    /** Called when the timer leaves the wheel */
+    TimerWheelCallback callback;
+} TimerWheelTimer;
+
+
+/** \brief Initialize a #TimerWheelTimer
+ *
+ * \param p_callback #TimerWheelCallback of the timer
+ *
+ * \return A #TimerWheelTimer initializer
+ */
+#define TIMER_WHEEL_TIMER_INIT(p_callback) \
+    { .state = TIMER_WHEEL_TIMER_IDLE, .callback = p_callback }
+
+
+/** \brief Internal data structure of the timer wheel
+ *
+ * This must be initialized with #TIMER_WHEEL_STATIC_INIT at declaration.
+ */
+typedef struct {
+    /** Bucket lists of each level, only touched by #TimerWheel_advance */
+    Slist buckets[TIMER_WHEEL_N_LEVELS][TIMER_WHEEL_N_SLOTS];
+    /** Armed timers not yet placed in #buckets */
+    Slist incoming;
+    /** Last tick processed */
+    _Atomic uint32_t tick;
+    /** Latest tick passed to #TimerWheel_advance */
+    _Atomic uint32_t target_tick;
+    /** Mutex that allows only one #TimerWheel_advance at a time */
+    atomic_flag advance_mutex;
+} TimerWheel;
+
+
+/** \brief Statically initialize a #TimerWheel
+ *
+ * \return A #TimerWheel static initializer starting at tick 0
+ */
+#define TIMER_WHEEL_STATIC_INIT \
+    { .tick = 0, .target_tick = 0, .advance_mutex = ATOMIC_FLAG_INIT }
+
+
+/** \brief Get the last tick processed by the wheel
+ *
+ * \param wheel #TimerWheel to query
+ *
+ * \return the tick up to which timers have been expired
+ */
+uint32_t TimerWheel_now(TimerWheel *wheel);
+
+
+/** \brief Arm a timer
+ *
+ * \param wheel   #TimerWheel to arm \p timer in
+ * \param timer   timer in #TIMER_WHEEL_TIMER_IDLE
+ * \param expires tick at which \p timer expires. If this has already passed,
+ *     \p timer expires on the next tick.
+ *
+ * \retval true  if \p timer was armed
+ * \retval false if \p timer was not idle
+ */
+bool TimerWheel_arm(TimerWheel *     wheel,
+                    TimerWheelTimer *timer,
+                    uint32_t         expires);
+
+
+/** \brief Cancel an armed timer
+ *
+ * \param wheel #TimerWheel that \p timer is armed in
+ * \param timer timer to cancel
+ *
+ * \retval true  if \p timer was cancelled. Its callback is called with
+ *     \c expired as \c false once it is dropped from the wheel.
+ * \retval false if \p timer was not armed (eg. it has already expired)
+ */
+bool TimerWheel_cancel(TimerWheel *wheel, TimerWheelTimer *timer);
+
+
+/** \brief Advance the wheel, expiring timers up to a tick
+ *
+ * Call this from the tick interrupt. Callbacks of expired and dropped timers
+ * are called from within this function.
+ *
+ * \param wheel #TimerWheel to advance
+ * \param tick  current tick
+ *
+ * \note If this interrupts another #TimerWheel_advance, it returns
+ * immediately and the interrupted call processes up to \p tick instead.
+ */
+void TimerWheel_advance(TimerWheel *wheel, uint32_t tick);
+
+
+#endif /* ifndef AINT_SAFE__TIMER_WHEEL_H */
@@ -0,0 +1,117 @@
+/** \file work_stealing.c
+ *
+ * Fixed capacity Chase-Lev work-stealing deque and a scheduler built on it
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#include "work_stealing.h"
+
+#include "memory_order.h"
+
+/* top and bottom are free running indexes, the elements are in
+ * [top, bottom). Since the deque never grows, the owner only pushes when
+ * bottom - top < n_elems, so a slot is never overwritten while a thief could
+ * still successfully steal it. A thief may read a slot that is being
+ * overwritten, but then top has moved on and its CAS fails.
+ *
+ * The owner pops by reserving the bottom element first (decrementing bottom)
+ * and only then reading top. If that leaves more than one element, no thief
+ * can reach the reserved one. For the last element, the owner and thieves
+ * race with a CAS on top.
+ *
+ * The memory orders are those of Le et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (PPoPP 2013). The store to bottom in
+ * pop and the load of top in steal are each followed by a seq_cst fence, as
+ * the owner and thieves must agree on who reserved the last element. */
+
+
+bool WorkStealingDeque_push(WorkStealingDeque *deque, void *elem) {
+    const intptr_t bottom =
+            atomic_load_explicit(&deque->bottom, AINT_SAFE_RELAXED);
+    const intptr_t top = atomic_load_explicit(&deque->top, AINT_SAFE_ACQUIRE);
+    if ((size_t)(bottom - top) >= deque->n_elems) { return false; }
+    atomic_store_explicit(&deque->data[(size_t)bottom % deque->n_elems],
+                          elem,
+                          AINT_SAFE_RELAXED);
+    /* Publishes elem to the thieves */
+    atomic_store_explicit(&deque->bottom, bottom + 1, AINT_SAFE_RELEASE);
+    return true;
+}
+
+
+void *WorkStealingDeque_pop(WorkStealingDeque *deque) {
+    const intptr_t bottom =
+            atomic_load_explicit(&deque->bottom, AINT_SAFE_RELAXED) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, AINT_SAFE_RELAXED);
+    atomic_thread_fence(memory_order_seq_cst);
+    intptr_t top = atomic_load_explicit(&deque->top, AINT_SAFE_RELAXED);
+    if (top > bottom) {
+        /* Empty */
+        atomic_store_explicit(&deque->bottom, bottom + 1, AINT_SAFE_RELAXED);
+        return NULL;
+    }
+
+    void *elem = atomic_load_explicit(
+            &deque->data[(size_t)bottom % deque->n_elems], AINT_SAFE_RELAXED);
+    if (top == bottom) {
+        /* Last element, race with the thieves for it */
+        if (!atomic_compare_exchange_strong_explicit(&deque->top,
+                                                     &top,
+                                                     top + 1,
+                                                     memory_order_seq_cst,
+                                                     AINT_SAFE_RELAXED)) {
+            elem = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, AINT_SAFE_RELAXED);
+    }
+    return elem;
+}
+
+
+void *WorkStealingDeque_steal(WorkStealingDeque *deque) {
+    intptr_t top = atomic_load_explicit(&deque->top, AINT_SAFE_ACQUIRE);
+    atomic_thread_fence(memory_order_seq_cst);
+    const intptr_t bottom =
+            atomic_load_explicit(&deque->bottom, AINT_SAFE_ACQUIRE);
+    if (top >= bottom) { return NULL; }
+
+    void *elem = atomic_load_explicit(
+            &deque->data[(size_t)top % deque->n_elems], AINT_SAFE_RELAXED);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top,
+                                                 &top,
+                                                 top + 1,
+                                                 memory_order_seq_cst,
+                                                 AINT_SAFE_RELAXED)) {
+        return NULL;
+    }
+    return elem;
+}
+
+
+bool WorkStealingScheduler_spawn(WorkStealingScheduler *sched,
+                                 size_t                 worker,
+                                 DeferredWork *         work) {
+    if (atomic_flag_test_and_set(&work->pending)) {
+        /* Already queued and not yet run, coalesce with it */
+        return true;
+    }
+    if (!WorkStealingDeque_push(&sched->deques[worker], work)) {
+        atomic_flag_clear(&work->pending);
+        return false;
+    }
+    return true;
+}
+
+
+bool WorkStealingScheduler_run_one(WorkStealingScheduler *sched,
+                                   size_t                 worker) {
+    DeferredWork *work = WorkStealingDeque_pop(&sched->deques[worker]);
+    /* Start with the next worker, so that thieves spread out over victims */
+    for (size_t i = 1; work == NULL && i < sched->n_workers; i++) {
+        const size_t victim = (worker + i) % sched->n_workers;
+        work = WorkStealingDeque_steal(&sched->deques[victim]);
+    }
+    if (work == NULL) { return false; }
+    DeferredWork_run(work);
+    return true;
+}
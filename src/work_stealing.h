@@ -0,0 +1,197 @@
+/** \file work_stealing.h
+ *
+ * Fixed capacity Chase-Lev work-stealing deque and a scheduler built on it
+ *
+ * A #WorkStealingDeque has a single owner that pushes and pops at the bottom
+ * end. Pushing and popping are plain loads and stores, except when popping the
+ * last element, which has to race with the thieves for it. Any number of
+ * thieves steal from the top end with a CAS.
+ *
+ * A #WorkStealingScheduler has one deque per worker. Each worker runs
+ * #DeferredWork from its own deque, and steals from the other workers when
+ * its own deque is empty. The scheduler doesn't create the workers itself,
+ * they are whatever threads (or cores) call #WorkStealingScheduler_run_one
+ * with their own worker index.
+ *
+ * Usage:
+ * \code{.c}
+ * #define N_WORKERS 4
+ *
+ * static void *deque_arrays[N_WORKERS][64];
+ * static WorkStealingDeque deques[N_WORKERS] = {
+ *     WORK_STEALING_DEQUE_STATIC_INIT(64, deque_arrays[0]),
+ *     WORK_STEALING_DEQUE_STATIC_INIT(64, deque_arrays[1]),
+ *     WORK_STEALING_DEQUE_STATIC_INIT(64, deque_arrays[2]),
+ *     WORK_STEALING_DEQUE_STATIC_INIT(64, deque_arrays[3]),
+ * };
+ * static WorkStealingScheduler scheduler =
+ *         WORK_STEALING_SCHEDULER_STATIC_INIT(N_WORKERS, deques);
+ *
+ * static void process_packet(void *arg) {
+ *     ...
+ *     // Split off more work, other workers steal it if they are idle
+ *     WorkStealingScheduler_spawn(&scheduler, this_worker, &more_work);
+ * }
+ *
+ * int worker_thread(void *arg) {
+ *     size_t this_worker = (size_t)arg;
+ *     while (running) {
+ *         if (!WorkStealingScheduler_run_one(&scheduler, this_worker)) {
+ *             ... // idle
+ *         }
+ *     }
+ *     return 0;
+ * }
+ * \endcode
+ *
+ * \note The owner end of a deque must only be used by one context at a time.
+ * It is not safe for an interrupt handler to push to the deque of the context
+ * it interrupted.
+ */
+/* Copyright 2019 Gaurav Juvekar */
+
+#ifndef AINT_SAFE__WORK_STEALING_H
+#define AINT_SAFE__WORK_STEALING_H 1
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "deferred_executor.h"
+
+#if !defined(__DOXYGEN__AINT_SAFE__)
+_Static_assert(
+        atomic_is_lock_free((intptr_t *)NULL),
+        "Your stdlib implementation does not have lock-free intptr_t atomics");
+_Static_assert(
+        atomic_is_lock_free((void **)NULL),
+        "Your stdlib implementation does not have lock-free pointer atomics");
+#endif
+
+
+/** \brief Internal data structure of the work-stealing deque
+ *
+ * This must be initialized with #WORK_STEALING_DEQUE_STATIC_INIT at
+ * declaration.
+ */
+typedef struct {
+    /** Array of elements */
+    void *_Atomic *const data;
+    /** Number of elements in #data */
+    const size_t n_elems;
+    /** Index of the next element to steal, only ever incremented */
+    _Atomic intptr_t top;
+    /** Index of the next element to push, only written by the owner */
+    _Atomic intptr_t bottom;
+} WorkStealingDeque;
+
+
+/** \brief Statically initialize a #WorkStealingDeque
+ *
+ * \param p_n_elems    number of elements in \p p_data_array
+ * \param p_data_array array of <tt>void *</tt>
+ *
+ * \return A #WorkStealingDeque static initializer
+ */
+#define WORK_STEALING_DEQUE_STATIC_INIT(p_n_elems, p_data_array)             \
+    {                                                                        \
+        .data = (void *_Atomic *)(p_data_array), .n_elems = p_n_elems,       \
+        .top = 0, .bottom = 0                                                \
+    }
+
+
+/** \brief Push an element at the bottom
+ *
+ * Only the owner of \p deque may call this.
+ *
+ * \param deque #WorkStealingDeque to push to
+ * \param elem  element to push, must not be \c NULL
+ *
+ * \retval true  if \p elem was pushed
+ * \retval false if \p deque is full
+ */
+bool WorkStealingDeque_push(WorkStealingDeque *deque, void *elem);
+
+
+/** \brief Pop the element at the bottom
+ *
+ * Only the owner of \p deque may call this.
+ *
+ * \param deque #WorkStealingDeque to pop from
+ *
+ * \return the most recently pushed element
+ * \retval NULL if \p deque is empty, or the last element was stolen
+ */
+void *WorkStealingDeque_pop(WorkStealingDeque *deque);
+
+
+/** \brief Steal the element at the top
+ *
+ * \param deque #WorkStealingDeque to steal from
+ *
+ * \return the least recently pushed element
+ * \retval NULL if \p deque is empty, or another thief or the owner took the
+ *     element first
+ */
+void *WorkStealingDeque_steal(WorkStealingDeque *deque);
+
+
+/** \brief Internal data structure of the work-stealing scheduler
+ *
+ * This must be initialized with #WORK_STEALING_SCHEDULER_STATIC_INIT at
+ * declaration.
+ */
+typedef struct {
+    /** Deques of <tt>DeferredWork *</tt>, one per worker */
+    WorkStealingDeque *const deques;
+    /** Number of elements in #deques */
+    const size_t n_workers;
+} WorkStealingScheduler;
+
+
+/** \brief Statically initialize a #WorkStealingScheduler
+ *
+ * \param p_n_workers number of elements in \p p_deques
+ * \param p_deques    array of #WorkStealingDeque, one per worker
+ *
+ * \return A #WorkStealingScheduler static initializer
+ */
+#define WORK_STEALING_SCHEDULER_STATIC_INIT(p_n_workers, p_deques) \
+    { .deques = p_deques, .n_workers = p_n_workers }
+
+
+/** \brief Schedule work on a worker
+ *
+ * Only the worker itself may call this, for example to split off work from a
+ * #DeferredWork that it is running. Work that is still pending is not queued
+ * twice.
+ *
+ * \param sched  #WorkStealingScheduler to run \p work
+ * \param worker index of the calling worker
+ * \param work   work to run
+ *
+ * \retval true  if \p work was queued, or was already pending
+ * \retval false if the deque of \p worker is full
+ */
+bool WorkStealingScheduler_spawn(WorkStealingScheduler *sched,
+                                 size_t                 worker,
+                                 DeferredWork *         work);
+
+
+/** \brief Run one work item
+ *
+ * Work is taken from the deque of \p worker first, then stolen from the other
+ * workers in turn.
+ *
+ * \param sched  #WorkStealingScheduler to run work from
+ * \param worker index of the calling worker
+ *
+ * \retval true  if a work item was run
+ * \retval false if no work was found
+ */
+bool WorkStealingScheduler_run_one(WorkStealingScheduler *sched,
+                                   size_t                 worker);
+
+
+#endif /* ifndef AINT_SAFE__WORK_STEALING_H */